@@ -65,13 +65,27 @@ end
 
 projectile_model = "dat/model/missile.s"
 weapons_cooldown = 0.5
+bullet_speed = 150.0
 
+-- Fire a missile from each muzzle
+-- The volley is positioned and launched with one call each, rather than one per missile
 function player_fire( ship )
 	if ship.cooldown <= 0.0 then
-		muzzle_pos = Vector( 3.0, 0.0, 0.0, 1.0 );
-		fire_missile( ship, muzzle_pos );
-		muzzle_pos = Vector( -3.0, 0.0, 0.0, 1.0 );
-		fire_missile( ship, muzzle_pos );
+		local muzzle_offsets = { Vector( 3.0, 0.0, 0.0, 1.0 ), Vector( -3.0, 0.0, 0.0, 1.0 ) }
+		local transforms = {}
+		local positions = {}
+		local physics = {}
+		local velocities = {}
+		local world_v = vtransformVector( ship.transform, Vector( 0.0, 0.0, bullet_speed, 0.0 ))
+		for i, muzzle_pos in ipairs( muzzle_offsets ) do
+			local projectile = fire_missile( ship )
+			transforms[i] = projectile.transform
+			positions[i] = vtransformVector( ship.transform, muzzle_pos )
+			physics[i] = projectile.physic
+			velocities[i] = world_v
+		end
+		vtransform_setWorldPositions( transforms, positions )
+		vphysic_setVelocities( physics, velocities )
 		ship.cooldown = weapons_cooldown
 	end
 end
@@ -89,54 +103,32 @@ end
 
 missiles  = {}
 missile_count = 0
-function fire_missile( ship, offset )
-	-- Create a new Projectile
+-- Create a new projectile facing the same way as [ship]
+-- The caller sets its muzzle position and velocity
+function fire_missile( ship )
 	local projectile = {}
 	projectile = gameobject_create( projectile_model );
 	vbody_setLayers( projectile.body, collision_layer_player )
-	vbody_setCollidableLayers( projectile.body, collision_layer_enemy )
+	vbody_setCollidableLayers( projectile.body, collision_layer_enemy + collision_layer_terrain )
 	vbody_registerCollisionCallback( projectile.body, missile_collisionHandler )
 
-	-- Position it at the correct muzzle position and rotation
-	muzzle_world_pos = vtransformVector( ship.transform, muzzle_pos )
+	-- Match the ship's rotation
 	vtransform_setWorldSpaceByTransform( projectile.transform, ship.transform )
-	vtransform_setWorldPosition( projectile.transform, muzzle_world_pos )
 
 	-- Attach a particle effect to the object
 	projectile.glow = vparticle_create( engine, projectile.transform, "dat/script/lisp/missile_glow.s" )
 	inTime( 0.2, function () projectile.trail = vparticle_create( engine, projectile.transform, "dat/script/lisp/missile_particle.s" ) end )
 
-	-- Apply initial velocity
-	bullet_speed = 150.0;
-	ship_v = Vector( 0.0, 0.0, bullet_speed, 0.0 )
-	world_v = vtransformVector( ship.transform, ship_v )
-	vphysic_setVelocity( projectile.physic, world_v );
-
 	-- Store the projectile so it doesn't get garbage collected
 	missiles[missile_count] = projectile
 	missile_count = missile_count + 1
+	return projectile
 end
 
-timers = {}
-timers.count = 0
-
-function addTimer( timer )
-	timers.count = timers.count + 1
-	timers[timers.count] = timer
-end
-
----[[
-function timer_create( time, action )
-	timer = {
-		time = time,
-		action = action,
-	}
-	return timer
-end
---]]
-
+-- Call [action] after [time] seconds; returns a handle for vtimer_cancel()
+-- Timers are kept by the engine, which only touches the ones that are due each frame
 function inTime( time, action )
-	addTimer( timer_create( time, action ))
+	return vtimer_after( time, action )
 end
 
 function iterator( t )
@@ -161,18 +153,6 @@ function filter( array, func )
 	return new_array
 end
 
-function timers_tick( dt )
-	for element in iterator( timers ) do
-		element.time = element.time - dt
-		if element.time < 0 then
-			element.action()
-		end
-	end
-
-	new_timers = filter( timers, function( e ) return ( e.time > 0 ) end )
-	timers = new_timers;
-end
-
 -- Create a player. The player is a specialised form of Gameobject
 function playership_create()
 	local p = gameobject_create( "dat/model/ship_hd.s" )
@@ -197,19 +177,30 @@ camera = "chase"
 flycam = nil
 chasecam = nil
 
-function ship_tick( ship )
-	vprint( "ship_tick" )
-	ship_v = Vector( 0.0, 0.0, ship.speed, 0.0 )
-	world_v = vtransformVector( ship.transform, ship_v )
-	vphysic_setVelocity( ship.physic, world_v )
-end
-
 function vrand( lower, upper )
 	return math.random() * ( upper - lower ) + lower
 end
 
-ships = {}
-ship_count = 0
+-- Every live ship, including the player's; ships.count of them, from 1
+ships = { count = 0 }
+
+function ships_add( ship )
+	ships.count = ships.count + 1
+	ships[ships.count] = ship
+end
+
+-- Fly each ship forwards at its own speed
+-- The whole fleet is one call into C, rather than one per ship
+function ships_tick()
+	local physics = {}
+	local velocities = {}
+	for i = 1, ships.count do
+		physics[i] = ships[i].physic
+		velocities[i] = Vector( 0.0, 0.0, ships[i].speed, 0.0 )
+	end
+	vphysic_setLocalVelocities( physics, velocities )
+end
+
 --[[
 function ship_spawner()
 	local ship = gameobject_create( "dat/model/ship_hd.s" )
@@ -221,10 +212,8 @@ function ship_spawner()
 	position = Vector( x, y, 100.0, 1.0 )
 	vtransform_setWorldPosition( ship.transform, position )
 
-	ships[ ship_count ] = ship
-	ship_count = ship_count + 1
+	ships_add( ship )
 
-	inTime( 0.1, function () ship_tick( ship ) end )
 	inTime( 3, ship_spawner )
 end
 --]]
@@ -245,6 +234,7 @@ function ship_collisionHandler( ship, collider )
 end
 
 function ship_destroy( ship )
+	ships = filter( ships, function( s ) return s ~= ship end )
 	gameobject_destroy( ship )
 	-- spawn explosion
 end
@@ -307,7 +297,7 @@ function player_ship_collisionHandler( ship, collider )
 
 	-- destroy it
 	spawn_explosion( ship.transform )
-	gameobject_destroy( ship )
+	ship_destroy( ship )
 
 	-- queue a restart
 	inTime( 2.0, restart )
@@ -321,12 +311,13 @@ function restart()
 	-- The player class itself creates several native C classes in the engine
 	player_ship = playership_create()
 	player_ship.speed = 0.0
+	ships_add( player_ship )
 	local no_velocity = Vector( 0.0, 0.0, 0.0, 0.0 )
 	vphysic_setVelocity( player_ship.physic, no_velocity )
 
 	vbody_registerCollisionCallback( player_ship.body, player_ship_collisionHandler )
 	vbody_setLayers( player_ship.body, collision_layer_player )
-	vbody_setCollidableLayers( player_ship.body, collision_layer_enemy )
+	vbody_setCollidableLayers( player_ship.body, collision_layer_enemy + collision_layer_terrain )
 
 	setup_controls()
 	--vtransform_yaw( player_ship.transform, math.pi * 2 * 1.32 );
@@ -358,7 +349,28 @@ function testSpawns()
 	end
 end
 
+-- Models used by the player, projectiles and spawn waves
+-- These load in the background so spawning doesn't stall the frame
+preload_models = {
+	"dat/model/ship_hd.s",
+	"dat/model/missile.s",
+	"dat/model/target.s",
+	"dat/model/skyscraper.s"
+}
+
+-- Particle and UI textures, packed together so they can share a texture bind
+atlas_textures = {
+	"dat/img/circle.tga",
+	"dat/img/cloud_rgba128.tga",
+	"dat/img/cloud2_rgba128.tga",
+	"dat/img/shockwave_ring_rgba128.tga",
+	"dat/img/starburst_rgba128.tga",
+	"dat/img/star_rgba64.tga"
+}
+
 function start()
+	vmodel_preload( preload_models )
+	vtexture_atlas( "atlas_particles", atlas_textures )
 	loadParticles()
 
 	restart()
@@ -481,11 +493,6 @@ function playership_tick( ship, dt )
 		player_fire( ship )
 	end
 	ship.cooldown = ship.cooldown - dt
-
-	-- Physics
-	ship_v = Vector( 0.0, 0.0, ship.speed, 0.0 )
-	world_v = vtransformVector( ship.transform, ship_v )
-	vphysic_setVelocity( ship.physic, world_v )
 end
 
 function toggle_camera()
@@ -500,10 +507,16 @@ function toggle_camera()
 	end
 end
 
+overdraw = false
+
 function debug_tick()
 	if vkeyPressed( input, key.c ) then
 		toggle_camera()
 	end
+	if vkeyPressed( input, key.o ) then
+		overdraw = not overdraw
+		vrender_setOverdraw( overdraw )
+	end
 --[[
 	array_a = { 6, 5, 3, 4, 2, 1 }
 	array_b = filter( array_a, function( e ) return (e % 2 == 0) end )
@@ -522,11 +535,10 @@ function tick( dt )
 	end
 
 	playership_tick( player_ship, dt )
+	ships_tick()
 
 	debug_tick()
 
-	timers_tick( dt )
-
 	update_spawns( player_ship )
 
 --[[
@@ -717,8 +729,7 @@ end
 -- Spawn all entities that need to be spawned this frame
 function update_spawns( ship )
 	ship_pos = vtransform_getWorldPosition( ship.transform )
-	x,y,z,w = vvector_values( ship_pos )
-	far = z + spawn_distance
+	far = ship_pos.z + spawn_distance
 	entities_spawnAll( last_spawn, far )
 	last_spawn = far;
 end
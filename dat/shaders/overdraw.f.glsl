@@ -0,0 +1,11 @@
+//#version 110
+// Overdraw Fragment Shader
+// Drawn with additive blending, so brightness shows how many times each pixel was shaded
+
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+void main() {
+	gl_FragColor = vec4( 0.1, 0.1, 0.1, 1.0 );
+}
@@ -0,0 +1,15 @@
+// Text fragment shader
+
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+varying vec2 texcoord;
+varying vec4 frag_color;
+
+uniform sampler2D tex;
+
+void main() {
+	// The glyph atlas is white, with coverage in alpha
+	gl_FragColor = texture2D( tex, texcoord ) * frag_color;
+}
@@ -12,17 +12,28 @@ typedef struct arrayTestStruct_s {
 	float c;
 } arrayTestStruct;
 
-DECLARE_FIXED_ARRAY( arrayTestStruct );
-IMPLEMENT_FIXED_ARRAY( arrayTestStruct );
+DECLARE_FIXED_ARRAY( arrayTestStruct )
+IMPLEMENT_FIXED_ARRAY( arrayTestStruct )
 
 void test_array() {
 	int size = 64;
 	arrayTestStructFixedArray* array = arrayTestStructFixedArray_create( size );
 	test( array->size == size, "Created fixedArray of correct size.", "Created fixedArray of incorrect size." );
-	for ( int i = 0; i < 64; ++i ) {
-		arrayTestStruct test_object = { 1, 2, 3.f };
-		arrayTestStructFixedArray_add( array, test_object );
+	arrayTestStruct* objects[64];
+	for ( int i = 0; i < size; ++i ) {
+		arrayTestStruct test_object = { i, 2, 3.f };
+		objects[i] = arrayTestStructFixedArray_add( array, test_object );
 	}
-	test( array->first_free == array->end );
+	test( array->first_free == kFixedArrayNoFree && array->count == size, "Filled fixedArray.", "Failed to fill fixedArray." );
+	test( objects[10]->a == 10, "FixedArray objects keep their values.", "FixedArray objects lost their values." );
+
+	// Removed slots are reused, and other objects don't move
+	arrayTestStructFixedArray_remove( array, objects[10] );
+	arrayTestStructFixedArray_remove( array, objects[20] );
+	arrayTestStruct test_object = { 100, 2, 3.f };
+	arrayTestStruct* added = arrayTestStructFixedArray_add( array, test_object );
+	test( added == objects[20] && objects[21]->a == 21, "FixedArray reused a removed slot.", "FixedArray did not reuse a removed slot." );
+	test( array->count == size - 1, "FixedArray count is correct.", "FixedArray count is incorrect." );
+	arrayTestStructFixedArray_delete( array );
 }
 #endif // UNIT_TEST
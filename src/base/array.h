@@ -1,6 +1,8 @@
 // Array.h
 #pragma once
 
+#include "mem/allocator.h"
+
 /*
 	Fixed Array
 
@@ -9,65 +11,72 @@
 
 	Objects are Fixed and are never moved once created (though can be destroyed)
 
-	Use a linked list of empty pointers in unused spaces to define which points are valid and which are not
+	Unused slots hold the index of the next unused slot, forming a free list, so no extra
+	storage is needed to track them
 
 	Initializing is O(n)
 	Adding an element is O(1)
-	Removing an element is proportional to the fragmentation of the array
+	Removing an element is O(1)
    */
 
+#define kFixedArrayNoFree -1
+
 #define DECLARE_FIXED_ARRAY( A ) \
-typedef struct A##FixedArray_s { \
-	A*	array; 					\
-	int	size;					\
-	A*	first_free;				\
-	A*	end;					\
+typedef union A##FixedArraySlot_u {	\
+	A	object;						\
+	int	next_free;					\
+} A##FixedArraySlot;				\
+									\
+typedef struct A##FixedArray_s {	\
+	A##FixedArraySlot*	array;		\
+	int	size;						\
+	int	count;						\
+	int	first_free;					\
 } A##FixedArray;					\
-								\
+									\
 A* A##FixedArray_add( A##FixedArray* array, A object );			\
-void A##FixedArray_remove( A##FixedArray* array, A* object ); 	\
-A##FixedArray* A##FixedArray_create( int size );					\
+void A##FixedArray_remove( A##FixedArray* array, A* object );	\
+A##FixedArray* A##FixedArray_create( int size );				\
+void A##FixedArray_delete( A##FixedArray* array );
 
 #define IMPLEMENT_FIXED_ARRAY( A ) \
-A* A##FixedArray_add( A##FixedArray* array, A object ) { \
-	/* Assert there is a space; */						\
-	vAssert( a->first_free < a->end );					\
-														\
-	A* next_free = *a->first_free;						\
-	*(a->first_free) = object;							\
-	A* inserted_position = a->first_free;				\
-	a->first_free = next_free;							\
-														\
-	return inserted_position;							\
-}														\
-														\
-void A##FixedArray_remove( A##FixedArray* array, A* object ) {	\
-	vAssert( object >= array->array && object < array->end );	\
+A* A##FixedArray_add( A##FixedArray* array, A object ) {		\
+	/* Assert there is a space */								\
+	vAssert( array->first_free != kFixedArrayNoFree );			\
 																\
-	void* previous_free = &array->first_free;					\
-	void* next_free = array->first_free;						\
+	A##FixedArraySlot* slot = &array->array[array->first_free];	\
+	array->first_free = slot->next_free;						\
+	slot->object = object;										\
+	array->count++;												\
+	return &slot->object;										\
+}																\
 																\
-	while ( next_free < object ) {								\
-		previous_free = next_free;								\
-		next_free = *next_free;									\
-	}															\
+void A##FixedArray_remove( A##FixedArray* array, A* object ) {	\
+	/* The object is the first member of its slot */			\
+	A##FixedArraySlot* slot = (A##FixedArraySlot*)object;		\
+	vAssert( slot >= array->array && slot < array->array + array->size );	\
 																\
-	/* Find previous and next free, and update them */			\
-	*object = next_free;										\
-	*previous_free = object;									\
+	slot->next_free = array->first_free;						\
+	array->first_free = slot - array->array;					\
+	array->count--;												\
 }																\
 																\
-A##FixedArray* A##FixedArray_create( int size ) {					\
+A##FixedArray* A##FixedArray_create( int size ) {				\
 	A##FixedArray* array = mem_alloc( sizeof( A##FixedArray ));	\
-	*array = {};												\
+	memset( array, 0, sizeof( A##FixedArray ));				\
 	array->size = size;											\
-	array->array = mem_alloc( sizeof( A ) * array->size ));		\
-	array->end = &array->array[size];							\
-	array->first_free = &array->array[0]; /* When created the array is empty, so the first element must be free*/ \
-	/* init all spare spaces, they all point to the next (and the last points past the end) */ \
-	for ( int i = 0; i < array->size; ++i ) { 					\
-		array->array[i] = array->array[i + 1];					\
+	array->array = mem_alloc( sizeof( A##FixedArraySlot ) * array->size );	\
+	/* When created the array is empty, so every slot is free, each pointing to the next */	\
+	array->first_free = size > 0 ? 0 : kFixedArrayNoFree;		\
+	for ( int i = 0; i < array->size; ++i ) {					\
+		array->array[i].next_free = ( i + 1 < size ) ? i + 1 : kFixedArrayNoFree;	\
 	}															\
+	return array;												\
+}																\
+																\
+void A##FixedArray_delete( A##FixedArray* array ) {				\
+	mem_free( array->array );									\
+	mem_free( array );											\
 }
 
 #ifdef UNIT_TEST
@@ -3,7 +3,9 @@
 #include "common.h"
 #include "camera.h"
 //---------------------
+#include "maths/geometry.h"
 #include "maths/maths.h"
+#include "maths/matrix.h"
 #include "maths/vector.h"
 #include "transform.h"
 #include "mem/allocator.h"
@@ -32,37 +34,18 @@ camera* camera_createWithTransform( scene* s ) {
 }
 
 const vector* camera_getTranslation( camera* c ) {
-	return matrix_getTranslation( c->trans->local );
+	return matrix_getTranslation( transform_local( c->trans ) );
 }
 
 void camera_setTranslation( camera* c, const vector* v ) {
-	matrix_setTranslation( c->trans->local, v );
+	matrix_setTranslation( transform_local( c->trans ), v );
+	transform_markDirty( c->trans );
 }
 
-// Calculate the planes of the view frustum defined by the camera *c*
-void camera_calculateFrustum( camera* c, vector* frustum ) {
-	vAssert( frustum );
-	// 6 planes: Front, Back, Top, Bottom, Left, Right
-	// We can define a plane in a standard 4-element vector:
-	// First 3 elements are the normal, last is the D value
-
-	vector v = Vector( 0.0, 0.0, 1.0, 0.0 ); // 0.0 w coordinate since vector not point
-	vector view = matrix_vecMul( c->trans->world, &v );
-	vector p = *matrix_getTranslation( c->trans->world );
-
-	/*
-	vector_printf( "cam pos: ", &p );
-	vector_printf( "cam dir: ", &view );
-*/
-
-	vector front = view;
-	front.coord.w = Dot( &p, &view ) + c->z_near;
-	vector back = view;
-	back.coord.w = Dot( &p, &view ) + c->z_far;
-
-//	vector_printf( "Near plane: ", &front );
-//	vector_printf( "Far plane: ", &back );
-
-	frustum[0] = front;
-	frustum[1] = back;
+// Calculate and cache the planes of the view frustum defined by the camera *c*, given its
+// *projection* and *view* (inverse world) matrices
+void camera_calculateFrustum( camera* c, matrix projection, matrix view ) {
+	matrix view_projection;
+	matrix_mul( view_projection, projection, view );
+	frustum_fromMatrix( c->frustum, view_projection );
 }
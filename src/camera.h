@@ -1,5 +1,6 @@
 // camera.h
 #pragma once
+#include "maths/geometry.h"
 
 struct camera_s {
 	transform* trans;
@@ -8,6 +9,9 @@ struct camera_s {
 	float z_far;
 
 	float fov; // in Radians
+
+	// World space view frustum, calculated once per frame by render()
+	vector frustum[kFrustumPlaneCount];
 //	float focalLength;
 //	float aperture;
 };
@@ -22,5 +26,6 @@ const vector* camera_getTranslation(camera* c);
 
 void camera_setTranslation(camera* c, const vector* v);
 
-// Calculate the planes of the view frustum defined by the camera *c*
-void camera_calculateFrustum( camera* c, vector* frustum );
+// Calculate and cache the planes of the view frustum defined by the camera *c*, given its
+// *projection* and *view* (inverse world) matrices
+void camera_calculateFrustum( camera* c, matrix projection, matrix view );
@@ -6,6 +6,7 @@
 #include "transform.h"
 #include "maths/quaternion.h"
 #include "maths/vector.h"
+#include "mem/allocator.h"
 
 #include "render/render.h" // TODO remove
 
@@ -23,7 +24,7 @@ chasecam* chasecam_create() {
 // Calculate the position as the offset from the chase target
 vector chasecam_targetPosition( chasecam* c ) {
 	vector offset = Vector( 0.f, 8.f, -15.f, 1.f );
-	vector position = matrix_vecMul( c->target->world, &offset );
+	vector position = matrix_vecMul( transform_world( c->target ), &offset );
 	return position;
 }
 
@@ -81,7 +81,7 @@ void velcam_process( velcam* cam, velcamInput* in ) {
 	// We have a translation in camera space
 	// Want to go to world space, so use normal (not inverse) cam transform
 	vector translation_delta = matrix_vecMul( m, &in->track );
-	Add( &cam->translation, matrix_getTranslation( cam->trans->world ), &translation_delta );
+	Add( &cam->translation, matrix_getTranslation( transform_world( cam->trans ) ), &translation_delta );
 	matrix_setTranslation( m, &cam->translation );
 	transform_setWorldSpace( cam->trans, m );
 }
@@ -97,9 +97,9 @@ void velcam_tick( velcam* f, float dt ) {
 	assert( f->camera_target );
 	vector vel;
 	vector forward = Vector( 0.f, 0.f, 1.f, 0.f );
-	vel = matrix_vecMul( f->trans->world, &forward );
+	vel = matrix_vecMul( transform_world( f->trans ), &forward );
 	float speed = 0.f;
 	vector_scale( &vel, &vel, speed );
 	f->phys->velocity = vel;
-	transform_setWorldSpace( f->camera_target->trans, f->trans->world );
+	transform_setWorldSpace( f->camera_target->trans, transform_world( f->trans ) );
 }
@@ -10,6 +10,12 @@
 #include "mem/allocator.h"
 #include "render/debugdraw.h"
 #include "render/texture.h"
+#include "test.h"
+#include "vtime.h"
+#include <float.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif // __SSE__
 
 #define CANYON_TERRAIN_INDEXED 1
 #define TERRAIN_USE_WORKER_THREAD 1
@@ -21,6 +27,7 @@ void canyonTerrainBlock_initVBO( canyonTerrainBlock* b );
 void canyonTerrainBlock_calculateBuffers( canyonTerrainBlock* b );
 void canyonTerrainBlock_createBuffers( canyonTerrainBlock* b );
 void canyonTerrainBlock_init( canyonTerrainBlock* b );
+void canyonTerrain_buildIndex( canyonTerrain* t );
 
 // *** Utility functions
 
@@ -58,9 +65,14 @@ int canyonTerrainBlock_triangleCount( canyonTerrainBlock* b ) {
 
 
 void canyonTerrainBlock_render( canyonTerrainBlock* b ) {
+	if ( render_cullAABB( render_camera, &b->bounds, &render_cull_stats.terrain_blocks ))
+		return;
+
 	drawCall* draw = drawCall_create( &renderPass_main, resources.shader_terrain, b->element_count, b->element_buffer, b->vertex_buffer, terrain_texture, modelview );
 	draw->texture_b = terrain_texture_cliff;
-	(void)draw;
+	// Verts are in world space, so order by the block rather than the (identity) transform
+	vector centre = vector_lerp( &b->bounds.min, &b->bounds.max, 0.5f );
+	draw->depth = render_viewDepth( &centre );
 	if ( *b->vertex_VBO != 0 ) {
 		draw->vertex_VBO = *b->vertex_VBO;
 		draw->element_VBO = *b->element_VBO;
@@ -87,48 +99,32 @@ int canyonTerrain_blockIndexFromUV( canyonTerrain* t, int u, int v ) {
 void canyonTerrain_render( void* data ) {
 	canyonTerrain* t = data;
 	render_resetModelView();
-	matrix_mul( modelview, modelview, t->trans->world );
+	matrix_mul( modelview, modelview, transform_world( t->trans ) );
 
-#if 0
-	// Draw center line first
-	int centre_u = ( t->u_block_count + 1 ) / 2;
-	for ( int v = 0; v < t->v_block_count; ++v ) {
-		int i = canyonTerrain_blockIndexFromUV( t, centre_u, v );
-		canyonTerrainBlock_render( t->blocks[i] );
-	}
-	// Then the two sides
-	for ( int v = 0; v < t->v_block_count; ++v ) {
-		for ( int u = centre_u - 1; u >= 0; --u ) {
-			int i = canyonTerrain_blockIndexFromUV( t, u, v );
-			canyonTerrainBlock_render( t->blocks[i] );
-		}
-	}
-	for ( int v = 0; v < t->v_block_count; ++v ) {
-		for ( int u = centre_u + 1; u < t->u_block_count; ++u ) {
-			int i = canyonTerrain_blockIndexFromUV( t, u, v );
-			canyonTerrainBlock_render( t->blocks[i] );
-		}
-	}
-#else
+	// The render pass sorts blocks front to back, so submission order doesn't matter
 	for ( int i = 0; i < t->total_block_count; ++i ) {
 		canyonTerrainBlock_render( t->blocks[i] );
 	}
-#endif
 }
 
 canyonTerrainBlock* canyonTerrainBlock_create( canyonTerrain* t ) {
 	canyonTerrainBlock* b = mem_alloc( sizeof( canyonTerrainBlock ));
 	memset( b, 0, sizeof( canyonTerrainBlock ));
+	b->terrain = t;
 	b->vertex_VBO = NULL;
 	b->element_VBO = NULL;
 	b->u_samples = t->u_samples_per_block;
 	b->v_samples = t->v_samples_per_block;
+	// Sized for the densest blocks, as blocks are reused at different sample counts
+	b->verts = mem_alloc( sizeof( vector ) * ( t->u_samples_per_block + 2 ) * ( t->v_samples_per_block + 2 ));
 	return b;
 }
 
 void canyonTerrainBlock_calculateExtents( canyonTerrainBlock* b, canyonTerrain* t, int coord[2] ) {
 	float u_size = (2 * t->u_radius) / (float)t->u_block_count;
 	float v_size = (2 * t->v_radius) / (float)t->v_block_count;
+	b->coord[0] = coord[0];
+	b->coord[1] = coord[1];
 	b->u_min = ((float)coord[0] - 0.5f) * u_size;
 	b->v_min = ((float)coord[1] - 0.5f) * v_size;
 	b->u_max = b->u_min + u_size;
@@ -180,6 +176,8 @@ void canyonTerrain_createBlocks( canyonTerrain* t ) {
 	vAssert( t->total_block_count > 0 );
 
 	t->blocks = mem_alloc( sizeof( canyonTerrainBlock* ) * t->total_block_count );
+	// Blocks look for their neighbours as they are generated, so no garbage pointers
+	memset( t->blocks, 0, sizeof( canyonTerrainBlock* ) * t->total_block_count );
 
 	// Ensure the block bounds are initialised;
 	canyonTerrain_calculateBounds( t->bounds, t, &t->sample_point );
@@ -212,6 +210,7 @@ canyonTerrain* canyonTerrain_create( int u_blocks, int v_blocks ) {
 	t->v_radius = 640.f;
 
 	canyonTerrain_createBlocks( t );
+	canyonTerrain_buildIndex( t );
 
 	t->trans = transform_create();
 
@@ -225,6 +224,25 @@ canyonTerrain* canyonTerrain_create( int u_blocks, int v_blocks ) {
 	return t;
 }
 
+// The terrain must not have blocks waiting on the worker thread
+void canyonTerrain_delete( canyonTerrain* t ) {
+	for ( int i = 0; i < t->total_block_count; i++ ) {
+		canyonTerrainBlock* b = t->blocks[i];
+		vAssert( !b->pending );
+		if ( b->vertex_VBO )
+			render_freeBuffer( b->vertex_VBO );
+		if ( b->element_VBO )
+			render_freeBuffer( b->element_VBO );
+		mem_free( b->element_buffer );
+		mem_free( b->vertex_buffer );
+		mem_free( b->verts );
+		mem_free( b );
+	}
+	mem_free( t->blocks );
+	transform_delete( t->trans );
+	mem_free( t );
+}
+
 bool canyonTerrainBlock_triangleInvalid( canyonTerrainBlock* b, int u_index, int v_index, int u_offset, int v_offset ) {
 	u_offset = u_offset / 2 + u_offset % 2;
 	u_offset = min( u_offset, 0 );
@@ -314,79 +332,84 @@ int vertexBufferIndexFromUV( canyonTerrainBlock* b, int u, int v ) {
 	return ( u + v * b->u_samples );
 }
 
-// Generate Normals
-void canyonTerrainBlock_calculateNormals( canyonTerrainBlock* block, int vert_count, vector* verts, vector* normals ) {
-	
-	/*
-	// Do top and bottom edges first
-	for ( int i = 0; i < block->u_samples; i++ )
-		normals[i] = y_axis;
-	for ( int i = vert_count - block->u_samples; i < vert_count; i++ )
-		normals[i] = y_axis;
-	*/
-
-	//Now the rest
-	//for ( int i = block->u_samples; i < ( vert_count - block->u_samples ); i++ ) {
-
-		/*
-		// Ignoring Left and Right Edges
-		if ( i % block->u_samples == 0 || i % block->u_samples == ( block->u_samples - 1 ) ) {    
-			normals[i] = y_axis;
-			continue;
-		}
-		*/
+/*
+   Normals
+
+   Each normal is the cross product of the central differences along the grid's u and v
+   directions. A row of samples is contiguous, so the rows are done four samples at a time with
+   SSE where we have it. The SIMD and scalar paths do the same float operations in the same order
+   (with a true divide and square root), so a sample gets the same normal whichever path it takes;
+   together with neighbours sharing their edge samples, that keeps normals identical across seams.
+   */
+
+// The normal from the samples either side of it in u and in v
+vector canyonTerrain_sampleNormal( const vector* u_prev, const vector* u_next, const vector* v_prev, const vector* v_next ) {
+	float tu_x = u_next->coord.x - u_prev->coord.x;
+	float tu_y = u_next->coord.y - u_prev->coord.y;
+	float tu_z = u_next->coord.z - u_prev->coord.z;
+	float tv_x = v_next->coord.x - v_prev->coord.x;
+	float tv_y = v_next->coord.y - v_prev->coord.y;
+	float tv_z = v_next->coord.z - v_prev->coord.z;
+	float x = tu_y * tv_z - tu_z * tv_y;
+	float y = tu_z * tv_x - tu_x * tv_z;
+	float z = tu_x * tv_y - tu_y * tv_x;
+	float inv_length = 1.f / sqrtf( x * x + y * y + z * z );
+	return Vector( x * inv_length, y * inv_length, z * inv_length, 0.f );
+}
 
-	(void)vert_count;
+// Normals for [count] consecutive samples of [row]; [prev] and [next] are the adjacent rows
+void canyonTerrain_calculateNormalsRow( int count, const vector* prev, const vector* row, const vector* next, vector* normals ) {
+	int u = 0;
+#ifdef __SSE__
+	const __m128 one = _mm_set1_ps( 1.f );
+	for ( ; u + 4 <= count; u += 4 ) {
+		// The differences for samples u to u + 3, one sample per register...
+		__m128 tu_x = _mm_sub_ps( _mm_loadu_ps( row[u + 1].val ), _mm_loadu_ps( row[u - 1].val ));
+		__m128 tu_y = _mm_sub_ps( _mm_loadu_ps( row[u + 2].val ), _mm_loadu_ps( row[u].val ));
+		__m128 tu_z = _mm_sub_ps( _mm_loadu_ps( row[u + 3].val ), _mm_loadu_ps( row[u + 1].val ));
+		__m128 tu_w = _mm_sub_ps( _mm_loadu_ps( row[u + 4].val ), _mm_loadu_ps( row[u + 2].val ));
+		__m128 tv_x = _mm_sub_ps( _mm_loadu_ps( next[u].val ), _mm_loadu_ps( prev[u].val ));
+		__m128 tv_y = _mm_sub_ps( _mm_loadu_ps( next[u + 1].val ), _mm_loadu_ps( prev[u + 1].val ));
+		__m128 tv_z = _mm_sub_ps( _mm_loadu_ps( next[u + 2].val ), _mm_loadu_ps( prev[u + 2].val ));
+		__m128 tv_w = _mm_sub_ps( _mm_loadu_ps( next[u + 3].val ), _mm_loadu_ps( prev[u + 3].val ));
+		// ...transposed to one component per register
+		_MM_TRANSPOSE4_PS( tu_x, tu_y, tu_z, tu_w );
+		_MM_TRANSPOSE4_PS( tv_x, tv_y, tv_z, tv_w );
+
+		__m128 x = _mm_sub_ps( _mm_mul_ps( tu_y, tv_z ), _mm_mul_ps( tu_z, tv_y ));
+		__m128 y = _mm_sub_ps( _mm_mul_ps( tu_z, tv_x ), _mm_mul_ps( tu_x, tv_z ));
+		__m128 z = _mm_sub_ps( _mm_mul_ps( tu_x, tv_y ), _mm_mul_ps( tu_y, tv_x ));
+		__m128 length_sq = _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, x ), _mm_mul_ps( y, y )), _mm_mul_ps( z, z ));
+		__m128 inv_length = _mm_div_ps( one, _mm_sqrt_ps( length_sq ));
+		x = _mm_mul_ps( x, inv_length );
+		y = _mm_mul_ps( y, inv_length );
+		z = _mm_mul_ps( z, inv_length );
+		__m128 w = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS( x, y, z, w );
+		_mm_storeu_ps( normals[u].val, x );
+		_mm_storeu_ps( normals[u + 1].val, y );
+		_mm_storeu_ps( normals[u + 2].val, z );
+		_mm_storeu_ps( normals[u + 3].val, w );
+	}
+#endif // __SSE__
+	for ( ; u < count; u++ )
+		normals[u] = canyonTerrain_sampleNormal( &row[u - 1], &row[u + 1], &prev[u], &next[u] );
+}
 
+// Normals for every rendered sample; the margin keeps y_axis
+void canyonTerrainBlock_calculateNormals( canyonTerrainBlock* block, vector* verts, vector* normals ) {
+	const int stride = block->u_samples + 2;
 	for ( int v = 0; v < block->v_samples; ++v ) {
-		for ( int u = 0; u < block->u_samples; ++u ) {
-			int index = canyonTerrainBlock_indexFromUV( block, u, v - 1 );
-			vector left		= verts[index];
-			index = canyonTerrainBlock_indexFromUV( block, u, v + 1 );
-			vector right	= verts[index];
-			index = canyonTerrainBlock_indexFromUV( block, u - 1, v );
-			vector top		= verts[index];
-			index = canyonTerrainBlock_indexFromUV( block, u + 1, v );
-			vector bottom	= verts[index];
-			int i = canyonTerrainBlock_indexFromUV( block, u, v );
-			/*
-			vector left		= verts[i - block->u_samples];
-			vector right	= verts[i + block->u_samples];
-			vector top		= verts[i - 1];
-			vector bottom	= verts[i + 1];
-*/
-
-			vector a, b, c, x, y;
-
-			// Calculate vertical vector
-			// Take cross product to calculate normals
-			Sub( &a, &bottom, &top );
-			Cross( &x, &a, &y_axis );
-			Cross( &b, &x, &a );
-
-			// Calculate horizontal vector
-			// Take cross product to calculate normals
-			Sub( &a, &right, &left );
-			Cross( &y, &a, &y_axis );
-			Cross( &c, &y, &a );
-
-			Normalize( &b, &b );
-			Normalize( &c, &c );
-
-			// Average normals
-			vector total = Vector( 0.f, 0.f, 0.f, 0.f );
-			Add( &total, &total, &b );
-			Add( &total, &total, &c );
-			total.coord.w = 0.f;
-			Normalize( &total, &total );
-			normals[i] = total;
+		int row = canyonTerrainBlock_indexFromUV( block, 0, v );
+		canyonTerrain_calculateNormalsRow( block->u_samples, &verts[row - stride], &verts[row], &verts[row + stride], &normals[row] );
 
 #if CANYON_TERRAIN_INDEXED
+		for ( int u = 0; u < block->u_samples; ++u ) {
 			int buffer_index = vertexBufferIndexFromUV( block, u, v );
-			block->vertex_buffer[buffer_index].normal = normals[i];
+			block->vertex_buffer[buffer_index].normal = normals[row + u];
 			block->vertex_buffer[buffer_index].color = Vector( 0.8f, 0.9f, 1.0f, 0.f );
-#endif // CANYON_TERRAIN_INDEXED
 		}
+#endif // CANYON_TERRAIN_INDEXED
 	}
 }
 
@@ -421,38 +444,144 @@ void canyonTerrainBlock_createBuffers( canyonTerrainBlock* b ) {
 }
 
 
-void canyonTerrainBlock_calculateBuffers( canyonTerrainBlock* b ) {
+/*
+   Shared Samples
+
+   A block's edge samples, and the margin either side of them, are the same points as its
+   neighbour's (when both have the same sample counts), so rather than sampling the terrain for
+   them again a block copies them from a neighbour that has already been generated.
+
+   Blocks are generated on the worker thread while others are still being drawn and moved, so a
+   neighbour is matched by the coordinate its grid was published for, not its current one, and
+   its grid is read under a sequence count: the copy is only kept if no rewrite started meanwhile.
+   */
+
+// Copy the samples [b] shares with [n], the neighbour at [du], [dv] blocks from [coord]
+// Copied samples are marked in [shared]; samples already shared are left alone
+int canyonTerrainBlock_copySharedSamples( canyonTerrainBlock* b, const int coord[2], canyonTerrainBlock* n, int du, int dv, vector* verts, uint8_t* shared ) {
+	int generation = n->verts_generation;
+	__sync_synchronize();
+	if (( generation & 1 ) ||
+			n->verts_coord[0] != coord[0] + du || n->verts_coord[1] != coord[1] + dv ||
+			n->verts_u_samples != b->u_samples || n->verts_v_samples != b->v_samples )
+		return 0;
+
+	// Our edge is the neighbour's opposite edge: sample i here is sample i - d * ( samples - 1 ) there
+	int u_shift = du * ( b->u_samples - 1 );
+	int v_shift = dv * ( b->v_samples - 1 );
+	int u_begin = du > 0 ? b->u_samples - 2 : -1;
+	int u_end = du < 0 ? 1 : b->u_samples;
+	int v_begin = dv > 0 ? b->v_samples - 2 : -1;
+	int v_end = dv < 0 ? 1 : b->v_samples;
+	for ( int v = v_begin; v <= v_end; ++v ) {
+		for ( int u = u_begin; u <= u_end; ++u ) {
+			int i = canyonTerrainBlock_indexFromUV( b, u, v );
+			if ( !shared[i] )
+				verts[i] = n->verts[canyonTerrainBlock_indexFromUV( b, u - u_shift, v - v_shift )];
+		}
+	}
+
+	__sync_synchronize();
+	if ( n->verts_generation != generation )
+		return 0;
+
+	int copied = 0;
+	for ( int v = v_begin; v <= v_end; ++v ) {
+		for ( int u = u_begin; u <= u_end; ++u ) {
+			int i = canyonTerrainBlock_indexFromUV( b, u, v );
+			copied += !shared[i];
+			shared[i] = true;
+		}
+	}
+	return copied;
+}
+
+// Copy every sample shared with a generated neighbour; returns how many were copied
+int canyonTerrainBlock_copyNeighbourSamples( canyonTerrainBlock* b, const int coord[2], vector* verts, uint8_t* shared ) {
+	const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	canyonTerrain* t = b->terrain;
+	int copied = 0;
+	for ( int i = 0; i < t->total_block_count; ++i ) {
+		canyonTerrainBlock* n = t->blocks[i];
+		if ( !n || n == b )
+			continue;
+		for ( int j = 0; j < 4; ++j )
+			copied += canyonTerrainBlock_copySharedSamples( b, coord, n, offsets[j][0], offsets[j][1], verts, shared );
+	}
+	return copied;
+}
+
+// Make the grid in [verts] available to neighbours, as the grid for [coord]
+void canyonTerrainBlock_publishSamples( canyonTerrainBlock* b, const int coord[2], const vector* verts ) {
+	__sync_fetch_and_add( &b->verts_generation, 1 );
+	memcpy( b->verts, verts, sizeof( vector ) * canyonTerrainBlock_vertCount( b ));
+	b->verts_coord[0] = coord[0];
+	b->verts_coord[1] = coord[1];
+	b->verts_u_samples = b->u_samples;
+	b->verts_v_samples = b->v_samples;
+	__sync_fetch_and_add( &b->verts_generation, 1 );
+}
+
+// Generate the sample grid and normals, writing the render positions (which collision reads too)
+// Returns the number of samples copied from neighbours
+int canyonTerrainBlock_calculateSamples( canyonTerrainBlock* b, vector* verts, vector* normals, aabb* bounds ) {
 	int vert_count = canyonTerrainBlock_vertCount( b );
-	
-	vector* verts = mem_alloc( sizeof( vector ) * vert_count );
-	vector* normals = mem_alloc( sizeof( vector ) * vert_count );
+	int coord[2] = { b->coord[0], b->coord[1] };
+	uint8_t* shared = mem_alloc( vert_count );
+	memset( shared, 0, vert_count );
+	int copied = canyonTerrainBlock_copyNeighbourSamples( b, coord, verts, shared );
+
+	bounds->min = Vector( FLT_MAX, FLT_MAX, FLT_MAX, 1.f );
+	bounds->max = Vector( -FLT_MAX, -FLT_MAX, -FLT_MAX, 1.f );
 
 	for ( int v_index = -1; v_index < b->v_samples + 1; ++v_index ) {
 		for ( int u_index = -1; u_index < b->u_samples + 1; ++u_index ) {
 			// Generate a vertex
 			int i = canyonTerrainBlock_indexFromUV( b, u_index, v_index );
 			vAssert( i < vert_count );
-			float u, v;
-			canyonTerrainBlock_positionsFromUV( b, u_index, v_index, &u, &v );
-			float vert_x, vert_z;
-			terrain_worldSpaceFromCanyon( u, v, &vert_x, &vert_z );
-			float vert_y = terrain_sample( vert_x, vert_z  );
-
-			verts[i] = Vector( vert_x, vert_y, vert_z, 1.f );
+			if ( !shared[i] ) {
+				float u, v;
+				canyonTerrainBlock_positionsFromUV( b, u_index, v_index, &u, &v );
+				float vert_x, vert_z;
+				terrain_worldSpaceFromCanyon( u, v, &vert_x, &vert_z );
+				float vert_y = terrain_sample( vert_x, vert_z  );
+				verts[i] = Vector( vert_x, vert_y, vert_z, 1.f );
+			}
 			normals[i] = y_axis;
 
-#if CANYON_TERRAIN_INDEXED
 			if ( v_index >= 0 && v_index < b->v_samples &&
 					u_index >= 0 && u_index < b->u_samples ) {
 				int buffer_index = vertexBufferIndexFromUV( b, u_index, v_index );
+				bounds->min = vector_min( &bounds->min, &verts[i] );
+				bounds->max = vector_max( &bounds->max, &verts[i] );
+#if CANYON_TERRAIN_INDEXED
 				b->vertex_buffer[buffer_index].position = verts[i];
 				b->vertex_buffer[buffer_index].uv = Vector( verts[i].coord.x * texture_scale, verts[i].coord.z * texture_scale, 0.f, 0.f );
-			}
 #endif // CANYON_TERRAIN_INDEXED
+			}
 		}
 	}
+	mem_free( shared );
 
-	canyonTerrainBlock_calculateNormals( b, vert_count, verts, normals );
+	canyonTerrainBlock_calculateNormals( b, verts, normals );
+
+	// Only publish if the block wasn't moved while we were generating it
+	if ( b->coord[0] == coord[0] && b->coord[1] == coord[1] )
+		canyonTerrainBlock_publishSamples( b, coord, verts );
+	return copied;
+}
+
+void canyonTerrainBlock_calculateBuffers( canyonTerrainBlock* b ) {
+	int vert_count = canyonTerrainBlock_vertCount( b );
+	
+	vector* verts = mem_alloc( sizeof( vector ) * vert_count );
+	vector* normals = mem_alloc( sizeof( vector ) * vert_count );
+
+	b->collision_ready = false;
+	__sync_synchronize();
+	// The bounds are still in use for culling, so only replace them once they're complete
+	aabb bounds;
+	canyonTerrainBlock_calculateSamples( b, verts, normals, &bounds );
 
 	
 #if CANYON_TERRAIN_INDEXED
@@ -476,14 +605,16 @@ void canyonTerrainBlock_calculateBuffers( canyonTerrainBlock* b ) {
 	canyonTerrainBlock_generateVertices( b, verts, normals );
 #endif // CANYON_TERRAIN_INDEXED
 	
-	// Store verts
-	b->verts = mem_alloc( sizeof( vector ) * vert_count );
-	memcpy( b->verts, verts, sizeof( vector ) * vert_count );
-
 	mem_free( verts );
 	mem_free( normals );
 
 	canyonTerrainBlock_initVBO( b );
+	b->bounds = bounds;
+
+	// Publish the collision data only once it is complete (this may run on the worker thread)
+	__sync_synchronize();
+	b->collision_ready = true;
+	__sync_fetch_and_add( &b->terrain->collision_generation, 1 );
 }
 
 // Create GPU vertex buffer objects to hold our data and save transferring to the GPU each frame
@@ -503,7 +634,6 @@ void* canyonTerrain_workerGenerateBlock( void* args ) {
 	canyonTerrainBlock* b = args;
 	if ( b->pending ) {
 		canyonTerrainBlock_calculateBuffers( b );
-		//canyonTerrainBlock_calculateCollision( t, b );
 		b->pending = false;
 	}
 	return NULL;
@@ -577,6 +707,9 @@ void canyonTerrain_updateBlocks( canyonTerrain* t ) {
 		coord[1] = bounds[0][1] + ( i / t->u_block_count );
 		// if not in old bounds
 		if ( !boundsContains( intersection, coord )) {
+			// Its vertices no longer match its extents until it is regenerated
+			new_blocks[i]->collision_ready = false;
+			__sync_fetch_and_add( &t->collision_generation, 1 );
 			canyonTerrainBlock_calculateExtents( new_blocks[i], t, coord );
 			// mark it as new, buffers will be filled in later
 			new_blocks[i]->pending = true;
@@ -595,7 +728,6 @@ void canyonTerrain_updateBlocks( canyonTerrain* t ) {
 		canyonTerrainBlock* b = t->blocks[i];
 		if ( b->pending ) {
 			canyonTerrainBlock_calculateBuffers( b );
-			//canyonTerrainBlock_calculateCollision( t, b );
 			b->pending = false;
 			break;
 		}
@@ -608,6 +740,574 @@ void canyonTerrain_tick( void* data, float dt, engine* eng ) {
 	(void)eng;
 	canyonTerrain* t = data;
 	canyonTerrain_updateBlocks( t );
+	if ( t->index_generation != t->collision_generation )
+		canyonTerrain_buildIndex( t );
 }
 
 
+
+/*
+   Terrain Collision
+
+   The render vertex buffer is indexed, one vertex per sample, so it is the heightfield: collision
+   reads its world positions directly, along with each block's world space bounds. A sphere is
+   matched to a block through an index of their bounds, then to a cell by walking the block's grid in world space;
+   spheres above the terrain (most of them) are rejected before any of that.
+   */
+#if !CANYON_TERRAIN_INDEXED
+#error "Canyon terrain collision needs the indexed vertex buffer"
+#endif // CANYON_TERRAIN_INDEXED
+
+// The world position of render vertex [i]
+#define canyonTerrainBlock_point( b, i ) ( &(b)->vertex_buffer[i].position )
+
+// The upward facing normal of the triangle [a], [c], [d]
+vector canyonTerrain_triangleNormal( const vector* a, const vector* c, const vector* d ) {
+	vector edge_a = vector_sub( *c, *a );
+	vector edge_b = vector_sub( *d, *a );
+	vector normal;
+	Cross( &normal, &edge_a, &edge_b );
+	normal.coord.w = 0.f;
+	if ( normal.coord.y < 0.f )
+		vector_scale( &normal, &normal, -1.f );
+	Normalize( &normal, &normal );
+	return normal;
+}
+
+// Barycentric coordinates of ( x, z ) along the edges [a]->[c] and [a]->[d], in the XZ plane
+void canyonTerrain_barycentricXZ( const vector* a, const vector* c, const vector* d, float x, float z, float* s, float* t ) {
+	float e0x = c->coord.x - a->coord.x, e0z = c->coord.z - a->coord.z;
+	float e1x = d->coord.x - a->coord.x, e1z = d->coord.z - a->coord.z;
+	float px = x - a->coord.x, pz = z - a->coord.z;
+	float inv_det = 1.f / ( e0x * e1z - e1x * e0z );
+	*s = ( px * e1z - e1x * pz ) * inv_det;
+	*t = ( e0x * pz - px * e0z ) * inv_det;
+}
+
+// A first guess at the cell containing ( x, z ), treating the block as a quad between its corners
+// Returns whether ( x, z ) is inside that quad
+bool canyonTerrainBlock_estimateCell( canyonTerrainBlock* b, float x, float z, int* cell_u, int* cell_v ) {
+	int last_u = b->u_samples - 1;
+	int last_v = b->v_samples - 1;
+	const vector* c00 = canyonTerrainBlock_point( b, canyonTerrainBlock_renderIndexFromUV( b, 0, 0 ));
+	const vector* c10 = canyonTerrainBlock_point( b, canyonTerrainBlock_renderIndexFromUV( b, last_u, 0 ));
+	const vector* c01 = canyonTerrainBlock_point( b, canyonTerrainBlock_renderIndexFromUV( b, 0, last_v ));
+	const vector* c11 = canyonTerrainBlock_point( b, canyonTerrainBlock_renderIndexFromUV( b, last_u, last_v ));
+	float s, t;
+	canyonTerrain_barycentricXZ( c00, c10, c01, x, z, &s, &t );
+	if ( s + t > 1.f ) {
+		canyonTerrain_barycentricXZ( c11, c01, c10, x, z, &s, &t );
+		s = 1.f - s;
+		t = 1.f - t;
+	}
+	*cell_u = clamp( (int)( s * (float)last_u ), 0, last_u - 1 );
+	*cell_v = clamp( (int)( t * (float)last_v ), 0, last_v - 1 );
+	return s >= 0.f && s <= 1.f && t >= 0.f && t <= 1.f;
+}
+
+/*
+   Blocks are found through the index, a grid over the loaded blocks in world space. Canyon space
+   doesn't give the block directly: it only roughly inverts the warped grid, and not at all before
+   the start of the canyon, where blocks collapse. The index is built from the blocks ready when
+   it is built, so a block published since is found from the next tick.
+   */
+int canyonTerrain_indexCell( canyonTerrain* t, int axis, float f ) {
+	return clamp( (int)(( f - t->collision_bounds.min.val[axis * 2] ) / t->index_cell_size[axis] ), 0, kCanyonTerrainIndexSize - 1 );
+}
+
+void canyonTerrain_buildIndex( canyonTerrain* t ) {
+	vAssert( t->total_block_count <= 64 );
+	int generation = t->collision_generation;
+	__sync_synchronize();
+
+	aabb bounds;
+	bounds.min = Vector( FLT_MAX, FLT_MAX, FLT_MAX, 1.f );
+	bounds.max = Vector( -FLT_MAX, -FLT_MAX, -FLT_MAX, 1.f );
+	for ( int i = 0; i < t->total_block_count; i++ ) {
+		canyonTerrainBlock* b = t->blocks[i];
+		if ( b->collision_ready ) {
+			bounds.min = vector_min( &bounds.min, &b->bounds.min );
+			bounds.max = vector_max( &bounds.max, &b->bounds.max );
+		}
+	}
+	t->collision_bounds = bounds;
+	t->index_cell_size[0] = fmaxf(( bounds.max.coord.x - bounds.min.coord.x ) / kCanyonTerrainIndexSize, 1.f );
+	t->index_cell_size[1] = fmaxf(( bounds.max.coord.z - bounds.min.coord.z ) / kCanyonTerrainIndexSize, 1.f );
+
+	memset( t->index, 0, sizeof( t->index ));
+	for ( int i = 0; i < t->total_block_count; i++ ) {
+		canyonTerrainBlock* b = t->blocks[i];
+		if ( !b->collision_ready )
+			continue;
+		int u_min = canyonTerrain_indexCell( t, 0, b->bounds.min.coord.x );
+		int u_max = canyonTerrain_indexCell( t, 0, b->bounds.max.coord.x );
+		int v_min = canyonTerrain_indexCell( t, 1, b->bounds.min.coord.z );
+		int v_max = canyonTerrain_indexCell( t, 1, b->bounds.max.coord.z );
+		for ( int v = v_min; v <= v_max; v++ )
+			for ( int u = u_min; u <= u_max; u++ )
+				t->index[u + v * kCanyonTerrainIndexSize] |= 1ull << i;
+	}
+	t->index_generation = generation;
+}
+
+int canyonTerrain_blockAt( canyonTerrain* t, float x, float z ) {
+	// Also false if nothing is loaded, as the bounds are then inside out
+	if ( x < t->collision_bounds.min.coord.x || x > t->collision_bounds.max.coord.x ||
+			z < t->collision_bounds.min.coord.z || z > t->collision_bounds.max.coord.z )
+		return -1;
+	uint64_t blocks = t->index[canyonTerrain_indexCell( t, 0, x ) + canyonTerrain_indexCell( t, 1, z ) * kCanyonTerrainIndexSize];
+
+	// Block bounds overlap where the grid is warped, so prefer a block whose corners surround us
+	int found = -1;
+	for ( int i = 0; blocks; i++, blocks >>= 1 ) {
+		if ( !( blocks & 1 ))
+			continue;
+		canyonTerrainBlock* b = t->blocks[i];
+		if ( b->collision_ready && x >= b->bounds.min.coord.x && x <= b->bounds.max.coord.x &&
+				z >= b->bounds.min.coord.z && z <= b->bounds.max.coord.z ) {
+			int cell_u, cell_v;
+			if ( canyonTerrainBlock_estimateCell( b, x, z, &cell_u, &cell_v ))
+				return i;
+			found = found < 0 ? i : found;
+		}
+	}
+	return found;
+}
+
+/*
+   The grid is warped, so the first guess is only a starting point. From there we walk across the
+   cells towards the sphere, stepping into the neighbouring block if we reach an edge (neighbouring
+   blocks share their edge vertices, so the walk is seamless).
+   Far from the canyon the grid can fold over itself, so the walk may not arrive; then we fall
+   back to sampling the terrain directly.
+   */
+#define kCanyonTerrainMaxWalk 64
+
+// A cell of the terrain mesh, where a walk starts from and finishes
+typedef struct canyonTerrainCursor_s {
+	int block;
+	int cell_u;
+	int cell_v;
+} canyonTerrainCursor;
+
+// Find the mesh height and normal at ( x, z ), walking from [cursor], and leave the cursor in the cell found
+bool canyonTerrain_walkTo( canyonTerrain* terrain, canyonTerrainCursor* cursor, float x, float z, float* height, vector* normal ) {
+	canyonTerrainBlock* b = terrain->blocks[cursor->block];
+	int block_u = cursor->block % terrain->u_block_count;
+	int block_v = cursor->block / terrain->u_block_count;
+	int cell_u = cursor->cell_u;
+	int cell_v = cursor->cell_v;
+
+	for ( int step = 0; step < kCanyonTerrainMaxWalk; ++step ) {
+		int i00 = canyonTerrainBlock_renderIndexFromUV( b, cell_u, cell_v );
+		const vector* p00 = canyonTerrainBlock_point( b, i00 );
+		const vector* p10 = canyonTerrainBlock_point( b, i00 + 1 );
+		const vector* p01 = canyonTerrainBlock_point( b, i00 + b->u_samples );
+		const vector* p11 = canyonTerrainBlock_point( b, i00 + b->u_samples + 1 );
+
+		// Split the cell the same way as the element buffer: ( 00, 10, 01 ) and ( 10, 11, 01 )
+		const vector* tri[3] = { NULL, NULL, NULL };
+		float s, t;
+		canyonTerrain_barycentricXZ( p00, p10, p01, x, z, &s, &t );
+		int du = s < 0.f ? -1 : 0;
+		int dv = t < 0.f ? -1 : 0;
+		if ( s >= 0.f && t >= 0.f && s + t <= 1.f ) {
+			tri[0] = p00; tri[1] = p10; tri[2] = p01;
+		}
+		else {
+			// Coordinates from the far corner, so they run towards -u and -v
+			canyonTerrain_barycentricXZ( p11, p01, p10, x, z, &s, &t );
+			if ( s >= 0.f && t >= 0.f && s + t <= 1.f ) {
+				tri[0] = p11; tri[1] = p01; tri[2] = p10;
+			}
+			else {
+				du = s < 0.f ? 1 : du;
+				dv = t < 0.f ? 1 : dv;
+			}
+		}
+
+		if ( tri[0] ) {
+			*height = tri[0]->coord.y + s * ( tri[1]->coord.y - tri[0]->coord.y ) + t * ( tri[2]->coord.y - tri[0]->coord.y );
+			*normal = canyonTerrain_triangleNormal( tri[0], tri[1], tri[2] );
+			cursor->block = canyonTerrain_blockIndexFromUV( terrain, block_u, block_v );
+			cursor->cell_u = cell_u;
+			cursor->cell_v = cell_v;
+			return true;
+		}
+
+		if ( du == 0 && dv == 0 )
+			return false;	// Degenerate cell (eg. before the start of the canyon)
+		cell_u += du;
+		cell_v += dv;
+		// Step into the neighbouring block, if there is one
+		int next_u = block_u + ( cell_u < 0 ? -1 : ( cell_u > b->u_samples - 2 ? 1 : 0 ));
+		int next_v = block_v + ( cell_v < 0 ? -1 : ( cell_v > b->v_samples - 2 ? 1 : 0 ));
+		if ( next_u != block_u || next_v != block_v ) {
+			if ( next_u < 0 || next_u >= terrain->u_block_count || next_v < 0 || next_v >= terrain->v_block_count )
+				return false;	// Off the edge of the terrain
+			canyonTerrainBlock* next = terrain->blocks[canyonTerrain_blockIndexFromUV( terrain, next_u, next_v )];
+			if ( !next->collision_ready )
+				return false;
+			// Blocks away from the canyon have fewer samples, so rescale the cell along the shared edge
+			cell_u = cell_u < 0 ? next->u_samples - 2 : ( cell_u > b->u_samples - 2 ? 0 : cell_u * ( next->u_samples - 1 ) / ( b->u_samples - 1 ));
+			cell_v = cell_v < 0 ? next->v_samples - 2 : ( cell_v > b->v_samples - 2 ? 0 : cell_v * ( next->v_samples - 1 ) / ( b->v_samples - 1 ));
+			b = next;
+			block_u = next_u;
+			block_v = next_v;
+		}
+	}
+	return false;
+}
+
+// Find the mesh height and normal at ( x, z ), starting in block [block]
+bool canyonTerrain_surfaceAt( canyonTerrain* terrain, int block, float x, float z, float* height, vector* normal ) {
+	canyonTerrainCursor cursor;
+	cursor.block = block;
+	canyonTerrainBlock_estimateCell( terrain->blocks[block], x, z, &cursor.cell_u, &cursor.cell_v );
+	return canyonTerrain_walkTo( terrain, &cursor, x, z, height, normal );
+}
+
+// How far a sphere at [p] is clear of the surface, along the surface normal; negative when touching
+// Starts looking in block [block]
+float canyonTerrain_clearance( canyonTerrain* terrain, int block, const vector* p, float radius, vector* normal ) {
+	float height;
+	if ( !canyonTerrain_surfaceAt( terrain, block, p->coord.x, p->coord.z, &height, normal )) {
+		height = terrain_sample( p->coord.x, p->coord.z );
+		*normal = y_axis;
+	}
+	// Distance from the sphere center to the triangle plane; anything below the surface is inside
+	return ( p->coord.y - height ) * normal->coord.y - radius;
+}
+
+// Test one sphere against the terrain, starting in block [block]; returns true and fills in [contact] if they touch
+bool canyonTerrain_collideSphere( canyonTerrain* terrain, int block, const vector* sphere, canyonTerrainContact* contact ) {
+	vector normal;
+	float clearance = canyonTerrain_clearance( terrain, block, sphere, sphere->coord.w, &normal );
+	if ( clearance >= 0.f )
+		return false;
+	contact->depth = -clearance;
+	contact->normal = normal;
+	return true;
+}
+
+int canyonTerrain_collideSpheres( canyonTerrain* t, int count, const vector* spheres, canyonTerrainContact* contacts ) {
+	float terrain_max = t->collision_bounds.max.coord.y;
+	int contact_count = 0;
+	for ( int i = 0; i < count; i++ ) {
+		const vector* sphere = &spheres[i];
+		if ( sphere->coord.y - sphere->coord.w > terrain_max )
+			continue;
+		int block = canyonTerrain_blockAt( t, sphere->coord.x, sphere->coord.z );
+		if ( block < 0 )
+			continue;
+		canyonTerrainContact* contact = &contacts[contact_count];
+		if ( canyonTerrain_collideSphere( t, block, sphere, contact )) {
+			contact->sphere = i;
+			++contact_count;
+		}
+	}
+	return contact_count;
+}
+
+/*
+   Casts march along the ray through the loaded blocks, stepping by a fraction of the clearance
+   (so quickly while high above the ground), until the ray is below the surface. The crossing is
+   then refined by false position, which lands on it in a step or two when both ends are over
+   the same triangle. Features thinner than kCanyonTerrainCastMinStep can be stepped over.
+   */
+#define kCanyonTerrainCastMinStep 1.f
+#define kCanyonTerrainCastMaxStep 16.f
+#define kCanyonTerrainCastRefine 6
+#define kCanyonTerrainCastTolerance 0.01f
+
+// Clearance of the cast at [t]; successive points are close, so each walk starts from the cell of the last
+// The cursor's block is -1 when the last point was off the mesh
+float canyonTerrain_castClearance( canyonTerrain* terrain, const vector* origin, const vector* dir, float t, float radius, canyonTerrainCursor* cursor, vector* normal ) {
+	vector p = vector_add( *origin, vector_scaled( *dir, t ));
+	if ( cursor->block < 0 ) {
+		cursor->block = canyonTerrain_blockAt( terrain, p.coord.x, p.coord.z );
+		if ( cursor->block < 0 )
+			return FLT_MAX;
+		canyonTerrainBlock_estimateCell( terrain->blocks[cursor->block], p.coord.x, p.coord.z, &cursor->cell_u, &cursor->cell_v );
+	}
+	float height;
+	if ( !canyonTerrain_walkTo( terrain, cursor, p.coord.x, p.coord.z, &height, normal )) {
+		// Walked off the loaded blocks, so there's nothing to hit; or the grid folded, so sample directly
+		cursor->block = -1;
+		if ( canyonTerrain_blockAt( terrain, p.coord.x, p.coord.z ) < 0 )
+			return FLT_MAX;
+		height = terrain_sample( p.coord.x, p.coord.z );
+		*normal = y_axis;
+	}
+	return ( p.coord.y - height ) * normal->coord.y - radius;
+}
+
+bool canyonTerrain_cast( canyonTerrain* terrain, const vector* origin, const vector* dir, float length, float radius, float* distance, vector* normal ) {
+	// Only march where the ray passes over the loaded blocks
+	aabb bounds = terrain->collision_bounds;
+	if ( bounds.min.coord.x > bounds.max.coord.x )
+		return false;
+	for ( int axis = 0; axis < 3; axis++ ) {
+		bounds.min.val[axis] -= radius;
+		bounds.max.val[axis] += radius;
+	}
+	float begin, end;
+	if ( !ray_clipAABB( origin, dir, &bounds, length, &begin, &end ))
+		return false;
+
+	canyonTerrainCursor cursor = { -1, 0, 0 };
+	float clear_t = begin;
+	float clear_clearance = 0.f;
+	float t = begin;
+	float clearance;
+	while ( true ) {
+		clearance = canyonTerrain_castClearance( terrain, origin, dir, t, radius, &cursor, normal );
+		if ( clearance < 0.f )
+			break;
+		if ( t >= end )
+			return false;
+		clear_t = t;
+		clear_clearance = clearance;
+		t = minf( t + fclamp( clearance * 0.5f, kCanyonTerrainCastMinStep, kCanyonTerrainCastMaxStep ), end );
+	}
+
+	// Somewhere in ( clear_t, t ] the cast touches the surface
+	// (clear_clearance is FLT_MAX if clear_t was off the terrain; then just bisect)
+	vector hit_normal = *normal;
+	for ( int i = 0; i < kCanyonTerrainCastRefine && t - clear_t > kCanyonTerrainCastTolerance; i++ ) {
+		float mid = ( clear_clearance < FLT_MAX ) ? clear_t + ( t - clear_t ) * clear_clearance / ( clear_clearance - clearance ) : ( clear_t + t ) * 0.5f;
+		mid = fclamp( mid, clear_t, t );
+		float mid_clearance = canyonTerrain_castClearance( terrain, origin, dir, mid, radius, &cursor, normal );
+		if ( mid_clearance < 0.f ) {
+			t = mid;
+			clearance = mid_clearance;
+			hit_normal = *normal;
+		}
+		else {
+			// Close enough to touching
+			if ( mid_clearance < kCanyonTerrainCastTolerance ) {
+				t = mid;
+				hit_normal = *normal;
+				break;
+			}
+			clear_t = mid;
+			clear_clearance = mid_clearance;
+		}
+	}
+	*distance = t;
+	*normal = hit_normal;
+	return true;
+}
+
+// A point on the terrain, found the slow way
+vector canyonTerrain_testPoint( float u, float v ) {
+	float x, z;
+	terrain_worldSpaceFromCanyon( u, v, &x, &z );
+	return Vector( x, terrain_sample( x, z ), z, 1.f );
+}
+
+void test_canyonTerrainCollision() {
+	canyonTerrain* t = canyonTerrain_create( 5, 5 );
+
+	// Spheres centered on vertices: just below the surface touch it, just above don't
+	// (one block on the canyon, one at the edge where canyon space is least accurate)
+	int block_u[2] = { 2, 0 };
+	for ( int i = 0; i < 2; i++ ) {
+		canyonTerrainBlock* b = t->blocks[canyonTerrain_blockIndexFromUV( t, block_u[i], 3 )];
+		vector on = *canyonTerrainBlock_point( b, canyonTerrainBlock_renderIndexFromUV( b, b->u_samples / 4, b->v_samples / 2 ));
+		vector spheres[2];
+		spheres[0] = on;
+		spheres[0].coord.y -= 0.5f;
+		spheres[0].coord.w = 1.f;
+		spheres[1] = on;
+		spheres[1].coord.y += 200.f;
+		spheres[1].coord.w = 1.f;
+		canyonTerrainContact contacts[2];
+		int hits = canyonTerrain_collideSpheres( t, 2, spheres, contacts );
+		test( hits == 1 && contacts[0].sphere == 0, "Sphere touching canyon terrain collided.", "Canyon terrain sphere collision failed." );
+		test( hits == 1 && contacts[0].depth > 0.5f && contacts[0].normal.coord.y > 0.f, "Canyon terrain contact is sensible.", "Canyon terrain contact is wrong." );
+	}
+
+	// Blocks are found from world space
+	int block = canyonTerrain_blockIndexFromUV( t, 2, 3 );
+	canyonTerrainBlock* b = t->blocks[block];
+	vector center = *canyonTerrainBlock_point( b, canyonTerrainBlock_renderIndexFromUV( b, b->u_samples / 2, b->v_samples / 2 ));
+	test( canyonTerrain_blockAt( t, center.coord.x, center.coord.z ) >= 0, "Found canyon terrain block from world space.", "Failed to find canyon terrain block." );
+	test( canyonTerrain_blockAt( t, 100000.f, center.coord.z ) == -1, "No block outside the terrain.", "Found a block outside the terrain." );
+
+	// Casting down onto a vertex lands on it, or a radius above it
+	vector above = vector_add( center, Vector( 0.f, 200.f, 0.f, 0.f ));
+	vector down = Vector( 0.f, -1.f, 0.f, 0.f );
+	float distance;
+	vector normal;
+	test( canyonTerrain_cast( t, &above, &down, 1000.f, 0.f, &distance, &normal ) && fabsf( distance - 200.f ) < 0.01f && normal.coord.y > 0.f,
+			"Ray hit canyon terrain.", "Ray missed canyon terrain." );
+	bool sphere_hit = canyonTerrain_cast( t, &above, &down, 1000.f, 2.f, &distance, &normal );
+	test( sphere_hit && distance < 198.01f && distance > 190.f, "Sphere cast hit canyon terrain.", "Sphere cast missed canyon terrain." );
+	test( !canyonTerrain_cast( t, &above, &down, 150.f, 0.f, &distance, &normal ), "Short ray stopped above canyon terrain.", "Short ray hit canyon terrain." );
+
+	canyonTerrain_delete( t );
+}
+
+void benchmark_canyonTerrainCollision() {
+	canyonTerrain* t = canyonTerrain_create( 5, 5 );
+	const int count = 4000;
+	vector* spheres = mem_alloc( sizeof( vector ) * count );
+	canyonTerrainContact* contacts = mem_alloc( sizeof( canyonTerrainContact ) * count );
+
+	// Half near the ground (the slow path), half well above it
+	for ( int i = 0; i < count; i++ ) {
+		float u = frand( -t->u_radius * 0.5f, t->u_radius * 0.5f );
+		float v = frand( 0.f, t->v_radius * 0.9f );
+		spheres[i] = canyonTerrain_testPoint( u, v );
+		spheres[i].coord.y += ( i % 2 ) ? frand( -5.f, 5.f ) : 1000.f;
+		spheres[i].coord.w = 3.f;
+	}
+
+	const int frames = 20;
+	int hits = 0;
+	uint64_t start = timer_microseconds();
+	for ( int i = 0; i < frames; i++ )
+		hits += canyonTerrain_collideSpheres( t, count, spheres, contacts );
+	uint64_t batched = timer_microseconds() - start;
+
+	// The old path: a full terrain sample per sphere
+	start = timer_microseconds();
+	int sample_hits = 0;
+	for ( int i = 0; i < frames; i++ )
+		for ( int j = 0; j < count; j++ )
+			sample_hits += terrain_sample( spheres[j].coord.x, spheres[j].coord.z ) > spheres[j].coord.y - spheres[j].coord.w;
+	uint64_t sampled = timer_microseconds() - start;
+
+	printf( "TERRAIN_COLLISION: %d spheres. Batched query: %.3fms per frame (%d hits), terrain_sample: %.3fms per frame (%d hits).\n",
+			count, (float)batched / frames / 1000.f, hits / frames, (float)sampled / frames / 1000.f, sample_hits / frames );
+
+	// Rays angled down at the ground from above it, as for targeting
+	start = timer_microseconds();
+	int ray_hits = 0;
+	for ( int i = 0; i < count; i++ ) {
+		vector origin = vector_add( spheres[i], Vector( 0.f, 100.f, 0.f, 0.f ));
+		vector dir = normalized( Vector( frand( -1.f, 1.f ), -1.f, frand( -1.f, 1.f ), 0.f ));
+		float distance;
+		vector normal;
+		ray_hits += canyonTerrain_cast( t, &origin, &dir, 1000.f, 0.f, &distance, &normal );
+	}
+	uint64_t rays = timer_microseconds() - start;
+	printf( "TERRAIN_COLLISION: %d rays: %.3fms (%d hits).\n", count, (float)rays / 1000.f, ray_hits );
+	mem_free( spheres );
+	mem_free( contacts );
+	canyonTerrain_delete( t );
+}
+
+// Normals of a block's published grid
+void canyonTerrain_testNormals( canyonTerrainBlock* b, vector* normals ) {
+	canyonTerrainBlock_calculateNormals( b, b->verts, normals );
+}
+
+void test_canyonTerrainNormals() {
+	// The batched row matches the scalar path exactly, so seams agree whichever path a sample takes
+	const int count = 11;
+	vector rows[3][13];
+	for ( int r = 0; r < 3; r++ )
+		for ( int u = 0; u < count + 2; u++ )
+			rows[r][u] = Vector( (float)u + frand( -0.3f, 0.3f ), frand( -2.f, 2.f ), (float)r + frand( -0.3f, 0.3f ), 1.f );
+	vector normals[count];
+	canyonTerrain_calculateNormalsRow( count, &rows[0][1], &rows[1][1], &rows[2][1], normals );
+	bool exact = true;
+	for ( int u = 0; u < count; u++ ) {
+		vector n = canyonTerrain_sampleNormal( &rows[1][u], &rows[1][u + 2], &rows[0][u + 1], &rows[2][u + 1] );
+		exact = exact && memcmp( &n, &normals[u], sizeof( vector )) == 0;
+	}
+	test( exact, "Batched terrain normals match scalar.", "Batched terrain normals differ from scalar." );
+
+	canyonTerrain* t = canyonTerrain_create( 5, 5 );
+	canyonTerrainBlock* lower = t->blocks[canyonTerrain_blockIndexFromUV( t, 2, 2 )];
+	canyonTerrainBlock* upper = t->blocks[canyonTerrain_blockIndexFromUV( t, 2, 3 )];
+	vAssert( upper->coord[1] == lower->coord[1] + 1 && upper->u_samples == lower->u_samples );
+
+	vector* lower_normals = mem_alloc( sizeof( vector ) * canyonTerrainBlock_vertCount( lower ));
+	vector* upper_normals = mem_alloc( sizeof( vector ) * canyonTerrainBlock_vertCount( upper ));
+	canyonTerrain_testNormals( lower, lower_normals );
+	canyonTerrain_testNormals( upper, upper_normals );
+
+	// The shared edge has identical points and normals in both blocks, all facing up
+	bool seam_points = true;
+	bool seam_normals = true;
+	bool up = true;
+	for ( int u = 0; u < lower->u_samples; u++ ) {
+		int i = canyonTerrainBlock_indexFromUV( lower, u, lower->v_samples - 1 );
+		int j = canyonTerrainBlock_indexFromUV( upper, u, 0 );
+		seam_points = seam_points && memcmp( &lower->verts[i], &upper->verts[j], sizeof( vector )) == 0;
+		seam_normals = seam_normals && memcmp( &lower_normals[i], &upper_normals[j], sizeof( vector )) == 0;
+		up = up && upper_normals[j].coord.y > 0.f && fabsf( vector_length( &upper_normals[j] ) - 1.f ) < 0.001f;
+	}
+	test( seam_points, "Canyon terrain blocks share their edge samples.", "Canyon terrain edge samples differ between blocks." );
+	test( seam_normals, "Canyon terrain normals match across a seam.", "Canyon terrain normals differ across a seam." );
+	test( up, "Canyon terrain normals are unit length and face up.", "Canyon terrain normals are wrong." );
+
+	// Regenerating a block with all its neighbours loaded samples less of the terrain
+	vector* verts = mem_alloc( sizeof( vector ) * canyonTerrainBlock_vertCount( upper ));
+	aabb bounds;
+	int copied = canyonTerrainBlock_calculateSamples( upper, verts, upper_normals, &bounds );
+	test( copied > 0, "Canyon terrain block reused its neighbours' samples.", "Canyon terrain block resampled shared edges." );
+
+	mem_free( verts );
+	mem_free( lower_normals );
+	mem_free( upper_normals );
+	canyonTerrain_delete( t );
+}
+
+void benchmark_canyonTerrainGeneration() {
+	canyonTerrain* t = canyonTerrain_create( 5, 5 );
+	int max_verts = ( t->u_samples_per_block + 2 ) * ( t->v_samples_per_block + 2 );
+	vector* verts = mem_alloc( sizeof( vector ) * max_verts );
+	vector* normals = mem_alloc( sizeof( vector ) * max_verts );
+	aabb bounds;
+
+	// Each block on its own (as before), then with its neighbours' edges to copy
+	uint64_t start = timer_microseconds();
+	for ( int i = 0; i < t->total_block_count; i++ ) {
+		for ( int j = 0; j < t->total_block_count; j++ )
+			t->blocks[j]->verts_u_samples = 0;
+		canyonTerrainBlock_calculateSamples( t->blocks[i], verts, normals, &bounds );
+	}
+	uint64_t isolated = timer_microseconds() - start;
+
+	start = timer_microseconds();
+	int copied = 0;
+	int samples = 0;
+	for ( int i = 0; i < t->total_block_count; i++ ) {
+		copied += canyonTerrainBlock_calculateSamples( t->blocks[i], verts, normals, &bounds );
+		samples += canyonTerrainBlock_vertCount( t->blocks[i] );
+	}
+	uint64_t shared = timer_microseconds() - start;
+
+	// The normal pass alone, one sample at a time vs batched rows
+	const int passes = 20;
+	start = timer_microseconds();
+	for ( int p = 0; p < passes; p++ ) {
+		for ( int i = 0; i < t->total_block_count; i++ ) {
+			canyonTerrainBlock* b = t->blocks[i];
+			int stride = b->u_samples + 2;
+			for ( int v = 0; v < b->v_samples; v++ ) {
+				for ( int u = 0; u < b->u_samples; u++ ) {
+					int k = canyonTerrainBlock_indexFromUV( b, u, v );
+					normals[k] = canyonTerrain_sampleNormal( &b->verts[k - 1], &b->verts[k + 1], &b->verts[k - stride], &b->verts[k + stride] );
+				}
+			}
+		}
+	}
+	uint64_t scalar = timer_microseconds() - start;
+	start = timer_microseconds();
+	for ( int p = 0; p < passes; p++ )
+		for ( int i = 0; i < t->total_block_count; i++ )
+			canyonTerrain_testNormals( t->blocks[i], normals );
+	uint64_t batched = timer_microseconds() - start;
+
+	printf( "TERRAIN_GENERATION: %d blocks. Isolated: %.3fms, shared edges: %.3fms (%d of %d samples copied). Normals: scalar %.3fms, batched %.3fms per terrain.\n",
+			t->total_block_count, (float)isolated / 1000.f, (float)shared / 1000.f, copied, samples,
+			(float)scalar / passes / 1000.f, (float)batched / passes / 1000.f );
+	mem_free( verts );
+	mem_free( normals );
+	canyonTerrain_delete( t );
+}
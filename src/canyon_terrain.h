@@ -2,7 +2,12 @@
 #pragma once
 #include "render/render.h"
 
+// Collision finds blocks through a grid of this many cells a side
+#define kCanyonTerrainIndexSize 16
+
 typedef struct canyonTerrainBlock_s {
+	canyonTerrain*	terrain;
+	int coord[2];	// Block coordinate in canyon space
 	int u_samples;
 	int v_samples;
 
@@ -18,14 +23,25 @@ typedef struct canyonTerrainBlock_s {
 	GLuint*			vertex_VBO;
 	GLuint*			element_VBO;
 
-	//temp
-	vector* verts;
+	// The last generated sample grid, including the one sample margin, and the block it is for.
+	// Neighbouring blocks copy the samples they share from here rather than resampling them
+	vector*	verts;
+	int		verts_coord[2];
+	int		verts_u_samples;
+	int		verts_v_samples;
+	volatile int	verts_generation;	// Odd while the grid is being rewritten
+
+	// World space bounds, for culling and collision
+	aabb	bounds;
+
+	// Collision reads the world positions straight from the (indexed) vertex buffer
+	bool	collision_ready;	// Vertex positions and bounds are up to date with the block extents
 
 	bool pending;	// Whether we need to recalculate the block
 
 } canyonTerrainBlock;
 
-typedef struct canyonTerrain_s {
+struct canyonTerrain_s {
 	transform* trans;
 
 	float	u_radius;
@@ -40,10 +56,42 @@ typedef struct canyonTerrain_s {
 	
 	int				bounds[2][2];
 	vector			sample_point;
-} canyonTerrain;
+
+	// Collision: the bounds of the loaded blocks, and a grid over them in XZ where each cell is a mask
+	// of the blocks overlapping it. Rebuilt on the tick after blocks move or are published
+	aabb			collision_bounds;
+	float			index_cell_size[2];
+	uint64_t		index[kCanyonTerrainIndexSize * kCanyonTerrainIndexSize];
+	int				index_generation;
+	volatile int	collision_generation;	// Bumped whenever a block's collision data changes
+};
+
+// A sphere touching the terrain
+typedef struct canyonTerrainContact_s {
+	int		sphere;		// Index of the sphere in the query
+	float	depth;		// How far the sphere penetrates the terrain
+	vector	normal;		// World space terrain normal
+} canyonTerrainContact;
 
 // *** Functions 
 
 canyonTerrain* canyonTerrain_create();
+void canyonTerrain_delete( canyonTerrain* t );
 void canyonTerrain_render( void* data );
 void canyonTerrain_tick( void* data, float dt, engine* eng );
+
+// The index of a loaded block whose world space bounds contain [x], [z], or -1
+int canyonTerrain_blockAt( canyonTerrain* t, float x, float z );
+
+// Test [count] spheres (xyz center, w radius) against the terrain in one batch
+// Writes a contact for each sphere touching the terrain and returns the number of contacts
+int canyonTerrain_collideSpheres( canyonTerrain* t, int count, const vector* spheres, canyonTerrainContact* contacts );
+
+// Cast a sphere of [radius] (0 for a ray) from [origin] along unit [dir], up to [length]
+// If it touches the terrain, gives the [distance] travelled and the surface [normal] there
+bool canyonTerrain_cast( canyonTerrain* t, const vector* origin, const vector* dir, float length, float radius, float* distance, vector* normal );
+
+void test_canyonTerrainCollision();
+void benchmark_canyonTerrainCollision();
+void test_canyonTerrainNormals();
+void benchmark_canyonTerrainGeneration();
@@ -2,12 +2,16 @@
 #include "common.h"
 #include "collision.h"
 //---------------------
+#include "canyon_terrain.h"
 #include "engine.h"
 #include "model.h"
+#include "model_loader.h"
 #include "test.h"
 #include "transform.h"
 #include "maths/geometry.h"
+#include "mem/allocator.h"
 #include "render/debugdraw.h"
+#include <float.h>
 
 collideFunc collide_funcs[kMaxShapeTypes][kMaxShapeTypes];
 
@@ -28,6 +32,8 @@ void collision_clearEvents() {
 }
 
 void collision_event( body* a, body* b ) {
+	if ( event_count >= kMaxCollisionEvents )
+		return;
 	collisionEvent* event = &collision_events[event_count++];
 	event->a = a;
 	event->b = b;
@@ -42,7 +48,10 @@ void collision_addBody( body* b ) {
 int dead_body_count = 0;
 body* dead_bodies[kMaxDeadBodies];
 
+// Safe to call more than once for the same body
 void collision_removeBody( body* b ) {
+	if ( array_find( (void**)dead_bodies, dead_body_count, b ) != -1 )
+		return;
 	vAssert( dead_body_count < kMaxDeadBodies );
 	dead_bodies[dead_body_count++] = b;
 }
@@ -59,24 +68,68 @@ void collision_removeDeadBodies( ) {
 	dead_body_count = 0;
 }
 
+// Bodies whose callback has already run this frame
+body*	called_bodies[kMaxCollisionEvents * 2];
+int		called_body_count = 0;
+
+// A body's callback runs at most once a frame, for its first contact, and not after it
+// has been removed; callbacks usually destroy their body (eg. a missile hitting a ship
+// and the terrain at once), which must only happen once
 void collision_callback( body* a, body* b ) {
-	if ( a->callback )
+	if ( !a->callback || array_find( (void**)called_bodies, called_body_count, a ) != -1 )
+		return;
+	called_bodies[called_body_count++] = a;
+	if ( array_find( (void**)dead_bodies, dead_body_count, a ) == -1 )
 		a->callback( a, b, a->callback_data );
 }
 
 void collision_runCallbacks() {
+	called_body_count = 0;
 	for ( int i = 0; i < event_count; ++i ) {
 		collision_callback( collision_events[i].a, collision_events[i].b );
 		collision_callback( collision_events[i].b, collision_events[i].a );
 	}
 }
 
+canyonTerrain* collision_terrain = NULL;
+body collision_terrain_body;
+
+void collision_setTerrain( canyonTerrain* t ) {
+	collision_terrain = t;
+	memset( &collision_terrain_body, 0, sizeof( collision_terrain_body ));
+	collision_terrain_body.layers = kCollisionLayerTerrain;
+}
+
+// Test every sphere that collides with the terrain in one query
+void collision_generateTerrainEvents() {
+	if ( !collision_terrain )
+		return;
+	vector spheres[kMaxCollidingBodies];
+	body* sphere_bodies[kMaxCollidingBodies];
+	int sphere_count = 0;
+	for ( int i = 0; i < body_count; ++i ) {
+		body* b = bodies[i];
+		if ( b->trans && b->shape->type == shapeSphere && ( b->collide_with & kCollisionLayerTerrain )) {
+			spheres[sphere_count] = matrix_vecMul( transform_world( b->trans ), &b->shape->origin );
+			spheres[sphere_count].coord.w = b->shape->radius;
+			sphere_bodies[sphere_count++] = b;
+		}
+	}
+
+	canyonTerrainContact contacts[kMaxCollidingBodies];
+	int contact_count = canyonTerrain_collideSpheres( collision_terrain, sphere_count, spheres, contacts );
+	for ( int i = 0; i < contact_count; ++i )
+		collision_event( sphere_bodies[contacts[i].sphere], &collision_terrain_body );
+}
+
 void collision_generateEvents() {
 	// for every body, check every other body
 	for ( int i = 0; i < body_count; ++i )
 		for ( int j = i + 1; j < body_count; j++ )
 			if ( body_colliding( bodies[i], bodies[j] ))
 				collision_event( bodies[i], bodies[j] );
+
+	collision_generateTerrainEvents();
 }
 
 void collisionMesh_drawWireframe( collisionMesh* m, matrix trans, vector color ) {
@@ -95,7 +148,7 @@ void body_debugdraw( body* b ) {
 			}
 			break;
 		case shapeMesh:
-			collisionMesh_drawWireframe( b->shape->collision_mesh, b->trans->world, green );
+			collisionMesh_drawWireframe( b->shape->collision_mesh, transform_world( b->trans ), green );
 			break;
 		case shapeHeightField:
 			break;
@@ -133,12 +186,20 @@ bool collisionFunc_SphereSphere( shape* a, shape* b, matrix matrix_a, matrix mat
 }
 
 bool collisionFunc_MeshSphere( shape* mesh_, shape* sphere_, matrix matrix_mesh, matrix matrix_sphere ) {
-	(void)mesh_;
-	(void)sphere_;
-	(void)matrix_mesh;
-	(void)matrix_sphere;
-
-	return false;
+	// Bring the sphere into mesh space
+	matrix sphere_to_mesh;
+	matrix inv_mesh;
+	matrix_inverse( inv_mesh, matrix_mesh );
+	matrix_mul( sphere_to_mesh, inv_mesh, matrix_sphere );
+	vector origin = sphere_->origin;
+	origin.coord.w = 1.f;
+	vector center = matrix_vecMul( sphere_to_mesh, &origin );
+	vector scale_axis = Vector( sphere_to_mesh[0][0], sphere_to_mesh[0][1], sphere_to_mesh[0][2], 0.f );
+	float radius = sphere_->radius * vector_length( &scale_axis );
+
+	collisionMesh* m = mesh_->collision_mesh;
+	// Touching the surface, or wholly inside
+	return collisionMesh_intersectsSphere( m, &center, radius ) || collisionMesh_containsPoint( m, &center );
 }
 
 // Just swap the types around
@@ -146,175 +207,34 @@ bool collisionFunc_SphereMesh( shape* sphere_, shape* mesh_, matrix matrix_spher
 	return collisionFunc_MeshSphere( mesh_, sphere_, matrix_mesh, matrix_sphere );
 }
 
-bool triangle_intersectingMesh( vector a, vector b, vector c, collisionMesh* m ) {
-	(void)a;
-	(void)b;
-	(void)c;
-	(void)m;
-	//vAssert( 0 ); //NYI
-	return false;
-}
-
-
-vector line_normal( vector a, vector b ) {
-	// TODO
-	float x = b.coord.x - a.coord.x;
-	float y = b.coord.y - a.coord.y;
-	vector normal = Vector( y, -x, 0.f, 0.f );
-	Normalize( &normal, &normal );
-	return normal;
-}
-
-// Using just X and Y
-bool line_intersect2d( vector point, vector dir, vector a, vector b ) {
-	if ( vector_equal( &a, &b )) {
-		// Degenerate triangle, so no intersection
-		return false;
-	}
-	vector normal = line_normal( a, b );
-	vector offset;
-	Sub( &offset, &a, &point );
-	float dir_dot_normal = Dot( &dir, &normal );
-	if ( f_eq (dir_dot_normal, 0.f )) {
-		return false;
-	}
-	float d = Dot( &offset, &normal ) / dir_dot_normal;
-	vector intersection;
-	vector_scale( &intersection, &dir, d ); 
-	Add( &intersection, &intersection, &point );
-	//printf( "dir_dot_normal: %.2f, intersection.z %.2f\n", dir_dot_normal, intersection.coord.z );
-	vAssert( f_eq( intersection.coord.z, 0.f ));
-
-
-	return false;
-}
-
-// Is a point inside the triangle
-bool point_insideTriangle( vector point, vector a, vector b, vector c ) {
-	// Extend a line from the point in one direction, count how many edges it crosses
-	// Odd number: inside
-	// Event number: outside
-	int intersections = 0;
-
-	//project onto the plane
-	point.coord.z = 0.f;
-	a.coord.z = 0.f;
-	b.coord.z = 0.f;
-	c.coord.z = 0.f;
-
-	vector ab, bc, ca;
-	Sub( &ab, &b, &b );
-	Sub( &bc, &c, &a );
-	Sub( &ca, &a, &c );
-
-	vector dir = Vector( 0.f, 1.f, 0.f, 0.f );
-	intersections += line_intersect2d( point, dir, a, b ) ? 1 : 0;
-	intersections += line_intersect2d( point, dir, b, c ) ? 1 : 0;
-	intersections += line_intersect2d( point, dir, c, a ) ? 1 : 0;
-
-	return (intersections % 2 ) == 1;
-}
-
-int line_intersectsTriangle( vector point, vector line, vector a, vector b, vector c ) {
-	vAssert( isNormalized( &line ));
-
-	// Calculate the plane of the 3 points
-	vector plane_normal;
-	float plane_d;
-	plane( a, b, c, &plane_normal, &plane_d );
-
-	float diff = plane_d - Dot( &point, &plane_normal );
-	float line_dot_normal = Dot( &line, &plane_normal );
-	// If the plane is parallel to the line, then return true if the point is on the plane
-	if ( f_eq( line_dot_normal, 0.f )) {
-		return f_eq( diff, 0.f );
-	}
-	vector intersection;
-	vector_scale( &intersection, &line, diff / line_dot_normal );
-	Add( &intersection, &intersection, &point );
-	
-	float d = Dot( &point, &line );
-	float d_intersect = Dot( &intersection, &line );
-
-	if ( d_intersect < d )
+bool collisionFunc_MeshMesh( shape* mesh_a, shape* mesh_b, matrix matrix_a, matrix matrix_b ) {
+	// There are 3 possible situations here
+	// 1. The meshes are not colliding at all
+	// 2. Some triangles of one mesh intersect the other
+	// 3. No triangles intersect, but one mesh is wholly inside the other
+	collisionMesh* a = mesh_a->collision_mesh;
+	collisionMesh* b = mesh_b->collision_mesh;
+	if ( a->vert_count == 0 || b->vert_count == 0 )
 		return false;
-	else {
-		// Test that the intersection is inside the triangle
-		return point_insideTriangle( point, a, b, c );
-	}
-}
-
-// Vert and Mesh must be in the same coordinate space now
-bool vertex_insideMesh( vector v, collisionMesh* m ) {
-	// Extend a line from the point in one direction, count how many polygons it crosses
-	// Odd number: inside
-	// Event number: outside
-	int intersections = 0;
-	for ( int i = 0; i < m->index_count; i = i+3 ) {
-		vector a = m->verts[m->indices[i+0]];
-		vector b = m->verts[m->indices[i+1]];
-		vector c = m->verts[m->indices[i+2]];
-		intersections += line_intersectsTriangle( v, y_axis, a, b, c );
-	}
-
-	return ( intersections % 2 ) == 1;
-}
-
-bool mesh_insideMesh( collisionMesh* mesh_a, collisionMesh* mesh_b, matrix matrix_a, matrix matrix_b ) {
-	// We build a combined matrix that translates verts from a-space into b-space
-	// So we can then do the collision tests purely in b-space
-	matrix a_space_to_b_space;
-	matrix inv_b;
-	matrix_inverse( inv_b, matrix_b );
-	matrix_mul( a_space_to_b_space, inv_b, matrix_a );
-
-	// Then test each vertex of MESH_A for whether it's wholly inside the other mesh
-	bool inside = false;
-	for ( int i = 0; !inside && ( i < mesh_a->vert_count ); ++i ) {
-		vector vert = matrix_vecMul( a_space_to_b_space, &mesh_a->verts[i] );
-		inside |= vertex_insideMesh( vert, mesh_b );
-	}
-	return inside;
-}
 
-bool mesh_intersectingMesh( collisionMesh* mesh_a, collisionMesh* mesh_b, matrix matrix_a, matrix matrix_b ) {
-	// We build a combined matrix that translates verts from a-space into b-space
-	// So we can then do the collision tests purely in b-space
-	matrix a_space_to_b_space;
+	// Do the tests in a-space
+	matrix b_to_a;
+	matrix inv_a;
+	matrix_inverse( inv_a, matrix_a );
+	matrix_mul( b_to_a, inv_a, matrix_b );
+	if ( collisionMesh_intersectsMesh( a, b, b_to_a ))
+		return true;
+
+	// With no intersections, a mesh is inside the other if any one of its vertices is
+	vector b_vert = matrix_vecMul( b_to_a, &b->verts[0] );
+	if ( collisionMesh_containsPoint( a, &b_vert ))
+		return true;
+	matrix a_to_b;
 	matrix inv_b;
 	matrix_inverse( inv_b, matrix_b );
-	matrix_mul( a_space_to_b_space, inv_b, matrix_a );
-
-	bool intersecting = false;
-	for ( int i = 0; !intersecting && i < mesh_a->index_count; i = i+3 ) {
-		vector a = matrix_vecMul( a_space_to_b_space, &mesh_a->verts[mesh_a->indices[i+0]]);
-		vector b = matrix_vecMul( a_space_to_b_space, &mesh_a->verts[mesh_a->indices[i+1]]);
-		vector c = matrix_vecMul( a_space_to_b_space, &mesh_a->verts[mesh_a->indices[i+2]]);
-		intersecting |= triangle_intersectingMesh( a, b, c, mesh_b );
-	}
-	return intersecting;
-}
-
-bool collisionFunc_MeshMesh( shape* mesh_a, shape* mesh_b, matrix matrix_a, matrix matrix_b ) {
-	// There are 3 possible situations here
-	// 1. The meshes are not colliding at all
-	// 2. At least one mesh has at least one vertex inside the other
-	// 3. No vertices are inside the other mesh, but there are intersecting edges/tris
-	printf( "MeshMesh! First mesh has %d verts, second has %d\n", mesh_a->collision_mesh->vert_count, mesh_b->collision_mesh->vert_count );
-	
-	bool colliding = false;
-	// Test each vertex to see if it's wholly inside the other mesh
-	// and vica versa
-	colliding |= mesh_insideMesh( mesh_a->collision_mesh, mesh_b->collision_mesh, matrix_a, matrix_b );
-	if ( !colliding ) {
-		colliding |= mesh_insideMesh( mesh_b->collision_mesh, mesh_a->collision_mesh, matrix_b, matrix_a );
-		if ( !colliding ) {
-			// Test for intersections of triangles (without intersecting vertices)
-			colliding |= mesh_intersectingMesh( mesh_b->collision_mesh, mesh_a->collision_mesh, matrix_b, matrix_a );
-		}
-	}
-	
-	return colliding;
+	matrix_mul( a_to_b, inv_b, matrix_a );
+	vector a_vert = matrix_vecMul( a_to_b, &a->verts[0] );
+	return collisionMesh_containsPoint( b, &a_vert );
 }
 
 bool collisionFunc_invalid( shape* a, shape* b, matrix matrix_a, matrix matrix_b ) {
@@ -353,7 +273,7 @@ bool body_colliding( body* a, body* b ) {
 	vAssert( b->trans );
 	bool test_collision =	( a->collide_with & b->layers ) |
 	   						( a->layers & b->collide_with );
-	return test_collision && shape_colliding( a->shape, b->shape, a->trans->world, b->trans->world );
+	return test_collision && shape_colliding( a->shape, b->shape, transform_world( a->trans ), transform_world( b->trans ) );
 }
 
 bool body_collided( body* b ) {
@@ -385,21 +305,390 @@ void vertexBuffer_asPositionsOnly( vector* verts, vertex* src_verts, int vert_co
 }
 */
 
+/*
+   Collision Mesh Trees
+
+   Each collision mesh has an AABB tree over its triangles, built once when the mesh is created.
+   Nodes are split at the spatial median of their triangles' centroids, along the longest axis,
+   until a node has few enough triangles to be a leaf. The mesh's index buffer is reordered so
+   every node's triangles are contiguous, so a leaf is just a range.
+
+   Queries are done in mesh space, walking the tree with a small explicit stack. Mesh against mesh
+   walks both trees together, transforming the other mesh's boxes into this mesh's space.
+   */
+
+#define kCollisionLeafTriangles 4
+#define kCollisionMaxTreeDepth 48
+
+typedef struct collisionBuildTriangle_s {
+	aabb		bounds;
+	vector		centroid;
+	uint16_t	indices[3];
+} collisionBuildTriangle;
+
+void aabb_grow( aabb* bb, const vector* p ) {
+	bb->min = vector_min( &bb->min, (vector*)p );
+	bb->max = vector_max( &bb->max, (vector*)p );
+}
+
+void aabb_setEmpty( aabb* bb ) {
+	bb->min = Vector( FLT_MAX, FLT_MAX, FLT_MAX, 1.f );
+	bb->max = Vector( -FLT_MAX, -FLT_MAX, -FLT_MAX, 1.f );
+}
+
+void collisionMesh_buildNode( collisionMesh* m, int node_index, collisionBuildTriangle* triangles, int first, int count, int depth ) {
+	collisionNode* node = &m->nodes[node_index];
+	aabb centroids;
+	aabb_setEmpty( &node->bounds );
+	aabb_setEmpty( &centroids );
+	for ( int i = first; i < first + count; i++ ) {
+		aabb_grow( &node->bounds, &triangles[i].bounds.min );
+		aabb_grow( &node->bounds, &triangles[i].bounds.max );
+		aabb_grow( &centroids, &triangles[i].centroid );
+	}
+
+	int axis = 0;
+	for ( int i = 1; i < 3; i++ )
+		if ( centroids.max.val[i] - centroids.min.val[i] > centroids.max.val[axis] - centroids.min.val[axis] )
+			axis = i;
+	float split = ( centroids.min.val[axis] + centroids.max.val[axis] ) * 0.5f;
+
+	if ( count <= kCollisionLeafTriangles || depth >= kCollisionMaxTreeDepth || centroids.max.val[axis] <= centroids.min.val[axis] ) {
+		node->first = first;
+		node->count = count;
+		return;
+	}
+
+	// Partition around the split; if everything lands on one side, just halve the range
+	int middle = first;
+	for ( int i = first; i < first + count; i++ ) {
+		if ( triangles[i].centroid.val[axis] < split ) {
+			collisionBuildTriangle swap = triangles[i];
+			triangles[i] = triangles[middle];
+			triangles[middle++] = swap;
+		}
+	}
+	if ( middle == first || middle == first + count )
+		middle = first + count / 2;
+
+	int children = m->node_count;
+	m->node_count += 2;
+	node->first = children;
+	node->count = 0;
+	collisionMesh_buildNode( m, children, triangles, first, middle - first, depth + 1 );
+	collisionMesh_buildNode( m, children + 1, triangles, middle, first + count - middle, depth + 1 );
+}
+
+void collisionMesh_buildTree( collisionMesh* m ) {
+	int triangle_count = m->index_count / 3;
+	m->node_count = 0;
+	m->nodes = NULL;
+	if ( triangle_count == 0 )
+		return;
+
+	collisionBuildTriangle* triangles = mem_alloc( sizeof( collisionBuildTriangle ) * triangle_count );
+	for ( int i = 0; i < triangle_count; i++ ) {
+		collisionBuildTriangle* t = &triangles[i];
+		aabb_setEmpty( &t->bounds );
+		t->centroid = Vector( 0.f, 0.f, 0.f, 1.f );
+		for ( int j = 0; j < 3; j++ ) {
+			t->indices[j] = m->indices[i * 3 + j];
+			const vector* v = &m->verts[t->indices[j]];
+			aabb_grow( &t->bounds, v );
+			t->centroid = vector_add( t->centroid, vector_scaled( *v, 1.f / 3.f ));
+		}
+		t->centroid.coord.w = 1.f;
+	}
+
+	// A binary tree with a triangle or more per leaf has fewer than 2n nodes
+	m->nodes = mem_alloc( sizeof( collisionNode ) * 2 * triangle_count );
+	m->node_count = 1;
+	collisionMesh_buildNode( m, 0, triangles, 0, triangle_count, 0 );
+
+	for ( int i = 0; i < triangle_count; i++ )
+		memcpy( &m->indices[i * 3], triangles[i].indices, sizeof( triangles[i].indices ));
+	mem_free( triangles );
+}
+
+// The verts of triangle [i], transformed by [m] (if not NULL)
+void collisionMesh_triangle( collisionMesh* mesh, int i, matrix m, vector* triangle ) {
+	for ( int j = 0; j < 3; j++ ) {
+		const vector* v = &mesh->verts[mesh->indices[i * 3 + j]];
+		triangle[j] = m ? matrix_vecMul( m, v ) : *v;
+	}
+}
+
+bool collisionMesh_intersectsSphere( collisionMesh* m, const vector* center, float radius ) {
+	if ( m->node_count == 0 )
+		return false;
+	const float radius_sq = radius * radius;
+	int stack[kCollisionMaxTreeDepth + 2];
+	int top = 0;
+	stack[top++] = 0;
+	while ( top > 0 ) {
+		collisionNode* node = &m->nodes[stack[--top]];
+		if ( aabb_distanceSq( &node->bounds, center ) > radius_sq )
+			continue;
+		if ( node->count == 0 ) {
+			stack[top++] = node->first;
+			stack[top++] = node->first + 1;
+			continue;
+		}
+		for ( int i = node->first; i < node->first + node->count; i++ ) {
+			vector t[3];
+			collisionMesh_triangle( m, i, NULL, t );
+			vector closest = triangle_closestPoint( center, &t[0], &t[1], &t[2] );
+			vector offset = vector_sub( closest, *center );
+			if ( Dot( &offset, &offset ) <= radius_sq )
+				return true;
+		}
+	}
+	return false;
+}
+
+// Casts a ray from the point; an odd number of crossings means inside
+// The ray is skewed off the axes so it doesn't run exactly along the edges of axis aligned
+// geometry, which would count one crossing twice
+bool collisionMesh_containsPoint( collisionMesh* m, const vector* point ) {
+	if ( m->node_count == 0 )
+		return false;
+	const vector dir = {{ 0.0137f, 0.9997f, 0.0211f, 0.f }};
+	int crossings = 0;
+	int stack[kCollisionMaxTreeDepth + 2];
+	int top = 0;
+	stack[top++] = 0;
+	while ( top > 0 ) {
+		collisionNode* node = &m->nodes[stack[--top]];
+		if ( !ray_intersectsAABB( point, &dir, &node->bounds, FLT_MAX ))
+			continue;
+		if ( node->count == 0 ) {
+			stack[top++] = node->first;
+			stack[top++] = node->first + 1;
+			continue;
+		}
+		for ( int i = node->first; i < node->first + node->count; i++ ) {
+			vector t[3];
+			float distance;
+			collisionMesh_triangle( m, i, NULL, t );
+			crossings += ray_intersectsTriangle( point, &dir, &t[0], &t[1], &t[2], &distance ) ? 1 : 0;
+		}
+	}
+	return ( crossings % 2 ) == 1;
+}
+
+float aabb_volume( const aabb* bb ) {
+	return ( bb->max.coord.x - bb->min.coord.x ) * ( bb->max.coord.y - bb->min.coord.y ) * ( bb->max.coord.z - bb->min.coord.z );
+}
+
+// Does any triangle of [b] intersect any triangle of [a]? [b_to_a] takes [b] into a-space
+bool collisionMesh_intersectsMesh( collisionMesh* a, collisionMesh* b, matrix b_to_a ) {
+	if ( a->node_count == 0 || b->node_count == 0 )
+		return false;
+	// Pairs of a-node, b-node
+	int stack[2 * ( 2 * kCollisionMaxTreeDepth + 2 )];
+	int top = 0;
+	stack[top++] = 0;
+	stack[top++] = 0;
+	while ( top > 0 ) {
+		collisionNode* node_b = &b->nodes[stack[--top]];
+		collisionNode* node_a = &a->nodes[stack[--top]];
+		aabb bounds_b;
+		aabb_transform( &bounds_b, &node_b->bounds, b_to_a );
+		if ( !aabb_intersects( &node_a->bounds, &bounds_b ))
+			continue;
+
+		if ( node_a->count > 0 && node_b->count > 0 ) {
+			for ( int j = node_b->first; j < node_b->first + node_b->count; j++ ) {
+				vector t_b[3];
+				collisionMesh_triangle( b, j, b_to_a, t_b );
+				for ( int i = node_a->first; i < node_a->first + node_a->count; i++ ) {
+					vector t_a[3];
+					collisionMesh_triangle( a, i, NULL, t_a );
+					if ( triangle_intersectsTriangle( t_a, t_b ))
+						return true;
+				}
+			}
+			continue;
+		}
+
+		// Descend into the bigger node (or the one that isn't a leaf)
+		bool split_a = node_b->count > 0 || ( node_a->count == 0 && aabb_volume( &node_a->bounds ) >= aabb_volume( &bounds_b ));
+		int node_index_b = node_b - b->nodes;
+		int node_index_a = node_a - a->nodes;
+		for ( int child = 0; child < 2; child++ ) {
+			stack[top++] = split_a ? node_a->first + child : node_index_a;
+			stack[top++] = split_a ? node_index_b : node_b->first + child;
+		}
+	}
+	return false;
+}
+
+// The nearest triangle hit by the ray from [origin] along [dir] within [max_t]
+// Gives the distance along [dir] and the triangle normal, facing back along the ray
+bool collisionMesh_raycast( collisionMesh* m, const vector* origin, const vector* dir, float max_t, float* t, vector* normal ) {
+	if ( m->node_count == 0 )
+		return false;
+	bool hit = false;
+	float best = max_t;
+	vector inv_dir = ray_inverseDirection( dir );
+	int stack[kCollisionMaxTreeDepth + 2];
+	int top = 0;
+	stack[top++] = 0;
+	while ( top > 0 ) {
+		collisionNode* node = &m->nodes[stack[--top]];
+		float enter, exit;
+		if ( !ray_clipAABBInverse( origin, &inv_dir, &node->bounds, best, &enter, &exit ))
+			continue;
+		if ( node->count == 0 ) {
+			stack[top++] = node->first;
+			stack[top++] = node->first + 1;
+			continue;
+		}
+		for ( int i = node->first; i < node->first + node->count; i++ ) {
+			vector tri[3];
+			float distance;
+			collisionMesh_triangle( m, i, NULL, tri );
+			if ( ray_intersectsTriangle( origin, dir, &tri[0], &tri[1], &tri[2], &distance ) && distance < best ) {
+				best = distance;
+				hit = true;
+				vector ab = vector_sub( tri[1], tri[0] );
+				vector ac = vector_sub( tri[2], tri[0] );
+				Cross( normal, &ab, &ac );
+			}
+		}
+	}
+	if ( !hit )
+		return false;
+	if ( Dot( normal, dir ) > 0.f )
+		*normal = vector_scaled( *normal, -1.f );
+	Normalize( normal, normal );
+	*t = best;
+	return true;
+}
+
+// The point on the mesh closest to [p], if there is one within [max_distance]
+bool collisionMesh_closestPoint( collisionMesh* m, const vector* p, float max_distance, vector* closest ) {
+	if ( m->node_count == 0 )
+		return false;
+	bool found = false;
+	float best_sq = max_distance * max_distance;
+	int stack[kCollisionMaxTreeDepth + 2];
+	int top = 0;
+	stack[top++] = 0;
+	while ( top > 0 ) {
+		collisionNode* node = &m->nodes[stack[--top]];
+		if ( aabb_distanceSq( &node->bounds, p ) > best_sq )
+			continue;
+		if ( node->count == 0 ) {
+			stack[top++] = node->first;
+			stack[top++] = node->first + 1;
+			continue;
+		}
+		for ( int i = node->first; i < node->first + node->count; i++ ) {
+			vector tri[3];
+			collisionMesh_triangle( m, i, NULL, tri );
+			vector point = triangle_closestPoint( p, &tri[0], &tri[1], &tri[2] );
+			vector offset = vector_sub( point, *p );
+			float distance_sq = Dot( &offset, &offset );
+			if ( distance_sq <= best_sq ) {
+				best_sq = distance_sq;
+				*closest = point;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+/*
+   A sphere cast walks the tree like a ray, against node bounds grown by the radius, and sweeps
+   the sphere against each triangle it reaches. The sweep is exact, so grazing contacts and thin
+   features are hit however far the sphere moves.
+   */
+bool collisionMesh_sphereCast( collisionMesh* m, const vector* origin, const vector* dir, float max_t, float radius, float* t, vector* normal ) {
+	if ( m->node_count == 0 )
+		return false;
+	bool hit = false;
+	float best = max_t;
+	vector hit_tri[3];
+	vector margin = Vector( radius, radius, radius, 0.f );
+	vector inv_dir = ray_inverseDirection( dir );
+	int stack[kCollisionMaxTreeDepth + 2];
+	int top = 0;
+	stack[top++] = 0;
+	while ( top > 0 ) {
+		collisionNode* node = &m->nodes[stack[--top]];
+		aabb bounds;
+		bounds.min = vector_sub( node->bounds.min, margin );
+		bounds.max = vector_add( node->bounds.max, margin );
+		float enter, exit;
+		if ( !ray_clipAABBInverse( origin, &inv_dir, &bounds, best, &enter, &exit ))
+			continue;
+		if ( node->count == 0 ) {
+			stack[top++] = node->first;
+			stack[top++] = node->first + 1;
+			continue;
+		}
+		for ( int i = node->first; i < node->first + node->count; i++ ) {
+			vector tri[3];
+			float distance;
+			collisionMesh_triangle( m, i, NULL, tri );
+			if ( sphere_sweepTriangle( origin, dir, radius, &tri[0], &tri[1], &tri[2], best, &distance ) && ( !hit || distance < best )) {
+				best = distance;
+				hit = true;
+				memcpy( hit_tri, tri, sizeof( hit_tri ));
+			}
+		}
+	}
+	if ( !hit )
+		return false;
+
+	// The normal points from the touching point to the sphere center
+	vector center = vector_add( *origin, vector_scaled( *dir, best ));
+	vector closest = triangle_closestPoint( &center, &hit_tri[0], &hit_tri[1], &hit_tri[2] );
+	vector offset = vector_sub( center, closest );
+	*normal = vector_scaled( *dir, -1.f );
+	if ( Dot( &offset, &offset ) > 1e-12f )
+		Normalize( normal, &offset );
+	*t = best;
+	return true;
+}
+
 collisionMesh* collisionMesh_fromRenderMesh( mesh* render_mesh ) {
 	collisionMesh* m = mem_alloc( sizeof( collisionMesh ));
 	m->vert_count = render_mesh->vert_count;
-	m->index_count = render_mesh->index_count;
 
 	// Allocate our buffers
 	m->verts = mem_alloc( sizeof( vector ) * m->vert_count );
-	m->indices = mem_alloc( sizeof( m->indices[0] ) * m->index_count );
+	m->indices = mem_alloc( sizeof( m->indices[0] ) * render_mesh->index_count );
 	
-	// Now fill them
-	memcpy( m->indices, render_mesh->indices, sizeof( m->indices[0] ) * m->index_count );
+	// Now fill them, skipping any triangle that indexes past the verts (some exported models have them)
+	m->index_count = 0;
+	for ( int i = 0; i + 2 < render_mesh->index_count; i += 3 ) {
+		const uint16_t* tri = &render_mesh->indices[i];
+		if ( tri[0] < m->vert_count && tri[1] < m->vert_count && tri[2] < m->vert_count ) {
+			m->indices[m->index_count++] = tri[0];
+			m->indices[m->index_count++] = tri[1];
+			m->indices[m->index_count++] = tri[2];
+		}
+	}
 	memcpy( m->verts, render_mesh->verts, sizeof( m->verts[0] ) * m->vert_count );
+	// These are positions, whatever the source had in w, so they transform with translation
+	for ( int i = 0; i < m->vert_count; i++ )
+		m->verts[i].coord.w = 1.f;
+
+	collisionMesh_buildTree( m );
 	return m;
 }
 
+void collisionMesh_delete( collisionMesh* m ) {
+	mem_free( m->verts );
+	mem_free( m->indices );
+	if ( m->nodes )
+		mem_free( m->nodes );
+	mem_free( m );
+}
+
 
 shape* mesh_createFromRenderMesh( mesh* render_mesh ) {
 	shape* s = mem_alloc( sizeof( shape ));
@@ -408,6 +697,184 @@ shape* mesh_createFromRenderMesh( mesh* render_mesh ) {
 	return s;
 }
 
+/*
+   Casts
+
+   The broadphase is built once per batch: the world space bounds of every body. Each cast
+   clips itself against those, then runs the narrowphase on the bodies it passes through in
+   order of entry, stopping once the next entry is further than the nearest hit so far.
+   */
+
+// The bodies that can be hit, with their bounds as arrays per axis so each cast's pass over them is a tight loop
+typedef struct collisionCastBodies_s {
+	int					count;
+	collision_layers_t	layers[kMaxCollidingBodies];
+	float				min[3][kMaxCollidingBodies];
+	float				max[3][kMaxCollidingBodies];
+	body*				b[kMaxCollidingBodies];
+	matrix				world_to_mesh[kMaxCollidingBodies];	// Mesh bodies only
+} collisionCastBodies;
+
+typedef struct collisionCastCandidate_s {
+	int		body;
+	float	enter;
+} collisionCastCandidate;
+
+// The world space bounds of every live body that can be hit
+void collision_castBodies( collisionCastBodies* cast_bodies ) {
+	cast_bodies->count = 0;
+	for ( int i = 0; i < body_count; ++i ) {
+		body* b = bodies[i];
+		if ( !b->trans || array_find( (void**)dead_bodies, dead_body_count, b ) >= 0 )
+			continue;
+		int index = cast_bodies->count;
+		aabb bounds;
+		if ( b->shape->type == shapeSphere ) {
+			vector center = matrix_vecMul( transform_world( b->trans ), &b->shape->origin );
+			vector extent = Vector( b->shape->radius, b->shape->radius, b->shape->radius, 0.f );
+			bounds.min = vector_sub( center, extent );
+			bounds.max = vector_add( center, extent );
+		}
+		else if ( b->shape->type == shapeMesh && b->shape->collision_mesh->node_count > 0 ) {
+			aabb_transform( &bounds, &b->shape->collision_mesh->nodes[0].bounds, transform_world( b->trans ));
+			matrix_inverse( cast_bodies->world_to_mesh[index], transform_world( b->trans ));
+		}
+		else
+			continue;
+		for ( int axis = 0; axis < 3; ++axis ) {
+			cast_bodies->min[axis][index] = bounds.min.val[axis];
+			cast_bodies->max[axis][index] = bounds.max.val[axis];
+		}
+		cast_bodies->layers[index] = b->layers;
+		cast_bodies->b[index] = b;
+		++cast_bodies->count;
+	}
+}
+
+// Cast against one body; gives the world space distance and normal of a hit
+bool collision_castBody( collisionCastBodies* cast_bodies, int index, const collisionCast* cast, float max_t, float* t, vector* normal ) {
+	body* b = cast_bodies->b[index];
+	shape* s = b->shape;
+	if ( s->type == shapeSphere ) {
+		vector center = matrix_vecMul( transform_world( b->trans ), &s->origin );
+		if ( !ray_intersectsSphere( &cast->origin, &cast->direction, &center, s->radius + cast->radius, t ) || *t > max_t )
+			return false;
+		vector offset = vector_sub( vector_add( cast->origin, vector_scaled( cast->direction, *t )), center );
+		*normal = vector_scaled( cast->direction, -1.f );
+		if ( Dot( &offset, &offset ) > 1e-12f )
+			Normalize( normal, &offset );
+		return true;
+	}
+
+	// Meshes are cast against in mesh space; distances along the direction are the same there
+	float (*inv)[4] = cast_bodies->world_to_mesh[index];
+	vector origin = cast->origin;
+	origin.coord.w = 1.f;
+	vector direction = cast->direction;
+	direction.coord.w = 0.f;
+	origin = matrix_vecMul( inv, &origin );
+	direction = matrix_vecMul( inv, &direction );
+	vector local_normal;
+	bool hit = false;
+	if ( cast->radius > 0.f ) {
+		vector scale_axis = Vector( inv[0][0], inv[0][1], inv[0][2], 0.f );
+		float radius = cast->radius * vector_length( &scale_axis );
+		hit = collisionMesh_sphereCast( s->collision_mesh, &origin, &direction, max_t, radius, t, &local_normal );
+	}
+	else
+		hit = collisionMesh_raycast( s->collision_mesh, &origin, &direction, max_t, t, &local_normal );
+	if ( !hit )
+		return false;
+	// Normals go back to world space by the inverse transpose
+	for ( int i = 0; i < 3; i++ )
+		normal->val[i] = inv[i][0] * local_normal.coord.x + inv[i][1] * local_normal.coord.y + inv[i][2] * local_normal.coord.z;
+	normal->coord.w = 0.f;
+	Normalize( normal, normal );
+	return true;
+}
+
+// The nearest hit for one cast
+bool collision_castOne( const collisionCast* cast, collisionCastBodies* cast_bodies, collisionHit* hit ) {
+	collisionCastCandidate candidates[kMaxCollidingBodies];
+	int candidate_count = 0;
+	const float radius = cast->radius;
+	const vector inv_dir = ray_inverseDirection( &cast->direction );
+	for ( int i = 0; i < cast_bodies->count; ++i ) {
+		if ( !( cast_bodies->layers[i] & cast->layers ))
+			continue;
+		// Slab test against the bounds grown by the cast radius
+		float enter = 0.f;
+		float exit = cast->length;
+		for ( int axis = 0; axis < 3; ++axis ) {
+			float t0 = ( cast_bodies->min[axis][i] - radius - cast->origin.val[axis] ) * inv_dir.val[axis];
+			float t1 = ( cast_bodies->max[axis][i] + radius - cast->origin.val[axis] ) * inv_dir.val[axis];
+			enter = maxf( enter, minf( t0, t1 ));
+			exit = minf( exit, maxf( t0, t1 ));
+		}
+		if ( enter > exit )
+			continue;
+		// Insertion sort by entry distance; there are only ever a few
+		int j = candidate_count++;
+		while ( j > 0 && candidates[j - 1].enter > enter ) {
+			candidates[j] = candidates[j - 1];
+			--j;
+		}
+		candidates[j].body = i;
+		candidates[j].enter = enter;
+	}
+
+	hit->b = NULL;
+	hit->distance = cast->length;
+	for ( int i = 0; i < candidate_count && candidates[i].enter <= hit->distance; ++i ) {
+		float t;
+		vector normal;
+		if ( collision_castBody( cast_bodies, candidates[i].body, cast, hit->distance, &t, &normal ) && t <= hit->distance ) {
+			hit->b = cast_bodies->b[candidates[i].body];
+			hit->distance = t;
+			hit->normal = normal;
+		}
+	}
+	if ( collision_terrain && ( cast->layers & kCollisionLayerTerrain )) {
+		float t;
+		vector normal;
+		if ( canyonTerrain_cast( collision_terrain, &cast->origin, &cast->direction, hit->distance, cast->radius, &t, &normal ) && t <= hit->distance ) {
+			hit->b = &collision_terrain_body;
+			hit->distance = t;
+			hit->normal = normal;
+		}
+	}
+
+	if ( !hit->b )
+		return false;
+	vector center = vector_add( cast->origin, vector_scaled( cast->direction, hit->distance ));
+	hit->point = vector_sub( center, vector_scaled( hit->normal, cast->radius ));
+	hit->point.coord.w = 1.f;
+	return true;
+}
+
+int collision_castBatch( int count, const collisionCast* casts, collisionHit* hits ) {
+	collisionCastBodies cast_bodies;
+	collision_castBodies( &cast_bodies );
+	int hit_count = 0;
+	for ( int i = 0; i < count; ++i )
+		hit_count += collision_castOne( &casts[i], &cast_bodies, &hits[i] );
+	return hit_count;
+}
+
+bool collision_sphereCast( const vector* origin, const vector* direction, float length, float radius, collision_layers_t layers, collisionHit* hit ) {
+	collisionCast cast;
+	cast.origin = *origin;
+	cast.direction = *direction;
+	cast.length = length;
+	cast.radius = radius;
+	cast.layers = layers;
+	return collision_castBatch( 1, &cast, hit ) > 0;
+}
+
+bool collision_raycast( const vector* origin, const vector* direction, float length, collision_layers_t layers, collisionHit* hit ) {
+	return collision_sphereCast( origin, direction, length, 0.f, layers, hit );
+}
+
 
 //
 //
@@ -537,6 +1004,10 @@ void shape_delete( shape* s ) {
 		vAssert( s->height_field );
 		mem_free( s->height_field );
 	}
+	if ( s->type == shapeMesh ) {
+		vAssert( s->collision_mesh );
+		collisionMesh_delete( s->collision_mesh );
+	}
 	mem_free( s );
 }
 
@@ -596,6 +1067,145 @@ void collision_init() {
 	collision_initCollisionFuncs();
 }
 
+// A mesh of the box from [min] to [max]
+collisionMesh* collisionMesh_createBox( vector min, vector max ) {
+	vector verts[8];
+	for ( int i = 0; i < 8; i++ )
+		verts[i] = Vector( ( i & 1 ) ? max.coord.x : min.coord.x, ( i & 2 ) ? max.coord.y : min.coord.y, ( i & 4 ) ? max.coord.z : min.coord.z, 1.f );
+	uint16_t indices[36] = {	0, 1, 3,  0, 3, 2,	4, 7, 5,  4, 6, 7,	// -z, +z
+								0, 4, 5,  0, 5, 1,	2, 3, 7,  2, 7, 6,	// -y, +y
+								0, 2, 6,  0, 6, 4,	1, 5, 7,  1, 7, 3 };	// -x, +x
+	mesh render_mesh;
+	memset( &render_mesh, 0, sizeof( render_mesh ));
+	render_mesh.vert_count = 8;
+	render_mesh.verts = verts;
+	render_mesh.index_count = 36;
+	render_mesh.indices = indices;
+	return collisionMesh_fromRenderMesh( &render_mesh );
+}
+
+// Every triangle against every triangle, for checking the tree
+bool collisionMesh_intersectsMeshBruteForce( collisionMesh* a, collisionMesh* b, matrix b_to_a ) {
+	for ( int j = 0; j < b->index_count / 3; j++ ) {
+		vector t_b[3];
+		collisionMesh_triangle( b, j, b_to_a, t_b );
+		for ( int i = 0; i < a->index_count / 3; i++ ) {
+			vector t_a[3];
+			collisionMesh_triangle( a, i, NULL, t_a );
+			if ( triangle_intersectsTriangle( t_a, t_b ))
+				return true;
+		}
+	}
+	return false;
+}
+
+void test_collisionMesh() {
+	collisionMesh* box = collisionMesh_createBox( Vector( -1.f, -1.f, -1.f, 1.f ), Vector( 1.f, 1.f, 1.f, 1.f ));
+	test( box->node_count > 1 && box->nodes[0].bounds.max.coord.x == 1.f, "Collision mesh tree built.", "Collision mesh tree not built." );
+
+	vector touching = Vector( 1.5f, 0.f, 0.f, 1.f );
+	vector apart = Vector( 2.5f, 0.f, 0.f, 1.f );
+	vector inside = Vector( 0.1f, 0.2f, 0.3f, 1.f );
+	test( collisionMesh_intersectsSphere( box, &touching, 0.6f ) && !collisionMesh_intersectsSphere( box, &apart, 0.6f ),
+			"Mesh-sphere surface test correct.", "Mesh-sphere surface test wrong." );
+	test( collisionMesh_containsPoint( box, &inside ) && !collisionMesh_containsPoint( box, &apart ),
+			"Mesh contains point correct.", "Mesh contains point wrong." );
+
+	// Through the shape functions, with transforms
+	shape box_shape = { .type = shapeMesh, .collision_mesh = box };
+	shape* sphere = sphere_create( 0.6f );
+	matrix m;
+	matrix_setIdentity( m );
+	matrix_setTranslation( m, &touching );
+	test( shape_colliding( &box_shape, sphere, matrix_identity, m ) && shape_colliding( sphere, &box_shape, m, matrix_identity ),
+			"Mesh and sphere collide.", "Mesh and sphere failed to collide." );
+	matrix_setTranslation( m, &apart );
+	test( !shape_colliding( &box_shape, sphere, matrix_identity, m ), "Mesh and sphere apart.", "Mesh and sphere collided when apart." );
+
+	collisionMesh* small = collisionMesh_createBox( Vector( -0.2f, -0.2f, -0.2f, 1.f ), Vector( 0.2f, 0.2f, 0.2f, 1.f ));
+	shape small_shape = { .type = shapeMesh, .collision_mesh = small };
+	matrix_setTranslation( m, &touching );
+	bool overlapping = shape_colliding( &box_shape, &small_shape, matrix_identity, m );
+	matrix_setTranslation( m, &apart );
+	bool separate = shape_colliding( &box_shape, &small_shape, matrix_identity, m );
+	bool contained = shape_colliding( &box_shape, &small_shape, matrix_identity, matrix_identity ) && shape_colliding( &small_shape, &box_shape, matrix_identity, matrix_identity );
+	vector edge = Vector( 1.1f, 0.f, 0.f, 1.f );
+	matrix_setTranslation( m, &edge );
+	bool crossing = shape_colliding( &box_shape, &small_shape, matrix_identity, m );
+	test( !overlapping && !separate && contained && crossing, "Mesh-mesh collisions correct.", "Mesh-mesh collisions wrong." );
+
+	// The tree agrees with testing every pair, for random placements
+	bool agree = true;
+	for ( int i = 0; i < 200; i++ ) {
+		vector position = Vector( frand( -1.5f, 1.5f ), frand( -1.5f, 1.5f ), frand( -1.5f, 1.5f ), 1.f );
+		matrix_setIdentity( m );
+		matrix_rotY( m, frand( 0.f, 2.f * PI ));
+		matrix_setTranslation( m, &position );
+		agree = agree && collisionMesh_intersectsMesh( box, small, m ) == collisionMesh_intersectsMeshBruteForce( box, small, m );
+	}
+	test( agree, "Collision mesh tree matches brute force.", "Collision mesh tree disagrees with brute force." );
+
+	mem_free( sphere );
+	collisionMesh_delete( box );
+	collisionMesh_delete( small );
+}
+
+// A body of [s] placed at [position], added to the collision system
+body* collision_testBody( shape* s, vector position, collision_layers_t layers ) {
+	matrix m;
+	matrix_setIdentity( m );
+	matrix_setTranslation( m, &position );
+	body* b = body_create( s, transform_create() );
+	transform_setWorldSpace( b->trans, m );
+	b->layers = layers;
+	collision_addBody( b );
+	return b;
+}
+
+void test_collisionCast() {
+	body* sphere = collision_testBody( sphere_create( 1.f ), Vector( 10.f, 0.f, 0.f, 1.f ), 0x1 );
+	shape box_shape = { .type = shapeMesh, .collision_mesh = collisionMesh_createBox( Vector( -1.f, -1.f, -1.f, 1.f ), Vector( 1.f, 1.f, 1.f, 1.f )) };
+	body* box = collision_testBody( &box_shape, Vector( 0.f, 0.f, 10.f, 1.f ), 0x2 );
+
+	vector origin = Vector( 0.f, 0.f, 0.f, 1.f );
+	collisionHit hit;
+	test( collision_raycast( &origin, &x_axis, 100.f, 0x1, &hit ) && hit.b == sphere && f_eq( hit.distance, 9.f ) && f_eq( hit.normal.coord.x, -1.f ),
+			"Raycast hit sphere.", "Raycast missed sphere." );
+	test( collision_raycast( &origin, &z_axis, 100.f, 0x2, &hit ) && hit.b == box && f_eq( hit.distance, 9.f ) && f_eq( hit.normal.coord.z, -1.f ),
+			"Raycast hit mesh.", "Raycast missed mesh." );
+	test( !collision_raycast( &origin, &z_axis, 100.f, 0x1, &hit ) && !collision_raycast( &origin, &z_axis, 5.f, 0x2, &hit ),
+			"Raycast ignores other layers and distant bodies.", "Raycast hit a masked or distant body." );
+	test( collision_sphereCast( &origin, &x_axis, 100.f, 0.5f, 0x3, &hit ) && hit.b == sphere && f_eq( hit.distance, 8.5f ) && f_eq( hit.point.coord.x, 9.f ),
+			"Sphere cast hit sphere.", "Sphere cast missed sphere." );
+	test( collision_sphereCast( &origin, &z_axis, 100.f, 0.5f, 0x3, &hit ) && hit.b == box && fabsf( hit.distance - 8.5f ) < 0.01f && hit.normal.coord.z < -0.99f,
+			"Sphere cast hit mesh.", "Sphere cast missed mesh." );
+	// Grazing the edge of the box, where the sphere only overlaps it along a short stretch
+	vector grazing = Vector( -10.f, 0.f, 8.6f, 1.f );
+	test( collision_sphereCast( &grazing, &x_axis, 100.f, 0.5f, 0x2, &hit ) && hit.b == box && fabsf( hit.distance - 8.7f ) < 0.001f &&
+			fabsf( hit.normal.coord.x + 0.6f ) < 0.001f && fabsf( hit.normal.coord.z + 0.8f ) < 0.001f,
+			"Sphere cast grazed mesh edge.", "Sphere cast missed mesh edge." );
+
+	// A batch finds the nearest hit of each cast
+	collisionCast casts[3] = {
+		{ .origin = origin, .direction = x_axis, .length = 100.f, .radius = 0.f, .layers = 0x3 },
+		{ .origin = Vector( 0.f, 0.f, 20.f, 1.f ), .direction = Vector( 0.f, 0.f, -1.f, 0.f ), .length = 100.f, .radius = 0.f, .layers = 0x3 },
+		{ .origin = origin, .direction = y_axis, .length = 100.f, .radius = 0.f, .layers = 0x3 } };
+	collisionHit hits[3];
+	int hit_count = collision_castBatch( 3, casts, hits );
+	test( hit_count == 2 && hits[0].b == sphere && hits[1].b == box && f_eq( hits[1].distance, 9.f ) && !hits[2].b,
+			"Batched casts found their hits.", "Batched casts were wrong." );
+
+	collision_removeBody( sphere );
+	collision_removeBody( box );
+	collision_removeDeadBodies();
+	transform_delete( sphere->trans );
+	transform_delete( box->trans );
+	shape_delete( sphere->shape );
+	collisionMesh_delete( box_shape.collision_mesh );
+	mem_free( sphere );
+	mem_free( box );
+}
+
 void test_collision() {
 	printf( "--- Beginning Unit Test: Collision ---\n" );
 	shape sphere_a;
@@ -660,4 +1270,92 @@ void test_collision() {
 	mem_free( body_c );
 
 	test_heightField();
+	test_collisionMesh();
+	test_collisionCast();
+}
+
+void benchmark_collision() {
+	collisionMesh* ship = collisionMesh_fromRenderMesh( model_load( "dat/model/ship_hd.s" )->meshes[0] );
+	collisionMesh* skyscraper = collisionMesh_fromRenderMesh( model_load( "dat/model/skyscraper.s" )->meshes[0] );
+	shape skyscraper_shape = { .type = shapeMesh, .collision_mesh = skyscraper };
+	shape* sphere = sphere_create( 2.f );
+
+	// The ship flies past, and through, the skyscraper
+	const aabb* bounds = &skyscraper->nodes[0].bounds;
+	vector center = vector_lerp( (vector*)&bounds->min, (vector*)&bounds->max, 0.5f );
+	vector extent = vector_sub( bounds->max, bounds->min );
+	const int count = 200;
+	matrix* placements = mem_alloc( sizeof( matrix ) * count );
+	for ( int i = 0; i < count; i++ ) {
+		vector position = vector_add( center, Vector( frand( -1.f, 1.f ) * extent.coord.x, frand( -0.5f, 0.5f ) * extent.coord.y, frand( -1.f, 1.f ) * extent.coord.z, 0.f ));
+		matrix_rotY( placements[i], frand( 0.f, 2.f * PI ));
+		matrix_setTranslation( placements[i], &position );
+	}
+
+	uint64_t start = timer_microseconds();
+	int tree_hits = 0;
+	for ( int i = 0; i < count; i++ )
+		tree_hits += collisionMesh_intersectsMesh( skyscraper, ship, placements[i] );
+	uint64_t tree = timer_microseconds() - start;
+
+	start = timer_microseconds();
+	int sphere_hits = 0;
+	for ( int i = 0; i < count; i++ )
+		sphere_hits += shape_colliding( &skyscraper_shape, sphere, matrix_identity, placements[i] );
+	uint64_t sphere_time = timer_microseconds() - start;
+
+	start = timer_microseconds();
+	int brute_hits = 0;
+	for ( int i = 0; i < count; i++ )
+		brute_hits += collisionMesh_intersectsMeshBruteForce( skyscraper, ship, placements[i] );
+	uint64_t brute = timer_microseconds() - start;
+
+	printf( "COLLISION: ship (%d triangles) vs skyscraper (%d triangles), %d placements. Tree: %.3fms (%d hits), every triangle pair: %.3fms (%d hits). Sphere vs skyscraper: %.3fms (%d hits).\n",
+			ship->index_count / 3, skyscraper->index_count / 3, count,
+			(float)tree / 1000.f, tree_hits, (float)brute / 1000.f, brute_hits, (float)sphere_time / 1000.f, sphere_hits );
+
+	mem_free( placements );
+
+	// Rays through a field of skyscrapers and ships
+	const int body_total = 64;
+	body* field[body_total];
+	for ( int i = 0; i < body_total; i++ ) {
+		vector position = Vector( frand( -200.f, 200.f ), frand( 0.f, 50.f ), frand( 0.f, 400.f ), 1.f );
+		field[i] = collision_testBody( ( i % 4 ) ? sphere : &skyscraper_shape, position, 0x1 );
+	}
+	const int ray_count = 4000;
+	collisionCast* casts = mem_alloc( sizeof( collisionCast ) * ray_count );
+	collisionHit* hits = mem_alloc( sizeof( collisionHit ) * ray_count );
+	for ( int i = 0; i < ray_count; i++ ) {
+		casts[i].origin = Vector( frand( -200.f, 200.f ), frand( 0.f, 50.f ), -50.f, 1.f );
+		casts[i].direction = normalized( Vector( frand( -0.2f, 0.2f ), frand( -0.1f, 0.1f ), 1.f, 0.f ));
+		casts[i].length = 500.f;
+		casts[i].radius = ( i % 2 ) ? 0.f : 1.f;
+		casts[i].layers = 0x1;
+	}
+
+	start = timer_microseconds();
+	int ray_hits = collision_castBatch( ray_count, casts, hits );
+	uint64_t batched = timer_microseconds() - start;
+
+	start = timer_microseconds();
+	int single_hits = 0;
+	for ( int i = 0; i < ray_count; i++ )
+		single_hits += collision_sphereCast( &casts[i].origin, &casts[i].direction, casts[i].length, casts[i].radius, casts[i].layers, &hits[i] );
+	uint64_t single = timer_microseconds() - start;
+
+	printf( "COLLISION: %d casts (half rays, half spheres) against %d bodies. Batched: %.3fms (%d hits), one at a time: %.3fms (%d hits).\n",
+			ray_count, body_total, (float)batched / 1000.f, ray_hits, (float)single / 1000.f, single_hits );
+
+	for ( int i = 0; i < body_total; i++ ) {
+		collision_removeBody( field[i] );
+		collision_removeDeadBodies();
+		transform_delete( field[i]->trans );
+		mem_free( field[i] );
+	}
+	mem_free( casts );
+	mem_free( hits );
+	mem_free( sphere );
+	collisionMesh_delete( ship );
+	collisionMesh_delete( skyscraper );
 }
@@ -4,6 +4,7 @@
 #define kMaxShapeTypes 4
 #define kMaxCollidingBodies 256
 
+#include "maths/geometry.h"
 #include "maths/maths.h"
 #include "maths/matrix.h"
 #include "maths/vector.h"
@@ -15,12 +16,23 @@ enum shapeType {
 	shapeHeightField
 };
 
+// A node of a collision mesh's bounding volume hierarchy
+// A leaf holds [count] triangles from triangle [first]; an interior node's children are
+// nodes [first] and [first] + 1
+typedef struct collisionNode_s {
+	aabb	bounds;
+	int		first;
+	int		count;	// 0 for interior nodes
+} collisionNode;
+
 // A full arbitrary collision mesh
 typedef struct collisionMesh_s {
 	vector* verts;	
 	int vert_count;
-	uint16_t* indices;
+	uint16_t* indices;	// Ordered so each leaf's triangles are contiguous
 	int index_count;
+	collisionNode*	nodes;	// nodes[0] is the root
+	int				node_count;
 } collisionMesh;
 
 // A mesh-shape defined by a heighfield - so underneath is always colliding
@@ -66,6 +78,22 @@ typedef struct collisionEvent_s {
 
 typedef bool (*collideFunc)( shape* a, shape* b, matrix matrix_a, matrix matrix_b );
 
+// A ray, or a sphere swept along a ray
+typedef struct collisionCast_s {
+	vector	origin;
+	vector	direction;	// Unit length
+	float	length;
+	float	radius;		// 0 for a ray
+	collision_layers_t layers;	// Only bodies on these layers are hit
+} collisionCast;
+
+typedef struct collisionHit_s {
+	body*	b;			// NULL if nothing was hit
+	float	distance;	// How far the cast travelled
+	vector	point;		// World space point of contact
+	vector	normal;		// World space surface normal at the contact
+} collisionHit;
+
 // Initialize the collision system
 void collision_init();
 
@@ -90,5 +118,29 @@ void heightField_delete( heightField* h );
 heightField* heightField_create( float width, float length, int x_samples, int z_samples);
 shape* shape_heightField_create( heightField* h );
 
+// Bodies on this layer collide with the canyon terrain
+#define kCollisionLayerTerrain 0x80
+
+// Spheres that collide with kCollisionLayerTerrain are tested against [t] each tick, in one batch
+// Their collision events have a shapeless terrain body as the other body
+void collision_setTerrain( canyonTerrain* t );
+
+// Casts against every body, and the terrain for casts on kCollisionLayerTerrain, finding the nearest hit
+// Terrain hits have the terrain body as their body
+bool collision_raycast( const vector* origin, const vector* direction, float length, collision_layers_t layers, collisionHit* hit );
+bool collision_sphereCast( const vector* origin, const vector* direction, float length, float radius, collision_layers_t layers, collisionHit* hit );
+// Run [count] casts together, writing each one's nearest hit to [hits]; returns how many hit something
+int collision_castBatch( int count, const collisionCast* casts, collisionHit* hits );
+
+// Mesh queries, in mesh space
+bool collisionMesh_intersectsSphere( collisionMesh* m, const vector* center, float radius );
+bool collisionMesh_intersectsMesh( collisionMesh* a, collisionMesh* b, matrix b_to_a );
+bool collisionMesh_containsPoint( collisionMesh* m, const vector* point );
+bool collisionMesh_raycast( collisionMesh* m, const vector* origin, const vector* dir, float max_t, float* t, vector* normal );
+bool collisionMesh_sphereCast( collisionMesh* m, const vector* origin, const vector* dir, float max_t, float radius, float* t, vector* normal );
+
 // Unit tests
 void test_collision();
+void test_collisionMesh();
+void test_collisionCast();
+void benchmark_collision();
@@ -3,8 +3,10 @@
 
 struct body_s;
 struct camera_s;
+struct canyonTerrain_s;
 struct debugtextframe_s;
 struct engine_s;
+struct font_s;
 struct heapAllocator_s;
 struct input_s;
 struct light_s;
@@ -15,6 +17,7 @@ struct mesh_s;
 struct particleEmitter_s;
 struct scene_s;
 struct shader_s;
+struct sizeClassAllocator_s;
 struct texture_s;
 struct transform_s;
 struct vertex_s;
@@ -24,8 +27,10 @@ union vector_u;
 
 typedef struct body_s body;
 typedef struct camera_s camera;
+typedef struct canyonTerrain_s canyonTerrain;
 typedef struct debugtextframe_s debugtextframe;
 typedef struct engine_s engine;
+typedef struct font_s font;
 typedef struct heapAllocator_s heapAllocator;
 typedef struct input_s input;
 typedef struct light_s light;
@@ -36,6 +41,7 @@ typedef struct mesh_s mesh;
 typedef struct particleEmitter_s particleEmitter;
 typedef struct scene_s scene;
 typedef struct shader_s shader;
+typedef struct sizeClassAllocator_s sizeClassAllocator;
 typedef struct texture_s texture;
 typedef struct transform_s transform;
 typedef struct vertex_s vertex;
@@ -3,8 +3,9 @@
 #include "common.h"
 #include "debugtext.h"
 //-----------------------
-#include "mem/allocator.h"
 #include "font.h"
+#include "maths/vector.h"
+#include "mem/allocator.h"
 
 void PrintDebugText( debugtextframe* frame, const char* string ) {
 	assert( strlen(string) < kDebugTextLineLength );
@@ -22,21 +23,24 @@ debugtextframe* debugtextframe_create( float x, float y, float lineHeight) {
 	return f;
 }
 
-void debugtextframe_tick( void* entity, float dt ) {
+void debugtextframe_tick( void* entity, float dt, engine* eng ) {
+	(void)entity;
+	(void)dt;
+	(void)eng;
 }
 
+// Lines are added to the frame's text batch; they're drawn when the batch is flushed
 void debugtextframe_render( void* entity ) {
-	assert( 0 );
-	glEnable(GL_TEXTURE_2D);
-
 	debugtextframe* f = (debugtextframe*)entity;
+	if ( !font_debug )
+		return;
+	const vector color = Vector( 1.f, 1.f, 1.f, 1.f );
 	float x = f->x;
-	float y = f->y;
+	// The frame is positioned from the top of the screen, text from the bottom
+	float y = kTextScreenHeight - f->y - f->lineHeight;
 	for ( int i = 0; i < f->lineCount; i++) {
-//		printf( "debugtext rendering: %d \"%s\"\n", i, f->lines[i] );
-		font_renderString( x, y, f->lines[i] );
-		y += f->lineHeight;
+		font_renderString( font_debug, x, y, color, f->lines[i] );
+		y -= f->lineHeight;
 	}
 	f->lineCount = 0;
-	glDisable(GL_TEXTURE_2D);
 }
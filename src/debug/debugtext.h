@@ -15,6 +15,6 @@ void PrintDebugText( debugtextframe* frame, const char* string );
 
 debugtextframe* debugtextframe_create( float x, float y, float lineHeight);
 
-void debugtextframe_tick( void* f, float dt );
+void debugtextframe_tick( void* f, float dt, engine* eng );
 
 void debugtextframe_render( void* entity );
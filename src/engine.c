@@ -12,11 +12,13 @@
 #include "maths/maths.h"
 #include "model.h"
 #include "particle.h"
+#include "physic.h"
 #include "scene.h"
 #include "skybox.h"
 #include "terrain.h"
 #include "transform.h"
 #include "worker.h"
+#include "camera/chasecam.h"
 #include "camera/flycam.h"
 #include "debug/debug.h"
 #include "debug/debugtext.h"
@@ -37,8 +39,6 @@
 // System Libraries
 #include <stdlib.h>
 
-IMPLEMENT_LIST(delegate)
-
 // System libraries
 
 // *** Static Hacks
@@ -50,8 +50,11 @@ canyonTerrain* theCanyonTerrain = NULL;
 xwindow xwindow_main = { NULL, 0x0, false };
 #endif
 
+// The frame's tick schedule
+tickGraph engine_tick_graph;
+
 // Function Declarations
-void engine_tickTickers( engine* e, float dt );
+void engine_tickTickers( engine* e, tickGraph* g );
 void engine_renderRenders( engine* e );
 void engine_inputInputs( engine* e );
 void engine_addTicker( engine* e, void* entity, tickfunc tick );
@@ -63,12 +66,9 @@ void engine_addTicker( engine* e, void* entity, tickfunc tick );
  */
 
 void test_engine_init( engine* e ) {
-#if 0
 	debugtextframe* f = debugtextframe_create( 10.f, 10.f, 20.f );
-	engine_addTicker( e, (void*)f, debugtextframe_tick );
 	engine_addRender( e, (void*)f, debugtextframe_render );
 	e->debugtext = f;
-#endif
 	
 
 	theScene = test_scene_init( e );
@@ -94,6 +94,7 @@ void test_engine_init( engine* e ) {
 		canyonTerrain* t = canyonTerrain_create( 5, 5 );
 		startTick( e, (void*)t, canyonTerrain_tick );
 		engine_addRender( e, (void*)t, canyonTerrain_render );
+		collision_setTerrain( t );
 		theCanyonTerrain = t;
 	}
 
@@ -121,26 +122,93 @@ void engine_input( engine* e ) {
 float frame_times[10];
 
 void countVisibleParticleEmitters( engine* e ) {
-	int count = 0;
-	delegatelist* d_list = e->renders;
-	while ( d_list ) {
-		if ( d_list->head->tick == particleEmitter_render) {
-			count += d_list->head->count;
-		}
-		d_list = d_list->tail;
-	}
+	delegate* d = delegateSet_find( &e->renders, particleEmitter_render );
+	int count = d ? d->count : 0;
 	printf( "Visible particle emitters: %d.\n", count );
 }
 void countActiveParticleEmitters( engine* e ) {
-	int count = 0;
-	delegatelist* d_list = e->tickers;
-	while ( d_list ) {
-		if ( d_list->head->tick == particleEmitter_tick) {
-			count += d_list->head->count;
+	delegate* d = delegateSet_find( &e->tickers, particleEmitter_tick );
+	int count = d ? d->count : 0;
+	printf( "Active particle emitters: %d.\n", count );
+}
+
+// Engine systems, wrapped as tick functions so they are scheduled along with the delegates
+void engine_luaPreTick( void* data, float dt, engine* e ) {
+	(void)data;
+	lua_preTick( e->lua, dt );
+}
+
+void engine_inputTick( void* data, float dt, engine* e ) {
+	(void)data;
+	input_tick( e->input, dt );
+}
+
+void engine_sceneTick( void* data, float dt, engine* e ) {
+	(void)e;
+	scene_tick( data, dt );
+}
+
+void engine_collisionTick( void* data, float dt, engine* e ) {
+	(void)data;
+	(void)e;
+	collision_tick( dt );
+}
+
+// Declare what each tick function touches, so the tick graph knows what can run together
+void engine_declareTicks() {
+	// Steps the Lua state, and scripts reach everything through the bindings, so run it alone
+	tick_declare( engine_luaPreTick,	kTickAccessAll,			kTickAccessAll,			kTickMainThread );
+	tick_declare( engine_inputTick,		0,						kTickAccessInput,		0 );
+	// Resolving models creates transforms and emitters
+	tick_declare( engine_sceneTick,		0,						kTickAccessScene | kTickAccessTransforms | kTickAccessDebugDraw, 0 );
+	// Collision callbacks can run any Lua
+	tick_declare( engine_collisionTick,	kTickAccessAll,			kTickAccessAll,			kTickMainThread );
+
+	// Moves from its own world position
+	tick_declare( physic_tick,			kTickAccessTransforms,	kTickAccessTransforms,	0 );
+	// Follows its target's world transform
+	tick_declare( chasecam_tick,		kTickAccessTransforms,	kTickAccessTransforms,	0 );
+	// Applies the transform built from this frame's input
+	tick_declare( flycam_tick,			kTickAccessInput | kTickAccessTransforms,	kTickAccessTransforms,	0 );
+	tick_declare( particleEmitter_tick,	kTickAccessTransforms,	0,						kTickParallel );
+	tick_declare( terrain_tick,			0,						kTickAccessTerrain,		0 );
+	tick_declare( canyonTerrain_tick,	0,						kTickAccessTerrain,		0 );
+	tick_declare( dynamicFog_tick,		0,						kTickAccessScene,		0 );
+}
+
+// Apply the delegate list changes requested while ticking
+void engine_applyDeferred( engine* e ) {
+	// Entries stopped while ticking were cleared in place
+	for ( int i = 0; i < e->tickers.count; i++ )
+		delegate_compact( e->tickers.delegates[i] );
+
+	// New delegates can be added from here, so apply these as normal
+	e->ticking = false;
+	for ( int i = 0; i < e->deferred_count; i++ ) {
+		engineChange* c = &e->deferred[i];
+		switch ( c->type ) {
+			case kEngineStartTick:		startTick( e, c->entity, (tickfunc)c->func ); break;
+			case kEngineStopTick:		stopTick( e, c->entity, (tickfunc)c->func ); break;
+			case kEngineAddRender:		engine_addRender( e, c->entity, (renderfunc)c->func ); break;
+			case kEngineRemoveRender:	engine_removeRender( e, c->entity, (renderfunc)c->func ); break;
+			case kEngineStartInput:		startInput( e, c->entity, (inputfunc)c->func ); break;
 		}
-		d_list = d_list->tail;
 	}
-	printf( "Active particle emitters: %d.\n", count );
+	e->deferred_count = 0;
+}
+
+// Returns true if the change was deferred, to be applied after the tick
+bool engine_deferChange( engine* e, enum engineChangeType type, void* entity, void* func ) {
+	if ( !e->ticking )
+		return false;
+	vmutex_lock( &e->deferred_lock );
+	vAssert( e->deferred_count < kMaxDeferredChanges );
+	engineChange* c = &e->deferred[e->deferred_count++];
+	c->type = type;
+	c->entity = entity;
+	c->func = func;
+	vmutex_unlock( &e->deferred_lock );
+	return true;
 }
 
 // tick - process a frame of game update
@@ -160,13 +228,24 @@ void engine_tick( engine* e ) {
 	printf( "TICK: frametime %.4fms (%.2f fps)\n", time, 1.f/time );
 
 	debugdraw_preTick( dt );
-	lua_preTick( e->lua, dt );
 
-	input_tick( e->input, dt );
-	scene_tick( theScene, dt );
-	collision_tick( dt );
+	// Build this frame's tick graph; engine systems come first, then the delegates
+	tickGraph* g = &engine_tick_graph;
+	tickGraph_reset( g );
+	void* engine_entity[1] = { e };
+	void* scene_entity[1] = { theScene };
+	tickGraph_addEntities( g, tickGraph_addSystem( g, engine_luaPreTick ), engine_entity, 1 );
+	tickGraph_addEntities( g, tickGraph_addSystem( g, engine_inputTick ), engine_entity, 1 );
+	tickGraph_addEntities( g, tickGraph_addSystem( g, engine_sceneTick ), scene_entity, 1 );
+	tickGraph_addEntities( g, tickGraph_addSystem( g, engine_collisionTick ), engine_entity, 1 );
+	engine_tickTickers( e, g );
+
+	e->ticking = true;
+	tickGraph_run( g, dt, e );
+	engine_applyDeferred( e );
 
-	engine_tickTickers( e, dt );
+	// Script timers fire after the other ticks, before the script's own tick
+	lua_timersTick( e->lua, dt );
 
 	//countVisibleParticleEmitters( e );
 	//countActiveParticleEmitters( e );
@@ -185,8 +264,8 @@ void engine_tick( engine* e ) {
 	}
 
 	vector v = Vector( 0.0, 0.0, 30.0, 1.0 );
-	theCanyonTerrain->sample_point = matrix_vecMul( theScene->cam->trans->world, &v );
-	//const vector* camera_position = matrix_getTranslation( theScene->cam->trans->world );
+	theCanyonTerrain->sample_point = matrix_vecMul( transform_world( theScene->cam->trans ), &v );
+	//const vector* camera_position = matrix_getTranslation( transform_world( theScene->cam->trans ) );
 	//canyon_seekForWorldPosition( *camera_position );
 	canyon_seekForWorldPosition( theCanyonTerrain->sample_point );
 	PROFILE_END( PROFILE_ENGINE_TICK );
@@ -227,9 +306,10 @@ engine* engine_create() {
 	e->callbacks = luaInterface_create();
 	e->onTick = luaInterface_addCallback(e->callbacks, "onTick");
 	e->input = input_create();
-	e->tickers = NULL;
-	e->inputs = NULL;
-	e->renders = NULL;
+	delegateSet_init( &e->tickers );
+	delegateSet_init( &e->inputs );
+	delegateSet_init( &e->renders );
+	vmutex_init( &e->deferred_lock );
 	return e;
 }
 
@@ -263,7 +343,7 @@ void engine_init(engine* e, int argc, char** argv) {
 
 	// *** Start up Core Systems
 	particle_init();
-	//font_init();
+	font_init();
 
 	// *** Initialise Lua
 	engine_initLua(e, argc, argv);
@@ -275,6 +355,8 @@ void engine_init(engine* e, int argc, char** argv) {
 
 	vthread worker_thread = vthread_create( worker_threadFunc, NULL );
 	(void)worker_thread;
+	worker_initFrameWorkers();
+	engine_declareTicks();
 
 	// TEST
 	test_engine_init( e );
@@ -287,8 +369,10 @@ void init(int argc, char** argv) {
 	// *** Initialise Memory
 	mem_init( argc, argv );
 	// Pools
-	transform_initPool();
+	transform_initStorage();
 	modelInstance_initPool();
+	particleEmitter_initPool();
+	physic_initPool();
 
 	// *** Static Module initialization
 	scene_initStatic();
@@ -300,6 +384,8 @@ void init(int argc, char** argv) {
 // terminateLua - terminates the Lua interpreter
 void engine_terminateLua(engine* e) {
 	lua_close(e->lua);
+	sizeClass_delete( lua_allocator );
+	lua_allocator = NULL;
 }
 
 // terminate - terminates (De-initialises) the engine
@@ -313,9 +399,22 @@ void engine_terminate(engine* e) {
 	exit(0);
 }
 
-void engine_waitForRenderThread() {
+// Lua garbage collection is done here, while the render thread is busy, up to this budget
+#define kLuaGCIdleBudgetUs 2000
+
+void engine_waitForRenderThread( engine* e ) {
 	PROFILE_BEGIN( PROFILE_ENGINE_WAIT );
-	vthread_waitCondition( finished_render );
+	unsigned long long start = timer_microseconds();
+	// Always step at least once, so garbage can't build up when there is no idle time
+	bool collecting = lua_gcStep( e->lua );
+	bool rendered = vthread_testCondition( finished_render );
+	while ( collecting && !rendered && timer_microseconds() - start < kLuaGCIdleBudgetUs ) {
+		collecting = lua_gcStep( e->lua );
+		rendered = vthread_testCondition( finished_render );
+	}
+	lua_gcNewFrame();
+	if ( !rendered )
+		vthread_waitCondition( finished_render );
 	PROFILE_END( PROFILE_ENGINE_WAIT );
 }
 
@@ -327,6 +426,13 @@ void engine_render( engine* e ) {
 	{
 		render( theScene );
 		engine_renderRenders( e );
+		renderCullStats* cull = &render_cull_stats;
+		printf( "CULL: models %d/%d, terrain blocks %d/%d, emitters %d/%d submitted\n",
+				cull->models.submitted, cull->models.submitted + cull->models.culled,
+				cull->terrain_blocks.submitted, cull->terrain_blocks.submitted + cull->terrain_blocks.culled,
+				cull->emitters.submitted, cull->emitters.submitted + cull->emitters.culled );
+		debugdraw_flush();
+		font_flush();
 		skybox_render( NULL );
 	}
 
@@ -410,7 +516,7 @@ void engine_run(engine* e) {
 		if ( active ) {
 			engine_input( e );
 			engine_tick( e );
-			engine_waitForRenderThread();
+			engine_waitForRenderThread( e );
 			engine_render( e );
 			e->running = e->running && !input_keyPressed( e->input, KEY_ESC );
 		}
@@ -431,134 +537,67 @@ void engine_run(engine* e) {
 #endif
 }
 
-// Run through all the delegates, ticking each of them
-void engine_tickTickers( engine* e, float dt ) {
-	delegatelist* d = e->tickers;
-	while (d != NULL) {
-		assert( d->head );	// Should never be NULL heads
-		delegate_tick( d->head, dt, e ); // tick the whole of this delegate
-		d = d->tail;
+// Schedule all the delegates
+void engine_tickTickers( engine* e, tickGraph* g ) {
+	for ( int i = 0; i < e->tickers.count; i++ ) {
+		delegate* d = e->tickers.delegates[i];
+		if ( d->count > 0 )
+			tickGraph_addEntities( g, tickGraph_addSystem( g, d->tick ), d->data, d->count );
 	}
 }
 
 void engine_renderRenders( engine* e ) {
-	delegatelist* d = e->renders;
-	while (d != NULL) {
-		assert( d->head );	// Should never be NULL heads
-		delegate_render( d->head ); // render the whole of this delegate
-		d = d->tail;
-	}
+	for ( int i = 0; i < e->renders.count; i++ )
+		delegate_render( e->renders.delegates[i] ); // render the whole of this delegate
 }
 
 void engine_inputInputs( engine* e ) {
-	delegatelist* d = e->inputs;
-	while ( d != NULL ) {
-		assert( d->head );	// Should never be NULL heads
-		delegate_input( d->head, e->input ); // render the whole of this delegate
-		d = d->tail;
-	}
-}
-
-// Search the list of delegates for one with the matching tick func
-// and space to add a new entry
-delegate* engine_findDelegate( delegatelist* d, void* func ) {
-	while ( d != NULL ) {
-		if ( d->head->tick == func && !delegate_isFull(d->head) ) {
-			return d->head;
-		}
-		d = d->tail;
-	}
-	return NULL;
-}
-
-delegate* engine_findTickDelegate( engine* e, tickfunc tick ) {
-	return engine_findDelegate( e->tickers, tick );
-}
-
-delegate* engine_findRenderDelegate( engine* e, renderfunc render ) {
-	return engine_findDelegate( e->renders, render );
-}
-
-delegate* engine_findInputDelegate( engine* e, inputfunc in ) {
-	return engine_findDelegate( e->inputs, in );
+	for ( int i = 0; i < e->inputs.count; i++ )
+		delegate_input( e->inputs.delegates[i], e->input );
 }
-// Add a new delegate to the delegatelist
-// (a delegate is a list of entities to all receive the same tick function)
-// (the delegatelist contains all the delegates, ie. for each different tick function)
 
-
-delegate* engine_addDelegate( delegatelist** d, void* func ) {
-	delegatelist* dl = *d;
-	if ( !*d ) {
-//		*d = mem_alloc( sizeof( delegatelist ));
-		*d = delegatelist_create();
-		dl = *d;
-	}
-	else {
-		while ( dl->tail != NULL)
-			dl = dl->tail;
-		dl->tail = delegatelist_create();
-		dl = dl->tail;
-	}
-	dl->tail = NULL;
-	dl->head = delegate_create( func, kDefaultDelegateSize );
-	return dl->head;
-}
-
-delegate* engine_addTickDelegate( engine* e, tickfunc tick ) {
-	return engine_addDelegate( &e->tickers, tick );
-}
-
-delegate* engine_addRenderDelegate( engine* e, renderfunc render ) {
-	return engine_addDelegate( &e->renders, render );
-}
-
-delegate* engine_addInputDelegate( engine* e, inputfunc in ) {
-	return engine_addDelegate( &e->inputs, in );
-}
-
-// Look for a delegate of the right type to add this entity too
-// If one is not found, create one
 void engine_addTicker( engine* e, void* entity, tickfunc tick ) {
-	delegate* d = engine_findTickDelegate( e, tick );
-	if ( !d )
-		d = engine_addTickDelegate( e, tick );
-	delegate_add( d, entity);
+	delegate_add( delegateSet_findOrAdd( &e->tickers, tick ), entity );
 }
 
-void engine_removeDelegateEntry( delegatelist* d, void* entity, void* delegate_func ) {
-	delegatelist* d_list = d;
-	while ( d_list ) {
-		if ( d_list->head->tick == delegate_func ) {
-			delegate_remove( d_list->head, entity );
-		}
-		d_list = d_list->tail;
-	}
+void engine_removeDelegateEntry( delegateSet* s, void* entity, void* delegate_func ) {
+	delegate* d = delegateSet_find( s, delegate_func );
+	if ( d )
+		delegate_remove( d, entity );
 }
 
 void startTick( engine* e, void* entity, tickfunc tick ) {
+	if ( engine_deferChange( e, kEngineStartTick, entity, tick ))
+		return;
 	engine_addTicker( e, entity, tick );
 }
 void stopTick( engine* e, void* entity, tickfunc tick ) {
-	engine_removeDelegateEntry( e->tickers, entity, tick );
+	if ( engine_deferChange( e, kEngineStopTick, entity, tick )) {
+		// Stop it ticking straight away, without disturbing ticks in progress
+		delegate* d = delegateSet_find( &e->tickers, tick );
+		if ( d )
+			delegate_clear( d, entity );
+		return;
+	}
+	engine_removeDelegateEntry( &e->tickers, entity, tick );
 }
 
 void startInput( engine* e, void* entity, inputfunc in ) {
-	delegate* d = engine_findInputDelegate( e, in );
-	if ( !d )
-		d = engine_addInputDelegate( e, in );
-	delegate_add( d, entity);
+	if ( engine_deferChange( e, kEngineStartInput, entity, in ))
+		return;
+	delegate_add( delegateSet_findOrAdd( &e->inputs, in ), entity );
 }
 
 void engine_addRender( engine* e, void* entity, renderfunc render ) {
-	delegate* d = engine_findRenderDelegate( e, render );
-	if ( !d )
-		d = engine_addRenderDelegate( e, render );
-	delegate_add( d, entity );
+	if ( engine_deferChange( e, kEngineAddRender, entity, render ))
+		return;
+	delegate_add( delegateSet_findOrAdd( &e->renders, render ), entity );
 }
 
 void engine_removeRender( engine* e, void* entity, renderfunc render ) {
-	engine_removeDelegateEntry( e->renders, entity, render );
+	if ( engine_deferChange( e, kEngineRemoveRender, entity, render ))
+		return;
+	engine_removeDelegateEntry( &e->renders, entity, render );
 }
 
 
@@ -5,6 +5,7 @@
 #include "lua.h"
 #include "ticker.h"
 #include "vtime.h"
+#include "system/thread.h"
 
 #ifdef ANDROID
 // Android Libraries
@@ -29,8 +30,22 @@ extern float depth;
 
 extern int threadsignal_render;
 
-DEF_LIST(delegate)
-#define kDefaultDelegateSize 16
+#define kMaxDeferredChanges 256
+
+// Changes to the delegate lists requested while ticking, applied once the tick is done
+enum engineChangeType {
+	kEngineStartTick,
+	kEngineStopTick,
+	kEngineAddRender,
+	kEngineRemoveRender,
+	kEngineStartInput
+};
+
+typedef struct engineChange_s {
+	enum engineChangeType	type;
+	void*					entity;
+	void*					func;
+} engineChange;
 
 #ifdef ANDROID
 typedef struct egl_renderer_s {
@@ -63,9 +78,15 @@ struct engine_s {
 	luaInterface* callbacks;		//!< Lua Interface for callbacks from the engine
 	luaCallback* onTick;			//!< OnTick event handler
 
-	delegatelist* tickers;	
-	delegatelist* renders;
-	delegatelist* inputs;
+	delegateSet tickers;
+	delegateSet renders;
+	delegateSet inputs;
+
+	// While ticking, the delegate lists are only changed at the end of the tick
+	bool			ticking;
+	engineChange	deferred[kMaxDeferredChanges];
+	int				deferred_count;
+	vmutex			deferred_lock;
 
 	debugtextframe* debugtext;
 
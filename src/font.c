@@ -4,204 +4,274 @@
 #include "font.h"
 //-----------------------
 #include "maths/maths.h"
-#include "external/util.h"
-#include "render/debugdraw.h"
+#include "maths/matrix.h"
+#include "maths/vector.h"
+#include "mem/allocator.h"
+#include "render/render.h"
+#include "render/texture.h"
 #include "system/file.h"
+#include "system/hash.h"
+#include "system/string.h"
 
 // *** The stb TrueType library
+// It doesn't build cleanly with our warning flags, so quieten those for it
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#pragma GCC diagnostic ignored "-Warray-bounds"
 #define STB_TRUETYPE_IMPLEMENTATION
 #include  "3rdparty/stbTrueType/stb_truetype.h"
-
-unsigned char ttf_buffer[1<<25];
-  
-#define CHAR_COUNT 256
-#define ASCII_SPACE 0x20
-#define SPACE_WIDTH 8
-
-vglTexture g_glyph[CHAR_COUNT];
-vglTexture g_atlas;
-vector g_glyphUV[CHAR_COUNT];
-vector g_glyphSize[CHAR_COUNT];
-float xmargin;
-
-stbtt_fontinfo font;
+#pragma GCC diagnostic pop
 
 #define FONT_PATH "dat/font/DroidSans.ttf"
+#define kFontDebugHeight 16.f
+#define kFontAtlasPadding 1
 
-// Test init function, based on the main func in the complete program implementation of stb TrueType ((C) Sean Barrett 2009)
-void font_init() {
-	vfont_loadTTF( FONT_PATH );
-}
+font* font_debug = NULL;
 
-// Load a TrueTypeFont into the font engine
-// This allocates texture(s) for the glyphs
-// And computes the glyphs
-void vfont_loadTTF( String path ) {
-	// *** load the ttf file
-	FILE* fontfile = vfile_open( path, "rb" );
-	int ret = fread(ttf_buffer, 1, 1<<25, fontfile);
-	(void)ret;
-
-	// *** init the tt system and extract font data
-	stbtt_InitFont(&font, ttf_buffer, stbtt_GetFontOffsetForIndex(ttf_buffer,0));
-
-#define ATLAS_W 256
-#define ATLAS_H 256
-#define ATLAS_ROWS 12
-#define MAX_ROW_HEIGHT 20
-	ubyte font_atlas[ATLAS_H][ATLAS_W];		// Image to atlas all glyph textures into
-	u32 row_height[ATLAS_ROWS];				// height of glyph row
-	u32 row_width[ATLAS_ROWS];				// Current width of glyph row
-	u32 row_start[ATLAS_ROWS];				// tex-Y coordinate each glyph row starts
-	memset( font_atlas, 0, ATLAS_H * ATLAS_W );
-	memset( row_height, 0, ATLAS_ROWS * 4 );
-	memset( row_width, 0, ATLAS_ROWS * 4 );
-	memset( row_start, 0, ATLAS_ROWS * 4 );
-	
-	row_height[0] = 20;
-	row_start[0] = 0;
-	row_height[1] = 16;
-	row_start[1] = 20;
-	row_height[2] = 8;
-	row_start[2] = 36;
-
-	for (unsigned char ch = 0; ch < 255; ch++) {
-		// *** extract a bitmap
-		int w,h,scale;
-		scale = 20;
-		unsigned char *bitmap;
-		bitmap = stbtt_GetCodepointBitmap( &font, 0,stbtt_ScaleForPixelHeight(&font, scale), ch, &w, &h, 0, 0 );
-
-		//printf( "Looking to atlas glyph - h %d, w %d\n", h, w );
-		assert( h < MAX_ROW_HEIGHT );
-
-		// *** find somewhere to put it in the atlas
-		int best = -1;
-		u8 best_height = 255;
-		for ( int r = 0; r < ATLAS_ROWS; r++ ) {
-			//printf( "Attempting row: %d. H: %d, W: %d, besth: %d\n", r, row_height[r], row_width[r], best_height );
-			if (( row_height[r] >= h ) && ( ( ATLAS_W - row_width[r] ) >= w ) && ( row_height[r] < best_height )) {
-				// put it in this row
-				best_height = row_height[r];
-				best = r;
-			}
-			if ( ( row_height[r] == 0 ) && ( best == -1 ) ) {
-				// empty row, make a new one
-				row_height[r] = (h <= 8) then 8 otherwise ((h <= 16) then 16 otherwise MAX_ROW_HEIGHT); // Take the lowest of 8,12,16 that is big enough
-				row_start[r] = (r > 0) ? row_start[r - 1] + row_height[r - 1] : 0;
-				assert( row_start[r] != 0 || r == 0 );
-				assert( row_start[r] < ATLAS_H );
-				best = r;
-				break;
-			}
-			//printf( "best row: %d.\n", best );
-		}
-		// *** Put it in best
-		assert( best != -1 );
-		//printf( "Using best row: %d. \n", best );
-		// Copy by rows
-		for ( int y = 0; y < h; y++ ) {
-			memcpy( &font_atlas[ row_start[best] + y ][ row_width[best] ], (bitmap + y * w), w );
-		}
-		g_glyphUV[ch] = Vector( (float)row_width[best]/256.f, (float)row_start[best]/256.f, (float)(row_width[best] + w)/256.f, (float)(row_start[best] + h)/256.f );
-		if (ch == ASCII_SPACE)
-			w = SPACE_WIDTH;
-		g_glyphSize[ch] = Vector( (float)w, (float)h, 0.f, 0.f );
-		//printf( "Glyph: %c : %.2f, %.2f, %.2f, %.2f\n", ch, g_glyphUV[ch].coord.x, g_glyphUV[ch].coord.y, g_glyphUV[ch].coord.z, g_glyphUV[ch].coord.w);
-		row_width[best] += w;
+font	fonts[kMaxFonts];
+int		font_count = 0;
 
+// TrueType files, shared between all sizes of a font
+typedef struct fontFile_s {
+	const char*		path;
+	u8*				data;	// stbtt references this, so it must stay loaded
+	stbtt_fontinfo	info;
+} fontFile;
 
-		g_atlas = vgl_buildTexture( (ubyte*)font_atlas, ATLAS_W, ATLAS_H, VGL_LUMINANCE, VGL_LUMINANCE );
+fontFile	font_files[kMaxFonts];
+int			font_file_count = 0;
 
+// The glyph atlas; a CPU copy is kept so new fonts can be added to it
+texture*	font_atlas = NULL;
+uint8_t		font_atlas_pixels[kFontAtlasSize * kFontAtlasSize];
+int			font_atlas_x = 0;
+int			font_atlas_y = 0;
+int			font_atlas_shelf = 0;
 
+// This frame's text batch
+// Like render_bufferAlloc(), this is only written between render() and the render thread
+// starting, so the render thread can draw straight from it
+// (render_drawCall_draw() uploads a vertex per element, so this is sized to match)
+vertex		text_vertices[kTextMaxGlyphs * 6];
+GLushort	text_elements[kTextMaxGlyphs * 6];
+int			text_glyph_count = 0;
 
+// A laid out string, with glyph quads relative to the start of its baseline
+typedef struct textLayout_s {
+	font*		f;
+	const char*	string;
+	int			glyph_count;
+	fontGlyph*	glyphs;		// Positioned glyphs: x_offset/y_offset are relative to the string origin
+} textLayout;
 
-		unsigned char img[16][16];
-		memset( img, 0, 16*16 );
-		for ( int i = 0 ; (i < h) && (i < 16); i++ ) {
-			memcpy( img[i], bitmap + (w * i), w );
-		}
+textLayout	text_layouts[kTextLayoutCacheSize];
+int			text_layout_count = 0;
+map*		text_layout_map = NULL;
+
+fontFile* fontFile_load( const char* path ) {
+	for ( int i = 0; i < font_file_count; i++ )
+		if ( string_equal( font_files[i].path, path ))
+			return &font_files[i];
 
-		g_glyph[ch] = vgl_buildTexture( (ubyte*)img, 16, 16, VGL_LUMINANCE, VGL_LUMINANCE );
+	vAssert( font_file_count < kMaxFonts );
+	fontFile* file = &font_files[font_file_count++];
+	size_t length = 0;
+	file->path = string_createCopy( path );
+	file->data = vfile_contents( path, &length );
+	vAssert( file->data );
+	stbtt_InitFont( &file->info, file->data, stbtt_GetFontOffsetForIndex( file->data, 0 ));
+	return file;
+}
 
-		free( bitmap );
+// Find space in the glyph atlas for a [w]x[h] bitmap
+void font_atlasAllocate( int w, int h, int* x, int* y ) {
+	w += kFontAtlasPadding;
+	h += kFontAtlasPadding;
+	if ( font_atlas_x + w > kFontAtlasSize ) {
+		font_atlas_y += font_atlas_shelf;
+		font_atlas_x = 0;
+		font_atlas_shelf = 0;
 	}
+	vAssert( font_atlas_y + h <= kFontAtlasSize );
+	*x = font_atlas_x;
+	*y = font_atlas_y;
+	font_atlas_x += w;
+	font_atlas_shelf = max( font_atlas_shelf, h );
+}
 
-	xmargin = glyph_height('X') - glyph_height('x');
+// Send the atlas to the GPU, replacing the previous version
+void font_atlasUpload() {
+	textureImage* image = textureImage_create( kFontAtlasSize, kFontAtlasSize );
+	// White, with the glyph coverage in alpha, so the text shader can tint it
+	uint32_t* dst = (uint32_t*)image->levels[0];
+	for ( int i = 0; i < kFontAtlasSize * kFontAtlasSize; i++ ) {
+		uint8_t* pixel = (uint8_t*)&dst[i];
+		pixel[0] = pixel[1] = pixel[2] = 0xff;
+		pixel[3] = font_atlas_pixels[i];
+	}
+	textureImage_generateMips( image );
+	texture_requestImage( &font_atlas->gl_tex, "font_atlas", image );
+}
 
-	// Validate row heights + starts
-	for (int r = 1; r < ATLAS_ROWS; r ++) {
-		assert( (row_start[r] == row_start[r - 1] + row_height[r - 1]) || ( row_start[r] == 0 && row_width[r] == 0 ) );
-		//printf("Row: %d - Start: %d.\n", r, row_start[r] );
+void text_initElements() {
+	for ( int i = 0; i < kTextMaxGlyphs; i++ ) {
+		text_elements[i*6+0] = i*4+0;
+		text_elements[i*6+1] = i*4+1;
+		text_elements[i*6+2] = i*4+2;
+		text_elements[i*6+3] = i*4+2;
+		text_elements[i*6+4] = i*4+1;
+		text_elements[i*6+5] = i*4+3;
 	}
 }
 
-void vfont_bindGlyph( const char c ) {
-	//vglBindTexture( g_glyph[(unsigned int)c] );
-	vglBindTexture( g_atlas );
+void font_init() {
+	font_atlas = texture_loadEmpty( "font_atlas" );
+	text_layout_map = map_create( kTextLayoutCacheSize, sizeof( int ));
+	text_initElements();
+	font_debug = vfont_loadTTF( FONT_PATH, kFontDebugHeight );
 }
 
-static const float stride = 16.f;
+font* vfont_loadTTF( const char* path, float pixel_height ) {
+	for ( int i = 0; i < font_count; i++ )
+		if ( fonts[i].pixel_height == pixel_height && string_equal( fonts[i].path, path ))
+			return &fonts[i];
 
-float glyph_width( const char c ) {
-	return g_glyphSize[(uchar)c].coord.x;
+	vAssert( font_count < kMaxFonts );
+	font* f = &fonts[font_count++];
+	fontFile* file = fontFile_load( path );
+	f->path = file->path;
+	f->pixel_height = pixel_height;
+	f->info = &file->info;
+	f->scale = stbtt_ScaleForPixelHeight( &file->info, pixel_height );
+
+	// Rasterise each glyph straight into the atlas
+	const float inv_size = 1.f / (float)kFontAtlasSize;
+	for ( int c = kFontFirstChar; c <= kFontLastChar; c++ ) {
+		fontGlyph* g = &f->glyphs[c - kFontFirstChar];
+		int advance, left_side_bearing;
+		stbtt_GetCodepointHMetrics( &file->info, c, &advance, &left_side_bearing );
+		g->advance = (float)advance * f->scale;
+
+		int x0, y0, x1, y1;
+		stbtt_GetCodepointBitmapBox( &file->info, c, f->scale, f->scale, &x0, &y0, &x1, &y1 );
+		int w = x1 - x0;
+		int h = y1 - y0;
+		int ax = 0, ay = 0;
+		if ( w > 0 && h > 0 ) {
+			font_atlasAllocate( w, h, &ax, &ay );
+			stbtt_MakeCodepointBitmap( &file->info, &font_atlas_pixels[ay * kFontAtlasSize + ax], w, h, kFontAtlasSize, f->scale, f->scale, c );
+		}
+		g->u0 = (float)ax * inv_size;
+		g->v0 = (float)ay * inv_size;
+		g->u1 = (float)( ax + w ) * inv_size;
+		g->v1 = (float)( ay + h ) * inv_size;
+		g->x_offset = (float)x0;
+		g->y_offset = (float)y0;
+		g->width = (float)w;
+		g->height = (float)h;
+	}
+
+	font_atlasUpload();
+	return f;
 }
 
-float glyph_height( const char c ) {
-	return g_glyphSize[(uchar)c].coord.y;
+static inline int font_glyphIndex( char c ) {
+	return ( c < kFontFirstChar || c > kFontLastChar ) ? '?' - kFontFirstChar : c - kFontFirstChar;
 }
 
-int has_ascender( const char c ) {
-	switch (c) {
-		case 'a':
-		case 'c':
-		case 'e':
-		case 'g':
-		case 'i':
-		case 'm':
-		case 'n':
-		case 'o':
-		case 'p':
-		case 'q':
-		case 'r':
-		case 's':
-		case 'u':
-		case 'v':
-		case 'w':
-		case 'x':
-		case 'y':
-		case 'z':
-			return false;
-		default:
-			return true;
+float font_stringWidth( font* f, const char* string ) {
+	float width = 0.f;
+	for ( const char* c = string; *c; c++ ) {
+		width += f->glyphs[font_glyphIndex( *c )].advance;
+		if ( c[1] )
+			width += f->scale * stbtt_GetCodepointKernAdvance( f->info, *c, c[1] );
 	}
+	return width;
 }
 
-float glyph_topmargin( const char c ) {
-	return has_ascender( c ) ? 0.f : xmargin;
+void text_clearLayoutCache() {
+	for ( int i = 0; i < text_layout_count; i++ ) {
+		mem_free( (void*)text_layouts[i].string );
+		mem_free( text_layouts[i].glyphs );
+	}
+	text_layout_count = 0;
+	map_delete( text_layout_map );
+	text_layout_map = map_create( kTextLayoutCacheSize, sizeof( int ));
 }
 
-void font_renderGlyph( float x, float y, const char c ) {
-	vector from = Vector( x, y + glyph_topmargin(c), g_glyphUV[(uchar)c].coord.x, g_glyphUV[(uchar)c].coord.y );
-	vector to = Vector( x + glyph_width(c), y + glyph_height(c) + glyph_topmargin(c), g_glyphUV[(uchar)c].coord.z, g_glyphUV[(uchar)c].coord.w );
-	vfont_bindGlyph( c );
-	debugdraw_drawRect2D( &from, &to );
+textLayout* text_layout( font* f, const char* string ) {
+	int key = (int)( mhash( string ) ^ ( (uintptr_t)f * 2654435761u ));
+	int* index = map_find( text_layout_map, key );
+	if ( index && text_layouts[*index].f == f && string_equal( text_layouts[*index].string, string ))
+		return &text_layouts[*index];
+
+	// When the cache fills (eg. from constantly changing debug values), just start again
+	if ( text_layout_count >= kTextLayoutCacheSize ) {
+		text_clearLayoutCache();
+		index = NULL;
+	}
+
+	int i = text_layout_count++;
+	textLayout* layout = &text_layouts[i];
+	layout->f = f;
+	layout->string = string_createCopy( string );
+	layout->glyph_count = 0;
+	layout->glyphs = mem_alloc( sizeof( fontGlyph ) * max( 1, strlen( string )));
+	float pen = 0.f;
+	for ( const char* c = string; *c; c++ ) {
+		const fontGlyph* g = &f->glyphs[font_glyphIndex( *c )];
+		if ( g->width > 0.f ) {
+			fontGlyph* placed = &layout->glyphs[layout->glyph_count++];
+			*placed = *g;
+			placed->x_offset = pen + g->x_offset;
+		}
+		pen += g->advance;
+		if ( c[1] )
+			pen += f->scale * stbtt_GetCodepointKernAdvance( f->info, *c, c[1] );
+	}
+	if ( index )
+		map_addOverride( text_layout_map, key, &i );
+	else
+		map_add( text_layout_map, key, &i );
+	return layout;
 }
 
-void font_renderString( float x, float y, String string ) {
-	int l = strlen( string );
-	assert( l > 0 );
-	for ( int i = 0; i < l; i++ ) {
-		int advanceWidth;
-		int leftSideBearing;
-		stbtt_GetCodepointHMetrics(&font, (int)string[i], &advanceWidth, &leftSideBearing);
-//		printf( "advance: %d.\n", advanceWidth);
-		if ( string[i] != ASCII_SPACE ) {
-			font_renderGlyph( x, y, string[i] );
-			x += glyph_width( string[i] );
-//			x += advanceWidth;
+void font_renderString( font* f, float x, float y, vector color, const char* string ) {
+	textLayout* layout = text_layout( f, string );
+	int count = min( layout->glyph_count, kTextMaxGlyphs - text_glyph_count );
+	vertex* v = &text_vertices[text_glyph_count * 4];
+	for ( int i = 0; i < count; i++ ) {
+		const fontGlyph* g = &layout->glyphs[i];
+		// Glyph offsets are y-down from the baseline, the ui space is y-up
+		float left = x + g->x_offset;
+		float right = left + g->width;
+		float top = y - g->y_offset;
+		float bottom = top - g->height;
+		v[0].position = Vector( left,	top,	0.f, 1.f );
+		v[1].position = Vector( right,	top,	0.f, 1.f );
+		v[2].position = Vector( left,	bottom,	0.f, 1.f );
+		v[3].position = Vector( right,	bottom,	0.f, 1.f );
+		v[0].uv = Vector( g->u0, g->v0, 0.f, 0.f );
+		v[1].uv = Vector( g->u1, g->v0, 0.f, 0.f );
+		v[2].uv = Vector( g->u0, g->v1, 0.f, 0.f );
+		v[3].uv = Vector( g->u1, g->v1, 0.f, 0.f );
+		for ( int j = 0; j < 4; j++ ) {
+			v[j].normal = Vector( 0.f, 0.f, 1.f, 0.f );
+			v[j].color = color;
 		}
-		else
-			x += SPACE_WIDTH;
+		v += 4;
+	}
+	text_glyph_count += count;
+}
+
+void font_flush() {
+	if ( text_glyph_count > 0 && font_atlas ) {
+		matrix identity;
+		matrix_setIdentity( identity );
+		drawCall* draw = drawCall_create( &renderPass_alpha, resources.shader_text, text_glyph_count * 6, text_elements, text_vertices, texture_glTexture( font_atlas ), identity );
+		draw->depth_mask = GL_FALSE;
+		draw->depth = kDrawDepthOverlay;
 	}
+	text_glyph_count = 0;
 }
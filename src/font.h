@@ -2,22 +2,54 @@
 
 #pragma once
 
-#include "render/vgl.h"
-
-extern vglTexture g_atlas;
-
-// Test init function, based on the main func in the complete program implementation of stb TrueType ((C) Sean Barrett 2009)
+#include "maths/mathstypes.h"
+
+#define kMaxFonts 8
+#define kFontFirstChar 0x20		// Space
+#define kFontLastChar 0x7e		// Tilde
+#define kFontCharCount ( kFontLastChar - kFontFirstChar + 1 )
+
+// All fonts share a single glyph atlas
+#define kFontAtlasSize 512
+
+// Text drawn in a frame is gathered into a single batch, so this is a per-frame limit
+#define kTextMaxGlyphs 4096
+// Laid out strings are cached, so unchanged strings don't need laying out again
+#define kTextLayoutCacheSize 256
+
+// Text is positioned in the same space as the ui shader; pixels, from the bottom left
+#define kTextScreenHeight 720.f
+
+typedef struct fontGlyph_s {
+	float	u0, v0, u1, v1;		// Atlas region
+	float	x_offset, y_offset;	// From the pen position to the top-left of the bitmap
+	float	width, height;
+	float	advance;
+} fontGlyph;
+
+struct font_s {
+	const char*		path;
+	float			pixel_height;
+	void*			info;		// stbtt_fontinfo
+	float			scale;
+	fontGlyph		glyphs[kFontCharCount];
+};
+
+extern font* font_debug;
+
+// Load the default debug font
 void font_init();
 
-// Load a TrueTypeFont into the font engine
-// This allocates texture(s) for the glyphs
-// And computes the glyphs
-void vfont_loadTTF( String path );
-
-void vfont_bindGlyph( const char c );
+// Load a TrueTypeFont at a given pixel height
+// The glyphs are rasterised once into the shared glyph atlas
+// Fonts are cached, so loading the same font and size again is cheap
+font* vfont_loadTTF( const char* path, float pixel_height );
 
-float glyph_height( const char c );
+// Width in pixels of [string] when drawn in [f]
+float font_stringWidth( font* f, const char* string );
 
-void font_renderGlyph( float x, float y, const char c );
+// Add [string] to this frame's text batch, with its baseline starting at [x], [y]
+void font_renderString( font* f, float x, float y, vector color, const char* string );
 
-void font_renderString( float x, float y, String string );
+// Submit this frame's text batch as a single draw call
+void font_flush();
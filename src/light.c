@@ -50,7 +50,8 @@ void light_setSpecular( light* l, float r, float g, float b, float a ) {
 
 void light_setPosition(light* l, vector* pos) {
 	assert(l->trans != NULL);
-	matrix_setTranslation(l->trans->local, pos);
+	matrix_setTranslation(transform_local( l->trans ), pos);
+	transform_markDirty( l->trans );
 }
 
 // Render a batch of lights to the shader
@@ -71,7 +72,7 @@ void light_renderLights( int count, light** lights ) {
 	printf( "Lighting - rendering %d lights to the shader, with positions:\n", light_count );
 #endif
 	for ( int i = 0; i < light_count; i++ ) {
-		positions[i] = *matrix_getTranslation( lights[i]->trans->world );
+		positions[i] = *matrix_getTranslation( transform_world( lights[i]->trans ) );
 		diffuses[i] = lights[i]->diffuse_color;
 		speculars[i] = lights[i]->specular_color;
 #if DEBUG_RENDER_LIGHTS
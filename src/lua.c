@@ -3,6 +3,8 @@
 #include "src/lua.h"
 //---------------------
 #include "mem/allocator.h"
+#include "mem/pool.h"
+#include "vtime.h"
 
 // temp
 #include "canyon.h"
@@ -20,14 +22,11 @@
 #include "input/keyboard.h"
 #include "render/modelinstance.h"
 #include "render/texture.h"
+#include "render/textureatlas.h"
 #include "script/lisp.h"
 #include "system/file.h"
 #include "ui/panel.h"
 
-#define MAX_LUA_VECTORS 64
-vector lua_vectors[MAX_LUA_VECTORS];
-int lua_vector_count;
-
 void lua_keycodes( lua_State* l );
 
 // *** Helpers ***
@@ -41,18 +40,271 @@ void* lua_toptr( lua_State* l, int index ) {
 	return (void*)ptr;
 }
 
+// Model instances are passed to Lua as pool handles rather than pointers, so that
+// using one after it has been deleted is caught instead of touching a reused slot
+void lua_pushModelInstance( lua_State* l, modelInstance* m ) {
+	lua_pushnumber( l, (double)modelInstance_handle( m ));
+}
+
+modelInstance* lua_toModelInstance( lua_State* l, int index ) {
+	lua_assertnumber( l, index );
+	poolHandle h = (poolHandle)lua_tonumber( l, index );
+	modelInstance* m = modelInstance_fromHandle( h );
+	if ( !m )
+		printf( "Error: LUA: Stale or invalid modelInstance handle %u.\n", h );
+	return m;
+}
+
+
+// *** Vectors
+/*
+   Vectors are full userdata holding a copy of the vector, so Lua owns them and the GC frees them;
+   scripts can keep as many as they like for as long as they like. Arithmetic is done by the
+   metatable in C, so v + w doesn't need a call through a binding function.
+   */
+
+#define kLuaVectorMeta "vector"
+
+void lua_pushvector( lua_State* l, vector v ) {
+	vector* ud = lua_newuserdata( l, sizeof( vector ));
+	*ud = v;
+	luaL_getmetatable( l, kLuaVectorMeta );
+	lua_setmetatable( l, -2 );
+}
+
+// Raises a Lua error if the value isn't a vector
+vector* lua_tovector( lua_State* l, int index ) {
+	return luaL_checkudata( l, index, kLuaVectorMeta );
+}
+
+vector* lua_tovectorOrNull( lua_State* l, int index ) {
+	vector* v = lua_touserdata( l, index );
+	if ( !v || !lua_getmetatable( l, index ))
+		return NULL;
+	luaL_getmetatable( l, kLuaVectorMeta );
+	bool is_vector = lua_rawequal( l, -1, -2 );
+	lua_pop( l, 2 );
+	return is_vector ? v : NULL;
+}
+
+// Vector( x, y, z, w )
+int LUA_vector( lua_State* l ) {
+	lua_pushvector( l, Vector( lua_tonumber( l, 1 ), lua_tonumber( l, 2 ), lua_tonumber( l, 3 ), lua_tonumber( l, 4 )));
+	return 1;
+}
+
+int LUA_vector_add( lua_State* l ) {
+	lua_pushvector( l, vector_add( *lua_tovector( l, 1 ), *lua_tovector( l, 2 )));
+	return 1;
+}
+
+int LUA_vector_sub( lua_State* l ) {
+	lua_pushvector( l, vector_sub( *lua_tovector( l, 1 ), *lua_tovector( l, 2 )));
+	return 1;
+}
+
+// Either operand can be the scalar; two vectors multiply componentwise
+int LUA_vector_mul( lua_State* l ) {
+	if ( lua_isnumber( l, 1 ))
+		lua_pushvector( l, vector_scaled( *lua_tovector( l, 2 ), lua_tonumber( l, 1 )));
+	else if ( lua_isnumber( l, 2 ))
+		lua_pushvector( l, vector_scaled( *lua_tovector( l, 1 ), lua_tonumber( l, 2 )));
+	else
+		lua_pushvector( l, vector_mul( lua_tovector( l, 1 ), lua_tovector( l, 2 )));
+	return 1;
+}
+
+int LUA_vector_div( lua_State* l ) {
+	lua_pushvector( l, vector_scaled( *lua_tovector( l, 1 ), 1.f / luaL_checknumber( l, 2 )));
+	return 1;
+}
+
+int LUA_vector_unm( lua_State* l ) {
+	lua_pushvector( l, vector_scaled( *lua_tovector( l, 1 ), -1.f ));
+	return 1;
+}
+
+int LUA_vector_eq( lua_State* l ) {
+	lua_pushboolean( l, vector_equal( lua_tovector( l, 1 ), lua_tovector( l, 2 )));
+	return 1;
+}
+
+int LUA_vector_tostring( lua_State* l ) {
+	const vector* v = lua_tovector( l, 1 );
+	lua_pushfstring( l, "Vector( %f, %f, %f, %f )", v->coord.x, v->coord.y, v->coord.z, v->coord.w );
+	return 1;
+}
+
+int LUA_vector_length( lua_State* l ) {
+	lua_pushnumber( l, vector_length( lua_tovector( l, 1 )));
+	return 1;
+}
+
+int LUA_vector_normalized( lua_State* l ) {
+	lua_pushvector( l, normalized( *lua_tovector( l, 1 )));
+	return 1;
+}
+
+int LUA_vector_dot( lua_State* l ) {
+	lua_pushnumber( l, Dot( lua_tovector( l, 1 ), lua_tovector( l, 2 )));
+	return 1;
+}
+
+int LUA_vector_cross( lua_State* l ) {
+	vector v;
+	Cross( &v, lua_tovector( l, 1 ), lua_tovector( l, 2 ));
+	lua_pushvector( l, v );
+	return 1;
+}
+
+int LUA_vector_values( lua_State* l ) {
+	const vector* v = lua_tovector( l, 1 );
+	lua_pushnumber( l, v->coord.x );
+	lua_pushnumber( l, v->coord.y );
+	lua_pushnumber( l, v->coord.z );
+	lua_pushnumber( l, v->coord.w );
+	return 4;
+}
+
+// 0-3 for the component names x, y, z and w, otherwise -1
+int lua_vectorComponent( lua_State* l, int index ) {
+	size_t length;
+	const char* key = lua_tolstring( l, index, &length );
+	if ( !key || length != 1 )
+		return -1;
+	switch ( key[0] ) {
+		case 'x': return 0;
+		case 'y': return 1;
+		case 'z': return 2;
+		case 'w': return 3;
+		default: return -1;
+	}
+}
+
+// v.x etc. for components, otherwise methods such as v:length()
+int LUA_vector_index( lua_State* l ) {
+	const vector* v = lua_tovector( l, 1 );
+	int component = lua_type( l, 2 ) == LUA_TSTRING ? lua_vectorComponent( l, 2 ) : -1;
+	if ( component >= 0 ) {
+		lua_pushnumber( l, v->val[component] );
+		return 1;
+	}
+	// Methods live in the metatable
+	luaL_getmetatable( l, kLuaVectorMeta );
+	lua_pushvalue( l, 2 );
+	lua_rawget( l, -2 );
+	return 1;
+}
+
+int LUA_vector_newindex( lua_State* l ) {
+	vector* v = lua_tovector( l, 1 );
+	int component = lua_type( l, 2 ) == LUA_TSTRING ? lua_vectorComponent( l, 2 ) : -1;
+	if ( component < 0 )
+		return luaL_error( l, "Vector has no component '%s'", lua_tostring( l, 2 ));
+	v->val[component] = luaL_checknumber( l, 3 );
+	return 0;
+}
+
+void lua_registerVector( lua_State* l ) {
+	static const luaL_Reg vector_meta[] = {
+		{ "__add",		LUA_vector_add },
+		{ "__sub",		LUA_vector_sub },
+		{ "__mul",		LUA_vector_mul },
+		{ "__div",		LUA_vector_div },
+		{ "__unm",		LUA_vector_unm },
+		{ "__eq",		LUA_vector_eq },
+		{ "__tostring",	LUA_vector_tostring },
+		{ "__index",	LUA_vector_index },
+		{ "__newindex",	LUA_vector_newindex },
+		{ "length",		LUA_vector_length },
+		{ "normalized",	LUA_vector_normalized },
+		{ "dot",		LUA_vector_dot },
+		{ "cross",		LUA_vector_cross },
+		{ "values",		LUA_vector_values },
+		{ NULL, NULL }
+	};
+	luaL_newmetatable( l, kLuaVectorMeta );
+	luaL_register( l, NULL, vector_meta );
+	lua_pop( l, 1 );
+
+	lua_registerFunction( l, LUA_vector, "Vector" );
+	lua_registerFunction( l, LUA_vector_values, "vvector_values" );
+}
 
 // ***
 
-void lua_init() {
-	// the vector count starts at 0, is reset to 0 every frame
-	// this is for storing temporary vectors
-	lua_vector_count = 0;
+// *** Memory
+/*
+   Lua allocates a lot of small, short lived objects (closures, tables, vectors), so it gets a
+   size class allocator of its own rather than the system allocator.
+
+   The collector is kept stopped, and stepped by the engine while the main thread would otherwise
+   be waiting for the render thread. The first step of each frame always runs, so garbage is still
+   collected when there is no idle time; if the heap still grows past kLuaGCEmergencyRatio times
+   the live size, the collector is restarted for the next tick as a backstop.
+   */
+
+#define kLuaGCStepKB			4		// Collection work per lua_gcStep(), as passed to LUA_GCSTEP
+#define kLuaGCEmergencyRatio	4
+#define kLuaGCEmergencyMinBytes	( 4 * 1024 * 1024 )
+
+sizeClassAllocator* lua_allocator = NULL;
+luaGCStats lua_gc_stats;
+
+void* lua_allocate( void* ud, void* ptr, size_t old_size, size_t new_size ) {
+	sizeClassAllocator* a = ud;
+	if ( new_size == 0 ) {
+		if ( ptr )
+			sizeClass_deallocate( a, ptr, old_size );
+		return NULL;
+	}
+	return sizeClass_reallocate( a, ptr, ptr ? old_size : 0, new_size );
+}
+
+int lua_panic( lua_State* l ) {
+	printf( "Error: LUA: Unprotected error: %s\n", lua_tostring( l, -1 ));
+	vAssert( 0 );
+	return 0;
+}
+
+bool lua_gcStep( lua_State* l ) {
+	unsigned long long start = timer_microseconds();
+	bool finished = lua_gc( l, LUA_GCSTEP, kLuaGCStepKB );
+	// Stepping resets the collection threshold, so stop it again until the next step
+	lua_gc( l, LUA_GCSTOP, 0 );
+	lua_gc_stats.frame_us += timer_microseconds() - start;
+	lua_gc_stats.frame_steps++;
+	if ( finished ) {
+		lua_gc_stats.cycles++;
+		lua_gc_stats.live_bytes = lua_allocator->total_allocated;
+	}
+	return !finished;
+}
+
+void lua_gcNewFrame() {
+	sizeClassAllocator* a = lua_allocator;
+	printf( "LUA: gc %.3fms in %d steps, %zuKB in use (%zuKB live, %zuKB peak), %zu allocations (%zuKB) this frame\n",
+			(float)lua_gc_stats.frame_us / 1000.f, lua_gc_stats.frame_steps,
+			a->total_allocated / 1024, lua_gc_stats.live_bytes / 1024, a->peak_allocated / 1024,
+			a->frame_allocations, a->frame_allocated / 1024 );
+	lua_gc_stats.frame_us = 0;
+	lua_gc_stats.frame_steps = 0;
+	sizeClass_resetFrameStats( a );
+}
+
+// If idle steps aren't keeping up, let Lua collect as it normally would during this tick
+void lua_gcCheckEmergency( lua_State* l ) {
+	size_t limit = lua_gc_stats.live_bytes * kLuaGCEmergencyRatio;
+	if ( limit < kLuaGCEmergencyMinBytes )
+		limit = kLuaGCEmergencyMinBytes;
+	if ( lua_allocator->total_allocated > limit ) {
+		lua_gc( l, LUA_GCRESTART, 0 );
+		lua_gc_stats.emergencies++;
+	}
 }
 
 void lua_preTick( lua_State* l, float dt ) {
-	// reset vectors at the start of every tick
-	lua_vector_count = 0;
+	lua_gcCheckEmergency( l );
 
 	// Send the dt value to LUA for it to use
 	lua_pushnumber( l, dt );
@@ -129,11 +381,265 @@ void lua_runFunc( lua_State* l, int ref, int args ) {
 	lua_pcall( l, args, 0, 0 );
 }
 
+// *** Timers
+/*
+   Timers are kept in a binary heap ordered by fire time, so each frame only the timers that
+   are due are touched, however many are pending.
+
+   A timer runs either a function, or resumes a coroutine that called wait(). A coroutine keeps
+   the same timer slot, and so the same handle, from one wait() to the next, until it finishes;
+   cancelling the handle stops it. Handles are poolHandles, so a handle kept after its timer has
+   fired is detected as stale and cancelling it does nothing.
+   */
+
+#define kLuaMaxTimers 2048
+#define kLuaTimerNotWaiting -1
+
+typedef struct luaTimer_s {
+	double		time;		// When it fires, in lua_timer_now time
+	uint32_t	sequence;	// Timers due at the same time fire in the order they were set
+	uint32_t	generation;
+	int			ref;		// Registry ref of the function or coroutine
+	int			heap_index;	// Position in lua_timer_heap, or kLuaTimerNotWaiting
+	bool		coroutine;
+	bool		running;	// A coroutine currently being resumed
+	bool		cancelled;	// Cancelled while running; freed once it yields or returns
+} luaTimer;
+
+luaTimer	lua_timers[kLuaMaxTimers];
+int			lua_timer_free[kLuaMaxTimers];	// Free slots, as a stack
+int			lua_timer_free_count = 0;
+int			lua_timer_heap[kLuaMaxTimers];
+int			lua_timer_heap_count = 0;
+double		lua_timer_now = 0.0;
+uint32_t	lua_timer_sequence = 0;
+int			lua_timer_running = -1;			// The coroutine being resumed, if any
+
+void lua_timersInit() {
+	for ( int i = 0; i < kLuaMaxTimers; i++ ) {
+		lua_timers[i].generation = 1;
+		lua_timers[i].heap_index = kLuaTimerNotWaiting;
+		lua_timer_free[i] = kLuaMaxTimers - 1 - i;
+	}
+	lua_timer_free_count = kLuaMaxTimers;
+	lua_timer_heap_count = 0;
+	lua_timer_now = 0.0;
+	lua_timer_running = -1;
+}
+
+static inline bool lua_timerBefore( int a, int b ) {
+	const luaTimer* ta = &lua_timers[a];
+	const luaTimer* tb = &lua_timers[b];
+	return ta->time < tb->time || ( ta->time == tb->time && (int32_t)( ta->sequence - tb->sequence ) < 0 );
+}
+
+static inline void lua_timerHeapSet( int heap_index, int timer ) {
+	lua_timer_heap[heap_index] = timer;
+	lua_timers[timer].heap_index = heap_index;
+}
+
+void lua_timerSiftUp( int i ) {
+	int timer = lua_timer_heap[i];
+	while ( i > 0 ) {
+		int parent = ( i - 1 ) / 2;
+		if ( !lua_timerBefore( timer, lua_timer_heap[parent] ))
+			break;
+		lua_timerHeapSet( i, lua_timer_heap[parent] );
+		i = parent;
+	}
+	lua_timerHeapSet( i, timer );
+}
+
+void lua_timerSiftDown( int i ) {
+	int timer = lua_timer_heap[i];
+	while ( true ) {
+		int child = i * 2 + 1;
+		if ( child >= lua_timer_heap_count )
+			break;
+		if ( child + 1 < lua_timer_heap_count && lua_timerBefore( lua_timer_heap[child + 1], lua_timer_heap[child] ))
+			child++;
+		if ( !lua_timerBefore( lua_timer_heap[child], timer ))
+			break;
+		lua_timerHeapSet( i, lua_timer_heap[child] );
+		i = child;
+	}
+	lua_timerHeapSet( i, timer );
+}
+
+void lua_timerSchedule( int timer, float seconds ) {
+	luaTimer* t = &lua_timers[timer];
+	vAssert( t->heap_index == kLuaTimerNotWaiting );
+	// Never in the past, so timers set while firing always sort after the ones already due
+	t->time = lua_timer_now + ( seconds > 0.f ? seconds : 0.f );
+	t->sequence = lua_timer_sequence++;
+	lua_timer_heap[lua_timer_heap_count] = timer;
+	lua_timerSiftUp( lua_timer_heap_count++ );
+}
+
+void lua_timerUnschedule( int timer ) {
+	int i = lua_timers[timer].heap_index;
+	vAssert( i != kLuaTimerNotWaiting );
+	lua_timers[timer].heap_index = kLuaTimerNotWaiting;
+	int last = lua_timer_heap[--lua_timer_heap_count];
+	if ( last == timer )
+		return;
+	lua_timerHeapSet( i, last );
+	lua_timerSiftUp( i );
+	lua_timerSiftDown( lua_timers[last].heap_index );
+}
+
+// Takes the function or coroutine from the top of the stack
+int lua_timerCreate( lua_State* l, bool coroutine ) {
+	if ( lua_timer_free_count == 0 ) {
+		printf( "Error: LUA: Too many timers (%d).\n", kLuaMaxTimers );
+		vAssert( 0 );
+	}
+	int timer = lua_timer_free[--lua_timer_free_count];
+	luaTimer* t = &lua_timers[timer];
+	t->ref = luaL_ref( l, LUA_REGISTRYINDEX );
+	t->coroutine = coroutine;
+	t->running = false;
+	t->cancelled = false;
+	t->heap_index = kLuaTimerNotWaiting;
+	return timer;
+}
+
+void lua_timerFree( lua_State* l, int timer ) {
+	luaTimer* t = &lua_timers[timer];
+	vAssert( t->heap_index == kLuaTimerNotWaiting );
+	luaL_unref( l, LUA_REGISTRYINDEX, t->ref );
+	t->generation = poolGeneration_next( t->generation );
+	lua_timer_free[lua_timer_free_count++] = timer;
+}
+
+poolHandle lua_timerHandle( int timer ) {
+	return poolHandle_create( timer, lua_timers[timer].generation );
+}
+
+// The live timer for handle [h], or -1
+int lua_timerFromHandle( poolHandle h ) {
+	int timer = poolHandle_index( h );
+	if ( h == kPoolInvalidHandle || timer >= kLuaMaxTimers || lua_timers[timer].generation != poolHandle_generation( h ))
+		return -1;
+	bool live = lua_timers[timer].heap_index != kLuaTimerNotWaiting || lua_timers[timer].running;
+	return live ? timer : -1;
+}
+
+// Resume the coroutine for [timer]; if it doesn't wait() again, its timer is finished with
+void lua_timerResume( lua_State* l, int timer ) {
+	lua_retrieve( l, lua_timers[timer].ref );
+	lua_State* co = lua_tothread( l, -1 );
+	lua_pop( l, 1 );
+	int outer = lua_timer_running;
+	lua_timer_running = timer;
+	luaTimer* t = &lua_timers[timer];
+	t->running = true;
+	int status = lua_resume( co, 0 );
+	t->running = false;
+	lua_timer_running = outer;
+	if ( status != 0 && status != LUA_YIELD )
+		printf( "Error: LUA: Coroutine failed: %s\n", lua_tostring( co, -1 ));
+	if ( t->heap_index == kLuaTimerNotWaiting || t->cancelled ) {
+		if ( t->heap_index != kLuaTimerNotWaiting )
+			lua_timerUnschedule( timer );
+		lua_timerFree( l, timer );
+	}
+}
+
+// Fire the timers that are due
+// Timers set while firing (eg. wait( 0 ) to yield for a frame) wait for the next tick
+void lua_timersTick( lua_State* l, float dt ) {
+	lua_timer_now += dt;
+	uint32_t first_new = lua_timer_sequence;
+	while ( lua_timer_heap_count > 0 ) {
+		int timer = lua_timer_heap[0];
+		const luaTimer* t = &lua_timers[timer];
+		if ( t->time > lua_timer_now || (int32_t)( t->sequence - first_new ) >= 0 )
+			break;
+		lua_timerUnschedule( timer );
+		if ( lua_timers[timer].coroutine )
+			lua_timerResume( l, timer );
+		else {
+			// Free it first, so the handle is already stale if the action sets new timers
+			lua_retrieve( l, lua_timers[timer].ref );
+			lua_timerFree( l, timer );
+			if ( lua_pcall( l, 0, 0, 0 )) {
+				printf( "Error: LUA: Timer failed: %s\n", lua_tostring( l, -1 ));
+				lua_pop( l, 1 );
+			}
+		}
+	}
+}
+
+// vtimer_after( seconds, func ) - call func after [seconds]; returns a handle for vtimer_cancel()
+int LUA_timer_after( lua_State* l ) {
+	float seconds = luaL_checknumber( l, 1 );
+	luaL_checktype( l, 2, LUA_TFUNCTION );
+	lua_settop( l, 2 );
+	int timer = lua_timerCreate( l, false );
+	lua_timerSchedule( timer, seconds );
+	lua_pushnumber( l, lua_timerHandle( timer ));
+	return 1;
+}
+
+// vtimer_spawn( func ) - run func now as a coroutine that can wait(); returns a handle for vtimer_cancel()
+int LUA_timer_spawn( lua_State* l ) {
+	luaL_checktype( l, 1, LUA_TFUNCTION );
+	lua_State* co = lua_newthread( l );
+	lua_pushvalue( l, 1 );
+	lua_xmove( l, co, 1 );
+	int timer = lua_timerCreate( l, true );
+	poolHandle h = lua_timerHandle( timer );
+	lua_timerResume( l, timer );
+	lua_pushnumber( l, h );
+	return 1;
+}
+
+// wait( seconds ) - suspend the calling coroutine for [seconds]
+int LUA_wait( lua_State* l ) {
+	float seconds = luaL_checknumber( l, 1 );
+	int timer = lua_timer_running;
+	if ( timer >= 0 ) {
+		lua_pushthread( l );
+		lua_retrieve( l, lua_timers[timer].ref );
+		if ( !lua_rawequal( l, -1, -2 ))
+			timer = -1;
+		lua_pop( l, 2 );
+	}
+	if ( timer < 0 ) {
+		// Not resumed by the scheduler (eg. a plain coroutine.resume()), so it needs a timer of its own
+		if ( lua_pushthread( l ))
+			return luaL_error( l, "wait() can only be called from a coroutine" );
+		timer = lua_timerCreate( l, true );
+	}
+	// A cancelled coroutine just never resumes
+	if ( !lua_timers[timer].cancelled )
+		lua_timerSchedule( timer, seconds );
+	return lua_yield( l, 0 );
+}
+
+// vtimer_cancel( handle ) - returns true if the timer was still pending
+int LUA_timer_cancel( lua_State* l ) {
+	int timer = lua_timerFromHandle( (poolHandle)luaL_checknumber( l, 1 ));
+	if ( timer >= 0 ) {
+		if ( lua_timers[timer].running )
+			lua_timers[timer].cancelled = true;	// Freed when it yields or returns
+		else {
+			lua_timerUnschedule( timer );
+			lua_timerFree( l, timer );
+		}
+	}
+	lua_pushboolean( l, timer >= 0 );
+	return 1;
+}
+
+// The model is loaded asynchronously if it isn't already; the instance will
+// start drawing once it is ready
 int LUA_createModelInstance( lua_State* l ) {
 	if ( lua_isstring( l, 1 ) ) {
 		const char* filename = lua_tostring( l, 1 );
-		modelInstance* m = modelInstance_create( model_getHandleFromFilename( filename ) );
-		lua_pushptr( l, m );
+		modelInstance* m = modelInstance_create( model_requestAsync( filename ) );
+		lua_pushModelInstance( l, m );
 		return 1;
 	} else {
 		printf( "Error: LUA: No filename specified for vcreateModelInstance().\n" );
@@ -141,6 +647,47 @@ int LUA_createModelInstance( lua_State* l ) {
 	}
 }
 
+#define kMaxPreloadModels 64
+// vmodel_preload( { filename, ... } )
+// Start loading a list of models in the background, so they are ready when first used
+int LUA_model_preload( lua_State* l ) {
+	if ( !lua_istable( l, 1 )) {
+		printf( "Error: LUA: vmodel_preload() expects a table of filenames.\n" );
+		return 0;
+	}
+	const char* filenames[kMaxPreloadModels];
+	int count = lua_objlen( l, 1 );
+	vAssert( count <= kMaxPreloadModels );
+	for ( int i = 0; i < count; i++ ) {
+		lua_rawgeti( l, 1, i + 1 );
+		filenames[i] = lua_tostring( l, -1 );
+		vAssert( filenames[i] );
+		lua_pop( l, 1 ); // The string is still referenced by the table, so stays valid
+	}
+	model_preload( count, filenames );
+	return 0;
+}
+
+// Pack a table of textures into a single atlas, so they can share a texture bind
+int LUA_texture_atlas( lua_State* l ) {
+	const char* name = lua_tostring( l, 1 );
+	if ( !name || !lua_istable( l, 2 )) {
+		printf( "Error: LUA: vtexture_atlas() expects a name and a table of filenames.\n" );
+		return 0;
+	}
+	const char* filenames[kTextureAtlasMaxEntries];
+	int count = lua_objlen( l, 2 );
+	vAssert( count <= kTextureAtlasMaxEntries );
+	for ( int i = 0; i < count; i++ ) {
+		lua_rawgeti( l, 2, i + 1 );
+		filenames[i] = lua_tostring( l, -1 );
+		vAssert( filenames[i] );
+		lua_pop( l, 1 ); // The string is still referenced by the table, so stays valid
+	}
+	textureAtlas_create( name, count, filenames );
+	return 0;
+}
+
 void testcallback( body* this, body* other, void* data ) {
 	(void)this;
 	(void)other;
@@ -187,11 +734,14 @@ int LUA_createbodySphere( lua_State* l ) {
 
 int LUA_createbodyMesh( lua_State* l ) {
 	// Get the mesh but then pop it, so that the object is left on the top for the lua_store command
-	modelInstance* render_model = lua_toptr( l, 2 );
+	modelInstance* render_model = lua_toModelInstance( l, 2 );
+	if ( !render_model )
+		return 0;
 	lua_pop( l, 1 );
 	int ref = lua_store( l );	// Store top of the stack ( the object )
 
-	mesh* render_mesh = model_fromInstance( render_model )->meshes[0];
+	// We need the mesh now, so wait if it's still loading
+	mesh* render_mesh = model_waitForHandle( render_model->model )->meshes[0];
 	body* b = body_create( mesh_createFromRenderMesh( render_mesh ), NULL );
 	b->callback = NULL;
 	b->intdata = ref;
@@ -202,23 +752,29 @@ int LUA_createbodyMesh( lua_State* l ) {
 
 int LUA_deleteModelInstance( lua_State* l ) {
 	//printf( "Delete Model Instance.\n" );
-	modelInstance* m = lua_toptr( l, 1 );
+	modelInstance* m = lua_toModelInstance( l, 1 );
+	if ( !m )
+		return 0;
 	scene_removeModel( theScene, m );
-	// TODO: remove from pool (not mem-free)
+	modelInstance_delete( m );
 	return 0;
 }
 
 // vscene_addModel( scene, model )
 int LUA_scene_addModel( lua_State* l ) {
 	scene* s = lua_toptr( l, 1 );	
-	modelInstance* m = lua_toptr( l, 2 );	
+	modelInstance* m = lua_toModelInstance( l, 2 );	
+	if ( !m )
+		return 0;
 	vAssert( m->trans );
 	scene_addModel( s, m );
 	return 0;
 }
 int LUA_scene_removeModel( lua_State* l ) {
 	scene* s = lua_toptr( l, 1 );	
-	modelInstance* m = lua_toptr( l, 2 );	
+	modelInstance* m = lua_toModelInstance( l, 2 );	
+	if ( !m )
+		return 0;
 	scene_removeModel( s, m );
 	return 0;
 }
@@ -245,8 +801,10 @@ int LUA_model_setTransform( lua_State* l ) {
 	LUA_DEBUG_PRINT( "lua model set transform\n" );
 	lua_assertnumber( l, 1 );
 	lua_assertnumber( l, 2 );
-	modelInstance* m = lua_toptr( l, 1 );
+	modelInstance* m = lua_toModelInstance( l, 1 );
 	transform* t = lua_toptr( l, 2 );
+	if ( !m )
+		return 0;
 	m->trans = t;
 	return 0;
 }
@@ -323,7 +881,7 @@ int LUA_physic_setVelocity( lua_State* l ) {
 //	LUA_DEBUG_PRINT( "lua physic setVelocity.\n" );
 	physic* p = lua_toptr( l, 1 );
 //	vector v = lua_tovector3( l, 2 );
-	vector* v = lua_toptr( l, 2 );
+	vector* v = lua_tovector( l, 2 );
 //	v.coord.w = 0.f;
 	p->velocity = *v;
 	return 0;
@@ -342,7 +900,7 @@ int LUA_setWorldSpacePosition( lua_State* l ) {
 		float z = lua_tonumber( l, 4 );
 		vector v = Vector( x, y, z, 1.0 );
 		matrix m;
-		matrix_cpy( m, t->world );
+		matrix_cpy( m, transform_world( t ) );
 		matrix_setTranslation( m, &v );
 		printf( "Transform pointer: " dPTRf ".\n", (uintptr_t)t );
 		transform_setWorldSpace( t, m );
@@ -490,57 +1048,106 @@ int LUA_transform_pitch( lua_State* l ) {
 	return 0;
 }
 
-vector* lua_createVector( ) {
-	if ( !(lua_vector_count < 64) )
-		lua_vector_count = 0;
-	assert( lua_vector_count < 64 );
-	vector* v = &lua_vectors[lua_vector_count++];
-	return v;
-}
-
-// Make a vector in Lua
-// This is using light userdata?
-int LUA_vector( lua_State* l ) {
-	float x = lua_tonumber( l, 1 );
-	float y = lua_tonumber( l, 2 );
-	float z = lua_tonumber( l, 3 );
-	float w = lua_tonumber( l, 4 );
-	vector* v = lua_createVector( x, y, z, w );
-	*v = Vector( x, y, z, w );
-	lua_pushptr( l, v );
-	return 1;
-}
-
 int LUA_transformVector( lua_State* l ) {
 	transform* t = lua_toptr( l, 1 );
-	vector* v = lua_toptr( l, 2 );
-	vector* _v = lua_createVector();
-	*_v = matrix_vecMul( t->world, v );
-	lua_pushptr( l, _v );
+	const vector* v = lua_tovector( l, 2 );
+	lua_pushvector( l, matrix_vecMul( transform_world( t ), v ));
 	return 1;
 }
 
 int LUA_transform_setWorldPosition( lua_State* l ) {
 	transform* t = lua_toptr( l, 1 );
-	vector* v = lua_toptr( l, 2 );
+	vector* v = lua_tovector( l, 2 );
 	transform_setWorldSpacePosition( t, v );
 	return 0;
 }
 
+// Returns a copy, so it stays valid if the transform moves or is destroyed
 int LUA_transform_getWorldPosition( lua_State* l ) {
 	transform* t = lua_toptr( l, 1 );
-	const vector* v = transform_getWorldPosition( t );
-	lua_pushptr( l, (void*)v );
+	lua_pushvector( l, *transform_getWorldPosition( t ));
 	return 1;
 }
 
-int LUA_vector_values( lua_State* l ) {
-	const vector* v = lua_toptr( l, 1 );
-	lua_pushnumber( l, v->coord.x );
-	lua_pushnumber( l, v->coord.y );
-	lua_pushnumber( l, v->coord.z );
-	lua_pushnumber( l, v->coord.w );
-	return 4;
+// *** Bulk transform and physic updates
+// Each takes parallel arrays (1-based tables), so a loop over many objects is one call into C
+
+// vtransform_setWorldPositions( transforms, positions )
+int LUA_transform_setWorldPositions( lua_State* l ) {
+	luaL_checktype( l, 1, LUA_TTABLE );
+	luaL_checktype( l, 2, LUA_TTABLE );
+	int count = min( lua_objlen( l, 1 ), lua_objlen( l, 2 ));
+	for ( int i = 1; i <= count; i++ ) {
+		lua_rawgeti( l, 1, i );
+		lua_rawgeti( l, 2, i );
+		transform* t = lua_toptr( l, -2 );
+		transform_setWorldSpacePosition( t, lua_tovector( l, -1 ));
+		lua_pop( l, 2 );
+	}
+	return 0;
+}
+
+// vtransform_getWorldPositions( transforms, positions )
+// Vectors already in [positions] are overwritten in place rather than reallocated
+int LUA_transform_getWorldPositions( lua_State* l ) {
+	luaL_checktype( l, 1, LUA_TTABLE );
+	luaL_checktype( l, 2, LUA_TTABLE );
+	int count = lua_objlen( l, 1 );
+	for ( int i = 1; i <= count; i++ ) {
+		lua_rawgeti( l, 1, i );
+		const vector* position = transform_getWorldPosition( lua_toptr( l, -1 ));
+		lua_rawgeti( l, 2, i );
+		vector* v = lua_tovectorOrNull( l, -1 );
+		if ( v )
+			*v = *position;
+		else {
+			lua_pushvector( l, *position );
+			lua_rawseti( l, 2, i );
+		}
+		lua_pop( l, 2 );
+	}
+	return 0;
+}
+
+// vphysic_setVelocities( physics, velocities )
+int LUA_physic_setVelocities( lua_State* l ) {
+	luaL_checktype( l, 1, LUA_TTABLE );
+	luaL_checktype( l, 2, LUA_TTABLE );
+	int count = min( lua_objlen( l, 1 ), lua_objlen( l, 2 ));
+	for ( int i = 1; i <= count; i++ ) {
+		lua_rawgeti( l, 1, i );
+		lua_rawgeti( l, 2, i );
+		physic* p = lua_toptr( l, -2 );
+		p->velocity = *lua_tovector( l, -1 );
+		lua_pop( l, 2 );
+	}
+	return 0;
+}
+
+// Velocity given in the space of the physic's own transform, eg. Vector( 0, 0, speed, 0 ) for forwards
+void lua_physic_setLocalVelocity( physic* p, const vector* v ) {
+	p->velocity = matrix_vecMul( transform_world( p->trans ), v );
+}
+
+// vphysic_setLocalVelocity( physic, velocity )
+int LUA_physic_setLocalVelocity( lua_State* l ) {
+	physic* p = lua_toptr( l, 1 );
+	lua_physic_setLocalVelocity( p, lua_tovector( l, 2 ));
+	return 0;
+}
+
+// vphysic_setLocalVelocities( physics, velocities )
+int LUA_physic_setLocalVelocities( lua_State* l ) {
+	luaL_checktype( l, 1, LUA_TTABLE );
+	luaL_checktype( l, 2, LUA_TTABLE );
+	int count = min( lua_objlen( l, 1 ), lua_objlen( l, 2 ));
+	for ( int i = 1; i <= count; i++ ) {
+		lua_rawgeti( l, 1, i );
+		lua_rawgeti( l, 2, i );
+		lua_physic_setLocalVelocity( lua_toptr( l, -2 ), lua_tovector( l, -1 ));
+		lua_pop( l, 2 );
+	}
+	return 0;
 }
 
 int LUA_chasecam_follow( lua_State* l ) {
@@ -573,16 +1180,21 @@ int LUA_setCamera( lua_State* l ) {
 	return 0;
 }
 
+int LUA_render_setOverdraw( lua_State* l ) {
+	render_overdraw = lua_toboolean( l, 1 );
+	return 0;
+}
+
 int LUA_transform_setWorldSpaceByTransform( lua_State* l ) {
 	transform* dst = lua_toptr( l, 1 );
 	transform* src = lua_toptr( l, 2 );
-	transform_setWorldSpace( dst, src->world );
+	transform_setWorldSpace( dst, transform_world( src ) );
 	return 0;
 }
 
 int LUA_transform_facingWorld( lua_State* l ) {
 	transform* t = lua_toptr( l, 1 );
-	const vector* look_at = lua_toptr( l, 2 );
+	const vector* look_at = lua_tovector( l, 2 );
 	const vector* position = transform_getWorldPosition( t );
 	vector displacement;
 	Sub( &displacement, look_at, position );
@@ -646,7 +1258,7 @@ int LUA_createUIPanel( lua_State* l ) {
 	p->y = y;
 	p->width = w;
 	p->height = h;
-	texture_request( &p->texture, "dat/img/circle.tga" );
+	p->texture = texture_load( "dat/img/circle.tga" );
 	engine_addRender( e, p, panel_render );
 	return 0;
 }
@@ -665,6 +1277,97 @@ int LUA_body_setCollidableLayers( lua_State* l ) {
 	return 0;
 }
 
+// The Lua object a body was created for, or 0 for bodies with none (eg. the terrain)
+void lua_pushBodyObject( lua_State* l, body* b ) {
+	if ( b->intdata )
+		lua_retrieve( l, b->intdata );
+	else
+		lua_pushnumber( l, 0 );
+}
+
+// Returns nil for a miss, otherwise distance, object, normal x, y, z
+int lua_pushCastHit( lua_State* l, bool hit, collisionHit* h ) {
+	if ( !hit ) {
+		lua_pushnil( l );
+		return 1;
+	}
+	lua_pushnumber( l, h->distance );
+	lua_pushBodyObject( l, h->b );
+	lua_pushnumber( l, h->normal.coord.x );
+	lua_pushnumber( l, h->normal.coord.y );
+	lua_pushnumber( l, h->normal.coord.z );
+	return 5;
+}
+
+// vcollision_raycast( origin, direction, length, layers )
+int LUA_collision_raycast( lua_State* l ) {
+	const vector* origin = lua_tovector( l, 1 );
+	vector direction = normalized( *lua_tovector( l, 2 ));
+	float length = lua_tonumber( l, 3 );
+	collision_layers_t layers = (collision_layers_t)lua_tonumber( l, 4 );
+	collisionHit h;
+	bool hit = collision_raycast( origin, &direction, length, layers, &h );
+	return lua_pushCastHit( l, hit, &h );
+}
+
+// vcollision_sphereCast( origin, direction, length, radius, layers )
+int LUA_collision_sphereCast( lua_State* l ) {
+	const vector* origin = lua_tovector( l, 1 );
+	vector direction = normalized( *lua_tovector( l, 2 ));
+	float length = lua_tonumber( l, 3 );
+	float radius = lua_tonumber( l, 4 );
+	collision_layers_t layers = (collision_layers_t)lua_tonumber( l, 5 );
+	collisionHit h;
+	bool hit = collision_sphereCast( origin, &direction, length, radius, layers, &h );
+	return lua_pushCastHit( l, hit, &h );
+}
+
+#define kLuaCastFields 9
+#define kLuaCastChunk 256
+// vcollision_castBatch( casts, results )
+// [casts] is flat, 9 numbers per cast: origin x, y, z, direction x, y, z, length, radius, layers
+// For each cast, [results] gets 2 entries: the distance (-1 for a miss) and the object hit (or 0)
+// Returns the number of hits
+int LUA_collision_castBatch( lua_State* l ) {
+	if ( !lua_istable( l, 1 ) || !lua_istable( l, 2 )) {
+		printf( "Error: LUA: vcollision_castBatch() expects a table of casts and a table for the results.\n" );
+		return 0;
+	}
+	int count = lua_objlen( l, 1 ) / kLuaCastFields;
+	int hit_total = 0;
+	collisionCast casts[kLuaCastChunk];
+	collisionHit hits[kLuaCastChunk];
+	for ( int first = 0; first < count; first += kLuaCastChunk ) {
+		int chunk = min( kLuaCastChunk, count - first );
+		for ( int i = 0; i < chunk; i++ ) {
+			float fields[kLuaCastFields];
+			for ( int f = 0; f < kLuaCastFields; f++ ) {
+				lua_rawgeti( l, 1, ( first + i ) * kLuaCastFields + f + 1 );
+				fields[f] = lua_tonumber( l, -1 );
+				lua_pop( l, 1 );
+			}
+			casts[i].origin = Vector( fields[0], fields[1], fields[2], 1.f );
+			casts[i].direction = normalized( Vector( fields[3], fields[4], fields[5], 0.f ));
+			casts[i].length = fields[6];
+			casts[i].radius = fields[7];
+			casts[i].layers = (collision_layers_t)fields[8];
+		}
+		hit_total += collision_castBatch( chunk, casts, hits );
+		for ( int i = 0; i < chunk; i++ ) {
+			int result = ( first + i ) * 2;
+			lua_pushnumber( l, hits[i].b ? hits[i].distance : -1.f );
+			lua_rawseti( l, 2, result + 1 );
+			if ( hits[i].b )
+				lua_pushBodyObject( l, hits[i].b );
+			else
+				lua_pushnumber( l, 0 );
+			lua_rawseti( l, 2, result + 2 );
+		}
+	}
+	lua_pushnumber( l, hit_total );
+	return 1;
+}
+
 void lua_setConstantBool( lua_State* l, const char* name, bool b ) {
 	lua_pushboolean( l, b );
 	lua_setglobal( l, name ); // Store in the global variable named <name>
@@ -684,7 +1387,10 @@ void lua_registerFunction( lua_State* l, lua_CFunction func, const char* name )
 
 // Create a Lua l and load it's initial contents from <filename>
 lua_State* vlua_create( engine* e, const char* filename ) {
-	lua_State* l = lua_open();
+	lua_allocator = sizeClass_create();
+	memset( &lua_gc_stats, 0, sizeof( lua_gc_stats ));
+	lua_State* l = lua_newstate( lua_allocate, lua_allocator );
+	lua_atpanic( l, lua_panic );
 	luaL_openlibs( l );	// Load the Lua libs into our lua l
 
 	// We now use luaL_loadbuffer rather than luaL_loadfile as on Android we need
@@ -701,8 +1407,14 @@ lua_State* vlua_create( engine* e, const char* filename ) {
 	lua_registerFunction( l, LUA_print, "vprint" );
 
 	// *** Vector
-	lua_registerFunction( l, LUA_vector, "Vector" );
-	lua_registerFunction( l, LUA_vector_values, "vvector_values" );
+	lua_registerVector( l );
+
+	// *** Timers
+	lua_timersInit();
+	lua_registerFunction( l, LUA_timer_after, "vtimer_after" );
+	lua_registerFunction( l, LUA_timer_spawn, "vtimer_spawn" );
+	lua_registerFunction( l, LUA_timer_cancel, "vtimer_cancel" );
+	lua_registerFunction( l, LUA_wait, "wait" );
 
 	// *** Input
 	lua_registerFunction( l, LUA_keyPressed, "vkeyPressed" );
@@ -715,6 +1427,8 @@ lua_State* vlua_create( engine* e, const char* filename ) {
 
 	// *** Scene
 	lua_registerFunction( l, LUA_createModelInstance, "vcreateModelInstance" );
+	lua_registerFunction( l, LUA_model_preload, "vmodel_preload" );
+	lua_registerFunction( l, LUA_texture_atlas, "vtexture_atlas" );
 	lua_registerFunction( l, LUA_deleteModelInstance, "vdeleteModelInstance" );
 	lua_registerFunction( l, LUA_model_setTransform, "vmodel_setTransform" );
 	lua_registerFunction( l, LUA_setWorldSpacePosition, "vsetWorldSpacePosition" );
@@ -726,6 +1440,9 @@ lua_State* vlua_create( engine* e, const char* filename ) {
 	lua_registerFunction( l, LUA_physic_setTransform,	"vphysic_setTransform" );
 	lua_registerFunction( l, LUA_physic_activate,		"vphysic_activate" );
 	lua_registerFunction( l, LUA_physic_setVelocity,	"vphysic_setVelocity" );
+	lua_registerFunction( l, LUA_physic_setVelocities,	"vphysic_setVelocities" );
+	lua_registerFunction( l, LUA_physic_setLocalVelocity,	"vphysic_setLocalVelocity" );
+	lua_registerFunction( l, LUA_physic_setLocalVelocities,	"vphysic_setLocalVelocities" );
 	lua_registerFunction( l, LUA_physic_destroy,		"vphysic_destroy" );
 
 	// *** Transform
@@ -736,6 +1453,8 @@ lua_State* vlua_create( engine* e, const char* filename ) {
 	lua_registerFunction( l, LUA_transformVector, "vtransformVector" );
 	lua_registerFunction( l, LUA_transform_setWorldPosition, "vtransform_setWorldPosition" );
 	lua_registerFunction( l, LUA_transform_getWorldPosition, "vtransform_getWorldPosition" );
+	lua_registerFunction( l, LUA_transform_setWorldPositions, "vtransform_setWorldPositions" );
+	lua_registerFunction( l, LUA_transform_getWorldPositions, "vtransform_getWorldPositions" );
 	lua_registerFunction( l, LUA_transform_setWorldSpaceByTransform, "vtransform_setWorldSpaceByTransform" );
 	lua_registerFunction( l, LUA_transform_destroy, "vdestroyTransform" );
 	lua_registerFunction( l, LUA_transform_facingWorld, "vtransform_facingWorld" );
@@ -752,12 +1471,18 @@ lua_State* vlua_create( engine* e, const char* filename ) {
 	lua_registerFunction( l, LUA_body_destroy, "vdestroyBody" );
 	lua_registerFunction( l, LUA_body_setCollidableLayers, "vbody_setCollidableLayers" );
 	lua_registerFunction( l, LUA_body_setLayers, "vbody_setLayers" );
+	lua_registerFunction( l, LUA_collision_raycast, "vcollision_raycast" );
+	lua_registerFunction( l, LUA_collision_sphereCast, "vcollision_sphereCast" );
+	lua_registerFunction( l, LUA_collision_castBatch, "vcollision_castBatch" );
 
 	// *** Camera
 	lua_registerFunction( l, LUA_chasecam_follow, "vchasecam_follow" );
 	lua_registerFunction( l, LUA_flycam, "vflycam" );
 	lua_registerFunction( l, LUA_setCamera, "vscene_setCamera" );
 
+	// *** Render
+	lua_registerFunction( l, LUA_render_setOverdraw, "vrender_setOverdraw" );
+
 	// *** UI
 	lua_registerFunction( l, LUA_createUIPanel, "vcreateUIPanel" );
 
@@ -775,9 +1500,17 @@ lua_State* vlua_create( engine* e, const char* filename ) {
 
 	lua_keycodes( l );
 
+	lua_pushnumber( l, kCollisionLayerTerrain );
+	lua_setglobal( l, "collision_layer_terrain" );
+
 	// *** Always call init
 	LUA_CALL( l, "init" );
 
+	// From here on the engine runs the collector (see lua_gcStep())
+	lua_gc( l, LUA_GCCOLLECT, 0 );
+	lua_gc( l, LUA_GCSTOP, 0 );
+	lua_gc_stats.live_bytes = lua_allocator->total_allocated;
+
 	return l;
 }
 
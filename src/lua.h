@@ -36,6 +36,29 @@ struct luaInterface_s {
 typedef struct luaInterface_s luaInterface;
 
 void lua_preTick( lua_State* l, float dt );
+// Fire the script timers that are due; timer actions can call anything, so only call this
+// when nothing else is ticking
+void lua_timersTick( lua_State* l, float dt );
+
+// Lua allocates through a sizeClassAllocator, and its collector only runs when the engine steps it
+// in idle time (see lua_gcStep()), so collection doesn't land in the middle of a tick
+typedef struct luaGCStats_s {
+	unsigned long long	frame_us;		// Time spent collecting since the last lua_gcNewFrame()
+	int					frame_steps;
+	int					cycles;			// Completed collection cycles
+	size_t				live_bytes;		// in bytes, allocated at the end of the last cycle
+	int					emergencies;	// Frames the collector had to run during the tick
+} luaGCStats;
+
+extern luaGCStats lua_gc_stats;
+extern sizeClassAllocator* lua_allocator;
+
+// Do one bounded increment of garbage collection
+// Returns false once a collection cycle has finished, so there's no more to do this frame
+bool lua_gcStep( lua_State* l );
+
+// Print this frame's Lua memory and collection telemetry, then reset the per-frame counters
+void lua_gcNewFrame();
 
 // Is the luaCallback currently enabled?
 int luaCallback_enabled(luaCallback* l);
@@ -8,19 +8,27 @@
 #ifndef ANDROID
 
 #include "common.h"
+#include "canyon_terrain.h"
 #include "collision.h"
 #include "engine.h"
 #include "input.h"
 #include "maths/maths.h"
 #include "particle.h"
+#include "scene.h"
 #include "terrain.h"
+#include "transform.h"
+#include "base/array.h"
 #include "mem/allocator.h"
+#include "mem/pool.h"
 #include "render/modelinstance.h"
 #include "system/file.h"
 #include "system/hash.h"
 #include "system/string.h"
 
 void test_lisp();
+void test_lisp_vm();
+void test_symbol();
+void benchmark_lisp();
 
 // ###################################
 
@@ -28,17 +36,23 @@ void test_lisp();
 void runTests() {
 	// Memory Tests
 	test_allocator();
+	test_pool();
+	test_array();
 
 	test_hash();
 
 	// System Tests
+	test_symbol();
 	test_sfile();
 	
 	test_lisp();
+	test_lisp_vm();
+	//benchmark_lisp();
 
 	test_maths();
 
 	test_property();
+	test_particleCache();
 
 	test_string();
 
@@ -46,9 +60,26 @@ void runTests() {
 
 	test_aabb_calculate();
 
+	test_tickGraph();
+
+	test_transform();
+	//benchmark_transform();
+
+	test_sceneFile();
+	//benchmark_sceneFile();
+
 	//test_collision();
+	test_collisionMesh();
+	test_collisionCast();
+	//benchmark_collision();
 	
 	//test_terrain();
+
+	// These need the canyon to have been generated
+	test_canyonTerrainCollision();
+	//benchmark_canyonTerrainCollision();
+	test_canyonTerrainNormals();
+	//benchmark_canyonTerrainGeneration();
 }
 #endif // UNIT_TEST
 
@@ -2,8 +2,11 @@
 #include "common.h"
 #include "geometry.h"
 //----------------------
+#include "test.h"
 #include "maths/maths.h"
+#include "maths/matrix.h"
 #include "maths/vector.h"
+#include <float.h>
 
 // Calculate the normal and distance of a plane containing 3 points
 // ax + by + cz - d = 0
@@ -35,3 +38,454 @@ float segment_closestPoint( vector a, vector b, vector point, vector* closest )
 
 	return ( d - a_d ) / ( b_d - a_d );
 }
+
+// Ericson's method: find the Voronoi region of the triangle that [p] is in, using barycentrics
+vector triangle_closestPoint( const vector* p, const vector* a, const vector* b, const vector* c ) {
+	vector ab = vector_sub( *b, *a );
+	vector ac = vector_sub( *c, *a );
+	vector ap = vector_sub( *p, *a );
+	float d1 = Dot( &ab, &ap );
+	float d2 = Dot( &ac, &ap );
+	if ( d1 <= 0.f && d2 <= 0.f )
+		return *a;
+
+	vector bp = vector_sub( *p, *b );
+	float d3 = Dot( &ab, &bp );
+	float d4 = Dot( &ac, &bp );
+	if ( d3 >= 0.f && d4 <= d3 )
+		return *b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if ( vc <= 0.f && d1 >= 0.f && d3 <= 0.f )
+		return vector_add( *a, vector_scaled( ab, d1 / ( d1 - d3 )));
+
+	vector cp = vector_sub( *p, *c );
+	float d5 = Dot( &ab, &cp );
+	float d6 = Dot( &ac, &cp );
+	if ( d6 >= 0.f && d5 <= d6 )
+		return *c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if ( vb <= 0.f && d2 >= 0.f && d6 <= 0.f )
+		return vector_add( *a, vector_scaled( ac, d2 / ( d2 - d6 )));
+
+	float va = d3 * d6 - d5 * d4;
+	if ( va <= 0.f && ( d4 - d3 ) >= 0.f && ( d5 - d6 ) >= 0.f ) {
+		vector bc = vector_sub( *c, *b );
+		return vector_add( *b, vector_scaled( bc, ( d4 - d3 ) / (( d4 - d3 ) + ( d5 - d6 ))));
+	}
+
+	// Inside the face
+	float denom = 1.f / ( va + vb + vc );
+	return vector_add( *a, vector_add( vector_scaled( ab, vb * denom ), vector_scaled( ac, vc * denom )));
+}
+
+// Are the triangles' projections onto [axis] disjoint?
+bool triangle_separatedOnAxis( const vector* a, const vector* b, const vector* axis ) {
+	float a_min = FLT_MAX, a_max = -FLT_MAX;
+	float b_min = FLT_MAX, b_max = -FLT_MAX;
+	for ( int i = 0; i < 3; i++ ) {
+		float d = Dot( &a[i], axis );
+		a_min = minf( a_min, d );
+		a_max = maxf( a_max, d );
+		d = Dot( &b[i], axis );
+		b_min = minf( b_min, d );
+		b_max = maxf( b_max, d );
+	}
+	return a_max < b_min || b_max < a_min;
+}
+
+/*
+   Separating axis test. Two triangles are disjoint if and only if their projections are disjoint
+   on one of: either face normal, or the cross product of an edge from each. When the triangles
+   are coplanar those cross products all degenerate to the normal, so the in-plane edge normals
+   are tested instead.
+   */
+bool triangle_intersectsTriangle( const vector* a, const vector* b ) {
+	vector a_edges[3], b_edges[3];
+	for ( int i = 0; i < 3; i++ ) {
+		a_edges[i] = vector_sub( a[( i + 1 ) % 3], a[i] );
+		b_edges[i] = vector_sub( b[( i + 1 ) % 3], b[i] );
+	}
+	vector a_normal, b_normal;
+	Cross( &a_normal, &a_edges[0], &a_edges[1] );
+	Cross( &b_normal, &b_edges[0], &b_edges[1] );
+	// Degenerate triangles have no surface to touch
+	if ( vector_lengthSq( &a_normal ) == 0.f || vector_lengthSq( &b_normal ) == 0.f )
+		return false;
+	if ( triangle_separatedOnAxis( a, b, &a_normal ) || triangle_separatedOnAxis( a, b, &b_normal ))
+		return false;
+
+	vector normal_cross;
+	Cross( &normal_cross, &a_normal, &b_normal );
+	const float epsilon = 1e-6f;
+	bool coplanar = vector_lengthSq( &normal_cross ) <= epsilon * vector_lengthSq( &a_normal ) * vector_lengthSq( &b_normal );
+	if ( !coplanar ) {
+		for ( int i = 0; i < 3; i++ ) {
+			for ( int j = 0; j < 3; j++ ) {
+				vector axis;
+				Cross( &axis, &a_edges[i], &b_edges[j] );
+				// Parallel edges give no axis; the other axes cover them
+				if ( vector_lengthSq( &axis ) <= epsilon * vector_lengthSq( &a_edges[i] ) * vector_lengthSq( &b_edges[j] ))
+					continue;
+				if ( triangle_separatedOnAxis( a, b, &axis ))
+					return false;
+			}
+		}
+	}
+	else {
+		for ( int i = 0; i < 3; i++ ) {
+			vector axis;
+			Cross( &axis, &a_normal, &a_edges[i] );
+			if ( triangle_separatedOnAxis( a, b, &axis ))
+				return false;
+			Cross( &axis, &b_normal, &b_edges[i] );
+			if ( triangle_separatedOnAxis( a, b, &axis ))
+				return false;
+		}
+	}
+	return true;
+}
+
+// Moller-Trumbore
+bool ray_intersectsTriangle( const vector* origin, const vector* dir, const vector* a, const vector* b, const vector* c, float* t ) {
+	vector ab = vector_sub( *b, *a );
+	vector ac = vector_sub( *c, *a );
+	vector p;
+	Cross( &p, dir, &ac );
+	float det = Dot( &ab, &p );
+	if ( fabsf( det ) < 1e-12f )
+		return false;
+	float inv_det = 1.f / det;
+	vector offset = vector_sub( *origin, *a );
+	float u = Dot( &offset, &p ) * inv_det;
+	if ( u < 0.f || u > 1.f )
+		return false;
+	vector q;
+	Cross( &q, &offset, &ab );
+	float v = Dot( dir, &q ) * inv_det;
+	if ( v < 0.f || u + v > 1.f )
+		return false;
+	*t = Dot( &ac, &q ) * inv_det;
+	return *t >= 0.f;
+}
+
+// Slab test: the ray is inside the box between the last entry and first exit across the axes
+bool ray_clipAABB( const vector* origin, const vector* dir, const aabb* bb, float max_t, float* enter, float* exit ) {
+	float t_min = 0.f;
+	float t_max = max_t;
+	for ( int i = 0; i < 3; i++ ) {
+		if ( fabsf( dir->val[i] ) < 1e-12f ) {
+			if ( origin->val[i] < bb->min.val[i] || origin->val[i] > bb->max.val[i] )
+				return false;
+			continue;
+		}
+		float inv = 1.f / dir->val[i];
+		float t0 = ( bb->min.val[i] - origin->val[i] ) * inv;
+		float t1 = ( bb->max.val[i] - origin->val[i] ) * inv;
+		t_min = maxf( t_min, minf( t0, t1 ));
+		t_max = minf( t_max, maxf( t0, t1 ));
+		if ( t_min > t_max )
+			return false;
+	}
+	*enter = t_min;
+	*exit = t_max;
+	return true;
+}
+
+bool ray_intersectsAABB( const vector* origin, const vector* dir, const aabb* bb, float max_t ) {
+	float enter, exit;
+	return ray_clipAABB( origin, dir, bb, max_t, &enter, &exit );
+}
+
+// Zero components become huge rather than infinite, so a ray lying on a box face doesn't produce 0 * inf
+vector ray_inverseDirection( const vector* dir ) {
+	vector inv;
+	for ( int i = 0; i < 3; i++ )
+		inv.val[i] = fabsf( dir->val[i] ) < 1e-12f ? copysignf( 1e30f, dir->val[i] ) : 1.f / dir->val[i];
+	inv.coord.w = 0.f;
+	return inv;
+}
+
+// With the reciprocal direction precomputed, for testing one ray against many boxes
+bool ray_clipAABBInverse( const vector* origin, const vector* inv_dir, const aabb* bb, float max_t, float* enter, float* exit ) {
+	float t_min = 0.f;
+	float t_max = max_t;
+	for ( int i = 0; i < 3; i++ ) {
+		float t0 = ( bb->min.val[i] - origin->val[i] ) * inv_dir->val[i];
+		float t1 = ( bb->max.val[i] - origin->val[i] ) * inv_dir->val[i];
+		t_min = maxf( t_min, minf( t0, t1 ));
+		t_max = minf( t_max, maxf( t0, t1 ));
+	}
+	*enter = t_min;
+	*exit = t_max;
+	return t_min <= t_max;
+}
+
+bool ray_intersectsSphere( const vector* origin, const vector* dir, const vector* center, float radius, float* t ) {
+	vector offset = vector_sub( *origin, *center );
+	float c = Dot( &offset, &offset ) - radius * radius;
+	if ( c <= 0.f ) {
+		*t = 0.f;
+		return true;
+	}
+	float b = Dot( &offset, dir );
+	float discriminant = b * b - c;
+	if ( b > 0.f || discriminant < 0.f )
+		return false;
+	*t = -b - sqrtf( discriminant );
+	return true;
+}
+
+// The first root in [0, max_t] of A t^2 + B t + C = 0, where C > 0 (so it starts outside)
+bool sweep_firstRoot( float a, float b, float c, float max_t, float* t ) {
+	if ( a < 1e-12f || b >= 0.f )
+		return false;
+	float discriminant = b * b - 4.f * a * c;
+	if ( discriminant < 0.f )
+		return false;
+	float root = ( -b - sqrtf( discriminant )) / ( 2.f * a );
+	if ( root < 0.f || root > max_t )
+		return false;
+	*t = root;
+	return true;
+}
+
+/*
+   The sphere first touches the triangle either on its face, where the offset plane is crossed inside
+   the triangle, or on an edge (a ray against a cylinder) or a vertex (a ray against a sphere).
+   The face is tried first, as when it is hit nothing else can be hit sooner.
+   */
+bool sphere_sweepTriangle( const vector* origin, const vector* dir, float radius, const vector* a, const vector* b, const vector* c, float max_t, float* t ) {
+	vector closest = triangle_closestPoint( origin, a, b, c );
+	vector offset = vector_sub( *origin, closest );
+	if ( Dot( &offset, &offset ) <= radius * radius ) {
+		*t = 0.f;
+		return true;
+	}
+
+	vector ab = vector_sub( *b, *a );
+	vector ac = vector_sub( *c, *a );
+	vector normal;
+	Cross( &normal, &ab, &ac );
+	float normal_length = vector_length( &normal );
+	if ( normal_length > 1e-12f ) {
+		normal = vector_scaled( normal, 1.f / normal_length );
+		vector from_a = vector_sub( *origin, *a );
+		float distance = Dot( &from_a, &normal );
+		if ( distance < 0.f ) {
+			normal = vector_scaled( normal, -1.f );
+			distance = -distance;
+		}
+		float approach = -Dot( dir, &normal );
+		if ( distance > radius && approach > 0.f ) {
+			float plane_t = ( distance - radius ) / approach;
+			if ( plane_t > max_t )
+				return false;	// Edges and vertices are no nearer than the plane
+			// Inside if the touching point is on the inner side of every edge
+			vector contact = vector_sub( vector_add( *origin, vector_scaled( *dir, plane_t )), vector_scaled( normal, radius ));
+			const vector* corners[3] = { a, b, c };
+			int inside = 0;
+			for ( int i = 0; i < 3; i++ ) {
+				vector edge = vector_sub( *corners[( i + 1 ) % 3], *corners[i] );
+				vector to_contact = vector_sub( contact, *corners[i] );
+				vector side;
+				Cross( &side, &edge, &to_contact );
+				inside += Dot( &side, &normal ) >= 0.f ? 1 : -1;
+			}
+			if ( inside == 3 || inside == -3 ) {
+				*t = plane_t;
+				return true;
+			}
+		}
+	}
+
+	bool hit = false;
+	float best = max_t;
+	float d_d = Dot( dir, dir );
+	const vector* corners[3] = { a, b, c };
+	for ( int i = 0; i < 3; i++ ) {
+		const vector* start = corners[i];
+		const vector* end = corners[( i + 1 ) % 3];
+		vector edge = vector_sub( *end, *start );
+		vector m = vector_sub( *origin, *start );
+		float e_e = Dot( &edge, &edge );
+		float m_d = Dot( &m, dir );
+		float m_m = Dot( &m, &m );
+		float root;
+
+		// The vertex
+		if ( sweep_firstRoot( d_d, 2.f * m_d, m_m - radius * radius, best, &root )) {
+			best = root;
+			hit = true;
+		}
+
+		// The edge, as the cylinder around it, where the touching point projects inside the edge
+		if ( e_e > 1e-12f ) {
+			float m_e = Dot( &m, &edge );
+			float d_e = Dot( dir, &edge );
+			float qa = d_d - d_e * d_e / e_e;
+			float qb = 2.f * ( m_d - m_e * d_e / e_e );
+			float qc = m_m - m_e * m_e / e_e - radius * radius;
+			if ( sweep_firstRoot( qa, qb, qc, best, &root )) {
+				float along = ( m_e + root * d_e ) / e_e;
+				if ( along >= 0.f && along <= 1.f ) {
+					best = root;
+					hit = true;
+				}
+			}
+		}
+	}
+	if ( hit )
+		*t = best;
+	return hit;
+}
+
+bool aabb_intersects( const aabb* a, const aabb* b ) {
+	return a->min.coord.x <= b->max.coord.x && a->max.coord.x >= b->min.coord.x &&
+		a->min.coord.y <= b->max.coord.y && a->max.coord.y >= b->min.coord.y &&
+		a->min.coord.z <= b->max.coord.z && a->max.coord.z >= b->min.coord.z;
+}
+
+float aabb_distanceSq( const aabb* bb, const vector* p ) {
+	float distance_sq = 0.f;
+	for ( int i = 0; i < 3; i++ ) {
+		float d = maxf( bb->min.val[i] - p->val[i], 0.f ) + maxf( p->val[i] - bb->max.val[i], 0.f );
+		distance_sq += d * d;
+	}
+	return distance_sq;
+}
+
+// Arvo's method: each output extent is the sum of the smaller and larger products per axis
+void aabb_transform( aabb* dst, const aabb* src, matrix m ) {
+	aabb result;
+	for ( int row = 0; row < 3; row++ ) {
+		result.min.val[row] = m[3][row];
+		result.max.val[row] = m[3][row];
+		for ( int col = 0; col < 3; col++ ) {
+			float e = m[col][row] * src->min.val[col];
+			float f = m[col][row] * src->max.val[col];
+			result.min.val[row] += minf( e, f );
+			result.max.val[row] += maxf( e, f );
+		}
+	}
+	result.min.coord.w = 1.f;
+	result.max.coord.w = 1.f;
+	*dst = result;
+}
+
+// The Gribb-Hartmann method: each plane is the sum or difference of the last row and one other row
+// of the projection * view matrix (matrices are column major, so row r is m[0..3][r])
+void frustum_fromMatrix( vector* frustum, matrix m ) {
+	for ( int i = 0; i < kFrustumPlaneCount; i++ ) {
+		int row = i / 2;
+		float sign = ( i % 2 ) ? -1.f : 1.f;
+		vector* plane = &frustum[i];
+		for ( int col = 0; col < 4; col++ )
+			plane->val[col] = m[col][3] + sign * m[col][row];
+		float length = sqrtf( plane->coord.x * plane->coord.x + plane->coord.y * plane->coord.y + plane->coord.z * plane->coord.z );
+		for ( int col = 0; col < 4; col++ )
+			plane->val[col] /= length;
+	}
+}
+
+bool frustum_cullAABB( const vector* frustum, const aabb* bb ) {
+	for ( int i = 0; i < kFrustumPlaneCount; i++ ) {
+		const vector* plane = &frustum[i];
+		// Only the corner furthest along the plane normal needs testing
+		vector corner = Vector( plane->coord.x >= 0.f ? bb->max.coord.x : bb->min.coord.x,
+								plane->coord.y >= 0.f ? bb->max.coord.y : bb->min.coord.y,
+								plane->coord.z >= 0.f ? bb->max.coord.z : bb->min.coord.z, 1.f );
+		if ( Dot( plane, &corner ) + plane->coord.w < 0.f )
+			return true;
+	}
+	return false;
+}
+
+bool frustum_cullSphere( const vector* frustum, const vector* center, float radius ) {
+	for ( int i = 0; i < kFrustumPlaneCount; i++ ) {
+		const vector* plane = &frustum[i];
+		if ( Dot( plane, center ) + plane->coord.w < -radius )
+			return true;
+	}
+	return false;
+}
+
+#ifdef UNIT_TEST
+void test_frustum() {
+	// A camera at the origin looking down +z, near 1, far 100
+	const float near = 1.f, far = 100.f;
+	matrix projection;
+	matrix_setIdentity( projection );
+	projection[2][2] = ( far + near ) / ( far - near );
+	projection[2][3] = 1.f;
+	projection[3][2] = ( -2.f * far * near ) / ( far - near );
+	projection[3][3] = 0.f;
+
+	vector frustum[kFrustumPlaneCount];
+	frustum_fromMatrix( frustum, projection );
+
+	vector ahead = Vector( 0.f, 0.f, 10.f, 1.f );
+	vector behind = Vector( 0.f, 0.f, -10.f, 1.f );
+	vector beyond = Vector( 0.f, 0.f, 200.f, 1.f );
+	vector aside = Vector( 50.f, 0.f, 10.f, 1.f );
+	test( !frustum_cullSphere( frustum, &ahead, 1.f ), "Frustum kept a sphere in view.", "Frustum culled a sphere in view." );
+	test( frustum_cullSphere( frustum, &behind, 1.f ) && frustum_cullSphere( frustum, &beyond, 1.f ) && frustum_cullSphere( frustum, &aside, 1.f ),
+			"Frustum culled spheres out of view.", "Frustum failed to cull spheres out of view." );
+	test( !frustum_cullSphere( frustum, &aside, 40.f ), "Frustum kept a sphere overlapping the view.", "Frustum culled a sphere overlapping the view." );
+
+	aabb inside = { Vector( -1.f, -1.f, 5.f, 1.f ), Vector( 1.f, 1.f, 6.f, 1.f ) };
+	aabb straddling = { Vector( -100.f, -1.f, 5.f, 1.f ), Vector( 0.f, 1.f, 6.f, 1.f ) };
+	aabb outside = { Vector( 20.f, -1.f, 5.f, 1.f ), Vector( 30.f, 1.f, 6.f, 1.f ) };
+	test( !frustum_cullAABB( frustum, &inside ) && !frustum_cullAABB( frustum, &straddling ), "Frustum kept boxes in view.", "Frustum culled a box in view." );
+	test( frustum_cullAABB( frustum, &outside ), "Frustum culled a box out of view.", "Frustum failed to cull a box out of view." );
+}
+
+void test_triangle() {
+	vector a[3] = { Vector( 0.f, 0.f, 0.f, 1.f ), Vector( 2.f, 0.f, 0.f, 1.f ), Vector( 0.f, 0.f, 2.f, 1.f ) };
+
+	// Closest points: on the face, an edge and a vertex
+	vector above = Vector( 0.5f, 3.f, 0.5f, 1.f );
+	vector beside = Vector( 1.f, 0.f, -1.f, 1.f );
+	vector beyond = Vector( -1.f, 1.f, -1.f, 1.f );
+	vector face = triangle_closestPoint( &above, &a[0], &a[1], &a[2] );
+	vector edge = triangle_closestPoint( &beside, &a[0], &a[1], &a[2] );
+	vector corner = triangle_closestPoint( &beyond, &a[0], &a[1], &a[2] );
+	vector expected_face = Vector( 0.5f, 0.f, 0.5f, 1.f );
+	vector expected_edge = Vector( 1.f, 0.f, 0.f, 1.f );
+	test( vector_distance( &face, &expected_face ) < 0.0001f && vector_distance( &edge, &expected_edge ) < 0.0001f && vector_distance( &corner, &a[0] ) < 0.0001f,
+			"Triangle closest points are correct.", "Triangle closest points are wrong." );
+
+	// Crossing, apart, and coplanar overlapping
+	vector crossing[3] = { Vector( 0.5f, -1.f, 0.5f, 1.f ), Vector( 0.5f, 1.f, 0.5f, 1.f ), Vector( 0.6f, 1.f, 0.4f, 1.f ) };
+	vector apart[3] = { Vector( 0.5f, 0.1f, 0.5f, 1.f ), Vector( 0.5f, 1.f, 0.5f, 1.f ), Vector( 0.6f, 1.f, 0.4f, 1.f ) };
+	vector coplanar[3] = { Vector( 0.5f, 0.f, 0.5f, 1.f ), Vector( 3.f, 0.f, 0.5f, 1.f ), Vector( 0.5f, 0.f, 3.f, 1.f ) };
+	vector coplanar_apart[3] = { Vector( 3.f, 0.f, 3.f, 1.f ), Vector( 4.f, 0.f, 3.f, 1.f ), Vector( 3.f, 0.f, 4.f, 1.f ) };
+	test( triangle_intersectsTriangle( a, crossing ) && triangle_intersectsTriangle( a, coplanar ), "Intersecting triangles detected.", "Intersecting triangles missed." );
+	test( !triangle_intersectsTriangle( a, apart ) && !triangle_intersectsTriangle( a, coplanar_apart ), "Separate triangles not intersecting.", "Separate triangles reported intersecting." );
+
+	vector origin = Vector( 0.5f, -2.f, 0.5f, 1.f );
+	float t = 0.f;
+	test( ray_intersectsTriangle( &origin, &y_axis, &a[0], &a[1], &a[2], &t ) && f_eq( t, 2.f ), "Ray hit triangle.", "Ray missed triangle." );
+
+	vector center = Vector( 0.5f, 3.f, 0.5f, 1.f );
+	vector off_ray = Vector( 3.f, 3.f, 0.5f, 1.f );
+	test( ray_intersectsSphere( &origin, &y_axis, &center, 1.f, &t ) && f_eq( t, 4.f ), "Ray hit sphere.", "Ray missed sphere." );
+	test( !ray_intersectsSphere( &origin, &y_axis, &off_ray, 1.f, &t ), "Ray passed sphere.", "Ray hit sphere it should miss." );
+
+	// Swept spheres touch the face, an edge and a vertex, and pass just clear
+	vector down = Vector( 0.f, -1.f, 0.f, 0.f );
+	vector over_edge = Vector( -5.f, 0.99f, 0.5f, 1.f );
+	vector by_corner = Vector( -5.f, 0.5f, -0.5f, 1.f );
+	vector clear = Vector( -5.f, 1.01f, 0.5f, 1.f );
+	float t_face = 0.f, t_edge = 0.f, t_corner = 0.f;
+	bool face_hit = sphere_sweepTriangle( &above, &down, 1.f, &a[0], &a[1], &a[2], 100.f, &t_face );
+	bool edge_hit = sphere_sweepTriangle( &over_edge, &x_axis, 1.f, &a[0], &a[1], &a[2], 100.f, &t_edge );
+	bool corner_hit = sphere_sweepTriangle( &by_corner, &x_axis, 1.f, &a[0], &a[1], &a[2], 100.f, &t_corner );
+	test( face_hit && edge_hit && corner_hit && fabsf( t_face - 2.f ) < 0.001f &&
+			fabsf( t_edge - ( 5.f - sqrtf( 1.f - 0.99f * 0.99f ))) < 0.001f && fabsf( t_corner - ( 5.f - sqrtf( 0.5f ))) < 0.001f,
+			"Swept sphere touched triangle.", "Swept sphere missed triangle." );
+	test( !sphere_sweepTriangle( &clear, &x_axis, 1.f, &a[0], &a[1], &a[2], 100.f, &t ) && !sphere_sweepTriangle( &over_edge, &x_axis, 1.f, &a[0], &a[1], &a[2], 4.f, &t ),
+			"Swept sphere passed triangle.", "Swept sphere hit triangle it should miss." );
+}
+#endif // UNIT_TEST
@@ -3,6 +3,58 @@
 
 #include "maths/mathstypes.h"
 
+// An axis aligned bounding box
+typedef struct aabb_s {
+	vector min;
+	vector max;
+} aabb;
+
+/*
+   A frustum is 6 planes: Left, Right, Bottom, Top, Near, Far
+   Each plane is a vector with the normal (pointing inwards) in xyz and the distance in w,
+   so a point p is inside the plane when Dot( n, p ) + w >= 0
+   */
+#define kFrustumPlaneCount 6
+
 void plane( vector a, vector b, vector c, vector* normal, float* d );
 
 float segment_closestPoint( vector a, vector b, vector point, vector* closest );
+
+// The point on the triangle [a], [b], [c] closest to [p]
+vector triangle_closestPoint( const vector* p, const vector* a, const vector* b, const vector* c );
+
+// Do the triangles [a] and [b] (3 verts each) touch?
+bool triangle_intersectsTriangle( const vector* a, const vector* b );
+
+// Does the ray from [origin] along [dir] hit the triangle? If so [t] is how far along [dir]
+bool ray_intersectsTriangle( const vector* origin, const vector* dir, const vector* a, const vector* b, const vector* c, float* t );
+
+// Does the ray from [origin] along [dir] hit the box within [max_t]?
+bool ray_intersectsAABB( const vector* origin, const vector* dir, const aabb* bb, float max_t );
+// As ray_intersectsAABB, also giving the distances along [dir] where the ray enters and leaves the box
+bool ray_clipAABB( const vector* origin, const vector* dir, const aabb* bb, float max_t, float* enter, float* exit );
+// As ray_clipAABB, taking ray_inverseDirection( dir ), for testing one ray against many boxes
+vector ray_inverseDirection( const vector* dir );
+bool ray_clipAABBInverse( const vector* origin, const vector* inv_dir, const aabb* bb, float max_t, float* enter, float* exit );
+// Does the ray from [origin] along unit [dir] hit the sphere? [t] is 0 if [origin] is inside
+bool ray_intersectsSphere( const vector* origin, const vector* dir, const vector* center, float radius, float* t );
+// Does a sphere of [radius] moving from [origin] along [dir] touch the triangle within [max_t]? [t] is 0 if it starts touching
+bool sphere_sweepTriangle( const vector* origin, const vector* dir, float radius, const vector* a, const vector* b, const vector* c, float max_t, float* t );
+
+bool aabb_intersects( const aabb* a, const aabb* b );
+// Squared distance from [p] to the box; 0 if inside
+float aabb_distanceSq( const aabb* bb, const vector* p );
+// The box containing [src] transformed by [m]
+void aabb_transform( aabb* dst, const aabb* src, matrix m );
+
+// Extract the frustum planes from a combined projection * view matrix
+void frustum_fromMatrix( vector* frustum, matrix view_projection );
+
+// Is the box / sphere completely outside the frustum?
+bool frustum_cullAABB( const vector* frustum, const aabb* bb );
+bool frustum_cullSphere( const vector* frustum, const vector* center, float radius );
+
+#ifdef UNIT_TEST
+void test_frustum();
+void test_triangle();
+#endif // UNIT_TEST
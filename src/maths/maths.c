@@ -2,6 +2,7 @@
 #include "common.h"
 #include "maths.h"
 //----------------------
+#include "maths/geometry.h"
 #include "maths/matrix.h"
 #include "maths/quaternion.h"
 #include "maths/vector.h"
@@ -66,5 +67,8 @@ void test_maths() {
 	test_quaternion();
 
 	test_matrix();
+
+	test_frustum();
+	test_triangle();
 }
 #endif // UNIT_TEST
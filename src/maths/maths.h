@@ -16,6 +16,10 @@ float fsign( float f );
 int max( int a, int b );
 int min( int a, int b );
 
+// For inner loops: fminf/fmaxf are library calls, as they have to handle NaN, where these are single instructions
+static inline float minf( float a, float b ) { return a < b ? a : b; }
+static inline float maxf( float a, float b ) { return a > b ? a : b; }
+
 int clamp( int a, int bottom, int top );
 bool contains( int a, int min, int max );
 
@@ -257,6 +257,7 @@ heapAllocator* heap_create( int heap_size ) {
 	allocator->total_size = heap_size;
 	allocator->total_free = heap_size;
 	allocator->total_allocated = 0;
+	allocator->allocations = 0;
 	
 	// Should not be possible to fail creating the first block header
 	block* first = block_create( data, heap_size );
@@ -332,6 +333,30 @@ void test_allocator() {
 	b = heap_allocate( heap, 512 );
 	memset( b, 0, 512 );
 	test( true, "Allocated 512 bytes succesfully.", NULL );
+
+	printf( "%s--- Beginning Unit Test: Arena Allocator ---\n", TERM_WHITE );
+	arenaAllocator* arena = arena_create( 1024 );
+	a = arena_allocate( arena, 100 );
+	b = arena_allocate( arena, 100 );
+	test( a && b && ((uintptr_t)b & 0xf ) == 0, "Allocated aligned arena blocks.", "Arena blocks not allocated or not aligned." );
+	test( arena_contains( arena, a ) && !arena_contains( arena, heap ), "Arena identifies its own allocations.", "Arena_contains incorrect." );
+	test( arena_allocate( arena, 1024 ) == NULL, "Arena refuses allocations when full.", "Arena allocated past its end." );
+	arena_reset( arena );
+	test( arena_allocate( arena, 1024 ) == a, "Arena reset releases all allocations.", "Arena reset failed." );
+
+	printf( "%s--- Beginning Unit Test: Size Class Allocator ---\n", TERM_WHITE );
+	sizeClassAllocator* classes = sizeClass_create();
+	a = sizeClass_allocate( classes, 24 );
+	b = sizeClass_allocate( classes, 24 );
+	test( a && b && a != b && ((uintptr_t)a & 0xf ) == 0 && ((uintptr_t)b & 0xf ) == 0, "Allocated aligned size class slots.", "Size class slots not allocated or not aligned." );
+	sizeClass_deallocate( classes, a, 24 );
+	test( sizeClass_allocate( classes, 20 ) == a, "Freed slots are reused by their size class.", "Freed slot not reused." );
+	memset( b, 0xab, 24 );
+	void* c = sizeClass_reallocate( classes, b, 24, 1000 );
+	test( ((uint8_t*)c)[23] == 0xab, "Reallocating to a large size keeps the contents.", "Reallocate lost the contents." );
+	test( classes->total_allocated == 20 + 1000 && classes->allocations == 2, "Size class allocator tracks live bytes.", "Size class stats incorrect." );
+	sizeClass_deallocate( classes, c, 1000 );
+	sizeClass_delete( classes );
 }
 #endif // UNIT_TEST
 
@@ -362,6 +387,129 @@ void passthrough_deallocate( passthroughAllocator* p, void* mem ) {
 	--p->allocations;
 	}
 	
+arenaAllocator* arena_create( size_t size ) {
+	arenaAllocator* a = mem_alloc( sizeof( arenaAllocator ));
+	a->data = heap_allocate_aligned( static_heap, size, 16 );
+	a->total_size = size;
+	a->total_allocated = 0;
+	a->peak_allocated = 0;
+	return a;
+}
+
+void arena_delete( arenaAllocator* a ) {
+	heap_deallocate( static_heap, a->data );
+	mem_free( a );
+}
+
+// Not threadsafe; an arena belongs to a single thread
+void* arena_allocate( arenaAllocator* a, size_t size ) {
+	size = ( size + 0xf ) & ~(size_t)0xf;
+	if ( a->total_allocated + size > a->total_size )
+		return NULL;
+	void* mem = a->data + a->total_allocated;
+	a->total_allocated += size;
+	if ( a->total_allocated > a->peak_allocated )
+		a->peak_allocated = a->total_allocated;
+	return mem;
+}
+
+bool arena_contains( arenaAllocator* a, const void* mem ) {
+	return (const uint8_t*)mem >= a->data && (const uint8_t*)mem < a->data + a->total_size;
+}
+
+void arena_reset( arenaAllocator* a ) {
+	a->total_allocated = 0;
+}
+
+sizeClassAllocator* sizeClass_create() {
+	sizeClassAllocator* a = mem_alloc( sizeof( sizeClassAllocator ));
+	memset( a, 0, sizeof( sizeClassAllocator ));
+	return a;
+}
+
+void sizeClass_delete( sizeClassAllocator* a ) {
+	void* chunk = a->chunks;
+	while ( chunk ) {
+		void* next = *(void**)chunk;
+		heap_deallocate( static_heap, chunk );
+		chunk = next;
+	}
+	mem_free( a );
+}
+
+static inline int sizeClass_index( size_t size ) {
+	return (int)(( size + kSizeClassGranularity - 1 ) / kSizeClassGranularity ) - 1;
+}
+
+// Carve a new chunk into slots for size class [i]
+void sizeClass_addChunk( sizeClassAllocator* a, int i ) {
+	size_t slot_size = (size_t)( i + 1 ) * kSizeClassGranularity;
+	uint8_t* chunk = heap_allocate_aligned( static_heap, kSizeClassChunkSize, 16 );
+	*(void**)chunk = a->chunks;
+	a->chunks = chunk;
+	a->total_reserved += kSizeClassChunkSize;
+	// The first slot holds the chunk link
+	uint8_t* end = chunk + kSizeClassChunkSize;
+	for ( uint8_t* slot = chunk + slot_size; slot + slot_size <= end; slot += slot_size ) {
+		*(void**)slot = a->free[i];
+		a->free[i] = slot;
+	}
+}
+
+void* sizeClass_allocate( sizeClassAllocator* a, size_t size ) {
+	vAssert( size > 0 );
+	void* mem;
+	if ( size > kSizeClassMaxSize )
+		mem = heap_allocate_aligned( static_heap, size, 16 );
+	else {
+		int i = sizeClass_index( size );
+		if ( !a->free[i] )
+			sizeClass_addChunk( a, i );
+		mem = a->free[i];
+		a->free[i] = *(void**)mem;
+	}
+	a->total_allocated += size;
+	if ( a->total_allocated > a->peak_allocated )
+		a->peak_allocated = a->total_allocated;
+	++a->allocations;
+	++a->frame_allocations;
+	a->frame_allocated += size;
+	return mem;
+}
+
+void sizeClass_deallocate( sizeClassAllocator* a, void* mem, size_t size ) {
+	if ( size > kSizeClassMaxSize )
+		heap_deallocate( static_heap, mem );
+	else {
+		int i = sizeClass_index( size );
+		*(void**)mem = a->free[i];
+		a->free[i] = mem;
+	}
+	a->total_allocated -= size;
+	--a->allocations;
+}
+
+void* sizeClass_reallocate( sizeClassAllocator* a, void* mem, size_t old_size, size_t new_size ) {
+	if ( !mem )
+		return sizeClass_allocate( a, new_size );
+	// Staying in the same size class needs no move
+	if ( old_size <= kSizeClassMaxSize && new_size <= kSizeClassMaxSize && sizeClass_index( old_size ) == sizeClass_index( new_size )) {
+		a->total_allocated += new_size - old_size;
+		if ( a->total_allocated > a->peak_allocated )
+			a->peak_allocated = a->total_allocated;
+		return mem;
+	}
+	void* moved = sizeClass_allocate( a, new_size );
+	memcpy( moved, mem, old_size < new_size ? old_size : new_size );
+	sizeClass_deallocate( a, mem, old_size );
+	return moved;
+}
+
+void sizeClass_resetFrameStats( sizeClassAllocator* a ) {
+	a->frame_allocations = 0;
+	a->frame_allocated = 0;
+}
+
 void mem_pushStackString( const char* string ) {
 	vAssert( mem_stack_string == NULL );
 	mem_stack_string = string;
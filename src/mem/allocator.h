@@ -53,6 +53,41 @@ typedef struct passthroughAllocator_s {
 	size_t allocations;
 } passthroughAllocator;
 
+// An arena (bump) allocator
+// Allocates linearly from a fixed buffer; allocations can't be freed individually,
+// instead the whole arena is released at once with arena_reset()
+// Insertion time is O(1)
+typedef struct arenaAllocator_s {
+	uint8_t* data;
+	size_t total_size;		// in bytes, size of the arena
+	size_t total_allocated;	// in bytes, currently allocated
+	size_t peak_allocated;	// in bytes, the most ever allocated between resets
+} arenaAllocator;
+
+// A size class allocator
+// Small allocations are rounded up to a multiple of kSizeClassGranularity, and each size class
+// keeps a free list of equal slots carved from chunks of the static heap; larger allocations go
+// to the static heap directly. The caller passes the size back when freeing (as Lua's allocator
+// interface does), so slots need no header.
+// Insertion time is O(1) for small allocations
+// Not threadsafe; it belongs to a single thread
+#define kSizeClassGranularity	16
+#define kSizeClassMaxSize		512
+#define kSizeClassCount			( kSizeClassMaxSize / kSizeClassGranularity )
+#define kSizeClassChunkSize		( 64 * 1024 )
+
+struct sizeClassAllocator_s {
+	void*	free[kSizeClassCount];	// Free slots, linked through their first word
+	void*	chunks;					// Chunks, linked through their first word
+	size_t	total_reserved;			// in bytes, taken from the static heap
+	size_t	total_allocated;		// in bytes, currently allocated
+	size_t	peak_allocated;			// in bytes, the most ever allocated
+	size_t	allocations;			// currently allocated
+	// Since the last sizeClass_resetFrameStats()
+	size_t	frame_allocations;
+	size_t	frame_allocated;		// in bytes
+};
+
 // Default allocate from the static heap
 // Passes straight through to heap_allocate()
 void* mem_alloc(size_t bytes);
@@ -107,6 +142,40 @@ void* passthrough_allocate( passthroughAllocator* p, size_t size );
 // (The allocation is actually in p->heap)
 void passthrough_deallocate( passthroughAllocator* p, void* mem );
 
+// Create an arenaAllocator of *size* bytes, allocated from the static heap
+arenaAllocator* arena_create( size_t size );
+
+// Release the arena *a* and its memory
+void arena_delete( arenaAllocator* a );
+
+// Allocate *size* bytes from the arena *a*, 16-byte aligned
+// Returns NULL if the arena is full
+void* arena_allocate( arenaAllocator* a, size_t size );
+
+// Is *mem* an allocation from the arena *a*
+bool arena_contains( arenaAllocator* a, const void* mem );
+
+// Release every allocation in the arena *a*
+void arena_reset( arenaAllocator* a );
+
+// Create an empty sizeClassAllocator; chunks are taken from the static heap as needed
+sizeClassAllocator* sizeClass_create();
+
+// Release every chunk, and the allocator itself; large allocations must already be freed
+void sizeClass_delete( sizeClassAllocator* a );
+
+// Allocate *size* bytes from *a*, 16-byte aligned
+void* sizeClass_allocate( sizeClassAllocator* a, size_t size );
+
+// Release *mem*, which was allocated from *a* with *size* bytes
+void sizeClass_deallocate( sizeClassAllocator* a, void* mem, size_t size );
+
+// Resize *mem* from *old_size* to *new_size* bytes, moving it if it changes size class
+// *mem* can be NULL, with an *old_size* of 0
+void* sizeClass_reallocate( sizeClassAllocator* a, void* mem, size_t old_size, size_t new_size );
+
+void sizeClass_resetFrameStats( sizeClassAllocator* a );
+
 void heap_dumpBlocks( heapAllocator* heap );
 void heap_dumpUsedBlocks( heapAllocator* heap );
 
@@ -0,0 +1,62 @@
+// pool.c
+#include "common.h"
+#include "pool.h"
+//-------------------------
+#include "test.h"
+
+#ifdef UNIT_TEST
+typedef struct poolTestStruct_s {
+	int a;
+	float b;
+} poolTestStruct;
+
+DECLARE_POOL( poolTestStruct )
+IMPLEMENT_POOL( poolTestStruct )
+
+void test_pool() {
+	const int size = 40;
+	pool_poolTestStruct* pool = pool_poolTestStruct_create( size );
+	poolTestStruct* objects[40];
+	for ( int i = 0; i < size; i++ ) {
+		objects[i] = pool_poolTestStruct_allocate( pool );
+		objects[i]->a = i;
+	}
+	test( pool->count == size && pool->first_free == kPoolNoFree, "Filled pool.", "Failed to fill pool." );
+
+	// Handles
+	poolHandle h = pool_poolTestStruct_handle( pool, objects[7] );
+	test( pool_poolTestStruct_fromHandle( pool, h ) == objects[7], "Pool handle resolves.", "Pool handle does not resolve." );
+	pool_poolTestStruct_free( pool, objects[7] );
+	test( pool_poolTestStruct_fromHandle( pool, h ) == NULL, "Stale pool handle detected.", "Stale pool handle not detected." );
+	poolTestStruct* reused = pool_poolTestStruct_allocate( pool );
+	test( reused == objects[7], "Pool reused a freed slot.", "Pool did not reuse a freed slot." );
+	test( pool_poolTestStruct_fromHandle( pool, h ) == NULL, "Stale pool handle not resolved to a reused slot.", "Stale pool handle resolved to a reused slot." );
+	test( pool_poolTestStruct_fromHandle( pool, kPoolInvalidHandle ) == NULL, "Invalid pool handle rejected.", "Invalid pool handle accepted." );
+
+	// Occupancy iteration
+	pool_poolTestStruct_free( pool, objects[3] );
+	pool_poolTestStruct_free( pool, objects[35] );
+	int visited = 0;
+	bool skipped = true;
+	for ( int i = pool_poolTestStruct_next( pool, 0 ); i != -1; i = pool_poolTestStruct_next( pool, i + 1 )) {
+		visited++;
+		skipped = skipped && i != 3 && i != 35;
+	}
+	test( visited == size - 2 && skipped, "Pool iterated occupied slots.", "Pool iterated incorrectly." );
+
+	// Growth
+	pool_poolTestStruct* growable = pool_poolTestStruct_createGrowable( 16 );
+	poolTestStruct* first = pool_poolTestStruct_allocate( growable );
+	first->a = 1234;
+	for ( int i = 0; i < 100; i++ )
+		pool_poolTestStruct_allocate( growable );
+	test( growable->count == 101 && growable->chunk_count == 7 && first->a == 1234,
+			"Growable pool grew without moving objects.", "Growable pool failed to grow." );
+	poolTestStruct* last = pool_poolTestStruct_allocate( growable );
+	test( pool_poolTestStruct_index( growable, last ) == 101 && pool_poolTestStruct_at( growable, 101 ) == last,
+			"Pool index found across chunks.", "Pool index wrong across chunks." );
+
+	pool_poolTestStruct_delete( pool );
+	pool_poolTestStruct_delete( growable );
+}
+#endif // UNIT_TEST
@@ -5,51 +5,245 @@
 #pragma once
 
 #include "mem/allocator.h"
+#include "system/thread.h"
+
+/*
+   Objects live in chunks that are never moved, so pointers to them stay valid. A fixed size pool
+   has a single chunk; a growable pool adds another chunk when it fills, up to kPoolMaxChunks.
+
+   Everything other than the chunks themselves (the chunk table, generations and occupancy) is
+   allocated for the pool's full capacity up front, so growing never moves anything that another
+   thread may be reading without the lock (eg. through pool_##type##_at() or _next()).
+
+   Each object is stored in a slot along with its index, so finding an object's index is O(1).
+
+   Free slots form an intrusive linked list: a free slot's object storage is unioned with the
+   index of the next free slot, so allocating and freeing are O(1).
+
+   Each slot has a generation, bumped when it is freed. A poolHandle packs the slot index and
+   generation, so a handle kept after its object is freed (eg. by Lua) is detected as stale
+   rather than silently referring to whatever reuses the slot.
+
+   Occupied slots are tracked in a bitset, for iteration with pool_##type##_next().
+   */
+
+typedef uint32_t poolHandle;
+
+#define kPoolHandleIndexBits	20
+#define kPoolHandleIndexMask	(( 1u << kPoolHandleIndexBits ) - 1 )
+#define kPoolHandleGenerationMask	( 0xffffffffu >> kPoolHandleIndexBits )
+#define kPoolInvalidHandle		0	// Generations start at 1, so no valid handle is 0
+#define kPoolNoFree				-1
+#define kPoolMaxChunks			64
+
+static inline poolHandle poolHandle_create( int index, uint32_t generation ) {
+	return ( generation << kPoolHandleIndexBits ) | (uint32_t)index;
+}
+
+static inline int poolHandle_index( poolHandle h ) {
+	return (int)( h & kPoolHandleIndexMask );
+}
+
+static inline uint32_t poolHandle_generation( poolHandle h ) {
+	return h >> kPoolHandleIndexBits;
+}
+
+static inline uint32_t poolGeneration_next( uint32_t generation ) {
+	generation = ( generation + 1 ) & kPoolHandleGenerationMask;
+	return generation ? generation : 1;
+}
+
+static inline bool poolBitset_test( const uint32_t* bits, int i ) {
+	return ( bits[i >> 5] >> ( i & 31 )) & 1;
+}
+
+static inline void poolBitset_set( uint32_t* bits, int i ) {
+	bits[i >> 5] |= ( 1u << ( i & 31 ));
+}
+
+static inline void poolBitset_clear( uint32_t* bits, int i ) {
+	bits[i >> 5] &= ~( 1u << ( i & 31 ));
+}
+
+// The first set bit at or after [from], or -1
+static inline int poolBitset_next( const uint32_t* bits, int size, int from ) {
+	if ( from >= size )
+		return -1;
+	int word = from >> 5;
+	uint32_t w = bits[word] & ( 0xffffffffu << ( from & 31 ));
+	int words = ( size + 31 ) >> 5;
+	while ( true ) {
+		if ( w ) {
+			int i = ( word << 5 ) + __builtin_ctz( w );
+			return i < size ? i : -1;
+		}
+		if ( ++word >= words )
+			return -1;
+		w = bits[word];
+	}
+}
+
+static inline void* pool_allocZeroed( size_t size ) {
+	void* data = mem_alloc( size );
+	memset( data, 0, size );
+	return data;
+}
+
+#if UNIT_TEST
+void test_pool();
+#endif // UNIT_TEST
 
 // Implementation Macro
 // ( Place in a .h file )
 
 #define DECLARE_POOL( type )				\
+typedef struct pool_##type##_slot_s {		\
+	union {		/* First, so an object pointer is a slot pointer */		\
+		type	object;														\
+		int		next_free;													\
+	};																		\
+	int			index;														\
+} pool_##type##_slot;						\
+											\
 typedef struct pool_##type##_s {			\
-	int				size;					\
-	bool*			free;					\
-	type*	pool;							\
+	int			size;		/* Slots in use chunks; published after the chunk is set up */	\
+	int			chunk_size;													\
+	int			chunk_count;												\
+	int			max_chunks;													\
+	bool		growable;													\
+	pool_##type##_slot**	chunks;		/* [max_chunks] */					\
+	uint32_t*	generation;	/* [max_chunks * chunk_size] */					\
+	uint32_t*	occupied;	/* Bitset, [max_chunks * chunk_size] */			\
+	int			first_free;													\
+	int			count;														\
+	vmutex		lock;														\
 } pool_##type;								\
 											\
-pool_##type* pool_##type##_create( int size );			\
-type* pool_##type##_allocate( pool_##type* pool );		\
-void pool_##type##_free( pool_##type* pool, type* m );
+pool_##type* pool_##type##_create( int size );				\
+pool_##type* pool_##type##_createGrowable( int chunk_size );	\
+void pool_##type##_delete( pool_##type* pool );				\
+type* pool_##type##_allocate( pool_##type* pool );			\
+void pool_##type##_free( pool_##type* pool, type* m );		\
+type* pool_##type##_at( pool_##type* pool, int index );		\
+int pool_##type##_index( pool_##type* pool, type* m );		\
+int pool_##type##_next( pool_##type* pool, int from );		\
+poolHandle pool_##type##_handle( pool_##type* pool, type* m );	\
+type* pool_##type##_fromHandle( pool_##type* pool, poolHandle h );
 
 // Implementation Macro
 // ( Place in a .c file )
 
 #define IMPLEMENT_POOL( type )											\
 																		\
+type* pool_##type##_at( pool_##type* pool, int index ) {				\
+	return &pool->chunks[index / pool->chunk_size][index % pool->chunk_size].object;	\
+}																		\
+/* Add a chunk of free slots, linked onto the front of the free list */	\
+/* Must be called with the lock held */									\
+void pool_##type##_addChunk( pool_##type* pool ) {						\
+	vAssert( pool->chunk_count < pool->max_chunks );					\
+	int old_size = pool->size;											\
+	int new_size = pool->size + pool->chunk_size;						\
+	pool_##type##_slot* chunk = mem_alloc( sizeof( pool_##type##_slot ) * pool->chunk_size );	\
+	for ( int i = 0; i < pool->chunk_size; i++ ) {						\
+		int index = old_size + i;										\
+		chunk[i].index = index;											\
+		pool->generation[index] = 1;									\
+		chunk[i].next_free = ( index + 1 < new_size ) ? index + 1 : pool->first_free;	\
+	}																	\
+	pool->chunks[pool->chunk_count++] = chunk;							\
+	pool->first_free = old_size;										\
+	/* Unlocked readers check against size, so the chunk must be visible first */	\
+	__sync_synchronize();												\
+	pool->size = new_size;												\
+}																		\
+pool_##type* pool_##type##_createWithChunks( int chunk_size, int max_chunks ) {	\
+	int capacity = chunk_size * max_chunks;								\
+	vAssert( capacity <= (int)kPoolHandleIndexMask );					\
+	pool_##type* p = pool_allocZeroed( sizeof( pool_##type ));			\
+	p->chunk_size = chunk_size;											\
+	p->max_chunks = max_chunks;											\
+	p->first_free = kPoolNoFree;										\
+	p->chunks = pool_allocZeroed( sizeof( pool_##type##_slot* ) * max_chunks );	\
+	p->generation = pool_allocZeroed( sizeof( uint32_t ) * capacity );	\
+	p->occupied = pool_allocZeroed( sizeof( uint32_t ) * (( capacity + 31 ) / 32 ));	\
+	vmutex_init( &p->lock );											\
+	pool_##type##_addChunk( p );										\
+	return p;															\
+}																		\
 pool_##type* pool_##type##_create( int size ) {							\
-	void* data = mem_alloc( sizeof( pool_##type ) + 					\
-							sizeof( bool ) * size +						\
-							sizeof( type ) * size );					\
-	pool_##type* p = data;												\
-	p->size = size;														\
-	p->free = data + sizeof( pool_##type );								\
-	p->pool = data + sizeof( pool_##type ) + sizeof( bool ) * size;		\
-	memset( p->free, 1, sizeof( bool ) * size );						\
+	return pool_##type##_createWithChunks( size, 1 );					\
+}																		\
+pool_##type* pool_##type##_createGrowable( int chunk_size ) {			\
+	pool_##type* p = pool_##type##_createWithChunks( chunk_size, kPoolMaxChunks );	\
+	p->growable = true;													\
 	return p;															\
 }																		\
+void pool_##type##_delete( pool_##type* pool ) {						\
+	for ( int c = 0; c < pool->chunk_count; c++ )						\
+		mem_free( pool->chunks[c] );									\
+	mem_free( pool->chunks );											\
+	mem_free( pool->generation );										\
+	mem_free( pool->occupied );											\
+	mem_free( pool );													\
+}																		\
 type* pool_##type##_allocate( pool_##type* pool ) {						\
-	for ( int i = 0; i < pool->size; i++) {								\
-		if ( pool->free[i] ) {											\
-			pool->free[i] = false;										\
-			return &pool->pool[i];										\
-		}																\
+	vmutex_lock( &pool->lock );											\
+	if ( pool->first_free == kPoolNoFree && pool->growable && pool->chunk_count < pool->max_chunks )	\
+		pool_##type##_addChunk( pool );									\
+	if ( pool->first_free == kPoolNoFree ) {							\
+		vmutex_unlock( &pool->lock );									\
+		printf( "Pool is full; cannot allocate new object.\n" );		\
+		assert( 0 );													\
+		return NULL;													\
 	}																	\
-	printf( "Pool is full; cannot allocate new object.\n" );			\
-	assert( 0 );														\
-	return NULL;														\
+	int index = pool->first_free;										\
+	pool_##type##_slot* slot = (pool_##type##_slot*)pool_##type##_at( pool, index );	\
+	pool->first_free = slot->next_free;									\
+	poolBitset_set( pool->occupied, index );							\
+	pool->count++;														\
+	vmutex_unlock( &pool->lock );										\
+	return &slot->object;												\
+}																		\
+int pool_##type##_index( pool_##type* pool, type* m ) {					\
+	int index = ((pool_##type##_slot*)m)->index;						\
+	vAssert( index >= 0 && index < pool->size );						\
+	return index;														\
 }																		\
 void pool_##type##_free( pool_##type* pool, type* m ) {					\
-	int index = m - pool->pool;											\
-	assert( index >= 0 );												\
-	assert( index < pool->size );										\
-	pool->free[index] = true;											\
+	vmutex_lock( &pool->lock );											\
+	int index = pool_##type##_index( pool, m );							\
+	vAssert( poolBitset_test( pool->occupied, index ));					\
+	poolBitset_clear( pool->occupied, index );							\
+	pool->generation[index] = poolGeneration_next( pool->generation[index] );	\
+	((pool_##type##_slot*)m)->next_free = pool->first_free;				\
+	pool->first_free = index;											\
+	pool->count--;														\
+	vmutex_unlock( &pool->lock );										\
+}																		\
+/* The first occupied slot at or after [from], or -1 */					\
+int pool_##type##_next( pool_##type* pool, int from ) {					\
+	int size = pool->size;												\
+	__sync_synchronize();												\
+	return poolBitset_next( pool->occupied, size, from );				\
+}																		\
+poolHandle pool_##type##_handle( pool_##type* pool, type* m ) {			\
+	vmutex_lock( &pool->lock );											\
+	int index = pool_##type##_index( pool, m );							\
+	vAssert( poolBitset_test( pool->occupied, index ));					\
+	poolHandle h = poolHandle_create( index, pool->generation[index] );	\
+	vmutex_unlock( &pool->lock );										\
+	return h;															\
+}																		\
+/* NULL if the handle is stale (the object has been freed) */			\
+type* pool_##type##_fromHandle( pool_##type* pool, poolHandle h ) {		\
+	int index = poolHandle_index( h );									\
+	type* m = NULL;														\
+	vmutex_lock( &pool->lock );											\
+	if ( h != kPoolInvalidHandle && index < pool->size &&				\
+			pool->generation[index] == poolHandle_generation( h ) &&	\
+			poolBitset_test( pool->occupied, index ))					\
+		m = pool_##type##_at( pool, index );							\
+	vmutex_unlock( &pool->lock );										\
+	return m;															\
 }
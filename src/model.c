@@ -15,13 +15,15 @@
 #include "render/vgl.h"
 #include "system/hash.h"
 #include "system/string.h"
+#include "system/thread.h"
+#include "worker.h"
 
 #define kMaxModels 256
 
 int			model_count;
-model*		models[kMaxModels];
+// Written by the worker thread when an asynchronous load completes; NULL until then
+model* volatile	models[kMaxModels];
 const char*	modelFiles[kMaxModels];
-int 		modelIDs[kMaxModels];
 
 uintptr_t aligned_size( uintptr_t size, uintptr_t alignment ) {
 	return ( (size / alignment) + (( size % alignment > 0 ) ? 1 : 0) ) * alignment;
@@ -65,15 +67,24 @@ mesh* mesh_createMesh( int vertCount, int index_count, int normal_count, int uv_
 	m->normal_count = normal_count;
 	m->vertex_buffer = NULL;
 	m->element_buffer = NULL;
+	m->submesh_count = 0;
+	m->submeshes = NULL;
+	m->cache_data = NULL;
+	m->cache_size = 0;
 
+	mesh_initRenderState( m );
+
+	return m;
+}
+
+// Set up the default texture and shader for a newly created mesh
+void mesh_initRenderState( mesh* m ) {
 	texture_request( &m->texture_diffuse, "dat/img/ship_hd_2.tga" );
 	m->shader = resources.shader_default;
 	vAssert( m->shader );
 
 	m->vertex_VBO = 0;
 	m->element_VBO = 0;
-
-	return m;
 }
 
 // Precalculate flat normals for a mesh
@@ -171,7 +182,7 @@ void model_draw( model* m ) {
 }
 
 void model_initModelStorage() {
-	memset( models, 0, sizeof( model* ) * kMaxModels );
+	memset( (void*)models, 0, sizeof( model* ) * kMaxModels );
 	memset( modelFiles, 0, sizeof( const char* ) * kMaxModels );
 	model_count = 0;
 }
@@ -185,42 +196,88 @@ model* model_loadFromFileSync( const char* filename ) {
 	return model_load( filename );
 }
 
-const char* model_getFileNameFromID( int id ) {
-	(void)id;
-	// TODO: Implement
+// Make a fully loaded model visible to other threads
+void model_publish( modelHandle h, model* m ) {
+	// Make sure all writes to the model are visible before the pointer is
+	__sync_synchronize();
+	models[h] = m;
+}
+
+// Worker task: load the model for a handle and publish it
+void* model_loadTask( void* args ) {
+	modelHandle h = (modelHandle)(uintptr_t)args;
+	model_publish( h, model_load( modelFiles[h] ));
 	return NULL;
 }
 
-modelHandle model_getHandleFromID( int id ) {
-	// If the model is already in the array, return it
+bool model_ready( modelHandle h ) {
+	return models[h] != NULL;
+}
+
+// Block until the model for this handle has finished loading
+model* model_waitForHandle( modelHandle h ) {
+	while ( !model_ready( h ))
+		vthread_yield();
+	__sync_synchronize();
+	return models[h];
+}
+
+// Returns -1 if this file has not been requested yet
+modelHandle model_findHandleFromFilename( const char* filename ) {
 	for ( int i = 0; i < model_count; i++ ) {
-		if ( modelIDs[i] == id ) {
+		if ( string_equal( filename, modelFiles[i] )) {
 			return (modelHandle)i;
 		}
 	}
-	// Otherwise add it and return
+	return -1;
+}
+
+modelHandle model_addHandle( const char* filename ) {
 	assert( model_count < kMaxModels );
 	modelHandle handle = (modelHandle)model_count;
-	modelIDs[handle] = id;
-	models[handle] = model_loadFromFileSync( model_getFileNameFromID( id ) );
+	modelFiles[handle] = string_createCopy( filename );
+	models[handle] = NULL;
 	model_count++;
 	return handle;
 }
 
+// Request a model be loaded on the worker thread
+// Returns a handle immediately; the model can be used once model_ready( handle )
+modelHandle model_requestAsync( const char* filename ) {
+	modelHandle handle = model_findHandleFromFilename( filename );
+	if ( handle == -1 ) {
+		handle = model_addHandle( filename );
+		worker_task task;
+		task.func = model_loadTask;
+		task.args = (void*)(uintptr_t)handle;
+		worker_addTask( task );
+	}
+	return handle;
+}
+
+// Request a list of models, so they are ready by the time they are needed
+void model_preload( int count, const char** filenames ) {
+	for ( int i = 0; i < count; i++ )
+		model_requestAsync( filenames[i] );
+}
+
+const char* model_getFileNameFromHandle( modelHandle handle ) {
+	vAssert( handle >= 0 && handle < model_count );
+	return modelFiles[handle];
+}
+
 // TODO - debug; should be replaced with hashed ID
+// Synchronous; if the model is still loading asynchronously, this waits for it
 modelHandle model_getHandleFromFilename( const char* filename ) {
 	// If the model is already in the array, return it
-	for ( int i = 0; i < model_count; i++ ) {
-		if ( string_equal( filename, modelFiles[i] )) {
-			return (modelHandle)i;
-		}
+	modelHandle handle = model_findHandleFromFilename( filename );
+	if ( handle != -1 ) {
+		model_waitForHandle( handle );
+		return handle;
 	}
 	// Otherwise add it and return
-	assert( model_count < kMaxModels );
-	modelHandle handle = (modelHandle)model_count;
-	modelFiles[handle] = string_createCopy( filename );
-	models[handle] = model_loadFromFileSync( filename );
-	model_count++;
+	handle = model_addHandle( filename );
+	model_publish( handle, model_loadFromFileSync( filename ));
 	return handle;
 }
 
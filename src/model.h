@@ -10,6 +10,17 @@
 #define kMaxSubTransforms	16
 #define kMaxSubEmitters		16
 
+typedef struct obb_s {
+	vector min;
+	vector max;
+} obb;
+
+// A contiguous range of the element buffer (one OBJ group)
+typedef struct meshSubmesh_s {
+	uint32_t	first_index;
+	uint32_t	index_count;
+} meshSubmesh;
+
 // *** Mesh ***
 /*
    A Mesh contains a list of vertices and a list of triangles (as indices to the vertex array)
@@ -36,6 +47,14 @@ struct mesh_s {
 	vertex*			vertex_buffer;
 	unsigned short*	element_buffer;
 
+	obb				bounds;
+	int				submesh_count;
+	meshSubmesh*	submeshes;
+
+	// If loaded from a binary mesh cache, the mapping the arrays above point into
+	void*		cache_data;
+	size_t		cache_size;
+
 	GLuint		texture_diffuse;
 
 	//
@@ -43,11 +62,6 @@ struct mesh_s {
 	GLuint*		element_VBO;
 };
 
-typedef struct obb_s {
-	vector min;
-	vector max;
-} obb;
-
 // *** Model ***
 /*
    A Model contains many meshes, each of which use a given shader
@@ -70,6 +84,9 @@ struct model_s {
 // Create an empty mesh with vertCount distinct vertices and index_count vertex indices
 mesh* mesh_createMesh( int vertCount, int index_count, int normal_count, int uv_count );
 
+// Set up the default texture and shader for a newly created mesh
+void mesh_initRenderState( mesh* m );
+
 // Draw the verts of a mesh to the openGL buffer
 void mesh_render(mesh* m);
 
@@ -96,8 +113,18 @@ void model_draw(model* m);
 model* model_fromInstance( modelInstance* instance );
 
 // Handle lookups
-modelHandle model_getHandleFromID( int id );
 modelHandle model_getHandleFromFilename( const char* filename );
+const char* model_getFileNameFromHandle( modelHandle handle );
+
+// *** Asynchronous loading
+// Request a model be loaded on the worker thread; returns a handle immediately
+modelHandle model_requestAsync( const char* filename );
+// Request a list of models ahead of time (eg. for a wave setup)
+void model_preload( int count, const char** filenames );
+// Has the model for this handle finished loading?
+bool model_ready( modelHandle h );
+// Block until the model for this handle has finished loading
+model* model_waitForHandle( modelHandle h );
 
 // Sub-element lookups
 int model_transformIndex( model* m, transform* ptr );
@@ -3,12 +3,61 @@
 //--------------------------------------------------------
 #include "scene.h"
 #include "model.h"
+#include "vtime.h"
+#include "mem/allocator.h"
 #include "script/lisp.h"
 #include "script/parse.h"
 #include "system/file.h"
 #include "system/string.h"
 
-mesh* mesh_loadObj( const char* filename ) {
+/*
+   Binary Mesh Cache
+
+   Parsing .obj text is slow, so the first time a mesh is loaded we write out the final
+   render data to a binary file next to the source ( "foo.obj" -> "foo.obj.vmesh" ).
+   Later loads mmap that file and point the mesh straight into it, so the vertex and element
+   buffers are handed to render_requestBuffer without any parsing or copying.
+
+   The cache is rebuilt automatically if the source .obj is newer, or if the version or vertex
+   layout does not match this build.
+
+   Layout (all offsets are bytes from the start of the file, each section 16-byte aligned):
+	meshCacheHeader
+	vector		verts[vert_count]				- positions, for collision and bounds
+	uint16_t	indices[index_count]			- indices into verts
+	vertex		vertex_buffer[index_count]		- final render vertices
+	uint16_t	element_buffer[index_count]		- final render elements
+	meshSubmesh	submeshes[submesh_count]
+   */
+
+#define kMeshCacheMagic		0x48534d56	// "VMSH"
+#define kMeshCacheVersion	1
+#define kMeshCacheExtension	".vmesh"
+#define kMeshCacheAlignment	16
+
+typedef struct meshCacheHeader_s {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	vertex_size;	// sizeof( vertex ) in the build that wrote the cache
+	uint32_t	total_size;
+	uint32_t	vert_count;
+	uint32_t	index_count;
+	uint32_t	submesh_count;
+	uint32_t	verts_offset;
+	uint32_t	indices_offset;
+	uint32_t	vertex_buffer_offset;
+	uint32_t	element_buffer_offset;
+	uint32_t	submeshes_offset;
+	obb			bounds;
+} meshCacheHeader;
+
+// Running totals, so we can see what mesh loading costs at startup
+int					mesh_cache_hits = 0;
+int					mesh_cache_misses = 0;
+unsigned long long	mesh_load_microseconds = 0;
+
+// Parse a text .obj file into a new mesh, building its render buffers
+mesh* mesh_parseObj( const char* filename ) {
 	// Load the raw data
 	int vert_count = 0, index_count = 0, normal_count = 0, uv_count = 0;
 	// Lets create these arrays on the heap, as they need to be big
@@ -19,17 +68,11 @@ mesh* mesh_loadObj( const char* filename ) {
 	uint16_t* indices			= mem_alloc( sizeof( uint16_t ) * kObjMaxIndices );
 	uint16_t* normal_indices	= mem_alloc( sizeof( uint16_t ) * kObjMaxIndices );
 	uint16_t* uv_indices		= mem_alloc( sizeof( uint16_t ) * kObjMaxIndices );
+	// Only the first *_count entries of each array are ever read, so no need to clear them
 
-#define array_clear( array, size ) \
-	memset( array, 0, sizeof( array[0] ) * size );
-
-	// Initialise to 0;
-	array_clear( vertices, kObjMaxVertices );
-	array_clear( normals, kObjMaxVertices );
-	array_clear( uvs, kObjMaxVertices );
-	array_clear( indices, kObjMaxIndices );
-	array_clear( normal_indices, kObjMaxIndices );
-	array_clear( uv_indices, kObjMaxIndices );
+	// Each group ('g' or 'o') starts a new submesh
+	int submesh_count = 0;
+	meshSubmesh submeshes[kObjMaxSubmeshes];
 
 	size_t file_length = -1;
 	char* file_buffer = vfile_contents( filename, &file_length );
@@ -37,6 +80,15 @@ mesh* mesh_loadObj( const char* filename ) {
 
 	while ( !inputStream_endOfFile( stream )) {
 		char* token = inputStream_nextToken( stream );
+		if ( string_equal( token, "g" ) || string_equal( token, "o" )) {
+			// Close the previous group if it has any faces, otherwise just reuse it
+			if ( submesh_count == 0 || submeshes[submesh_count - 1].index_count > 0 ) {
+				vAssert( submesh_count < kObjMaxSubmeshes );
+				submeshes[submesh_count].first_index = index_count;
+				submeshes[submesh_count].index_count = 0;
+				submesh_count++;
+			}
+		}
 		if ( string_equal( token, "v" )) {
 			assert( vert_count < kObjMaxVertices );
 			// Vertex
@@ -115,12 +167,15 @@ mesh* mesh_loadObj( const char* filename ) {
 				normal_indices[index_count]	= atoi( norm ) - 1; // -1 as obj uses 1-based indices, not 0-based as we do
 				uv_indices[index_count]		= atoi( uv ) - 1; // -1 as obj uses 1-based indices, not 0-based as we do
 				index_count++;
+				if ( submesh_count > 0 )
+					submeshes[submesh_count - 1].index_count++;
 			}
 		}
 		mem_free( token );
 		inputStream_nextLine( stream );
 	}
 	mem_free( file_buffer );
+	mem_free( stream );
 	printf( "MESH_LOAD: Parsed .obj file \"%s\" with %d verts, %d faces, %d normals, %d uvs.\n", filename, vert_count, index_count / 3, normal_count, uv_count );
 
 	// Copy our loaded data into the Mesh structure
@@ -133,9 +188,179 @@ mesh* mesh_loadObj( const char* filename ) {
 	memcpy( msh->uv_indices,	uv_indices,			index_count * sizeof( uint16_t ));
 	mesh_buildBuffers( msh );
 
+	// Files without groups are a single submesh
+	if ( submesh_count == 0 ) {
+		submeshes[0].first_index = 0;
+		submeshes[0].index_count = index_count;
+		submesh_count = 1;
+	}
+	msh->submesh_count = submesh_count;
+	msh->submeshes = mem_alloc( sizeof( meshSubmesh ) * submesh_count );
+	memcpy( msh->submeshes, submeshes, sizeof( meshSubmesh ) * submesh_count );
+	msh->bounds = obb_calculate( msh->vert_count, msh->verts );
+
+	mem_free( vertices );
+	mem_free( normals );
+	mem_free( uvs );
+	mem_free( indices );
+	mem_free( normal_indices );
+	mem_free( uv_indices );
+
 	return msh;
 }
 
+
+void meshCache_path( char* cache_path, const char* filename ) {
+	vAssert(( strlen( filename ) + strlen( kMeshCacheExtension )) < kMeshCacheMaxPath );
+	strcpy( cache_path, filename );
+	strcat( cache_path, kMeshCacheExtension );
+}
+
+uint32_t meshCache_align( uint32_t offset ) {
+	return ( offset + kMeshCacheAlignment - 1 ) & ~( kMeshCacheAlignment - 1 );
+}
+
+// Write the final render data of a mesh out to a binary cache file
+void meshCache_write( mesh* m, const char* cache_path ) {
+	vAssert( m->vertex_buffer );
+	vAssert( m->element_buffer );
+
+	meshCacheHeader header;
+	memset( &header, 0, sizeof( header ));
+	header.magic			= kMeshCacheMagic;
+	header.version			= kMeshCacheVersion;
+	header.vertex_size		= sizeof( vertex );
+	header.vert_count		= m->vert_count;
+	header.index_count		= m->index_count;
+	header.submesh_count	= m->submesh_count;
+	header.bounds			= m->bounds;
+
+	uint32_t offset = meshCache_align( sizeof( meshCacheHeader ));
+	header.verts_offset = offset;
+	offset = meshCache_align( offset + sizeof( vector ) * m->vert_count );
+	header.indices_offset = offset;
+	offset = meshCache_align( offset + sizeof( uint16_t ) * m->index_count );
+	header.vertex_buffer_offset = offset;
+	offset = meshCache_align( offset + sizeof( vertex ) * m->index_count );
+	header.element_buffer_offset = offset;
+	offset = meshCache_align( offset + sizeof( uint16_t ) * m->index_count );
+	header.submeshes_offset = offset;
+	offset = offset + sizeof( meshSubmesh ) * m->submesh_count;
+	header.total_size = offset;
+
+	uint8_t* buffer = mem_alloc( header.total_size );
+	memset( buffer, 0, header.total_size );
+	memcpy( buffer, &header, sizeof( header ));
+	memcpy( buffer + header.verts_offset,			m->verts,			sizeof( vector ) * m->vert_count );
+	memcpy( buffer + header.indices_offset,			m->indices,			sizeof( uint16_t ) * m->index_count );
+	memcpy( buffer + header.vertex_buffer_offset,	m->vertex_buffer,	sizeof( vertex ) * m->index_count );
+	memcpy( buffer + header.element_buffer_offset,	m->element_buffer,	sizeof( uint16_t ) * m->index_count );
+	memcpy( buffer + header.submeshes_offset,		m->submeshes,		sizeof( meshSubmesh ) * m->submesh_count );
+
+	vfile_writeContents( cache_path, buffer, header.total_size );
+	mem_free( buffer );
+}
+
+// Does an aligned array of [count] elements of [size] at [offset] fit in [length] bytes?
+bool meshCache_rangeValid( uint32_t offset, uint32_t count, size_t size, size_t length ) {
+	return offset % kMeshCacheAlignment == 0 && (uint64_t)offset + (uint64_t)count * size <= length;
+}
+
+bool meshCache_valid( const meshCacheHeader* header, size_t length ) {
+	if ( length < sizeof( meshCacheHeader ) ||
+			header->magic != kMeshCacheMagic ||
+			header->version != kMeshCacheVersion ||
+			header->vertex_size != sizeof( vertex ) ||
+			header->total_size != length )
+		return false;
+	if ( !meshCache_rangeValid( header->verts_offset, header->vert_count, sizeof( vector ), length ) ||
+			!meshCache_rangeValid( header->indices_offset, header->index_count, sizeof( uint16_t ), length ) ||
+			!meshCache_rangeValid( header->vertex_buffer_offset, header->index_count, sizeof( vertex ), length ) ||
+			!meshCache_rangeValid( header->element_buffer_offset, header->index_count, sizeof( uint16_t ), length ) ||
+			!meshCache_rangeValid( header->submeshes_offset, header->submesh_count, sizeof( meshSubmesh ), length ))
+		return false;
+
+	// Every submesh draws elements from within the element buffer, that index within the vertex buffer
+	const uint8_t* data = (const uint8_t*)header;
+	const meshSubmesh* submeshes = (const meshSubmesh*)( data + header->submeshes_offset );
+	const uint16_t* elements = (const uint16_t*)( data + header->element_buffer_offset );
+	for ( uint32_t i = 0; i < header->submesh_count; i++ ) {
+		const meshSubmesh* submesh = &submeshes[i];
+		if ( (uint64_t)submesh->first_index + submesh->index_count > header->index_count )
+			return false;
+		for ( uint32_t j = submesh->first_index; j < submesh->first_index + submesh->index_count; j++ )
+			if ( elements[j] >= header->index_count )
+				return false;
+	}
+	return true;
+}
+
+// Create a mesh that uses the data in a mapped cache file in place
+mesh* meshCache_load( const char* cache_path ) {
+	size_t length = 0;
+	uint8_t* data = vfile_map( cache_path, &length );
+	if ( !data )
+		return NULL;
+
+	const meshCacheHeader* header = (const meshCacheHeader*)data;
+	if ( !meshCache_valid( header, length )) {
+		printf( "MESH_LOAD: Ignoring stale or invalid mesh cache \"%s\".\n", cache_path );
+		vfile_unmap( data, length );
+		return NULL;
+	}
+
+	mesh* m = mem_alloc( sizeof( mesh ));
+	memset( m, 0, sizeof( mesh ));
+	m->vert_count		= header->vert_count;
+	m->index_count		= header->index_count;
+	m->verts			= (vector*)( data + header->verts_offset );
+	m->indices			= (uint16_t*)( data + header->indices_offset );
+	m->vertex_buffer	= (vertex*)( data + header->vertex_buffer_offset );
+	m->element_buffer	= (GLushort*)( data + header->element_buffer_offset );
+	m->submesh_count	= header->submesh_count;
+	m->submeshes		= (meshSubmesh*)( data + header->submeshes_offset );
+	m->bounds			= header->bounds;
+	m->cache_data		= data;
+	m->cache_size		= length;
+	mesh_initRenderState( m );
+
+	// The mapping stays alive as long as the mesh, so the render thread can upload straight from it
+	m->vertex_VBO = render_requestBuffer( GL_ARRAY_BUFFER, m->vertex_buffer, sizeof( vertex ) * m->index_count );
+	m->element_VBO = render_requestBuffer( GL_ELEMENT_ARRAY_BUFFER, m->element_buffer, sizeof( GLushort ) * m->index_count );
+	return m;
+}
+
+// Load a mesh, from the binary cache if it is up to date, otherwise from the .obj source
+// (rebuilding the cache)
+mesh* mesh_loadObj( const char* filename ) {
+	unsigned long long start = timer_microseconds();
+	mesh* m = NULL;
+#ifdef LINUX_X
+	char cache_path[kMeshCacheMaxPath];
+	meshCache_path( cache_path, filename );
+	time_t cache_time = vfile_modifiedTime( cache_path );
+	bool cache_fresh = cache_time != 0 && cache_time >= vfile_modifiedTime( filename );
+	if ( cache_fresh )
+		m = meshCache_load( cache_path );
+	if ( m ) {
+		++mesh_cache_hits;
+	}
+	else {
+		++mesh_cache_misses;
+		m = mesh_parseObj( filename );
+		meshCache_write( m, cache_path );
+	}
+#else
+	m = mesh_parseObj( filename );
+#endif // LINUX_X
+	unsigned long long duration = timer_microseconds() - start;
+	mesh_load_microseconds += duration;
+	printf( "MESH_LOAD: Loaded \"%s\" in %.2fms (%s). Total mesh load time %.2fms (%d cached, %d parsed).\n",
+			filename, (float)duration / 1000.f, m->cache_data ? "cached" : "parsed",
+			(float)mesh_load_microseconds / 1000.f, mesh_cache_hits, mesh_cache_misses );
+	return m;
+}
+
 model* model_load( const char* filename ) {
 	sterm* s = parse_file( filename );
 	model* mdl = eval( s );
@@ -4,6 +4,9 @@
 
 #define kObjMaxVertices 64 << 10
 #define kObjMaxIndices 128 << 10
+#define kObjMaxSubmeshes 16
+#define kMeshCacheMaxPath 128
 
+// Load a mesh from an .obj file, using (and maintaining) its binary mesh cache where possible
 mesh* mesh_loadObj( const char* filename );
 model* model_load( const char* filename );
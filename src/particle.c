@@ -3,6 +3,7 @@
 #include "src/particle.h"
 //---------------------
 #include "model.h"
+#include "vtime.h"
 #include "maths/vector.h"
 #include "mem/allocator.h"
 #include "render/debugdraw.h"
@@ -16,6 +17,7 @@
 float property_samplef( property* p, float time );
 vector property_samplev( property* p, float time );
 float property_valuef( property* p, int key );
+float property_maxf( property* p );
 property* property_range( property* p, float from, float to );
 
 particleEmitterDef* particleEmitterDef_create() {
@@ -27,27 +29,46 @@ particleEmitterDef* particleEmitterDef_create() {
 
 // De-init the particleEmitterDef, freeing all its members
 void particleEmitterDef_deInit( particleEmitterDef* def ) {
+	// Properties loaded from a particle cache live inside its buffer
+	if ( def->cache_data ) {
+		mem_free( def->cache_data );
+		def->cache_data = NULL;
+		def->size = NULL;
+		def->color = NULL;
+		def->spawn_rate = NULL;
+	}
 	if ( def->size ) {
-		mem_free( def->size );
+		property_delete( def->size );
 		def->size = NULL;
 	}
 	if ( def->color ) {
-		mem_free( def->color );
+		property_delete( def->color );
 		def->color = NULL;
 	}
 	if ( def->spawn_rate ) {
-		mem_free( def->spawn_rate );
+		property_delete( def->spawn_rate );
 		def->spawn_rate = NULL;
 	}
 }
 
+IMPLEMENT_POOL( particleEmitter )
+
+#define kParticleEmitterChunkSize 256
+
+pool_particleEmitter* static_particleEmitter_pool = NULL;
+
+void particleEmitter_initPool() {
+	static_particleEmitter_pool = pool_particleEmitter_createGrowable( kParticleEmitterChunkSize );
+}
+
 particleEmitter* particleEmitter_create() {
-	particleEmitter* p = mem_alloc( sizeof( particleEmitter ));
+	particleEmitter* p = pool_particleEmitter_allocate( static_particleEmitter_pool );
 	memset( p, 0, sizeof( particleEmitter ));
 	p->definition = NULL;
 	p->vertex_buffer = mem_alloc( sizeof( vertex ) * kMaxParticleVerts );
 	p->element_buffer = mem_alloc( sizeof( GLushort ) * kMaxParticleVerts );
 	p->destroyed = false;
+	matrix_setIdentity( p->world );
 
 	return p;
 }
@@ -74,7 +95,7 @@ void particleEmitter_spawnParticle( particleEmitter* e ) {
 	if ( !(e->definition->flags & kParticleWorldSpace ))
 		p->position	= offset;
 	else
-		p->position = matrix_vecMul( e->trans->world, &offset );
+		p->position = matrix_vecMul( particleEmitter_world( e ), &offset );
 	p->age = 0.f;
 	if ( e->definition->flags & kParticleRandomRotation )
 		p->rotation = frand( 0.f, 2*PI );
@@ -82,6 +103,30 @@ void particleEmitter_spawnParticle( particleEmitter* e ) {
 		p->rotation = 0.f;
 }
 
+// Bound the live particles, allowing for the largest size and any rotation of their quads
+void particleEmitter_calculateBounds( particleEmitter* e ) {
+	bool local = !( e->definition->flags & kParticleWorldSpace );
+	float extent = property_maxf( e->definition->size ) * sqrtf( 2.f );
+	vector extents = Vector( extent, extent, extent, 0.f );
+	aabb bounds;
+	bounds.min = *matrix_getTranslation( particleEmitter_world( e ));
+	bounds.max = bounds.min;
+	for ( int i = 0; i < e->count; i++ ) {
+		int index = ( e->start + i ) % kMaxParticles;
+		vector position = e->particles[index].position;
+		if ( local )
+			position = matrix_vecMul( particleEmitter_world( e ), &position );
+		if ( i == 0 ) {
+			bounds.min = position;
+			bounds.max = position;
+		}
+		bounds.min = vector_min( &bounds.min, &position );
+		bounds.max = vector_max( &bounds.max, &position );
+	}
+	Sub( &e->bounds.min, &bounds.min, &extents );
+	Add( &e->bounds.max, &bounds.max, &extents );
+}
+
 void particleEmitter_tick( void* data, float dt, engine* eng ) {
 	particleEmitter* e = data;
 	// Update existing particles
@@ -131,10 +176,13 @@ void particleEmitter_tick( void* data, float dt, engine* eng ) {
 	}
 	e->emitter_age += dt;
 
+	particleEmitter_calculateBounds( e );
+
 	if ( e->destroyed && e->count <= 0 ) {
 		engine_removeRender( eng, e, particleEmitter_render );
 		stopTick( eng, e, particleEmitter_tick );
 		particleEmitter_delete( e );
+		return;
 	}
 
 	// TEST
@@ -146,7 +194,8 @@ void particleEmitter_tick( void* data, float dt, engine* eng ) {
 
 // Output the 4 verts of the quad to the target vertex array
 // both position and normals
-void particle_quad( particleEmitter* e, vertex* dst, vector* point, float rotation, float size, vector color ) {
+// UVs are remapped into [region], in case the texture has been packed into an atlas
+void particle_quad( particleEmitter* e, const textureRegion* region, vertex* dst, vector* point, float rotation, float size, vector color ) {
 	vector offset = Vector( size, size, 0.f, 0.f );
 
 	vector p;
@@ -162,12 +211,12 @@ void particle_quad( particleEmitter* e, vertex* dst, vector* point, float rotati
 
 	Add( &dst[0].position, &p, &offset );
 	dst[0].normal = Vector( 0.f, 0.f, 1.f, 0.f );
-	dst[0].uv = Vector( 1.f, 1.f, 0.f, 0.f );
+	dst[0].uv = textureRegion_uv( region, 1.f, 1.f );
 	dst[0].color = color;
 
 	Sub( &dst[1].position, &p, &offset );
 	dst[1].normal = Vector( 0.f, 0.f, 1.f, 0.f );
-	dst[1].uv = Vector( 0.f, 0.f, 0.f, 0.f );
+	dst[1].uv = textureRegion_uv( region, 0.f, 0.f );
 	dst[1].color = color;
 
 	offset = Vector( size, -size, 0.f, 0.f );
@@ -175,24 +224,27 @@ void particle_quad( particleEmitter* e, vertex* dst, vector* point, float rotati
 
 	Add( &dst[2].position, &p, &offset );
 	dst[2].normal = Vector( 0.f, 0.f, 1.f, 0.f );
-	dst[2].uv = Vector( 1.f, 0.f, 0.f, 0.f );
+	dst[2].uv = textureRegion_uv( region, 1.f, 0.f );
 	dst[2].color = color;
 
 	Sub( &dst[3].position, &p, &offset );
 	dst[3].normal = Vector( 0.f, 0.f, 1.f, 0.f );
-	dst[3].uv = Vector( 0.f, 1.f, 0.f, 0.f );
+	dst[3].uv = textureRegion_uv( region, 0.f, 1.f );
 	dst[3].color = color;
 }
 
 // Render a particleEmitter system
 void particleEmitter_render( void* data ) {
 	particleEmitter* p = data;
-		
+	if ( p->count == 0 || render_cullAABB( render_camera, &p->bounds, &render_cull_stats.emitters ))
+		return;
+
 	// reset modelview matrix so we can billboard
 	// particle_quad() will manually apply the modelview
 	render_resetModelView();
-	matrix_mul( modelview, modelview, p->trans->world );
+	matrix_mul( modelview, modelview, particleEmitter_world( p ) );
 
+	textureRegion region = texture_region( p->definition->texture_diffuse );
 	for ( int i = 0; i < p->count; i++ ) {
 		int index = (p->start + i) % kMaxParticles;
 
@@ -200,7 +252,7 @@ void particleEmitter_render( void* data ) {
 		float	size	= property_samplef( p->definition->size, p->particles[index].age );
 		vector	color	= property_samplev( p->definition->color, p->particles[index].age );
 
-		particle_quad( p, &p->vertex_buffer[i*4], &p->particles[index].position, p->particles[index].rotation, size, color );
+		particle_quad( p, &region, &p->vertex_buffer[i*4], &p->particles[index].position, p->particles[index].rotation, size, color );
 
 		vAssert( ( i*6 + 5 ) < kMaxParticleVerts );
 
@@ -220,8 +272,10 @@ void particleEmitter_render( void* data ) {
 	// We only need to send this to the GPU if we actually have something to draw (i.e. particles have been emitted)
 	if ( index_count > 0 ) {
 		drawCall* draw = drawCall_create( &renderPass_alpha, resources.shader_particle, index_count, p->element_buffer, p->vertex_buffer, 
-											p->definition->texture_diffuse->gl_tex, modelview );
+											region.gl_tex, modelview );
 		draw->depth_mask = GL_FALSE;
+		vector centre = vector_lerp( &p->bounds.min, &p->bounds.max, 0.5f );
+		draw->depth = render_viewDepth( &centre );
 	}
 }
 
@@ -241,6 +295,11 @@ property* property_copy( property* p ) {
 	return p_copy;
 }
 
+void property_delete( property* p ) {
+	mem_free( p->data );
+	mem_free( p );
+}
+
 // add [p->stride] number of float [values], at [time]
 void property_addf( property* p, float time, float value ) {
 	assert( p->count < kmax_property_values );
@@ -308,6 +367,14 @@ float property_valuef( property* p, int key ) {
 	return f;
 }
 
+// The largest value of a float property
+float property_maxf( property* p ) {
+	float f = 0.f;
+	for ( int key = 0; key < p->count; key++ )
+		f = fmaxf( f, property_valuef( p, key ));
+	return f;
+}
+
 float property_keyDomain( float* key ) {
 	return *key;
 }
@@ -351,6 +418,284 @@ void particle_init() {
 	particleEmitterAssets = map_create( kMaxParticleAssets, sizeof( particleEmitterDef* ));
 }
 
+/*
+   Binary Particle Cache
+
+   Evaluating a particle definition means running the lisp that builds it, so once a definition
+   has been evaluated we cook it to a binary file next to the source ( "foo.s" -> "foo.s.vparticle" ).
+   Later loads read that file in one go and fix up the property data pointers, without touching lisp.
+
+   The cache is rebuilt if the source, or any of the lisp libraries it is evaluated with, is newer.
+   Live-reloading still goes through lisp, and rewrites the cache.
+
+   Layout (all offsets are bytes from the start of the file, each section 16-byte aligned):
+	particleCacheHeader
+	property	properties[kParticleCacheProperties]	- data holds an offset until fixed up
+	float		data[kmax_property_values * stride]		- for each property, in order
+	char		texture_filename[]						- if there is a texture
+   */
+
+#define kParticleCacheMagic			0x54525056	// "VPRT"
+#define kParticleCacheVersion		1
+#define kParticleCacheExtension		".vparticle"
+#define kParticleCacheAlignment		16
+#define kParticleCacheMaxPath		128
+#define kParticleCacheProperties	3
+#define kParticleCacheMaxStride		5			// A key time, then up to a vector
+
+typedef struct particleCacheHeader_s {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	property_size;	// sizeof( property ) in the build that wrote the cache
+	uint32_t	total_size;
+	vector		spawn_box;
+	vector		velocity;
+	float		lifetime;
+	uint32_t	flags;
+	uint32_t	properties_offset;
+	uint32_t	property_mask;	// Which of size, color and spawn_rate are present
+	uint32_t	texture_offset;	// 0 if there is no texture
+} particleCacheHeader;
+
+// Running totals, so we can see what particle loading costs at startup
+int					particle_cache_hits = 0;
+int					particle_cache_misses = 0;
+unsigned long long	particle_load_microseconds = 0;
+
+// The newest modification time of the lisp libraries particle definitions are evaluated with
+time_t particleCache_libraryTime() {
+	time_t newest = 0;
+	for ( int i = 0; i < kLispLibraryCount; i++ ) {
+		time_t t = vfile_modifiedTime( lisp_library_files[i] );
+		if ( t > newest )
+			newest = t;
+	}
+	return newest;
+}
+
+void particleCache_path( char* cache_path, const char* filename ) {
+	vAssert(( strlen( filename ) + strlen( kParticleCacheExtension )) < kParticleCacheMaxPath );
+	strcpy( cache_path, filename );
+	strcat( cache_path, kParticleCacheExtension );
+}
+
+uint32_t particleCache_align( uint32_t offset ) {
+	return ( offset + kParticleCacheAlignment - 1 ) & ~( kParticleCacheAlignment - 1 );
+}
+
+// The properties of a definition, in cache order
+void particleCache_properties( particleEmitterDef* def, property*** properties ) {
+	properties[0] = &def->size;
+	properties[1] = &def->color;
+	properties[2] = &def->spawn_rate;
+}
+
+// Write a particle definition out to a binary cache file
+void particleCache_write( particleEmitterDef* def, const char* cache_path ) {
+	property** properties[kParticleCacheProperties];
+	particleCache_properties( def, properties );
+
+	particleCacheHeader header;
+	memset( &header, 0, sizeof( header ));
+	header.magic			= kParticleCacheMagic;
+	header.version			= kParticleCacheVersion;
+	header.property_size	= sizeof( property );
+	header.spawn_box		= def->spawn_box;
+	header.velocity			= def->velocity;
+	header.lifetime			= def->lifetime;
+	header.flags			= def->flags;
+
+	uint32_t offset = particleCache_align( sizeof( particleCacheHeader ));
+	header.properties_offset = offset;
+	offset = particleCache_align( offset + sizeof( property ) * kParticleCacheProperties );
+	uint32_t data_offsets[kParticleCacheProperties];
+	for ( int i = 0; i < kParticleCacheProperties; i++ ) {
+		property* p = *properties[i];
+		data_offsets[i] = 0;
+		if ( p ) {
+			header.property_mask |= ( 1 << i );
+			data_offsets[i] = offset;
+			offset = particleCache_align( offset + sizeof( float ) * p->stride * kmax_property_values );
+		}
+	}
+	const char* texture_filename = def->texture_diffuse ? def->texture_diffuse->filename : NULL;
+	if ( texture_filename ) {
+		header.texture_offset = offset;
+		offset += strlen( texture_filename ) + 1;
+	}
+	header.total_size = offset;
+
+	uint8_t* buffer = mem_alloc( header.total_size );
+	memset( buffer, 0, header.total_size );
+	memcpy( buffer, &header, sizeof( header ));
+	property* cached = (property*)( buffer + header.properties_offset );
+	for ( int i = 0; i < kParticleCacheProperties; i++ ) {
+		property* p = *properties[i];
+		if ( p ) {
+			cached[i].count = p->count;
+			cached[i].stride = p->stride;
+			cached[i].data = (float*)(uintptr_t)data_offsets[i];
+			memcpy( buffer + data_offsets[i], p->data, sizeof( float ) * p->stride * kmax_property_values );
+		}
+	}
+	if ( texture_filename )
+		strcpy( (char*)buffer + header.texture_offset, texture_filename );
+
+	vfile_writeContents( cache_path, buffer, header.total_size );
+	mem_free( buffer );
+}
+
+// Does an aligned array of [count] elements of [size] at [offset] fit in [length] bytes?
+bool particleCache_rangeValid( uint64_t offset, uint64_t count, size_t size, size_t length ) {
+	return offset % kParticleCacheAlignment == 0 && offset + count * size <= length;
+}
+
+bool particleCache_valid( const particleCacheHeader* header, size_t length ) {
+	if ( length < sizeof( particleCacheHeader ) ||
+			header->magic != kParticleCacheMagic ||
+			header->version != kParticleCacheVersion ||
+			header->property_size != sizeof( property ) ||
+			header->total_size != length ||
+			header->property_mask >= ( 1 << kParticleCacheProperties ) ||
+			!particleCache_rangeValid( header->properties_offset, kParticleCacheProperties, sizeof( property ), length ))
+		return false;
+
+	// Each property's keys lie within the file; data holds their offset until fixed up
+	const uint8_t* data = (const uint8_t*)header;
+	const property* cached = (const property*)( data + header->properties_offset );
+	for ( int i = 0; i < kParticleCacheProperties; i++ ) {
+		if ( !( header->property_mask & ( 1 << i )))
+			continue;
+		const property* p = &cached[i];
+		if ( p->stride < 1 || p->stride > kParticleCacheMaxStride ||
+				p->count < 0 || p->count > kmax_property_values ||
+				!particleCache_rangeValid( (uintptr_t)p->data, p->stride * kmax_property_values, sizeof( float ), length ))
+			return false;
+	}
+
+	// The texture filename must be terminated within the file
+	if ( header->texture_offset ) {
+		if ( header->texture_offset >= length ||
+				!memchr( data + header->texture_offset, '\0', length - header->texture_offset ))
+			return false;
+	}
+	return true;
+}
+
+// Create a particle definition from a cache file; the properties point into the loaded buffer
+particleEmitterDef* particleCache_load( const char* cache_path ) {
+	size_t length = 0;
+	uint8_t* data = vfile_contents( cache_path, &length );
+	if ( !data )
+		return NULL;
+
+	const particleCacheHeader* header = (const particleCacheHeader*)data;
+	if ( !particleCache_valid( header, length )) {
+		printf( "PARTICLE_LOAD: Ignoring stale or invalid particle cache \"%s\".\n", cache_path );
+		mem_free( data );
+		return NULL;
+	}
+
+	particleEmitterDef* def = particleEmitterDef_create();
+	def->spawn_box	= header->spawn_box;
+	def->velocity	= header->velocity;
+	def->lifetime	= header->lifetime;
+	def->flags		= (particle_flags_t)header->flags;
+	def->cache_data	= data;
+
+	property** properties[kParticleCacheProperties];
+	particleCache_properties( def, properties );
+	property* cached = (property*)( data + header->properties_offset );
+	for ( int i = 0; i < kParticleCacheProperties; i++ ) {
+		if ( header->property_mask & ( 1 << i )) {
+			property* p = &cached[i];
+			p->data = (float*)( data + (uintptr_t)p->data );
+			*properties[i] = p;
+		}
+	}
+	if ( header->texture_offset )
+		def->texture_diffuse = texture_load( (const char*)data + header->texture_offset );
+	return def;
+}
+
+// Evaluate a particle definition from its lisp source
+particleEmitterDef* particle_evalAsset( const char* particle_file ) {
+	term* particle_term = lisp_eval_file( lisp_global_context, particle_file );
+	return particle_term->data;
+}
+
+// Load a particle definition, from the binary cache if it is up to date, otherwise from the
+// lisp source (rebuilding the cache)
+particleEmitterDef* particle_cookedAsset( const char* particle_file ) {
+	unsigned long long start = timer_microseconds();
+	particleEmitterDef* def = NULL;
+#ifdef LINUX_X
+	char cache_path[kParticleCacheMaxPath];
+	particleCache_path( cache_path, particle_file );
+	time_t cache_time = vfile_modifiedTime( cache_path );
+	bool cache_fresh = cache_time != 0 &&
+		cache_time >= vfile_modifiedTime( particle_file ) &&
+		cache_time >= particleCache_libraryTime();
+	if ( cache_fresh )
+		def = particleCache_load( cache_path );
+	if ( def ) {
+		++particle_cache_hits;
+		// The source wasn't opened, so record its time here, or live-reloading would see it as changed
+		vfile_storeModifiedTime( particle_file );
+	}
+	else {
+		++particle_cache_misses;
+		def = particle_evalAsset( particle_file );
+		particleCache_write( def, cache_path );
+	}
+#else
+	def = particle_evalAsset( particle_file );
+#endif // LINUX_X
+	unsigned long long duration = timer_microseconds() - start;
+	particle_load_microseconds += duration;
+	printf( "PARTICLE_LOAD: Loaded \"%s\" in %.2fms (%s). Total particle load time %.2fms (%d cached, %d evaluated).\n",
+			particle_file, (float)duration / 1000.f, def->cache_data ? "cached" : "evaluated",
+			(float)particle_load_microseconds / 1000.f, particle_cache_hits, particle_cache_misses );
+	return def;
+}
+
+void test_particleCache() {
+	char cache_path[kParticleCacheMaxPath];
+	vfile_tempPath( cache_path, sizeof( cache_path ), "test_particle.vparticle" );
+	particleEmitterDef* def = particleEmitterDef_create();
+	def->lifetime = 2.5f;
+	def->spawn_box = Vector( 1.f, 2.f, 3.f, 0.f );
+	def->velocity = Vector( 0.f, 1.f, 0.f, 0.f );
+	def->flags = kParticleWorldSpace | kParticleBurst;
+	def->size = property_create( 2 );
+	property_addf( def->size, 0.f, 1.f );
+	property_addf( def->size, 1.f, 4.f );
+	def->spawn_rate = property_create( 2 );
+	property_addf( def->spawn_rate, 0.5f, 8.f );
+
+	particleCache_write( def, cache_path );
+	particleEmitterDef* cooked = particleCache_load( cache_path );
+	vAssert( cooked );
+	vAssert( cooked->cache_data );
+	vAssert( f_eq( cooked->lifetime, def->lifetime ));
+	vAssert( vector_equal( &cooked->spawn_box, &def->spawn_box ));
+	vAssert( vector_equal( &cooked->velocity, &def->velocity ));
+	vAssert( cooked->flags == def->flags );
+	vAssert( cooked->color == NULL );
+	vAssert( cooked->texture_diffuse == NULL );
+	vAssert( cooked->size->count == 2 );
+	vAssert( f_eq( property_samplef( cooked->size, 0.5f ), property_samplef( def->size, 0.5f )));
+	vAssert( cooked->spawn_rate->count == 1 );
+	vAssert( f_eq( property_valuef( cooked->spawn_rate, 0 ), 8.f ));
+
+	particleEmitterDef_deInit( cooked );
+	vAssert( cooked->cache_data == NULL && cooked->size == NULL );
+	mem_free( cooked );
+	particleEmitterDef_deInit( def );
+	mem_free( def );
+	remove( cache_path );
+}
+
 particleEmitterDef* particle_loadAsset( const char* particle_file ) {
 	int key = mhash( particle_file );
 	// try to find it if it's already loaded
@@ -360,8 +705,12 @@ particleEmitterDef* particle_loadAsset( const char* particle_file ) {
 		// If the file has changed, we want to update this (live-reloading)
 		if ( vfile_modifiedSinceLast( particle_file )) {
 			// Load the new file
-			term* particle_term = lisp_eval_file( lisp_global_context, particle_file );
-			particleEmitterDef* new = particle_term->data;
+			particleEmitterDef* new = particle_evalAsset( particle_file );
+#ifdef LINUX_X
+			char cache_path[kParticleCacheMaxPath];
+			particleCache_path( cache_path, particle_file );
+			particleCache_write( new, cache_path );
+#endif // LINUX_X
 			// Save over the old
 			particleEmitterDef_deInit( def );
 			*def = *new;
@@ -370,8 +719,7 @@ particleEmitterDef* particle_loadAsset( const char* particle_file ) {
 	}
 	
 	// otherwise load it and add it
-	term* particle_term = lisp_eval_file( lisp_global_context, particle_file );
-	particleEmitterDef* def = particle_term->data;
+	particleEmitterDef* def = particle_cookedAsset( particle_file );
 	map_add( particleEmitterAssets, key, &def );
 	return def;
 }
@@ -384,6 +732,10 @@ particleEmitter* particle_newEmitter( particleEmitterDef* definition ) {
 
 void particleEmitter_destroy( particleEmitter* e ) {
 	e->destroyed = true;
+	if ( e->trans ) {
+		matrix_cpy( e->world, transform_world( e->trans ));
+		e->trans = NULL;
+	}
 }
 
 void particleEmitter_delete( particleEmitter* e ) {
@@ -393,5 +745,5 @@ void particleEmitter_delete( particleEmitter* e ) {
 	vAssert( e->element_buffer );
 	mem_free( e->vertex_buffer );
 	mem_free( e->element_buffer );
-	mem_free( e );
+	pool_particleEmitter_free( static_particleEmitter_pool, e );
 }
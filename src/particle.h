@@ -1,6 +1,8 @@
 // particle.h
 #pragma once
+#include "maths/geometry.h"
 #include "maths/maths.h"
+#include "mem/pool.h"
 #include "render/vgl.h"
 
 #define kMaxParticles 128
@@ -38,10 +40,13 @@ typedef struct particleEmitterDef_s {
 	vector	velocity;
 	texture*	texture_diffuse;
 	particle_flags_t	flags;
+	// If loaded from a particle cache, the buffer the properties point into
+	void*		cache_data;
 } particleEmitterDef;
 
 struct particleEmitter_s {
-	transform*	trans;
+	transform*	trans;		// NULL once destroyed; see particleEmitter_world()
+	matrix		world;		// Where it was when destroyed
 	particle	particles[kMaxParticles];
 	int		start;
 	int		count;
@@ -49,13 +54,22 @@ struct particleEmitter_s {
 	float	emitter_age;
 	particleEmitterDef*	definition;
 	bool	destroyed;
+	aabb	bounds;		// World space bounds of the live particles, updated each tick
 
 	vertex*		vertex_buffer;
 	GLushort*	element_buffer;
 };
 
+// A destroyed emitter lets its particles die out, but its transform may be deleted first (eg.
+// with its modelInstance), so it detaches and keeps the last world matrix instead
+#define particleEmitter_world( e )	( (e)->trans ? transform_world( (e)->trans ) : (e)->world )
+
+// Emitters are allocated together, so ticking and rendering them walks contiguous memory
+DECLARE_POOL( particleEmitter )
+
 // *** System static init
 void particle_init();
+void particleEmitter_initPool();
 
 // *** EmitterDef functions
 particleEmitterDef* particleEmitterDef_create();
@@ -74,6 +88,7 @@ particleEmitterDef* particle_loadAsset( const char* particle_file );
 
 property* property_create( int stride );
 property* property_copy( property* p );
+void property_delete( property* p );
 void property_addf( property* p, float time, float value );
 void property_addfv( property* p, float time, float* values );
 void property_addv( property* p, float time, vector value );
@@ -81,3 +96,4 @@ void property_addv( property* p, float time, vector value );
 // *** Test
 
 void test_property();
+void test_particleCache();
@@ -5,9 +5,20 @@
 #include "engine.h"
 #include "transform.h"
 #include "maths/vector.h"
+#include "mem/allocator.h"
+
+IMPLEMENT_POOL( physic )
+
+#define kPhysicChunkSize 256
+
+pool_physic* static_physic_pool = NULL;
+
+void physic_initPool() {
+	static_physic_pool = pool_physic_createGrowable( kPhysicChunkSize );
+}
 
 physic* physic_create()  {
-	physic* p = mem_alloc( sizeof( physic ));
+	physic* p = pool_physic_allocate( static_physic_pool );
 	memset( p, 0, sizeof( physic ));
 	p->velocity = Vector( 0.f, 0.f, 0.f, 0.f );
 	p->mass = 0.f;
@@ -27,12 +38,12 @@ void physic_tick( void* data, float dt, engine* eng ) {
 	vector delta;
 	vector_scale( &delta, &p->velocity, dt );
 	vector position;
-	Add( &position, &delta, matrix_getTranslation( p->trans->world ));
+	Add( &position, &delta, matrix_getTranslation( transform_world( p->trans ) ));
 	transform_setWorldSpacePosition( p->trans, &position );
 
 	// If requested to delete
 	if ( p->to_delete ) {
-		mem_free( p );
 		stopTick( eng, p, physic_tick );
+		pool_physic_free( static_physic_pool, p );
 	}
 }
@@ -1,6 +1,7 @@
 // physic.h
 #pragma once
 #include "maths/maths.h"
+#include "mem/pool.h"
 
 typedef struct physic_s {
 	transform* trans;
@@ -9,6 +10,11 @@ typedef struct physic_s {
 	bool	to_delete;
 } physic;
 
+// Physics objects are allocated together, so ticking them walks contiguous memory
+DECLARE_POOL( physic )
+
+void physic_initPool();
+
 physic* physic_create();
 void physic_delete( physic* p );
 
@@ -4,167 +4,177 @@
 #include "render/debugdraw.h"
 //-----------------------
 #include "maths/maths.h"
+#include "maths/matrix.h"
 #include "maths/vector.h"
+#include "mem/allocator.h"
 #include "render/render.h"
 
 #include "render/vgl.h"
 
-// The total number of verts per frame we can draw using the debug draw system
-#define kMaxDebugDrawVerts 0x1 << 20
-
-// Static buffers used to store debug draw verts and indices - these are wiped each frame
-vertex debugDraw_vertex_buffer[kMaxDebugDrawVerts];
-GLushort debugDraw_element_buffer[kMaxDebugDrawVerts];
-int debugDraw_verts_used;
+/*
+   Debug geometry is collected through the frame as world space (or screen space, for 2D) lines,
+   one line list per pass. debugdraw_flush() then expands each list into vertices and submits it
+   as a single GL_LINES draw call.
+
+   Each vertex is only used once, so every draw shares one ascending element buffer, and a draw
+   is limited to the range of a GLushort; longer lists are split into a few draws.
+
+   The vertices are built into an arena that is reset each flush, and regrown when a frame needs
+   more; the render thread isn't running between engine_waitForRenderThread() and engine_render()
+   signalling it, so this can't touch data that is being drawn.
+   */
+
+#define kDebugDrawMaxCallVerts		0x10000
+#define kDebugDrawMinLines			256
+#define kDebugDrawMinArenaSize		( 256 * 1024 )
+
+typedef struct debugLine_s {
+	vector	from;
+	vector	to;
+	vector	color;
+} debugLine;
+
+typedef struct debugLineList_s {
+	debugLine*	lines;
+	int			count;
+	int			capacity;
+} debugLineList;
+
+debugLineList	debugdraw_lists[kDebugDrawPassCount];
+arenaAllocator*	debugdraw_arena = NULL;
+GLushort*		debugdraw_elements = NULL;	// 0, 1, 2... shared by every debug draw call
+
+void debugdraw_line( enum debugDrawPass pass, vector from, vector to, vector color ) {
+	debugLineList* list = &debugdraw_lists[pass];
+	if ( list->count == list->capacity ) {
+		int capacity = max( kDebugDrawMinLines, list->capacity * 2 );
+		debugLine* lines = mem_alloc( sizeof( debugLine ) * capacity );
+		if ( list->lines ) {
+			memcpy( lines, list->lines, sizeof( debugLine ) * list->count );
+			mem_free( list->lines );
+		}
+		list->lines = lines;
+		list->capacity = capacity;
+	}
+	// 3D lines are in world space, so make sure they are transformed as points
+	if ( pass != kDebugDraw2D ) {
+		from.coord.w = 1.f;
+		to.coord.w = 1.f;
+	}
+	debugLine* line = &list->lines[list->count++];
+	line->from = from;
+	line->to = to;
+	line->color = color;
+}
 
 void debugdraw_line2d( vector from, vector to, vector color ) {
-	// Grab a vertex and element buffer from our static ones
-	int vert_count = 2;
-	vertex* vertex_buffer = &debugDraw_vertex_buffer[debugDraw_verts_used];
-	GLushort* element_buffer = &debugDraw_element_buffer[debugDraw_verts_used];
-	debugDraw_verts_used += vert_count;
-	vAssert( debugDraw_verts_used < kMaxDebugDrawVerts );
-
-	vertex_buffer[0].position = from;
-	vertex_buffer[1].position = to;
-	vertex_buffer[0].color = color;
-	vertex_buffer[1].color = color;
-
-	element_buffer[0] = 0;
-	element_buffer[1] = 1;
-
-	// Make a drawcall
-	const GLuint no_texture = 0;
-	drawCall* draw = drawCall_create( &renderPass_debug, resources.shader_debug_2d, vert_count, element_buffer, vertex_buffer, no_texture, modelview );
-	draw->elements_mode = GL_LINES;
+	debugdraw_line( kDebugDraw2D, from, to, color );
 }
 
 void debugdraw_line3d( vector from, vector to, vector color ) {
-	// Grab a vertex and element buffer from our static ones
-	int vert_count = 2;
-	vertex* vertex_buffer = &debugDraw_vertex_buffer[debugDraw_verts_used];
-	GLushort* element_buffer = &debugDraw_element_buffer[debugDraw_verts_used];
-	debugDraw_verts_used += vert_count;
-	vAssert( debugDraw_verts_used < kMaxDebugDrawVerts );
-
-	vertex_buffer[0].position = from;
-	vertex_buffer[1].position = to;
-	vertex_buffer[0].color = color;
-	vertex_buffer[1].color = color;
-
-	// TODO - this could be static const
-	element_buffer[0] = 0;
-	element_buffer[1] = 1;
-
-	render_resetModelView();
-
-	// Make a drawcall
-	const GLuint no_texture = 0;
-	drawCall* draw = drawCall_create( &renderPass_debug, resources.shader_debug, vert_count, element_buffer, vertex_buffer, no_texture, modelview );
-	draw->elements_mode = GL_LINES;
+	debugdraw_line( kDebugDrawOverlay, from, to, color );
 }
 
 void debugdraw_sphere( vector origin, float radius, vector color ) {
-	// Grab a vertex and element buffer from our static ones
-	int vert_count = 24;
-	vertex* vertex_buffer = &debugDraw_vertex_buffer[debugDraw_verts_used];
-	GLushort* element_buffer = &debugDraw_element_buffer[debugDraw_verts_used];
-	debugDraw_verts_used += vert_count;
-	vAssert( debugDraw_verts_used < kMaxDebugDrawVerts );
-
-	// Set up verts
-	vector offset = Vector( 0.f, radius, 0.f, 0.f );
-	Add( &vertex_buffer[0].position, &origin, &offset );
-	Sub( &vertex_buffer[1].position, &origin, &offset );
-	offset = Vector( radius, 0.f, 0.f, 0.f );
-	Add( &vertex_buffer[2].position, &origin, &offset );
-	Sub( &vertex_buffer[3].position, &origin, &offset );
-	offset = Vector( 0.f, 0.f, radius, 0.f );
-	Add( &vertex_buffer[4].position, &origin, &offset );
-	Sub( &vertex_buffer[5].position, &origin, &offset );
-
-	// Colors
-	vertex_buffer[0].color = color;
-	vertex_buffer[1].color = color;
-	vertex_buffer[2].color = color;
-	vertex_buffer[3].color = color;
-	vertex_buffer[4].color = color;
-	vertex_buffer[5].color = color;
-
-	// TODO - this could be static const
-	element_buffer[0] = 0;
-	element_buffer[1] = 2;
-	element_buffer[2] = 2;
-	element_buffer[3] = 1;
-	element_buffer[4] = 1;
-	element_buffer[5] = 3;
-	element_buffer[6] = 3;
-	element_buffer[7] = 0;
-
-	element_buffer[8] = 0;
-	element_buffer[9] = 4;
-	element_buffer[10] = 4;
-	element_buffer[11] = 1;
-	element_buffer[12] = 1;
-	element_buffer[13] = 5;
-	element_buffer[14] = 5;
-	element_buffer[15] = 0;
-
-	element_buffer[16] = 4;
-	element_buffer[17] = 2;
-	element_buffer[18] = 2;
-	element_buffer[19] = 5;
-	element_buffer[20] = 5;
-	element_buffer[21] = 3;
-	element_buffer[22] = 3;
-	element_buffer[23] = 4;
-
-	render_resetModelView();
-
-	// Make a drawcall
-	const GLuint no_texture = 0;
-	drawCall* draw = drawCall_create( &renderPass_debug, resources.shader_debug, vert_count, element_buffer, vertex_buffer, no_texture, modelview );
-	draw->elements_mode = GL_LINES;
+	// An octahedron: a ring around each axis
+	vector x = Vector( radius, 0.f, 0.f, 0.f );
+	vector y = Vector( 0.f, radius, 0.f, 0.f );
+	vector z = Vector( 0.f, 0.f, radius, 0.f );
+	vector points[6] = {
+		vector_add( origin, y ), vector_sub( origin, y ),
+		vector_add( origin, x ), vector_sub( origin, x ),
+		vector_add( origin, z ), vector_sub( origin, z ) };
+	static const int edges[12][2] = {
+		{ 0, 2 }, { 2, 1 }, { 1, 3 }, { 3, 0 },
+		{ 0, 4 }, { 4, 1 }, { 1, 5 }, { 5, 0 },
+		{ 4, 2 }, { 2, 5 }, { 5, 3 }, { 3, 4 } };
+	for ( int i = 0; i < 12; i++ )
+		debugdraw_line3d( points[edges[i][0]], points[edges[i][1]], color );
 }
 
 // Draw a wireframe mesh
+// The verts are transformed into world space here, so they can join the shared line list
 void debugdraw_wireframeMesh( int vert_count, vector* verts, int index_count, uint16_t* indices, matrix trans, vector color ) {
-	vAssert( index_count >= vert_count );
-	// Grab a vertex and element buffer from our static ones
-	vertex* vertex_buffer = &debugDraw_vertex_buffer[debugDraw_verts_used];
-	GLushort* element_buffer = &debugDraw_element_buffer[debugDraw_verts_used];
-	debugDraw_verts_used += index_count*2;
-	vAssert( debugDraw_verts_used < kMaxDebugDrawVerts );
-
-	for ( int i = 0; i < vert_count; ++i ) {
-		vertex_buffer[i].position = verts[i];
-		vertex_buffer[i].color = color;
+	(void)vert_count;
+	// For each triangle (3 indices), we draw 3 lines
+	for ( int j = 0; j + 2 < index_count; j += 3 ) {
+		vector a = matrix_vecMul( trans, &verts[indices[j+0]] );
+		vector b = matrix_vecMul( trans, &verts[indices[j+1]] );
+		vector c = matrix_vecMul( trans, &verts[indices[j+2]] );
+		debugdraw_line3d( a, b, color );
+		debugdraw_line3d( b, c, color );
+		debugdraw_line3d( c, a, color );
 	}
+}
 
-	// For each triangle (3 indices), we draw 3 lines (6 indices)
-	for ( int j = 0; j < index_count; j+=3 ) {
-		element_buffer[j*2+0] = indices[j+0];
-		element_buffer[j*2+1] = indices[j+1];
-		
-		element_buffer[j*2+2] = indices[j+1];
-		element_buffer[j*2+3] = indices[j+2];
-	
-		element_buffer[j*2+4] = indices[j+2];
-		element_buffer[j*2+5] = indices[j+0];
-	}
+void debugdraw_preTick( float dt ) {
+	(void)dt;
+	for ( int i = 0; i < kDebugDrawPassCount; i++ )
+		debugdraw_lists[i].count = 0;
+}
 
-	render_resetModelView();
-	matrix_mul( modelview, modelview, trans );
+// Make sure the arena can hold [size] bytes this frame
+void debugdraw_reserve( size_t size ) {
+	if ( debugdraw_arena && debugdraw_arena->total_size >= size ) {
+		arena_reset( debugdraw_arena );
+		return;
+	}
+	size_t arena_size = debugdraw_arena ? debugdraw_arena->total_size : kDebugDrawMinArenaSize;
+	while ( arena_size < size )
+		arena_size *= 2;
+	if ( debugdraw_arena )
+		arena_delete( debugdraw_arena );
+	debugdraw_arena = arena_create( arena_size );
+}
 
-	// Make a drawcall
+// Expand a line list into draw calls, at most kDebugDrawMaxCallVerts verts each
+void debugdraw_submit( debugLineList* list, renderPass* pass, shader* s, vertex* verts ) {
 	const GLuint no_texture = 0;
-	drawCall* draw = drawCall_create( &renderPass_debug, resources.shader_debug, index_count*2, element_buffer, vertex_buffer, no_texture, modelview );
-	draw->elements_mode = GL_LINES;
+	const int max_call_lines = kDebugDrawMaxCallVerts / 2;
+	for ( int first = 0; first < list->count; first += max_call_lines ) {
+		int line_count = min( max_call_lines, list->count - first );
+		vertex* call_verts = &verts[first * 2];
+		for ( int i = 0; i < line_count; i++ ) {
+			const debugLine* line = &list->lines[first + i];
+			call_verts[i*2+0].position = line->from;
+			call_verts[i*2+0].color = line->color;
+			call_verts[i*2+1].position = line->to;
+			call_verts[i*2+1].color = line->color;
+		}
+		drawCall* draw = drawCall_create( pass, s, line_count * 2, debugdraw_elements, call_verts, no_texture, modelview );
+		draw->elements_mode = GL_LINES;
+		draw->depth_mask = GL_FALSE;
+		// Depth tested lines go in the alpha pass, drawn after the scene they are tested against
+		draw->depth = kDrawDepthOverlay;
+	}
 }
 
-void debugdraw_preTick( float dt ) {
-	(void)dt;
-	debugDraw_verts_used = 0;
+void debugdraw_flush() {
+	if ( !debugdraw_elements ) {
+		debugdraw_elements = mem_alloc( sizeof( GLushort ) * kDebugDrawMaxCallVerts );
+		for ( int i = 0; i < kDebugDrawMaxCallVerts; i++ )
+			debugdraw_elements[i] = (GLushort)i;
+	}
+
+	size_t vert_total = 0;
+	for ( int i = 0; i < kDebugDrawPassCount; i++ )
+		vert_total += debugdraw_lists[i].count * 2;
+	if ( vert_total == 0 )
+		return;
+	// Each pass's verts start on a 16 byte boundary
+	debugdraw_reserve( vert_total * sizeof( vertex ) + kDebugDrawPassCount * 16 );
+
+	render_resetModelView();
+	shader* shaders[kDebugDrawPassCount] = { resources.shader_debug, resources.shader_debug, resources.shader_debug_2d };
+	renderPass* passes[kDebugDrawPassCount] = { &renderPass_alpha, &renderPass_debug, &renderPass_debug };
+	for ( int i = 0; i < kDebugDrawPassCount; i++ ) {
+		debugLineList* list = &debugdraw_lists[i];
+		if ( list->count == 0 )
+			continue;
+		vertex* verts = arena_allocate( debugdraw_arena, sizeof( vertex ) * list->count * 2 );
+		vAssert( verts );
+		debugdraw_submit( list, passes[i], shaders[i], verts );
+	}
 }
 
 	/*
@@ -10,11 +10,23 @@ void debugdraw_cross( const vector* center, float radius );
 void debugdraw_drawRect2D( vector* from, vector* to );
 
 // *** Debug draw primitives
+// These collect lines for the frame; debugdraw_flush() submits each pass as one draw call
+enum debugDrawPass {
+	kDebugDrawDepthTested,	// 3D, hidden behind scene geometry
+	kDebugDrawOverlay,		// 3D, drawn over everything
+	kDebugDraw2D,			// Screen space
+	kDebugDrawPassCount
+};
+
+void debugdraw_line( enum debugDrawPass pass, vector from, vector to, vector color );
+// 3D primitives are drawn in the overlay pass
 void debugdraw_line2d( vector from, vector to, vector color );
 void debugdraw_line3d( vector from, vector to, vector color );
 void debugdraw_sphere( vector origin, float radius, vector color );
 void debugdraw_wireframeMesh( int vert_count, vector* verts, int index_count, uint16_t* indices, matrix trans, vector color );
 
 void debugdraw_preTick( float dt );
+// Build and submit this frame's debug draw calls; call from engine_render(), before the render thread starts
+void debugdraw_flush();
 
 #endif // __DEBUGDRAW__
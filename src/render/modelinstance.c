@@ -12,10 +12,12 @@
 
 IMPLEMENT_POOL( modelInstance )
 
+#define kModelInstanceChunkSize 1024
+
 pool_modelInstance* static_modelInstance_pool = NULL;
 
 void modelInstance_initPool() {
-	static_modelInstance_pool = pool_modelInstance_create( 256 );
+	static_modelInstance_pool = pool_modelInstance_createGrowable( kModelInstanceChunkSize );
 }
 
 modelInstance* modelInstance_createEmpty( ) {
@@ -24,11 +26,32 @@ modelInstance* modelInstance_createEmpty( ) {
 	return i;
 }
 
+// Free a modelInstance and its sub transforms; its emitters stop spawning and are left to die out
+// The instance's own transform is not owned by it, so is not deleted
+void modelInstance_delete( modelInstance* instance ) {
+	// Emitters detach from the sub transforms first, as they outlive them
+	for ( int i = 0; i < instance->emitter_count; i++ )
+		particleEmitter_destroy( instance->emitters[i] );
+	for ( int i = 0; i < instance->transform_count; i++ )
+		transform_delete( instance->transforms[i] );
+	pool_modelInstance_free( static_modelInstance_pool, instance );
+}
+
+// A handle that can be held outside the engine (eg. by Lua), and detects if the instance is deleted
+poolHandle modelInstance_handle( modelInstance* instance ) {
+	return pool_modelInstance_handle( static_modelInstance_pool, instance );
+}
+
+// NULL if the instance has been deleted
+modelInstance* modelInstance_fromHandle( poolHandle h ) {
+	return pool_modelInstance_fromHandle( static_modelInstance_pool, h );
+}
+
 void modelInstance_createSubTransforms( modelInstance* instance ) {
 	model* m = model_fromInstance( instance );
 	for ( int i = 0; i < m->transform_count; i++ ) {
 		instance->transforms[i] = transform_create();
-		matrix_cpy( instance->transforms[i]->local, m->transforms[i]->local );
+		matrix_cpy( transform_local( instance->transforms[i] ), transform_local( m->transforms[i] ) );
 	}
 	instance->transform_count = m->transform_count;
 }
@@ -55,18 +78,34 @@ void modelInstance_createSubEmitters( modelInstance* instance ) {
 	instance->emitter_count = m->emitter_count;
 }
 
+// The model may still be loading asynchronously, in which case sub elements are
+// created later by modelInstance_resolvePending
 modelInstance* modelInstance_create( modelHandle m ) {
 	modelInstance* instance = modelInstance_createEmpty();
 	instance->model = m;
 
-	modelInstance_createSubTransforms( instance );
-	modelInstance_createSubEmitters( instance );
+	if ( model_ready( m )) {
+		modelInstance_createSubTransforms( instance );
+		modelInstance_createSubEmitters( instance );
+	}
+	else {
+		instance->pending = true;
+	}
 	
 	vAssert( !instance->trans );
 
 	return instance;
 }
 
+bool modelInstance_resolvePending( modelInstance* instance ) {
+	if ( !instance->pending || !model_ready( instance->model ))
+		return false;
+	modelInstance_createSubTransforms( instance );
+	modelInstance_createSubEmitters( instance );
+	instance->pending = false;
+	return true;
+}
+
 aabb aabb_calculate( obb bb, matrix m ) {
 	vector points[8];
 	points[0] = bb.min;
@@ -156,7 +195,7 @@ void modelInstance_calculateBoundingBox( modelInstance* instance ) {
 	instance->bb.min = Vector( 0.0, 0.0, 0.0, 1.0 );
 	instance->bb.max = Vector( 0.0, 0.0, 0.0, 1.0 );
 	model* m = model_fromInstance( instance );
-	instance->bb = aabb_calculate( m->obb, instance->trans->world );
+	instance->bb = aabb_calculate( m->obb, transform_world( instance->trans ) );
 #if 0
 	printf( "AABB: ( " );
 	vector_print( &bb.min );
@@ -177,28 +216,6 @@ void aabb_expand( aabb* bb, vector* points ) {
 	points[7] = Vector( bb->max.coord.x, bb->min.coord.y, bb->max.coord.z, 1.f );
 }
 
-bool plane_cull( aabb* bb, vector* plane ) {
-	vector points[8];
-	aabb_expand( bb, points );
-	for ( int i = 0; i < 6; i++ ) {
-		if ( Dot( &points[i], plane ) > plane->coord.w )
-			return false;
-	}
-	return true;
-}
-
-// Cull the AABB *bb* against the frustum defined as 6 planes in *frustum*
-bool frustum_cull( aabb* bb, vector* frustum ) {
-	if ( plane_cull( bb, &frustum[0] )) {
-		return true;
-	}
-	/*
-	if ( plane_cull( bb, &frustum[1] ))
-		return true;
-		*/
-	return false;
-}
-
 void debugdraw_aabb( aabb bb ) {
 	vector points[8];
 	aabb_expand( &bb, points );
@@ -219,17 +236,19 @@ void debugdraw_aabb( aabb bb ) {
 }
 
 void modelInstance_draw( modelInstance* instance, camera* cam ) {
+	// Models still loading are skipped until they are ready
+	if ( !model_ready( instance->model ))
+		return;
+
 	// Bounding box cull
 	modelInstance_calculateBoundingBox( instance );
 	//debugdraw_aabb( instance->bb );
 
-	vector frustum[6];
-	camera_calculateFrustum( cam, frustum );
-	if ( frustum_cull( &instance->bb, frustum ) )
+	if ( render_cullAABB( cam, &instance->bb, &render_cull_stats.models ))
 		return;
 
 	render_resetModelView();
-	matrix_mul( modelview, modelview, instance->trans->world );
+	matrix_mul( modelview, modelview, transform_world( instance->trans ) );
 
 	model_draw( model_fromInstance( instance ) );
 }
@@ -2,6 +2,7 @@
 
 #pragma once
 #include "mem/pool.h"
+#include "maths/geometry.h"
 #include "maths/maths.h"
 
 #include "model.h"
@@ -14,11 +15,6 @@
 	in different positions/situations
    */
 
-typedef struct aabb_s {
-	vector min;
-	vector max;
-} aabb;
-
 struct modelInstance_s {
 	modelHandle	model;
 	transform* trans;
@@ -28,6 +24,8 @@ struct modelInstance_s {
 	transform*			transforms[kMaxSubTransforms];
 	particleEmitter*	emitters[kMaxSubEmitters];
 	aabb	bb;
+	// The model is still loading, so sub elements have not been created yet
+	bool	pending;
 };
 
 DECLARE_POOL( modelInstance )
@@ -36,6 +34,14 @@ void modelInstance_initPool();
 
 modelInstance* modelInstance_createEmpty( );
 modelInstance* modelInstance_create( modelHandle m );
+void modelInstance_delete( modelInstance* instance );
+
+poolHandle modelInstance_handle( modelInstance* instance );
+modelInstance* modelInstance_fromHandle( poolHandle h );
+
+// If the instance was waiting on its model and that has now loaded, create its sub elements
+// Returns true if the instance was resolved by this call
+bool modelInstance_resolvePending( modelInstance* instance );
 
 void modelInstance_draw( modelInstance* instance, camera* cam );
 
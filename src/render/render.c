@@ -51,6 +51,10 @@ gl_resources resources;
 
 window window_main = { 1280, 720, 0, 0, 0, true };
 
+camera* render_camera = NULL;
+renderCullStats render_cull_stats;
+bool render_overdraw = false;
+
 GLuint render_glBufferCreate( GLenum target, const void* data, GLsizei size ) {
 	//printf( "Allocating oGL buffer.\n" );
 	GLuint buffer; // The OpenGL object handle we generate
@@ -87,6 +91,10 @@ int				buffer_request_count = 0;
 bufferCopyRequest	buffer_copy_requests[kMaxBufferCopyRequests];
 int				buffer_copy_request_count = 0;
 
+#define	kMaxBufferDeletes	128
+GLuint	buffer_deletes[kMaxBufferDeletes];
+int		buffer_delete_count = 0;
+
 // Mutex for buffer requests
 vmutex buffer_mutex = kMutexInitialiser;
 
@@ -138,6 +146,32 @@ GLuint* render_requestBuffer( GLenum target, const void* data, GLsizei size ) {
 	return b->ptr;
 }
 
+// Asynchronously free a buffer from render_requestBuffer
+// Any requests still waiting on it are dropped, so the data they point to can be freed straight away
+void render_freeBuffer( GLuint* buffer ) {
+	vmutex_lock( &buffer_mutex );
+	{
+		for ( int i = 0; i < buffer_request_count; ) {
+			if ( buffer_requests[i].ptr == buffer )
+				buffer_requests[i] = buffer_requests[--buffer_request_count];
+			else
+				i++;
+		}
+		if ( *buffer != kInvalidBuffer ) {
+			for ( int i = 0; i < buffer_copy_request_count; ) {
+				if ( buffer_copy_requests[i].buffer == *buffer )
+					buffer_copy_requests[i] = buffer_copy_requests[--buffer_copy_request_count];
+				else
+					i++;
+			}
+			vAssert( buffer_delete_count < kMaxBufferDeletes );
+			buffer_deletes[buffer_delete_count++] = *buffer;
+		}
+	}
+	vmutex_unlock( &buffer_mutex );
+	mem_free( buffer );
+}
+
 // Load any waiting buffer requests
 void render_bufferTick() {
 	vmutex_lock( &buffer_mutex );
@@ -158,6 +192,10 @@ void render_bufferTick() {
 			//printf( "Created buffer %x for request for %d bytes.\n", *b->ptr, b->size );
 		}
 		buffer_copy_request_count = 0;
+
+		if ( buffer_delete_count > 0 )
+			glDeleteBuffers( buffer_delete_count, buffer_deletes );
+		buffer_delete_count = 0;
 	}
 	vmutex_unlock( &buffer_mutex );
 }
@@ -346,16 +384,18 @@ void render_buildShaders() {
 	resources.shader_filter		= shader_load( "dat/shaders/filter.v.glsl",			"dat/shaders/filter.f.glsl" );
 	resources.shader_debug		= shader_load( "dat/shaders/debug_lines.v.glsl",	"dat/shaders/debug_lines.f.glsl" );
 	resources.shader_debug_2d	= shader_load( "dat/shaders/debug_lines_2d.v.glsl",	"dat/shaders/debug_lines_2d.f.glsl" );
+	resources.shader_text		= shader_load( "dat/shaders/text.v.glsl",			"dat/shaders/text.f.glsl" );
+	resources.shader_overdraw	= shader_load( "dat/shaders/overdraw.v.glsl",		"dat/shaders/overdraw.f.glsl" );
 
+	// Bindings are reflected from active variables only, so add any that every shader optimised out
 #define GET_UNIFORM_LOCATION( var ) \
-	resources.uniforms.var = shader_findConstant( mhash( #var )); \
-	assert( resources.uniforms.var != NULL );
+	resources.uniforms.var = shader_findOrAddConstant( mhash( #var ));
 	SHADER_UNIFORMS( GET_UNIFORM_LOCATION )
 	VERTEX_ATTRIBS( VERTEX_ATTRIB_LOOKUP );
 }
 
 #define kMaxDrawCalls 2048
-#define kCallBufferCount 8		// Needs to be at least as many as we have shaders
+#define kCallBufferCount 16		// Needs to be at least as many as we have shaders
 // Each shader has it's own buffer for drawcalls
 // This means drawcalls get batched by shader
 drawCall	call_buffer[kCallBufferCount][kMaxDrawCalls];
@@ -369,6 +409,7 @@ int callbatch_count = 0;
 struct renderPass_s {
 	drawCall	call_buffer[kCallBufferCount][kMaxDrawCalls];
 	int			next_call_index[kCallBufferCount];
+	int			call_count;		// Across all buffers, for drawCall.order
 };
 
 // Parameters for the whole render operation
@@ -388,6 +429,7 @@ sceneParams sceneParams_main;
 
 void renderPass_clearBuffers( renderPass* pass ) {
 	memset( pass->next_call_index, 0, sizeof( int ) * kCallBufferCount );
+	pass->call_count = 0;
 #if debug
 	memset( pass->call_buffer, 0, sizeof( drawCall ) * kMaxDrawCalls * kCallBufferCount );
 #endif
@@ -574,6 +616,15 @@ void render_resetModelView( ) {
 	matrix_cpy( modelview, camera_inverse );
 }
 
+bool render_cullAABB( camera* cam, const aabb* bb, cullCounter* counter ) {
+	if ( frustum_cullAABB( cam->frustum, bb )) {
+		counter->culled++;
+		return true;
+	}
+	counter->submitted++;
+	return false;
+}
+
 void render_setUniform_matrix( GLuint uniform, matrix m ) {
 	glUniformMatrix4fv( uniform, 1, /*transpose*/false, (GLfloat*)m );
 }
@@ -615,11 +666,11 @@ void render( scene* s ) {
 	camera* cam = s->cam;
 	render_perspectiveMatrix( perspective, cam->fov, aspect, cam->z_near, cam->z_far );
 
-	vector frustum[6];
-	camera_calculateFrustum( cam, frustum );
-
-	render_validateMatrix( cam->trans->world );
-	matrix_inverse( camera_inverse, cam->trans->world );
+	render_validateMatrix( transform_world( cam->trans ) );
+	matrix_inverse( camera_inverse, transform_world( cam->trans ) );
+	camera_calculateFrustum( cam, perspective, camera_inverse );
+	render_camera = cam;
+	memset( &render_cull_stats, 0, sizeof( render_cull_stats ));
 	render_resetModelView();
 	render_validateMatrix( modelview );
 
@@ -686,11 +737,19 @@ drawCall* drawCall_create( renderPass* pass, shader* vshader, int count, GLushor
 	draw->element_VBO	= resources.element_buffer[0];
 	draw->depth_mask = GL_TRUE;
 	draw->elements_mode = GL_TRIANGLES;
+	// Callers drawing world space geometry with an identity transform should set a better depth
+	draw->depth = mv[3][2];
+	draw->order = pass->call_count++;
 
 	matrix_cpy( draw->modelview, mv );
 	return draw;
 }
 
+float render_viewDepth( const vector* world_position ) {
+	vector view = matrix_vecMul( camera_inverse, world_position );
+	return view.coord.z;
+}
+
 void render_printShader( shader* s ) {
 	if ( s == resources.shader_default )
 		printf( "shader: default\n" );
@@ -704,6 +763,8 @@ void render_printShader( shader* s ) {
 		printf( "shader: ui\n" );
 	if ( s == resources.shader_filter )
 		printf( "shader: filter\n" );
+	if ( s == resources.shader_text )
+		printf( "shader: text\n" );
 }
 
 void render_drawCall_draw( drawCall* draw ) {
@@ -742,23 +803,32 @@ void render_drawCall_draw( drawCall* draw ) {
 	VERTEX_ATTRIBS( VERTEX_ATTRIB_DISABLE_ARRAY );
 }
 
+// The texture bound by the last draw in this batch, so we can skip rebinding it
+GLuint render_batch_texture = kInvalidGLTexture;
+
 void render_drawBatch( drawCall* draw ) {
 	// Reset the current texture unit so we have as many as we need for this batch
 	render_current_texture_unit = 0;
 	// Only draw if we have a valid texture
 	if ( draw->texture != kInvalidGLTexture ) {
-		render_setUniform_texture( *resources.uniforms.tex,			draw->texture );
-		if ( *resources.uniforms.tex_b ) {
-			render_setUniform_texture( *resources.uniforms.tex_b,		draw->texture_b );
+		// Consecutive draws sharing a texture (eg. atlased particles and UI) don't need to rebind
+		if ( draw->texture != render_batch_texture || *resources.uniforms.tex_b ) {
+			render_setUniform_texture( *resources.uniforms.tex,			draw->texture );
+			if ( *resources.uniforms.tex_b ) {
+				render_setUniform_texture( *resources.uniforms.tex_b,		draw->texture_b );
+			}
+			render_batch_texture = draw->texture;
 		}
 		render_setUniform_matrix( *resources.uniforms.modelview,	draw->modelview );
 		render_drawCall_draw( draw );
 	}
 }
 
-void render_drawCallBatch( int count, drawCall* calls ) {
-	glDepthMask( calls[0].depth_mask );
-	shader_activate( calls[0].vitae_shader );
+// Set up the shader and shared uniforms for a run of drawcalls like [first]
+void render_beginBatch( drawCall* first ) {
+	glDepthMask( first->depth_mask );
+	shader_activate( render_overdraw ? resources.shader_overdraw : first->vitae_shader );
+	render_batch_texture = kInvalidGLTexture;
 	render_lighting( theScene );
 	// Set up uniform matrices
 	render_setUniform_matrix( *resources.uniforms.projection,	perspective );
@@ -767,7 +837,10 @@ void render_drawCallBatch( int count, drawCall* calls ) {
 	render_setUniform_vector( *resources.uniforms.directional_light_direction, &directional_light_direction );
 
 	render_sceneParams( &sceneParams_main );
+}
 
+void render_drawCallBatch( int count, drawCall* calls ) {
+	render_beginBatch( &calls[0] );
 	for ( int i = 0; i < count; i++ ) {
 		render_drawBatch( &calls[i] );
 	}
@@ -783,6 +856,52 @@ void render_drawPass( renderPass* pass ) {
 	}
 }
 
+int drawCall_compareFrontToBack( const void* a_, const void* b_ ) {
+	const drawCall* a = a_;
+	const drawCall* b = b_;
+	if ( a->depth != b->depth )
+		return a->depth < b->depth ? -1 : 1;
+	return a->order - b->order;
+}
+
+int drawCall_compareBackToFront( const void* a_, const void* b_ ) {
+	const drawCall* a = *(const drawCall**)a_;
+	const drawCall* b = *(const drawCall**)b_;
+	if ( a->depth != b->depth )
+		return a->depth > b->depth ? -1 : 1;
+	return a->order - b->order;
+}
+
+// Opaque geometry: nearest first within each shader batch, so the depth test rejects
+// hidden fragments before they are shaded. Batches stay whole, to keep shader changes down
+void render_drawPassFrontToBack( renderPass* pass ) {
+	for ( int i = 0; i < kCallBufferCount; i++ ) {
+		int count = pass->next_call_index[i];
+		if ( count > 1 )
+			qsort( pass->call_buffer[i], count, sizeof( drawCall ), drawCall_compareFrontToBack );
+	}
+	render_drawPass( pass );
+}
+
+drawCall* render_sorted_calls[kCallBufferCount * kMaxDrawCalls];
+
+// Blended geometry: furthest first across all shaders, as blending needs it for correctness.
+// Consecutive calls sharing a shader are still drawn as one batch
+void render_drawPassBackToFront( renderPass* pass ) {
+	int count = 0;
+	for ( int i = 0; i < kCallBufferCount; i++ )
+		for ( int j = 0; j < pass->next_call_index[i]; j++ )
+			render_sorted_calls[count++] = &pass->call_buffer[i][j];
+	qsort( render_sorted_calls, count, sizeof( drawCall* ), drawCall_compareBackToFront );
+
+	for ( int i = 0; i < count; i++ ) {
+		drawCall* draw = render_sorted_calls[i];
+		if ( i == 0 || draw->vitae_shader != render_sorted_calls[i-1]->vitae_shader || draw->depth_mask != render_sorted_calls[i-1]->depth_mask )
+			render_beginBatch( draw );
+		render_drawBatch( draw );
+	}
+}
+
 void render_attachFrameBuffer() {
 	glBindFramebuffer( GL_FRAMEBUFFER, render_frame_buffer );
 }
@@ -796,13 +915,23 @@ void render_draw( window* w, engine* e ) {
 	render_set3D( w->width, w->height );
 	render_clear();
 
+	// When showing overdraw, every fragment that passes the depth test adds to the colour
+	if ( render_overdraw )
+		glBlendFunc( GL_ONE, GL_ONE );
+
 	glEnable( GL_DEPTH_TEST );
-	glDisable( GL_BLEND );
-	render_drawPass( &renderPass_main );
+	if ( render_overdraw )
+		glEnable( GL_BLEND );
+	else
+		glDisable( GL_BLEND );
+	render_drawPassFrontToBack( &renderPass_main );
 
 	glEnable( GL_DEPTH_TEST );
 	glEnable( GL_BLEND );
-	render_drawPass( &renderPass_alpha );
+	render_drawPassBackToFront( &renderPass_alpha );
+
+	if ( render_overdraw )
+		glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );	// Standard Alpha Blending
 	
 	// No depth-test for debug
 	glDisable( GL_DEPTH_TEST );
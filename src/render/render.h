@@ -1,10 +1,12 @@
 // render.h
 #pragma once
 #include "scene.h"
+#include "maths/geometry.h"
 #include "system/thread.h"
 
 // External
 #include "EGL/egl.h"
+#include <float.h>
 
 #define kVboCount 1
 #define kInvalidBuffer 0
@@ -12,6 +14,18 @@
 typedef struct renderPass_s renderPass;
 typedef struct sceneParams_s sceneParams;
 
+// Objects submitted for drawing vs culled, this frame
+typedef struct cullCounter_s {
+	int submitted;
+	int culled;
+} cullCounter;
+
+typedef struct renderCullStats_s {
+	cullCounter models;
+	cullCounter terrain_blocks;
+	cullCounter emitters;
+} renderCullStats;
+
 #define SHADER_UNIFORMS( f ) \
 	f( projection ) \
 	f( modelview ) \
@@ -41,7 +55,7 @@ typedef struct sceneParams_s sceneParams;
 	glDisableVertexAttribArray( *resources.attributes.attrib );
 
 #define VERTEX_ATTRIB_LOOKUP( attrib ) \
-	resources.attributes.attrib = (shader_findConstant( mhash( #attrib )));
+	resources.attributes.attrib = (shader_findOrAddConstant( mhash( #attrib )));
 
 #define VERTEX_ATTRIB_POINTER( attrib ) \
 	glVertexAttribPointer( *resources.attributes.attrib, /*vec4*/ 4, GL_FLOAT, /*Normalized?*/GL_FALSE, sizeof( vertex ), (void*)offsetof( vertex, attrib) ); \
@@ -80,6 +94,8 @@ typedef struct gl_resources_s {
 	shader* shader_filter;
 	shader* shader_debug;
 	shader* shader_debug_2d;
+	shader* shader_text;
+	shader* shader_overdraw;
 } gl_resources;
 
 struct vertex_s {
@@ -112,6 +128,9 @@ extern renderPass renderPass_alpha;
 extern renderPass renderPass_debug;
 extern sceneParams sceneParams_main;
 extern window window_main;
+extern camera* render_camera;	// The camera for the frame being built
+extern renderCullStats render_cull_stats;
+extern bool render_overdraw;	// Debug: draw every fragment as additive grey, to show overdraw
 
 void render_setBuffers( float* vertex_buffer, int vertex_buffer_size, int* element_buffer, int element_buffer_size );
 
@@ -149,6 +168,9 @@ void render_terminate();
 void render( scene* s );
 
 void render_resetModelView( );
+
+// Is *bb* outside the view frustum of *cam*? Counts the result in *counter*
+bool render_cullAABB( camera* cam, const aabb* bb, cullCounter* counter );
 void render_setUniform_matrix( GLuint uniform, matrix m );
 void render_setUniform_texture( GLuint uniform, GLuint texture );
 void render_setUniform_vector( GLuint uniform, vector* v );
@@ -164,6 +186,9 @@ GLuint render_glBufferCreate( GLenum target, const void* data, GLsizei size );
 // Asynchronosuly create a GPU buffer
 GLuint* render_requestBuffer( GLenum target, const void* data, GLsizei size );
 
+// Asynchronously free a GPU buffer, dropping any requests still pending for it
+void render_freeBuffer( GLuint* buffer );
+
 // Asynchronously copy data to a GPU  buffer
 void render_bufferCopy( GLenum target, GLuint buffer, const void* data, GLsizei size );
 
@@ -188,9 +213,18 @@ typedef struct drawCall_s {
 	unsigned int	element_buffer_offset;
 	GLenum		depth_mask;
 	GLenum		elements_mode;
+
+	// Ordering
+	float		depth;		// View space depth; defaults to that of the modelview origin
+	int			order;		// Submission order, so sorting is stable
 } drawCall;
 
+// Draw depth for screen space overlays (UI, text), so they sort in front of everything
+#define kDrawDepthOverlay -FLT_MAX
+
 drawCall* drawCall_create( renderPass* pass, shader* vshader, int count, GLushort* elements, vertex* verts, GLint tex, matrix mv );
+// View space depth of a world space point, for drawCall ordering
+float render_viewDepth( const vector* world_position );
 void render_drawCall( drawCall* draw );
 void* render_bufferAlloc( size_t size );
 
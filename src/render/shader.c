@@ -4,15 +4,55 @@
 #include "render/shader.h"
 //---------------------
 #include "mem/allocator.h"
+#include "vtime.h"
 #include "render/render.h"
 #include "system/file.h"
 #include "system/string.h"
 #include "system/hash.h"
 
+/*
+   Program Binary Cache
+
+   Compiling and linking GLSL is the bulk of our startup cost, so once a program is linked we
+   ask the driver for its binary (glGetProgramBinary) and write it next to the vertex shader
+   ( "foo.v.glsl" -> "foo.v.glsl.vprogram" ). Later loads hand that straight back to the driver
+   with glProgramBinary, skipping compilation entirely.
+
+   The cache is keyed on a hash of both sources plus the GL vendor, renderer and version strings,
+   so editing a shader or updating the driver rebuilds it. The driver can still reject a binary
+   it wrote itself, in which case we fall back to compiling.
+
+   Constant bindings come from reflecting the linked program (glGetActiveUniform), as a cached
+   program has no source to scan.
+
+   Layout:
+	shaderCacheHeader
+	uint8_t		binary[binary_size]
+   */
+
+#define kShaderCacheMagic		0x47525056	// "VPRG"
+#define kShaderCacheVersion		1
+#define kShaderCacheExtension	".vprogram"
+#define kShaderCacheMaxPath		256
+#define kShaderMaxNameLength	128
+
+typedef struct shaderCacheHeader_s {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	key;			// Hash of the sources and driver
+	uint32_t	binary_format;
+	uint32_t	binary_size;
+} shaderCacheHeader;
+
 #define kMaxShaderConstants 128
 map* shader_constants = NULL;
 #define kShaderMaxLogLength (16 << 10)
 
+// Running totals, so we can see what shader building costs at startup
+int					shader_cache_hits = 0;
+int					shader_cache_misses = 0;
+unsigned long long	shader_load_microseconds = 0;
+
 // Find the program location for a named Uniform variable in the given program
 GLint shader_getUniformLocation( GLuint program, const char* name ) {
 	GLint location = glGetUniformLocation( program, name );
@@ -34,7 +74,7 @@ GLint shader_getAttributeLocation( GLuint program, const char* name ) {
 }
 
 // Create a binding for the given variable within the given program
-shaderConstantBinding shader_createBinding( GLuint shader_program, const char* variable_type, const char* variable_name ) {
+shaderConstantBinding shader_createBinding( GLuint shader_program, GLenum variable_type, const char* variable_name ) {
 	// For each one create a binding
 	shaderConstantBinding binding;
 	binding.program_location = shader_getAttributeLocation( shader_program, variable_name );
@@ -42,16 +82,14 @@ shaderConstantBinding shader_createBinding( GLuint shader_program, const char* v
 		binding.program_location = shader_getUniformLocation( shader_program, variable_name );
 	binding.value = map_findOrAdd( shader_constants, mhash( variable_name ));
 
-	// TODO: Make this into an easy lookup table
-	binding.type = uniform_unknown;
-	if ( string_equal( "vec4", variable_type ))
-		binding.type = uniform_vector;
-	if ( string_equal( "mat4", variable_type ))
-		binding.type = uniform_matrix;
-	if ( string_equal( "sampler2D", variable_type ))
-		binding.type = uniform_tex2D;
+	switch ( variable_type ) {
+		case GL_FLOAT_VEC4:	binding.type = uniform_vector; break;
+		case GL_FLOAT_MAT4:	binding.type = uniform_matrix; break;
+		case GL_SAMPLER_2D:	binding.type = uniform_tex2D; break;
+		default:			binding.type = uniform_unknown; break;
+	}
 
-	printf( "SHADER: Created Shader binding 0x" xPTRf " for \"%s\" at location 0x%x, type: %s\n", (uintptr_t)binding.value, variable_name, binding.program_location, variable_type );
+	printf( "SHADER: Created Shader binding 0x" xPTRf " for \"%s\" at location 0x%x, type: 0x%x\n", (uintptr_t)binding.value, variable_name, binding.program_location, variable_type );
 	return binding;
 }
 
@@ -60,39 +98,35 @@ void shaderDictionary_addBinding( shaderDictionary* d, shaderConstantBinding b )
 	d->bindings[d->count++] = b;
 }
 
-// Find a list of uniform variable names in a shader source file
-void shader_buildDictionary( shaderDictionary* dict, GLuint shader_program, const char* src ) {
-	// Find a list of uniform variable names
-	inputStream* stream = inputStream_create( src );
-	char* token;
-	while ( !inputStream_endOfFile( stream )) {
-		token = inputStream_nextToken( stream );
-		if (( string_equal( token, "uniform" ) || string_equal( token, "attribute" )) && !inputStream_endOfFile( stream )) {
-			// Advance two tokens (the next is the type declaration, the second is the variable name)
-			mem_free( token );
-			token = inputStream_nextToken( stream );
-			const char* type = string_trim( token );
-			mem_free( token );
-			token = inputStream_nextToken( stream );
-			const char* name = string_trim( token );
-			// If it's an array remove the array specification
-			char* c = (char*)name;
-			int length = strlen(name );
-			while ( c < name + length ) {
-				if ( *c == '[' )
-					*c = '\0';
-				c++;
-			}
-
-			shaderDictionary_addBinding( dict, shader_createBinding( shader_program, type, name ));
-
-			mem_free( (void*)name );
-			mem_free( (void*)type );
-		}
-		mem_free( token );
+typedef void (*func_getActive)( GLuint, GLuint, GLsizei, GLsizei*, GLint*, GLenum*, GLchar* );
+
+// Add a binding for each active variable reported by [getActive]
+void shader_reflectVariables( shaderDictionary* dict, GLuint shader_program, GLenum count_query, func_getActive getActive ) {
+	GLint count = 0;
+	glGetProgramiv( shader_program, count_query, &count );
+	for ( GLint i = 0; i < count; i++ ) {
+		char name[kShaderMaxNameLength];
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		getActive( shader_program, (GLuint)i, kShaderMaxNameLength, &length, &size, &type, name );
+		// Built-in variables (eg. gl_Vertex) have no constant to bind
+		if ( strncmp( name, "gl_", 3 ) == 0 )
+			continue;
+		// Arrays are reported as their first element, eg. "lights[0]"
+		char* bracket = strchr( name, '[' );
+		if ( bracket )
+			*bracket = '\0';
+		shaderDictionary_addBinding( dict, shader_createBinding( shader_program, type, name ));
 	}
 }
 
+// Build the constant dictionary from the program's active attributes and uniforms
+void shader_buildDictionary( shaderDictionary* dict, GLuint shader_program ) {
+	shader_reflectVariables( dict, shader_program, GL_ACTIVE_ATTRIBUTES, glGetActiveAttrib );
+	shader_reflectVariables( dict, shader_program, GL_ACTIVE_UNIFORMS, glGetActiveUniform );
+}
+
 void gl_dumpInfoLog( GLuint object, func_getIV getIV, func_getInfoLog getInfoLog ) {
 	GLint length = -1;
 	char* log;
@@ -146,6 +180,10 @@ GLuint shader_link( GLuint vertex_shader, GLuint fragment_shader ) {
 	GLuint program = glCreateProgram();
 	glAttachShader( program, vertex_shader );
 	glAttachShader( program, fragment_shader );
+#ifdef LINUX_X
+	// Must be set before linking, so the driver keeps the binary for the shader cache
+	glProgramParameteri( program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+#endif // LINUX_X
 	glLinkProgram( program );
 	glValidateProgram( program );
 
@@ -179,6 +217,12 @@ GLint* shader_findConstant( int key ) {
 	return map_find( shader_constants, key );
 }
 
+// As shader_findConstant(), but adds the constant if no program uses it
+// (reflection only reports active variables, so one the compiler removed everywhere is never bound)
+GLint* shader_findOrAddConstant( int key ) {
+	return map_findOrAdd( shader_constants, key );
+}
+
 // Clear all constants so that they are unbound
 void shader_clearConstants() {
 #define CLEAR_SHADER_UNIFORM( var ) \
@@ -204,9 +248,94 @@ void shader_activate( shader* s ) {
 	shader_bindConstants( s );
 }
 
-// Load a shader from GLSL files
+#ifdef LINUX_X
+void shaderCache_path( char* cache_path, const char* vertex_name ) {
+	vAssert(( strlen( vertex_name ) + strlen( kShaderCacheExtension )) < kShaderCacheMaxPath );
+	strcpy( cache_path, vertex_name );
+	strcat( cache_path, kShaderCacheExtension );
+}
+
+uint32_t shaderCache_hashString( const char* string, uint32_t seed ) {
+	return string ? MurmurHash2( string, strlen( string ), seed ) : seed;
+}
+
+// Identifies both sources and the driver that compiled them
+uint32_t shaderCache_key( const char* vertex_file, const char* fragment_file ) {
+	uint32_t key = kShaderCacheMagic;
+	key = shaderCache_hashString( vertex_file, key );
+	key = shaderCache_hashString( fragment_file, key );
+	key = shaderCache_hashString( (const char*)glGetString( GL_VENDOR ), key );
+	key = shaderCache_hashString( (const char*)glGetString( GL_RENDERER ), key );
+	key = shaderCache_hashString( (const char*)glGetString( GL_VERSION ), key );
+	return key;
+}
+
+bool shaderCache_supported() {
+	GLint formats = 0;
+	glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+	return formats > 0;
+}
+
+// Create a program from a cached binary, or return 0 if there is no usable cache
+GLuint shaderCache_load( const char* cache_path, uint32_t key ) {
+	if ( vfile_modifiedTime( cache_path ) == 0 )
+		return 0;
+
+	size_t length = 0;
+	uint8_t* data = vfile_contents( cache_path, &length );
+	const shaderCacheHeader* header = (const shaderCacheHeader*)data;
+	bool valid = length >= sizeof( shaderCacheHeader ) &&
+		header->magic == kShaderCacheMagic &&
+		header->version == kShaderCacheVersion &&
+		header->key == key &&
+		sizeof( shaderCacheHeader ) + header->binary_size == length;
+	GLuint program = 0;
+	if ( valid ) {
+		program = glCreateProgram();
+		glProgramBinary( program, header->binary_format, data + sizeof( shaderCacheHeader ), header->binary_size );
+		GLint program_ok = GL_FALSE;
+		glGetProgramiv( program, GL_LINK_STATUS, &program_ok );
+		if ( !program_ok ) {
+			printf( "SHADER: Driver rejected cached program \"%s\".\n", cache_path );
+			glDeleteProgram( program );
+			program = 0;
+		}
+	}
+	else
+		printf( "SHADER: Ignoring stale or invalid shader cache \"%s\".\n", cache_path );
+	mem_free( data );
+	return program;
+}
+
+void shaderCache_write( GLuint program, const char* cache_path, uint32_t key ) {
+	GLint binary_size = 0;
+	glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &binary_size );
+	if ( binary_size <= 0 )
+		return;
+
+	size_t length = sizeof( shaderCacheHeader ) + binary_size;
+	uint8_t* buffer = mem_alloc( length );
+	shaderCacheHeader* header = (shaderCacheHeader*)buffer;
+	GLenum binary_format = 0;
+	GLsizei written = 0;
+	glGetProgramBinary( program, binary_size, &written, &binary_format, buffer + sizeof( shaderCacheHeader ));
+	if ( written == binary_size ) {
+		header->magic			= kShaderCacheMagic;
+		header->version			= kShaderCacheVersion;
+		header->key				= key;
+		header->binary_format	= binary_format;
+		header->binary_size		= binary_size;
+		vfile_writeContents( cache_path, buffer, length );
+	}
+	mem_free( buffer );
+}
+#endif // LINUX_X
+
+// Load a shader from GLSL files, using the cached program binary if it is up to date
+// (rebuilding the cache otherwise)
 shader* shader_load( const char* vertex_name, const char* fragment_name ) {
 	printf( "SHADER: Loading Shader (Vertex: \"%s\", Fragment: \"%s\")\n", vertex_name, fragment_name );
+	unsigned long long start = timer_microseconds();
 	shader* s = mem_alloc( sizeof( shader ));
 	memset( s, 0, sizeof( shader ));
 	s->dict.count = 0;
@@ -216,17 +345,41 @@ shader* shader_load( const char* vertex_name, const char* fragment_name ) {
 	const char* vertex_file = vfile_contents( vertex_name, &length );
 	const char* fragment_file = vfile_contents( fragment_name, &length );
 
-	// Build the shader program
+	bool cached = false;
+#ifdef LINUX_X
+	char cache_path[kShaderCacheMaxPath];
+	shaderCache_path( cache_path, vertex_name );
+	bool cache_supported = shaderCache_supported();
+	uint32_t key = shaderCache_key( vertex_file, fragment_file );
+	if ( cache_supported )
+		s->program = shaderCache_load( cache_path, key );
+	cached = s->program != 0;
+	if ( cached ) {
+		++shader_cache_hits;
+	}
+	else {
+		++shader_cache_misses;
+		s->program = shader_build( vertex_name, fragment_name, vertex_file, fragment_file );
+		if ( cache_supported )
+			shaderCache_write( s->program, cache_path, key );
+	}
+#else
 	s->program = shader_build( vertex_name, fragment_name, vertex_file, fragment_file );
+#endif // LINUX_X
 
-	// Build our dictionaries
-	shader_buildDictionary( &s->dict, s->program, vertex_file );
-	shader_buildDictionary( &s->dict, s->program, fragment_file );
+	// Build our dictionary
+	shader_buildDictionary( &s->dict, s->program );
 
 	// Clear up memory
 	mem_free( (void*)vertex_file );			// Cast away const to free, we allocated this ourselves
 	mem_free( (void*)fragment_file	);		// Cast away const to free, "
 
+	unsigned long long duration = timer_microseconds() - start;
+	shader_load_microseconds += duration;
+	printf( "SHADER: Loaded \"%s\" in %.2fms (%s). Total shader load time %.2fms (%d cached, %d compiled).\n",
+			vertex_name, (float)duration / 1000.f, cached ? "cached" : "compiled",
+			(float)shader_load_microseconds / 1000.f, shader_cache_hits, shader_cache_misses );
+
 	vAssert( s );
 	return s;
 }
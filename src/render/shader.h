@@ -43,7 +43,7 @@ void shader_init();
 // Compile a GLSL shader object from the given source code
 GLuint shader_compile( GLenum type, const char* path, const char* source );
 
-// Load a shader from GLSL files
+// Load a shader from GLSL files (or a cached program binary of them)
 shader* shader_load( const char* vertex_name, const char* fragment_name );
 
 // Find the program location for a named Uniform variable in the given program
@@ -56,3 +56,5 @@ GLint shader_getAttributeLocation( GLuint program, const char* name );
 void shader_activate( shader* s );
 
 GLint* shader_findConstant( int key );
+// As shader_findConstant(), but adds the constant if no loaded shader uses it
+GLint* shader_findOrAddConstant( int key );
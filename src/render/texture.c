@@ -4,56 +4,134 @@
 #include "render/texture.h"
 //---------------------
 #include "maths/maths.h"
+#include "maths/vector.h"
 #include "mem/allocator.h"
 #include "render/render.h"
 #include "system/file.h"
 #include "system/hash.h"
 #include "system/string.h"
 #include "system/thread.h"
+#include "worker.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // __SSE2__
 
 // Globals
 GLuint g_texture_default = 0;
 vmutex	texture_mutex = kMutexInitialiser;
+vmutex	texture_cache_mutex = kMutexInitialiser;
 
+// Textures are decoded on the worker thread, then uploaded on the render thread
 typedef struct textureRequest_s {
 	GLuint* tex;
 	const char* filename;
+	textureImage* image;
+	bool replace;	// Delete the existing GL texture once the new one is uploaded
 } textureRequest;
 
-#define kMaxTextureRequests 32
-textureRequest requests[kMaxTextureRequests];
-int texture_request_count = 0;
+// Requests that have been decoded and are waiting to be uploaded
+#define kMaxTextureUploads 256
+textureRequest* texture_uploads[kMaxTextureUploads];
+int texture_upload_count = 0;
+
+// Limit how much texture data we upload per frame, so level loads don't hitch the render thread
+// (we always upload at least one texture per frame, so large textures still make progress)
+#define kTextureUploadBytesPerFrame ( 1024 * 1024 )
+
+GLuint texture_upload( textureImage* image );
 
 // Load any waiting texture requests
 void texture_tick() {
 	vmutex_lock( &texture_mutex );
 	{
 		// TODO: This could be a lock-free queue
-		for ( int i = 0; i < texture_request_count; i++ ) {
-			*(requests[i].tex) = texture_loadTGA( requests[i].filename );
-			mem_free( (void*)requests[i].filename );
+		size_t uploaded = 0;
+		int done = 0;
+		while ( done < texture_upload_count && ( done == 0 || uploaded + texture_uploads[done]->image->size <= kTextureUploadBytesPerFrame )) {
+			textureRequest* request = texture_uploads[done];
+			GLuint previous = *(request->tex);
+			*(request->tex) = texture_upload( request->image );
+			if ( request->replace && previous != kInvalidGLTexture )
+				glDeleteTextures( 1, &previous );
+			uploaded += request->image->size;
+			textureImage_free( request->image );
+			mem_free( (void*)request->filename );
+			mem_free( request );
+			++done;
 		}
-		texture_request_count = 0;
+		// Keep the rest, in order, for next frame
+		texture_upload_count -= done;
+		memmove( texture_uploads, texture_uploads + done, sizeof( textureRequest* ) * texture_upload_count );
 	}
 	vmutex_unlock( &texture_mutex );
 }
 
-void texture_request( GLuint* tex, const char* filename ) {
-	// TODO - check if we've already loaded it
+void texture_addUpload( textureRequest* request ) {
 	vmutex_lock( &texture_mutex );
 	{
-		vAssert( texture_request_count < kMaxTextureRequests );
-		textureRequest* request = &requests[texture_request_count++];
-		request->tex = tex;
-		*request->tex = kInvalidGLTexture;
-		request->filename = string_createCopy( filename );
+		vAssert( texture_upload_count < kMaxTextureUploads );
+		texture_uploads[texture_upload_count++] = request;
 	}
 	vmutex_unlock( &texture_mutex );
 }
 
+// Worker task: decode a requested texture and queue it for upload
+void* texture_decodeTask( void* args ) {
+	textureRequest* request = args;
+	request->image = textureImage_loadTGA( request->filename );
+	texture_addUpload( request );
+	return NULL;
+}
+
+// Queue an already decoded image for upload on the render thread
+// Takes ownership of [image]
+// If [tex] already holds a texture, it stays valid until the new one replaces it
+void texture_requestImage( GLuint* tex, const char* filename, textureImage* image ) {
+	textureRequest* request = mem_alloc( sizeof( textureRequest ));
+	request->tex = tex;
+	request->filename = string_createCopy( filename );
+	request->image = image;
+	request->replace = true;
+	texture_addUpload( request );
+}
+
+void texture_request( GLuint* tex, const char* filename ) {
+	// TODO - check if we've already loaded it
+	textureRequest* request = mem_alloc( sizeof( textureRequest ));
+	request->tex = tex;
+	*request->tex = kInvalidGLTexture;
+	request->filename = string_createCopy( filename );
+	request->image = NULL;
+	request->replace = false;
+
+	worker_task task;
+	task.func = texture_decodeTask;
+	task.args = request;
+	worker_addTask( task );
+}
+
 void texture_init( texture* t, const char* filename ) {
 	t->gl_tex = kInvalidGLTexture;
 	t->filename = string_createCopy( filename );
+	t->atlas = NULL;
+	t->uv_rect = Vector( 0.f, 0.f, 1.f, 1.f );
+}
+
+GLuint texture_glTexture( texture* t ) {
+	return texture_region( t ).gl_tex;
+}
+
+textureRegion texture_region( texture* t ) {
+	textureRegion region;
+	vmutex_lock( &texture_cache_mutex );
+	region.gl_tex = t->atlas ? t->atlas->gl_tex : t->gl_tex;
+	region.uv_rect = t->uv_rect;
+	vmutex_unlock( &texture_cache_mutex );
+	return region;
+}
+
+vector textureRegion_uv( const textureRegion* region, float u, float v ) {
+	return Vector( region->uv_rect.coord.x + u * region->uv_rect.coord.z, region->uv_rect.coord.y + v * region->uv_rect.coord.w, 0.f, 0.f );
 }
 
 // Hash map of pointers to textures
@@ -85,31 +163,120 @@ texture* texture_nextEmpty() {
 	return &textures[texture_count++];
 }
 
+// Find a texture in the cache, creating a new unloaded one if it isn't there
+// Must be called with texture_cache_mutex held
+texture* texture_findOrCreate( const char* filename, bool* created ) {
+	texture* t = textureCache_find( filename );
+	*created = ( t == NULL );
+	if ( !t ) {
+		t = texture_nextEmpty();
+		texture_init( t, filename );
+		textureCache_add( t, filename );
+	}
+	return t;
+}
+
 // Get a texture matching a given filename
 // Pulls it from cache if existing, otherwise loads it asynchronously
+// Can be called from worker threads (eg. when loading models)
 texture* texture_load( const char* filename ) {
 	texture* t;
-	t = textureCache_find( filename );
-	if ( t ) {
-		//printf( "Texture \"%s\" already loaded.\n", filename );
-		return t;
-	}
-	else {
+	bool created;
+	vmutex_lock( &texture_cache_mutex );
+	t = texture_findOrCreate( filename, &created );
+	if ( created ) {
 		printf( "Loading Texture \"%s\".\n", filename );
-		t = texture_nextEmpty();
-		texture_init( t, filename );
-		textureCache_add( t, filename );
-		// temp
 		texture_request( &t->gl_tex, filename );
 	}
+	vmutex_unlock( &texture_cache_mutex );
+	return t;
+}
+
+// Get a texture for [filename] without loading it; its pixels come from elsewhere (eg. an atlas)
+texture* texture_loadEmpty( const char* filename ) {
+	texture* t;
+	bool created;
+	vmutex_lock( &texture_cache_mutex );
+	t = texture_findOrCreate( filename, &created );
+	vmutex_unlock( &texture_cache_mutex );
 	return t;
 }
 
+// Point [t] at a region of [atlas]
+// Textures that were already loaded standalone switch over to the atlas
+void texture_setAtlas( texture* t, texture* atlas, vector uv_rect ) {
+	vmutex_lock( &texture_cache_mutex );
+	t->uv_rect = uv_rect;
+	t->atlas = atlas;
+	vmutex_unlock( &texture_cache_mutex );
+}
+
+// Swap the R and B channels of 32-bit pixels ( BGRA <-> RGBA )
+void texture_swizzleBGRA( uint8_t* pixels, int pixel_count ) {
+	uint32_t* p = (uint32_t*)pixels;
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i mask_ga = _mm_set1_epi32( 0xff00ff00 );
+	const __m128i mask_low = _mm_set1_epi32( 0x000000ff );
+	for ( ; i + 4 <= pixel_count; i += 4 ) {
+		__m128i v = _mm_loadu_si128( (__m128i*)&p[i] );
+		__m128i ga = _mm_and_si128( v, mask_ga );
+		__m128i r = _mm_and_si128( _mm_srli_epi32( v, 16 ), mask_low );
+		__m128i b = _mm_slli_epi32( _mm_and_si128( v, mask_low ), 16 );
+		_mm_storeu_si128( (__m128i*)&p[i], _mm_or_si128( ga, _mm_or_si128( r, b )));
+	}
+#endif // __SSE2__
+	// Remainder (or everything, without SSE) - still a whole pixel at a time
+	for ( ; i < pixel_count; i++ ) {
+		uint32_t v = p[i];
+		p[i] = ( v & 0xff00ff00 ) | (( v >> 16 ) & 0xff ) | (( v & 0xff ) << 16 );
+	}
+}
+
+// Copy one source pixel (3 or 4 bytes) to a 4-byte destination pixel
+static inline void tga_copyPixel( uint8_t* dst, const uint8_t* src, int pixel_bytes ) {
+	dst[0] = src[0];
+	dst[1] = src[1];
+	dst[2] = src[2];
+	dst[3] = ( pixel_bytes == 4 ) ? src[3] : 0xff;
+}
+
+// Decode run-length encoded pixel data into a 32-bit buffer
+// Returns false if the data runs out before the image is complete
+bool tga_decodeRLE( uint8_t* dst, int pixel_count, const uint8_t* src, const uint8_t* src_end, int pixel_bytes ) {
+	int i = 0;
+	while ( i < pixel_count ) {
+		if ( src >= src_end )
+			return false;
+		uint8_t packet = *src++;
+		int count = ( packet & 0x7f ) + 1;
+		if ( i + count > pixel_count || src + pixel_bytes > src_end )
+			return false;
+		if ( packet & 0x80 ) {
+			// Run-length packet: one pixel repeated
+			for ( int j = 0; j < count; j++ )
+				tga_copyPixel( &dst[( i + j ) * 4], src, pixel_bytes );
+			src += pixel_bytes;
+		}
+		else {
+			// Raw packet: count literal pixels
+			if ( src + count * pixel_bytes > src_end )
+				return false;
+			for ( int j = 0; j < count; j++ )
+				tga_copyPixel( &dst[( i + j ) * 4], &src[j * pixel_bytes], pixel_bytes );
+			src += count * pixel_bytes;
+		}
+		i += count;
+	}
+	return true;
+}
 
+// Read a TGA into a 32-bit RGBA buffer
+// Supports uncompressed and RLE TrueColor, 24 or 32-bit
 uint8_t* read_tga( const char* file, int* w, int* h ) {
 	size_t length = 0;
 	u8* image_data = vfile_contents( file, &length );
-	if ( image_data == 0 ) {
+	if ( image_data == 0 || length < sizeof( tga_header )) {
 		printf( "ERROR: Error reading TGA.\n" );
 		vAssert( 0 );
 	}
@@ -118,35 +285,50 @@ uint8_t* read_tga( const char* file, int* w, int* h ) {
 	u8* body = image_data + sizeof(tga_header);
 
 	static const int kTrueColor_Uncompressed = 0x2;
-	if ( header->image_type != kTrueColor_Uncompressed ) {
-		printf( "ERROR: TGA is not uncompressed and in TrueColor.\n" );
+	static const int kTrueColor_RLE = 0xa;
+	if ( header->image_type != kTrueColor_Uncompressed && header->image_type != kTrueColor_RLE ) {
+		printf( "ERROR: TGA is not in TrueColor (uncompressed or RLE).\n" );
+		assert( 0 );
+	}
+
+	int pixel_bytes = header->pixel_depth / 8;
+	if ( pixel_bytes != 3 && pixel_bytes != 4 ) {
+		printf( "ERROR: TGA is not 24 or 32-bit.\n" );
 		assert( 0 );
 	}
 
 	int width = header->width;
 	int height = header->height;
-	u8* id_field = body;
-	(void)id_field;
 	u8* color_map = body + header->id_length;
-	tga_colormap_spec* mapspec = (tga_colormap_spec*)header->color_map_spec;
-	u8* pixels = color_map + mapspec->entry_count;
-
-	int pixel_bytes = header->pixel_depth / 8;
-	int size = width * height * pixel_bytes;
-	uint8_t* tex = mem_alloc( size );
-	memcpy( tex, pixels, size );
-
-	bool swizzle = true;
-
-	if ( swizzle ) {
-		// Switch from BGRA to RGBA
-		for ( int i = 0; i < width * height; i++ ) {
-			uint8_t tmp = tex[i * pixel_bytes + 0];
-			tex[i * pixel_bytes + 0] = tex[i * pixel_bytes + 2];
-			tex[i * pixel_bytes + 2] = tmp;
+	// The spec is not aligned, so read it byte by byte
+	uint16_t map_entries = header->color_map_spec[2] | ( header->color_map_spec[3] << 8 );
+	uint8_t map_entry_bits = header->color_map_spec[4];
+	u8* pixels = color_map + map_entries * (( map_entry_bits + 7 ) / 8 );
+	u8* end = image_data + length;
+
+	int pixel_count = width * height;
+	uint8_t* tex = mem_alloc( pixel_count * 4 );
+
+	if ( header->image_type == kTrueColor_RLE ) {
+		if ( !tga_decodeRLE( tex, pixel_count, pixels, end, pixel_bytes )) {
+			printf( "ERROR: TGA \"%s\" has truncated RLE data.\n", file );
+			vAssert( 0 );
+		}
+	}
+	else {
+		vAssert( pixels + pixel_count * pixel_bytes <= end );
+		if ( pixel_bytes == 4 ) {
+			memcpy( tex, pixels, pixel_count * 4 );
+		}
+		else {
+			for ( int i = 0; i < pixel_count; i++ )
+				tga_copyPixel( &tex[i * 4], &pixels[i * pixel_bytes], pixel_bytes );
 		}
 	}
 
+	// Switch from BGRA to RGBA
+	texture_swizzleBGRA( tex, pixel_count );
+
 	*w = width;
 	*h = height;
 
@@ -154,40 +336,144 @@ uint8_t* read_tga( const char* file, int* w, int* h ) {
 	return tex;
 }
 
-GLuint texture_loadTGA( const char* filename ) {
-	printf( "TEXTURE: Loading TGA \"%s\"\n" , filename );
-	GLuint tex;
-	int w, h;
-	void* img = read_tga( filename, &w, &h );
+// Box-filter one RGBA level down to the next (half size in each dimension, minimum 1)
+void texture_downsample( uint8_t* dst, const uint8_t* src, int src_w, int src_h ) {
+	int dst_w = src_w > 1 ? src_w / 2 : 1;
+	int dst_h = src_h > 1 ? src_h / 2 : 1;
+	int step_x = src_w > 1 ? 4 : 0;			// Byte offset to the neighbouring pixel in x
+	int step_y = src_h > 1 ? src_w * 4 : 0;	// Byte offset to the neighbouring row in y
+	for ( int y = 0; y < dst_h; y++ ) {
+		const uint8_t* row = src + ( y * ( src_h > 1 ? 2 : 1 )) * src_w * 4;
+		for ( int x = 0; x < dst_w; x++ ) {
+			const uint8_t* p = row + x * ( src_w > 1 ? 2 : 1 ) * 4;
+			for ( int c = 0; c < 4; c++ ) {
+				int sum = p[c] + p[c + step_x] + p[c + step_y] + p[c + step_x + step_y];
+				dst[( y * dst_w + x ) * 4 + c] = ( sum + 2 ) / 4;
+			}
+		}
+	}
+}
 
+// Allocate an RGBA image with space for its full mip chain
+// Level 0 is left uninitialised
+textureImage* textureImage_create( int w, int h ) {
 	vAssert( isPowerOf2( w ) );
 	vAssert( isPowerOf2( h ) );
 
-	if ( !img )
-		return 0;	// Failed to load the texture
+	// Count the levels, and the total size of the chain
+	int mip_count = 0;
+	size_t size = 0;
+	for ( int lw = w, lh = h; ; lw = lw > 1 ? lw / 2 : 1, lh = lh > 1 ? lh / 2 : 1 ) {
+		vAssert( mip_count < kTextureMaxMipLevels );
+		size += lw * lh * 4;
+		++mip_count;
+		if ( lw == 1 && lh == 1 )
+			break;
+	}
 
+	textureImage* image = mem_alloc( sizeof( textureImage ) + size );
+	image->width = w;
+	image->height = h;
+	image->mip_count = mip_count;
+	image->size = size;
+
+	uint8_t* level = (uint8_t*)( image + 1 );
+	int lw = w, lh = h;
+	for ( int i = 0; i < mip_count; i++ ) {
+		image->levels[i] = level;
+		level += lw * lh * 4;
+		lw = lw > 1 ? lw / 2 : 1;
+		lh = lh > 1 ? lh / 2 : 1;
+	}
+	return image;
+}
+
+// Fill in every mip level from level 0
+void textureImage_generateMips( textureImage* image ) {
+	int lw = image->width, lh = image->height;
+	for ( int i = 0; i + 1 < image->mip_count; i++ ) {
+		texture_downsample( image->levels[i + 1], image->levels[i], lw, lh );
+		lw = lw > 1 ? lw / 2 : 1;
+		lh = lh > 1 ? lh / 2 : 1;
+	}
+}
+
+void textureImage_clampMips( textureImage* image, int mip_count ) {
+	if ( mip_count >= image->mip_count )
+		return;
+	image->mip_count = mip_count;
+	image->size = 0;
+	int lw = image->width, lh = image->height;
+	for ( int i = 0; i < mip_count; i++ ) {
+		image->size += lw * lh * 4;
+		lw = lw > 1 ? lw / 2 : 1;
+		lh = lh > 1 ? lh / 2 : 1;
+	}
+}
+
+// Load a TGA and build its full mip chain
+textureImage* textureImage_loadTGA( const char* filename ) {
+	int w, h;
+	uint8_t* pixels = read_tga( filename, &w, &h );
+	textureImage* image = textureImage_create( w, h );
+	memcpy( image->levels[0], pixels, w * h * 4 );
+	mem_free( pixels );
+	textureImage_generateMips( image );
+	return image;
+}
+
+void textureImage_free( textureImage* image ) {
+	mem_free( image );
+}
+
+// Create a GL texture from a decoded image, uploading every mip level
+// Must be called on the render thread
+GLuint texture_upload( textureImage* image ) {
+	GLuint tex;
 	// Generate a texture name and bind to that
 	glGenTextures( 1, &tex );
 	glBindTexture( GL_TEXTURE_2D, tex );
 
-	// Set up sampling parameters, use defaults for now
-	// Bilinear interpolation, clamped
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	// Trilinear filtering, repeating
+#ifdef GL_TEXTURE_MAX_LEVEL
+	// A clamped mip chain (eg. an atlas's) stops sampling at its last level
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image->mip_count - 1 );
+	GLint min_filter = GL_LINEAR_MIPMAP_LINEAR;
+#else
+	// GLES2 has no max level, and a clamped chain would be incomplete, so that isn't mipmapped
+	bool full_chain = ( 1 << ( image->mip_count - 1 )) >= max( image->width, image->height );
+	GLint min_filter = full_chain ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
+#endif
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_REPEAT );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_REPEAT );
 
-	glTexImage2D( GL_TEXTURE_2D,
-		   			0,			// No Mipmaps for now
-					GL_RGBA,	// 3-channel, 8-bits per channel (32-bit stride)
-					(GLsizei)w, (GLsizei)h,
-					0,			// Border, unused
-					GL_RGBA,		// TGA uses BGR order internally
-					GL_UNSIGNED_BYTE,	// 8-bits per channel
-					img );
-
-	mem_free( img );	// OpenGL copies the data, so we can free this here
+	int w = image->width, h = image->height;
+	for ( int i = 0; i < image->mip_count; i++ ) {
+		glTexImage2D( GL_TEXTURE_2D,
+						i,			// Mip level
+						GL_RGBA,	// 4-channel, 8-bits per channel (32-bit stride)
+						(GLsizei)w, (GLsizei)h,
+						0,			// Border, unused
+						GL_RGBA,	// Swizzled from TGA's BGRA when decoded
+						GL_UNSIGNED_BYTE,	// 8-bits per channel
+						image->levels[i] );
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	return tex;
+}
 
+// Synchronously load a TGA into a GL texture
+// Must be called on the render thread
+GLuint texture_loadTGA( const char* filename ) {
+	printf( "TEXTURE: Loading TGA \"%s\"\n" , filename );
+	textureImage* image = textureImage_loadTGA( filename );
+	if ( !image )
+		return 0;	// Failed to load the texture
+	GLuint tex = texture_upload( image );
+	textureImage_free( image );	// OpenGL copies the data, so we can free this here
 	return tex;
 }
 
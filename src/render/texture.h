@@ -2,9 +2,20 @@
 #ifndef __TEXTURE_H__
 #define __TEXTURE_H__
 
+#include "maths/mathstypes.h"
 #include "render/vgl.h"
 
 #define kInvalidGLTexture 0xffffffff
+#define kTextureMaxMipLevels 16
+
+// A decoded RGBA image, with its full mip chain in one allocation
+typedef struct textureImage_s {
+	int			width;
+	int			height;
+	int			mip_count;
+	size_t		size;	// Total bytes of all levels
+	uint8_t*	levels[kTextureMaxMipLevels];
+} textureImage;
 
 // Globals
 extern GLuint g_texture_default;
@@ -13,6 +24,16 @@ void texture_staticInit();
 
 GLuint texture_loadTGA(const char* filename);
 
+// Read a TGA into a 32-bit RGBA buffer, owned by the caller
+uint8_t* read_tga( const char* file, int* w, int* h );
+
+textureImage* textureImage_create( int w, int h );
+void textureImage_generateMips( textureImage* image );
+// Drop all but the first [mip_count] levels of [image]
+void textureImage_clampMips( textureImage* image, int mip_count );
+textureImage* textureImage_loadTGA( const char* filename );
+void textureImage_free( textureImage* image );
+
 	// TGA format
 	//
 	// 1 byte ID length
@@ -52,11 +73,32 @@ typedef struct tga_header_s {
 struct texture_s {
 	GLuint gl_tex;
 	const char* filename;
+	texture* atlas;		// If packed into an atlas, the texture that actually holds the pixels
+	vector uv_rect;		// The region of the GL texture this uses: ( u, v, width, height )
 };
 
+// Upload textures that have finished decoding (render thread only)
 void texture_tick();
+// Asynchronously load a texture; decoding happens on the worker thread
 void texture_request( GLuint* tex, const char* filename );
+// Queue an already decoded image for upload, replacing any existing texture; takes ownership of [image]
+void texture_requestImage( GLuint* tex, const char* filename, textureImage* image );
 
 texture* texture_load( const char* filename );
+texture* texture_loadEmpty( const char* filename );
+void texture_setAtlas( texture* t, texture* atlas, vector uv_rect );
+
+// Where a texture's pixels are: the GL texture to bind, and the uv rect within it
+typedef struct textureRegion_s {
+	GLuint gl_tex;
+	vector uv_rect;
+} textureRegion;
+
+// The GL texture to bind for [t], which is the atlas if [t] has been packed
+GLuint texture_glTexture( texture* t );
+// The region [t] occupies, read under the same lock texture_setAtlas writes it under
+textureRegion texture_region( texture* t );
+// Map a uv in [0,1] into [region]
+vector textureRegion_uv( const textureRegion* region, float u, float v );
 
 #endif // __TEXTURE_H__
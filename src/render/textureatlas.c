@@ -0,0 +1,113 @@
+// textureatlas.c
+#include "common.h"
+#include "render/textureatlas.h"
+//---------------------
+#include "maths/maths.h"
+#include "maths/vector.h"
+#include "mem/allocator.h"
+#include "render/texture.h"
+
+typedef struct atlasEntry_s {
+	const char* filename;
+	uint8_t*	pixels;
+	int			width;
+	int			height;
+	int			x;
+	int			y;
+} atlasEntry;
+
+// Sort tallest first, which makes shelf packing much tighter
+int atlasEntry_compareHeight( const void* a, const void* b ) {
+	const atlasEntry* entry_a = *(const atlasEntry**)a;
+	const atlasEntry* entry_b = *(const atlasEntry**)b;
+	return entry_b->height - entry_a->height;
+}
+
+// Round [n] up to a whole number of paddings, so each level-[kTextureAtlasMipLevels-1] texel
+// covers only one entry (or its padding)
+int textureAtlas_align( int n ) {
+	return ( n + kTextureAtlasPadding - 1 ) & ~( kTextureAtlasPadding - 1 );
+}
+
+// Shelf-pack [entries] into a [size]x[size] square
+// Returns false if they don't fit
+bool textureAtlas_pack( int count, atlasEntry** entries, int size ) {
+	int x = 0;
+	int y = 0;
+	int shelf_height = 0;
+	for ( int i = 0; i < count; i++ ) {
+		atlasEntry* e = entries[i];
+		int w = textureAtlas_align( e->width ) + kTextureAtlasPadding * 2;
+		int h = textureAtlas_align( e->height ) + kTextureAtlasPadding * 2;
+		if ( x + w > size ) {
+			// Start a new shelf
+			y += shelf_height;
+			x = 0;
+			shelf_height = 0;
+		}
+		if ( x + w > size || y + h > size )
+			return false;
+		e->x = x + kTextureAtlasPadding;
+		e->y = y + kTextureAtlasPadding;
+		x += w;
+		shelf_height = max( shelf_height, h );
+	}
+	return true;
+}
+
+// Copy an entry into the atlas, clamping to repeat its edge pixels into the padding
+// (and out to the aligned edge of its cell)
+void textureAtlas_blit( uint8_t* atlas, int atlas_size, atlasEntry* e ) {
+	int padded_width = textureAtlas_align( e->width ) + kTextureAtlasPadding;
+	int padded_height = textureAtlas_align( e->height ) + kTextureAtlasPadding;
+	for ( int row = -kTextureAtlasPadding; row < padded_height; row++ ) {
+		int src_row = clamp( row, 0, e->height - 1 );
+		uint32_t* dst = (uint32_t*)atlas + ( e->y + row ) * atlas_size + e->x;
+		const uint32_t* src = (const uint32_t*)e->pixels + src_row * e->width;
+		for ( int col = -kTextureAtlasPadding; col < 0; col++ )
+			dst[col] = src[0];
+		memcpy( dst, src, e->width * 4 );
+		for ( int col = e->width; col < padded_width; col++ )
+			dst[col] = src[e->width - 1];
+	}
+}
+
+texture* textureAtlas_create( const char* name, int count, const char** filenames ) {
+	vAssert( count <= kTextureAtlasMaxEntries );
+	atlasEntry entries[kTextureAtlasMaxEntries];
+	atlasEntry* sorted[kTextureAtlasMaxEntries];
+	for ( int i = 0; i < count; i++ ) {
+		entries[i].filename = filenames[i];
+		entries[i].pixels = read_tga( filenames[i], &entries[i].width, &entries[i].height );
+		sorted[i] = &entries[i];
+	}
+	qsort( sorted, count, sizeof( atlasEntry* ), atlasEntry_compareHeight );
+
+	// Find the smallest power-of-two square that holds everything
+	int size = 64;
+	while ( !textureAtlas_pack( count, sorted, size )) {
+		size *= 2;
+		vAssert( size <= kTextureAtlasMaxSize );
+	}
+
+	textureImage* image = textureImage_create( size, size );
+	memset( image->levels[0], 0, size * size * 4 );
+	for ( int i = 0; i < count; i++ )
+		textureAtlas_blit( image->levels[0], size, &entries[i] );
+	textureImage_clampMips( image, kTextureAtlasMipLevels );
+	textureImage_generateMips( image );
+
+	texture* atlas = texture_loadEmpty( name );
+	texture_requestImage( &atlas->gl_tex, name, image );
+
+	float inv_size = 1.f / (float)size;
+	for ( int i = 0; i < count; i++ ) {
+		atlasEntry* e = &entries[i];
+		vector uv_rect = Vector( e->x * inv_size, e->y * inv_size, e->width * inv_size, e->height * inv_size );
+		texture_setAtlas( texture_loadEmpty( e->filename ), atlas, uv_rect );
+		mem_free( e->pixels );
+	}
+
+	printf( "TEXTURE: Packed %d textures into %dx%d atlas \"%s\"\n", count, size, size, name );
+	return atlas;
+}
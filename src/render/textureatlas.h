@@ -0,0 +1,19 @@
+// textureatlas.h
+#ifndef __TEXTUREATLAS_H__
+#define __TEXTUREATLAS_H__
+
+#define kTextureAtlasMaxEntries 32
+#define kTextureAtlasMaxSize 2048
+// Each packed texture has its edge pixels repeated this far out, and its cell is aligned to
+// this, so bilinear filtering doesn't bleed in from neighbours
+#define kTextureAtlasPadding 4
+// Deeper mips would have less than a texel of padding, so the atlas's mip chain stops here
+#define kTextureAtlasMipLevels 3	// log2( kTextureAtlasPadding ) + 1
+
+// Pack a set of TGAs into a single texture, named [name]
+// Each source filename is registered with the texture cache as a region of the atlas,
+// so texture_load() of any of them then returns the atlas region
+// The packing is done synchronously; the upload happens on the render thread
+texture* textureAtlas_create( const char* name, int count, const char** filenames );
+
+#endif // __TEXTUREATLAS_H__
@@ -10,12 +10,14 @@
 #include "model_loader.h"
 #include "particle.h"
 #include "physic.h"
+#include "vtime.h"
 #include "input/keyboard.h"
 #include "maths/vector.h"
 #include "mem/allocator.h"
 #include "render/debugdraw.h"
 #include "render/modelinstance.h"
 #include "script/parse.h"
+#include "system/file.h"
 #include "font.h"
 #include "debug/debugtext.h"
 
@@ -23,9 +25,6 @@
 
 // *** Private Declarations
 
-void scene_saveFile( scene* s, const char* filename );
-scene* scene_loadFile( const char* filename );
-
 void scene_removeTransform( scene* s, transform* e );
 void scene_removeEmitter( scene* s, particleEmitter* e );
 
@@ -47,17 +46,13 @@ void scene_initStatic( ) {
 	input_setDefaultKeyBind( scene_debug_lights_toggle, KEY_L );
 }
 
-// Add an existing modelInstance to the scene
-void scene_addModel( scene* s, modelInstance* instance ) {
-	vAssert( s->model_count < MAX_MODELS );
-	vAssert( instance->trans ); // Disallow adding a model without a transform already set
-	s->modelInstances[s->model_count++] = instance;
-
+// Add the sub transforms and emitters of a modelInstance to the scene
+void scene_addModelSubElements( scene* s, modelInstance* instance ) {
 	for ( int i = 0; i < instance->transform_count; i++ ) {
 		scene_addTransform( s, instance->transforms[i] );
 		// At this point we set up subtransforms to be parented by the modelinstance transform
 		// Can't do it earlier as the transform doesn't exist when modelinstance is created
-		instance->transforms[i]->parent = instance->trans;
+		transform_setParent( instance->transforms[i], instance->trans );
 	}
 	for ( int i = 0; i < instance->emitter_count; i++ ) {
 		scene_addEmitter( s, instance->emitters[i] );
@@ -71,6 +66,26 @@ void scene_addModel( scene* s, modelInstance* instance ) {
 	}
 }
 
+// Add an existing modelInstance to the scene
+void scene_addModel( scene* s, modelInstance* instance ) {
+	vAssert( s->model_count < MAX_MODELS );
+	vAssert( instance->trans ); // Disallow adding a model without a transform already set
+	s->modelInstances[s->model_count++] = instance;
+
+	// If the model is still loading, sub elements are added once it's ready
+	if ( !instance->pending )
+		scene_addModelSubElements( s, instance );
+}
+
+// Finish adding any modelInstances whose models have now loaded
+void scene_resolvePendingModels( scene* s ) {
+	for ( int i = 0; i < s->model_count; i++ ) {
+		modelInstance* instance = s->modelInstances[i];
+		if ( modelInstance_resolvePending( instance ))
+			scene_addModelSubElements( s, instance );
+	}
+}
+
 // TODO: Thread-Safe
 void scene_removeModel( scene* s, modelInstance* instance ) {
 	vAssert( instance );
@@ -143,6 +158,7 @@ void scene_free( scene* s ) {
 	mem_free( s->transforms );
 	mem_free( s->lights );
 	mem_free( s->modelInstances );
+	mem_free( s->emitters );
 //	mem_free( s->cam );
 
 	// Finally free our scene
@@ -222,9 +238,10 @@ transform* scene_transform( scene* s, int i ) {
 }
 
 // Traverse the transform graph, updating worldspace transforms
+// Transforms are stored and updated together, so this updates every transform, not just the scene's
 void scene_concatenateTransforms(scene* s) {
-	for (int i = 0; i < s->transform_count; i++)
-		transform_concatenate( scene_transform( s, i ));
+	(void)s;
+	transform_updateAll();
 }
 
 void scene_debugTransforms( scene* s ) {
@@ -256,6 +273,7 @@ void scene_input( scene* s, input* in ) {
 // Update the scene
 void scene_tick(scene* s, float dt) {
 	(void)dt;
+	scene_resolvePendingModels( s );
 	scene_concatenateTransforms( s );
 
 	if ( s->debug_flags & kSceneDebugTransforms )
@@ -270,7 +288,7 @@ void scene_tick(scene* s, float dt) {
 void scene_setCamera(scene* s, float x, float y, float z, float w) {
 	vector v = Vector(x, y, z, w);
 	matrix trans;
-	matrix_cpy( trans, s->cam->trans->world );
+	matrix_cpy( trans, transform_world( s->cam->trans ) );
 	matrix_setTranslation( trans, &v );
 	transform_setWorldSpace( s->cam->trans, trans );
 }
@@ -289,156 +307,577 @@ void test_scene_tick(scene* s, float dt) {
 	transform_setLocalTranslation( s->modelInstances[1]->trans, &translateB );
 	
 	vector translateC = Vector( 0.f, 0.f, animate,  1.f );
-	transform_setLocalTranslation( s->modelInstances[0]->trans->parent, &translateC);
+	transform_setLocalTranslation( transform_parent( s->modelInstances[0]->trans ), &translateC);
+}
+
+/*
+   Scene Files
+
+   A scene can be saved as a snapshot of its transforms, model instances, lights and camera, and
+   loaded back much faster than re-running the scene script that built it.
+
+   The format is explicitly laid out with fixed size fields and offsets rather than pointers, so
+   files are the same across builds and 32/64-bit. Files are mapped and the records read in place;
+   model filenames are used straight from the mapping.
+
+   Layout (all offsets are bytes from the start of the file, each section 16-byte aligned):
+	sceneFileHeader
+	sceneFileSection	sections[section_count]
+	...					section data, one array of [count] records of [stride] bytes per section
+
+   Sections:
+	kSceneSectionTransforms		sceneFileTransform[]	- parent is an index into this array, or -1
+	kSceneSectionModelFiles		uint32_t[]				- offsets into the string section
+	kSceneSectionModels			sceneFileModel[]		- model_file is an index into the model files
+	kSceneSectionLights			sceneFileLight[]
+	kSceneSectionCamera			sceneFileCamera[]		- zero or one
+	kSceneSectionStrings		char[]					- null-terminated strings
+
+   Model instance sub transforms and emitters are not saved; they are recreated from the model.
+   */
+
+#define kSceneFileMagic		0x4e435356	// "VSCN"
+#define kSceneFileVersion	1
+#define kSceneFileAlignment	16
+#define kSceneNoTransform	-1
+
+enum sceneFileSectionType {
+	kSceneSectionTransforms,
+	kSceneSectionModelFiles,
+	kSceneSectionModels,
+	kSceneSectionLights,
+	kSceneSectionCamera,
+	kSceneSectionStrings,
+	kSceneSectionCount
+};
+
+typedef struct sceneFileHeader_s {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	total_size;
+	uint32_t	section_count;
+	float		ambient[4];
+	float		fog_color[4];
+	float		sky_color[4];
+} sceneFileHeader;
+
+typedef struct sceneFileSection_s {
+	uint32_t	type;
+	uint32_t	count;
+	uint32_t	stride;
+	uint32_t	offset;
+} sceneFileSection;
+
+typedef struct sceneFileTransform_s {
+	float		local[16];
+	int32_t		parent;
+	int32_t		padding[3];
+} sceneFileTransform;
+
+typedef struct sceneFileModel_s {
+	int32_t		transform;
+	int32_t		model_file;
+} sceneFileModel;
+
+typedef struct sceneFileLight_s {
+	int32_t		transform;
+	float		diffuse[4];
+	float		specular[4];
+	float		attenuation[3];	// constant, linear, quadratic
+} sceneFileLight;
+
+typedef struct sceneFileCamera_s {
+	int32_t		transform;
+	float		z_near;
+	float		z_far;
+	float		fov;
+} sceneFileCamera;
+
+// A scene object and its index, so we can look up indices by pointer while saving
+typedef struct sceneIndex_s {
+	const void*	ptr;
+	int			index;
+} sceneIndex;
+
+int sceneIndex_compare( const void* a_, const void* b_ ) {
+	const sceneIndex* a = a_;
+	const sceneIndex* b = b_;
+	return ( a->ptr > b->ptr ) - ( a->ptr < b->ptr );
+}
+
+int sceneIndex_find( sceneIndex* indices, int count, const void* ptr ) {
+	sceneIndex key = { ptr, 0 };
+	sceneIndex* found = bsearch( &key, indices, count, sizeof( sceneIndex ), sceneIndex_compare );
+	return found ? found->index : -1;
+}
+
+uint32_t sceneFile_align( uint32_t offset ) {
+	return ( offset + kSceneFileAlignment - 1 ) & ~( kSceneFileAlignment - 1 );
+}
+
+// Lay out a section after [offset], returning the end of it
+uint32_t sceneFile_addSection( sceneFileSection* section, uint32_t type, uint32_t count, uint32_t stride, uint32_t offset ) {
+	section->type = type;
+	section->count = count;
+	section->stride = stride;
+	section->offset = sceneFile_align( offset );
+	return section->offset + count * stride;
+}
+
+// The record size of each section type
+static const uint32_t sceneFile_strides[kSceneSectionCount] = {
+	sizeof( sceneFileTransform ),	// kSceneSectionTransforms
+	sizeof( uint32_t ),				// kSceneSectionModelFiles
+	sizeof( sceneFileModel ),		// kSceneSectionModels
+	sizeof( sceneFileLight ),		// kSceneSectionLights
+	sizeof( sceneFileCamera ),		// kSceneSectionCamera
+	sizeof( char )					// kSceneSectionStrings
+};
+
+// Find a section; the file must already have passed sceneFile_valid
+const void* sceneFile_section( const uint8_t* data, uint32_t type, uint32_t* count ) {
+	const sceneFileHeader* header = (const sceneFileHeader*)data;
+	const sceneFileSection* sections = (const sceneFileSection*)( data + sizeof( sceneFileHeader ));
+	for ( uint32_t i = 0; i < header->section_count; i++ ) {
+		const sceneFileSection* section = &sections[i];
+		if ( section->type != type )
+			continue;
+		*count = section->count;
+		return data + section->offset;
+	}
+	*count = 0;
+	return NULL;
+}
+
+// Is [i] the index of a saved transform, or kSceneNoTransform?
+bool sceneFile_transformValid( int32_t i, uint32_t transform_count ) {
+	return i >= kSceneNoTransform && i < (int32_t)transform_count;
+}
+
+// Check the header, that every section fits in the file with the record size we expect, and
+// that every index between records is in range, so loading can trust the file
+bool sceneFile_valid( const uint8_t* data, size_t length ) {
+	const sceneFileHeader* header = (const sceneFileHeader*)data;
+	if ( length < sizeof( sceneFileHeader ) ||
+			header->magic != kSceneFileMagic ||
+			header->version != kSceneFileVersion ||
+			header->total_size != length ||
+			sizeof( sceneFileHeader ) + sizeof( sceneFileSection ) * header->section_count > length )
+		return false;
+
+	const sceneFileSection* sections = (const sceneFileSection*)( data + sizeof( sceneFileHeader ));
+	for ( uint32_t i = 0; i < header->section_count; i++ ) {
+		const sceneFileSection* section = &sections[i];
+		if ( section->type >= kSceneSectionCount ||
+				section->stride != sceneFile_strides[section->type] ||
+				section->offset % kSceneFileAlignment != 0 ||
+				(uint64_t)section->offset + (uint64_t)section->count * section->stride > length )
+			return false;
+	}
+
+	uint32_t transform_count = 0;
+	const sceneFileTransform* transforms = sceneFile_section( data, kSceneSectionTransforms, &transform_count );
+	if ( transform_count > MAX_TRANSFORMS )
+		return false;
+	for ( uint32_t i = 0; i < transform_count; i++ ) {
+		if ( !sceneFile_transformValid( transforms[i].parent, transform_count ) || transforms[i].parent == (int32_t)i )
+			return false;
+	}
+
+	uint32_t strings_size = 0;
+	const char* strings = sceneFile_section( data, kSceneSectionStrings, &strings_size );
+	uint32_t model_file_count = 0;
+	const uint32_t* model_files = sceneFile_section( data, kSceneSectionModelFiles, &model_file_count );
+	for ( uint32_t i = 0; i < model_file_count; i++ ) {
+		if ( model_files[i] >= strings_size || !memchr( strings + model_files[i], '\0', strings_size - model_files[i] ))
+			return false;
+	}
+
+	uint32_t model_count = 0;
+	const sceneFileModel* models = sceneFile_section( data, kSceneSectionModels, &model_count );
+	if ( model_count > MAX_MODELS )
+		return false;
+	for ( uint32_t i = 0; i < model_count; i++ ) {
+		if ( !sceneFile_transformValid( models[i].transform, transform_count ) ||
+				models[i].model_file < 0 || models[i].model_file >= (int32_t)model_file_count )
+			return false;
+	}
+
+	uint32_t light_count = 0;
+	const sceneFileLight* lights = sceneFile_section( data, kSceneSectionLights, &light_count );
+	if ( light_count > MAX_LIGHTS )
+		return false;
+	for ( uint32_t i = 0; i < light_count; i++ ) {
+		if ( !sceneFile_transformValid( lights[i].transform, transform_count ))
+			return false;
+	}
+
+	uint32_t camera_count = 0;
+	const sceneFileCamera* cam = sceneFile_section( data, kSceneSectionCamera, &camera_count );
+	return camera_count <= 1 && ( camera_count == 0 || sceneFile_transformValid( cam->transform, transform_count ));
 }
 
-// All sceneData data is owned by the sceneData
-// EXCEPT now it will all be one big blob
-// so just free the data
-void sceneData_free( sceneData* data ) {
-	mem_free( data );
+// The file index of a scene transform, or kSceneNoTransform if it is not saved
+int32_t sceneFile_transformIndex( sceneIndex* transform_indices, int count, int* file_index, transform* t ) {
+	int index = t ? sceneIndex_find( transform_indices, count, t ) : -1;
+	return index == -1 ? kSceneNoTransform : file_index[index];
 }
 
-// save a scene as a binary blob
-// the data should be packed in the following format:
-//
-// SceneData header
-// Transform Array (transform_count items)
-// Model Array (model_count items)
-// Light Array (light_count items)
-//
-sceneData* scene_save( scene* s ) {
-	// Calculate total size of binary blob needed
-	// Total size is header + size of all arrays
-
-	size_t models_size =		sizeof( modelInstance ) *	s->model_count;
-	size_t lights_size =		sizeof( light ) *			s->light_count;
-	size_t transforms_size =	sizeof( transform ) *		s->transform_count;
-
-	size_t blob_size = sizeof( sceneData ) +
-						transforms_size +
-						models_size +
-						lights_size +
-						sizeof( camera );
-
-	void* blob = mem_alloc( blob_size );
-	void* blob_end = blob + blob_size;	// Used for debug check to ensure we don't write over the end
-	
-	sceneData* data = (sceneData*)blob;
-	data->size = blob_size;
+// Save a snapshot of the scene to a file
+void scene_saveFile( scene* s, const char* filename ) {
+	// Sort the scene transforms by address, so we can find the index of a transform quickly
+	sceneIndex* transform_indices = mem_alloc( sizeof( sceneIndex ) * max( 1, s->transform_count ));
+	for ( int i = 0; i < s->transform_count; i++ ) {
+		transform_indices[i].ptr = s->transforms[i];
+		transform_indices[i].index = i;
+	}
+	qsort( transform_indices, s->transform_count, sizeof( sceneIndex ), sceneIndex_compare );
 
-	// transforms or parent transforms are stored as indices rather than pointers
-	// so that they can be restored correctly when moved and loaded
+	// Model instance sub transforms are recreated on load, so skip them
+	int* file_index = mem_alloc( sizeof( int ) * max( 1, s->transform_count ));
+	for ( int i = 0; i < s->transform_count; i++ )
+		file_index[i] = 0;
+	for ( int i = 0; i < s->model_count; i++ ) {
+		modelInstance* instance = s->modelInstances[i];
+		for ( int j = 0; j < instance->transform_count; j++ ) {
+			int index = sceneIndex_find( transform_indices, s->transform_count, instance->transforms[j] );
+			if ( index != -1 )
+				file_index[index] = kSceneNoTransform;
+		}
+	}
+	int transform_count = 0;
+	for ( int i = 0; i < s->transform_count; i++ )
+		if ( file_index[i] != kSceneNoTransform )
+			file_index[i] = transform_count++;
 
-	// transforms
-	data->transform_count = s->transform_count;
-	data->transforms = blob + sizeof( sceneData );
-	assert( (void*)data->transforms < blob_end );
 
+	// Each model file is stored once
+	int model_file_count = 0;
+	modelHandle* model_files = mem_alloc( sizeof( modelHandle ) * max( 1, s->model_count ));
+	int* model_file_index = mem_alloc( sizeof( int ) * max( 1, s->model_count ));
+	uint32_t strings_size = 0;
+	for ( int i = 0; i < s->model_count; i++ ) {
+		modelHandle h = s->modelInstances[i]->model;
+		int index = -1;
+		for ( int j = 0; j < model_file_count && index == -1; j++ )
+			if ( model_files[j] == h )
+				index = j;
+		if ( index == -1 ) {
+			index = model_file_count++;
+			model_files[index] = h;
+			strings_size += strlen( model_getFileNameFromHandle( h )) + 1;
+		}
+		model_file_index[i] = index;
+	}
+
+	sceneFileSection sections[kSceneSectionCount];
+	uint32_t offset = sizeof( sceneFileHeader ) + sizeof( sections );
+	offset = sceneFile_addSection( &sections[kSceneSectionTransforms], kSceneSectionTransforms, transform_count, sizeof( sceneFileTransform ), offset );
+	offset = sceneFile_addSection( &sections[kSceneSectionModelFiles], kSceneSectionModelFiles, model_file_count, sizeof( uint32_t ), offset );
+	offset = sceneFile_addSection( &sections[kSceneSectionModels], kSceneSectionModels, s->model_count, sizeof( sceneFileModel ), offset );
+	offset = sceneFile_addSection( &sections[kSceneSectionLights], kSceneSectionLights, s->light_count, sizeof( sceneFileLight ), offset );
+	offset = sceneFile_addSection( &sections[kSceneSectionCamera], kSceneSectionCamera, s->cam ? 1 : 0, sizeof( sceneFileCamera ), offset );
+	offset = sceneFile_addSection( &sections[kSceneSectionStrings], kSceneSectionStrings, strings_size, sizeof( char ), offset );
+
+	sceneFileHeader header;
+	memset( &header, 0, sizeof( header ));
+	header.magic = kSceneFileMagic;
+	header.version = kSceneFileVersion;
+	header.total_size = offset;
+	header.section_count = kSceneSectionCount;
+	memcpy( header.ambient, s->ambient, sizeof( header.ambient ));
+	memcpy( header.fog_color, s->fog_color.val, sizeof( header.fog_color ));
+	memcpy( header.sky_color, s->sky_color.val, sizeof( header.sky_color ));
+
+	uint8_t* buffer = mem_alloc( header.total_size );
+	memset( buffer, 0, header.total_size );
+	memcpy( buffer, &header, sizeof( header ));
+	memcpy( buffer + sizeof( header ), sections, sizeof( sections ));
+
+	sceneFileTransform* transforms = (sceneFileTransform*)( buffer + sections[kSceneSectionTransforms].offset );
 	for ( int i = 0; i < s->transform_count; i++ ) {
-		data->transforms[i] = *scene_transform( s, i );
-		assert( data->transforms[i].parent != scene_transform( s, i ));
-		data->transforms[i].parent = (void*)(uintptr_t)scene_transformIndex( s, data->transforms[i].parent );
+		if ( file_index[i] == kSceneNoTransform )
+			continue;
+		sceneFileTransform* t = &transforms[file_index[i]];
+		memcpy( t->local, transform_local( s->transforms[i] ), sizeof( t->local ));
+		t->parent = sceneFile_transformIndex( transform_indices, s->transform_count, file_index, transform_parent( s->transforms[i] ));
+		vAssert( t->parent != file_index[i] );
 	}
-	
-	// modelInstances
-	data->model_count = s->model_count;
-	data->modelInstances = (void*)data->transforms + transforms_size;
-	assert( (void*)data->modelInstances < blob_end );
 
-	for ( int i = 0; i < s->model_count; i++ ) {
-		data->modelInstances[i] = *scene_model( s, i );
-		data->modelInstances[i].trans = (void*)(uintptr_t)scene_transformIndex( s, data->modelInstances[i].trans );
+	uint32_t* model_file_offsets = (uint32_t*)( buffer + sections[kSceneSectionModelFiles].offset );
+	char* strings = (char*)( buffer + sections[kSceneSectionStrings].offset );
+	uint32_t string_offset = 0;
+	for ( int i = 0; i < model_file_count; i++ ) {
+		const char* model_filename = model_getFileNameFromHandle( model_files[i] );
+		model_file_offsets[i] = string_offset;
+		strcpy( strings + string_offset, model_filename );
+		string_offset += strlen( model_filename ) + 1;
 	}
 
-	// lights
-	data->light_count = s->light_count;
-	data->lights = (void*)data->modelInstances + models_size;
-	assert( (void*)data->lights < blob_end );
+	sceneFileModel* models = (sceneFileModel*)( buffer + sections[kSceneSectionModels].offset );
+	for ( int i = 0; i < s->model_count; i++ ) {
+		models[i].transform = sceneFile_transformIndex( transform_indices, s->transform_count, file_index, s->modelInstances[i]->trans );
+		models[i].model_file = model_file_index[i];
+	}
 
+	sceneFileLight* lights = (sceneFileLight*)( buffer + sections[kSceneSectionLights].offset );
 	for ( int i = 0; i < s->light_count; i++ ) {
-		data->lights[i] = *scene_light( s, i );
-		data->lights[i].trans = (void*)(uintptr_t)scene_transformIndex( s, data->lights[i].trans );
+		light* l = s->lights[i];
+		lights[i].transform = sceneFile_transformIndex( transform_indices, s->transform_count, file_index, l->trans );
+		memcpy( lights[i].diffuse, l->diffuse_color.val, sizeof( lights[i].diffuse ));
+		memcpy( lights[i].specular, l->specular_color.val, sizeof( lights[i].specular ));
+		lights[i].attenuation[0] = l->attenuationConstant;
+		lights[i].attenuation[1] = l->attenuationLinear;
+		lights[i].attenuation[2] = l->attenuationQuadratic;
 	}
 
-	data->cam = (void*)data->lights + lights_size;
-	assert( (void*)data->cam < blob_end );
+	if ( s->cam ) {
+		sceneFileCamera* cam = (sceneFileCamera*)( buffer + sections[kSceneSectionCamera].offset );
+		cam->transform = sceneFile_transformIndex( transform_indices, s->transform_count, file_index, s->cam->trans );
+		cam->z_near = s->cam->z_near;
+		cam->z_far = s->cam->z_far;
+		cam->fov = s->cam->fov;
+	}
 
-	memcpy( data->cam, s->cam, sizeof( camera ));
-	data->cam->trans = (transform*)(uintptr_t)scene_transformIndex( s, data->cam->trans );
+	vfile_writeContents( filename, buffer, header.total_size );
 
-	return data;
+	mem_free( buffer );
+	mem_free( model_file_index );
+	mem_free( model_files );
+	mem_free( file_index );
+	mem_free( transform_indices );
 }
 
-transform* scene_resolveTransform( scene* s, uintptr_t i ) {
-	if ( i == INVALID_TRANSFORM_INDEX )
+transform* scene_resolveTransform( scene* s, int32_t i ) {
+	if ( i == kSceneNoTransform )
 		return NULL;
 	else
 		return scene_transform( s, i );
 }
 
-// TODO
-void scene_saveFile( scene* s, const char* filename ) {
-	sceneData* data = scene_save( s );
-	vfile_writeContents( filename, data, data->size );
-	sceneData_free( data );
-}
-
-// TODO
+// Create a scene from a scene file snapshot
 scene* scene_loadFile( const char* filename ) {
-	size_t buffer_length;
-	void* buffer = vfile_contents( filename, &buffer_length );
-	sceneData* data = (sceneData*)buffer;
-	printf( "Loading scene from file %s. File Size: " dPTRf ", Data size: " dPTRf ".\n", filename, buffer_length, data->size );
-	assert( data->size == buffer_length );
-	return scene_load( buffer );
-}
-
-scene* scene_load( sceneData* data ) {
-	// create scene
-	scene* s = scene_create();
-	scene_setAmbient( s, 0.2f, 0.2f, 0.2f, 1.f );
-
-	printf( "Loading %d transforms.\n", data->transform_count );
-
-	size_t models_size =		sizeof( modelInstance ) *	data->model_count;
-//	size_t lights_size =		sizeof( light ) *			data->light_count;
-	size_t transforms_size =	sizeof( transform ) *		data->transform_count;
+	size_t length = 0;
+	bool mapped = true;
+	uint8_t* data = vfile_map( filename, &length );
+	if ( !data ) {
+		// Not every platform can map files
+		mapped = false;
+		data = vfile_contents( filename, &length );
+	}
 
-	// Need to fix up array pointers
-	data->transforms = (void*)data + sizeof( sceneData );
-	data->modelInstances = (void*)data->transforms + transforms_size;
-	data->lights = (void*)data->modelInstances + models_size;
+	if ( !sceneFile_valid( data, length )) {
+		printf( "SCENE_LOAD: \"%s\" is not a valid version %d scene file.\n", filename, kSceneFileVersion );
+		if ( mapped )
+			vfile_unmap( data, length );
+		else
+			mem_free( data );
+		return NULL;
+	}
 
-	// create transforms
-	for ( int i = 0; i < data->transform_count; i++ ) {
-		transform* t = transform_create( s );
-		memcpy( t, &data->transforms[i], sizeof( transform ));
+	const sceneFileHeader* header = (const sceneFileHeader*)data;
+	scene* s = scene_create();
+	memcpy( s->ambient, header->ambient, sizeof( s->ambient ));
+	memcpy( s->fog_color.val, header->fog_color, sizeof( header->fog_color ));
+	memcpy( s->sky_color.val, header->sky_color, sizeof( header->sky_color ));
+
+	// create transforms; they are added first so file indices are also scene indices
+	uint32_t transform_count = 0;
+	const sceneFileTransform* transforms = sceneFile_section( data, kSceneSectionTransforms, &transform_count );
+	for ( uint32_t i = 0; i < transform_count; i++ ) {
+		transform* t = transform_create();
+		memcpy( transform_local( t ), transforms[i].local, sizeof( matrix ));
 		scene_addTransform( s, t );
-		printf(" Loading transform %d. Parent index = " dPTRf ".\n", i, (uintptr_t)t->parent );
-		t->parent = scene_resolveTransform( s, (uintptr_t)t->parent );
-		assert( t != t->parent );
+	}
+	for ( uint32_t i = 0; i < transform_count; i++ )
+		transform_setParent( s->transforms[i], scene_resolveTransform( s, transforms[i].parent ));
+
+	uint32_t camera_count = 0;
+	const sceneFileCamera* cam = sceneFile_section( data, kSceneSectionCamera, &camera_count );
+	if ( camera_count > 0 ) {
+		s->cam = camera_create();
+		s->cam->trans = scene_resolveTransform( s, cam->transform );
+		s->cam->z_near = cam->z_near;
+		s->cam->z_far = cam->z_far;
+		s->cam->fov = cam->fov;
 	}
 
-	s->cam = camera_create( s );
-	memcpy( s->cam, data->cam, sizeof( camera ));
-	s->cam->trans = scene_resolveTransform( s, (uintptr_t)s->cam->trans );
-
-	// create modelInstances
-	for ( int i = 0; i < data->model_count; i++ ) {
-		modelInstance* m = modelInstance_createEmpty( );
-		memcpy( m, &data->modelInstances[i], sizeof( modelInstance ));
-		m->trans = scene_resolveTransform( s, (uintptr_t)m->trans );
+	// create modelInstances, looking up each model only once
+	uint32_t strings_size = 0;
+	const char* strings = sceneFile_section( data, kSceneSectionStrings, &strings_size );
+	uint32_t model_file_count = 0;
+	const uint32_t* model_files = sceneFile_section( data, kSceneSectionModelFiles, &model_file_count );
+	modelHandle* handles = mem_alloc( sizeof( modelHandle ) * max( 1, model_file_count ));
+	for ( uint32_t i = 0; i < model_file_count; i++ )
+		handles[i] = model_getHandleFromFilename( strings + model_files[i] );
+	uint32_t model_count = 0;
+	const sceneFileModel* models = sceneFile_section( data, kSceneSectionModels, &model_count );
+	for ( uint32_t i = 0; i < model_count; i++ ) {
+		modelInstance* m = modelInstance_create( handles[models[i].model_file] );
+		m->trans = scene_resolveTransform( s, models[i].transform );
 		scene_addModel( s, m );
 	}
+	mem_free( handles );
 
 	// create lights
-	for ( int i = 0; i < data->light_count; i++ ) {
+	uint32_t light_count = 0;
+	const sceneFileLight* lights = sceneFile_section( data, kSceneSectionLights, &light_count );
+	for ( uint32_t i = 0; i < light_count; i++ ) {
 		light* l = light_create( );
-		memcpy( l, &data->lights[i], sizeof( light ));
+		l->trans = scene_resolveTransform( s, lights[i].transform );
+		light_setDiffuse( l, lights[i].diffuse[0], lights[i].diffuse[1], lights[i].diffuse[2], lights[i].diffuse[3] );
+		light_setSpecular( l, lights[i].specular[0], lights[i].specular[1], lights[i].specular[2], lights[i].specular[3] );
+		light_setAttenuation( l, lights[i].attenuation[0], lights[i].attenuation[1], lights[i].attenuation[2] );
 		scene_addLight( s, l );
-		l->trans = scene_resolveTransform( s, (uintptr_t)l->trans );
 	}
 
+	if ( mapped )
+		vfile_unmap( data, length );
+	else
+		mem_free( data );
 	return s;
 }
+
+// *** Testing
+
+// Delete a scene built by a test, along with the instances, transforms, lights and camera in it
+void test_scene_delete( scene* s ) {
+	while ( s->model_count > 0 ) {
+		modelInstance* instance = s->modelInstances[s->model_count - 1];
+		// Removing the model also removes its sub transforms, which the instance deletes
+		scene_removeModel( s, instance );
+		modelInstance_delete( instance );
+	}
+	for ( int i = 0; i < s->transform_count; i++ )
+		transform_delete( s->transforms[i] );
+	for ( int i = 0; i < s->light_count; i++ )
+		mem_free( s->lights[i] );
+	if ( s->cam )
+		mem_free( s->cam );
+	scene_free( s );
+}
+
+void test_sceneFile() {
+	char filename[256];
+	vfile_tempPath( filename, sizeof( filename ), "test_scene.vscene" );
+	scene* s = scene_create();
+	scene_setAmbient( s, 0.1f, 0.2f, 0.3f, 1.f );
+	vector fog = Vector( 0.5f, 0.6f, 0.7f, 1.f );
+	scene_setFogColor( s, &fog );
+
+	s->cam = camera_createWithTransform( s );
+	s->cam->fov = 1.2f;
+	transform* root = transform_createAndAdd( s );
+	transform* child = transform_createAndAdd( s );
+	transform_setParent( child, root );
+	vector translation = Vector( 1.f, 2.f, 3.f, 1.f );
+	transform_setLocalTranslation( child, &translation );
+	modelInstance* instance = modelInstance_create( model_getHandleFromFilename( "dat/model/cube.s" ));
+	instance->trans = child;
+	scene_addModel( s, instance );
+	light* l = light_createWithTransform( s );
+	light_setDiffuse( l, 1.f, 0.5f, 0.25f, 1.f );
+	light_setAttenuation( l, 1.f, 0.1f, 0.01f );
+	scene_addLight( s, l );
+
+	scene_saveFile( s, filename );
+	scene* loaded = scene_loadFile( filename );
+	vAssert( loaded );
+	vAssert( loaded->transform_count == s->transform_count );
+	for ( int i = 0; i < s->transform_count; i++ ) {
+		vAssert( memcmp( transform_local( loaded->transforms[i] ), transform_local( s->transforms[i] ), sizeof( matrix )) == 0 );
+		vAssert( scene_transformIndex( loaded, transform_parent( loaded->transforms[i] )) == scene_transformIndex( s, transform_parent( s->transforms[i] )));
+	}
+	vAssert( loaded->model_count == 1 );
+	vAssert( loaded->modelInstances[0]->model == instance->model );
+	vAssert( scene_transformIndex( loaded, loaded->modelInstances[0]->trans ) == scene_transformIndex( s, child ));
+	vAssert( loaded->light_count == 1 );
+	vAssert( vector_equal( &loaded->lights[0]->diffuse_color, &l->diffuse_color ));
+	vAssert( f_eq( loaded->lights[0]->attenuationLinear, 0.1f ));
+	vAssert( scene_transformIndex( loaded, loaded->lights[0]->trans ) == scene_transformIndex( s, l->trans ));
+	vAssert( loaded->cam && f_eq( loaded->cam->fov, 1.2f ));
+	vAssert( scene_transformIndex( loaded, loaded->cam->trans ) == scene_transformIndex( s, s->cam->trans ));
+	vAssert( vector_equal( &loaded->fog_color, &fog ));
+	vAssert( f_eq( loaded->ambient[2], 0.3f ));
+
+	// Out of range indices or sections are rejected, rather than trusted
+	size_t length = 0;
+	uint8_t* data = vfile_contents( filename, &length );
+	uint32_t model_count = 0;
+	sceneFileModel* models = (sceneFileModel*)sceneFile_section( data, kSceneSectionModels, &model_count );
+	vAssert( model_count == 1 );
+	models[0].transform = s->transform_count;
+	vfile_writeContents( filename, data, length );
+	vAssert( scene_loadFile( filename ) == NULL );
+	models[0].transform = scene_transformIndex( s, child );
+	sceneFileSection* sections = (sceneFileSection*)( data + sizeof( sceneFileHeader ));
+	sections[0].count = 0x10000000;
+	vfile_writeContents( filename, data, length );
+	vAssert( scene_loadFile( filename ) == NULL );
+	mem_free( data );
+
+	// A file from another build or format is rejected, rather than trusted
+	uint32_t bad_magic = 0;
+	vfile_writeContents( filename, &bad_magic, sizeof( bad_magic ));
+	vAssert( scene_loadFile( filename ) == NULL );
+	remove( filename );
+
+	test_scene_delete( loaded );
+	test_scene_delete( s );
+}
+
+// Compare loading a scene from a snapshot against running the equivalent scene script,
+// then time a large snapshot on its own (scene scripts keep every string they parse, so
+// very large ones exhaust the script string heap)
+void benchmark_sceneFile() {
+	const int script_instance_count = 250;
+	const int large_instance_count = 1500;
+	char filename[256];
+	vfile_tempPath( filename, sizeof( filename ), "benchmark_scene.vscene" );
+	const char* instance_script = "(transform (translation (vector %d.0 0.0 %d.0 1.0)) (model-instance (filename \"dat/model/cube.s\")))";
+	size_t script_size = 32 + ( strlen( instance_script ) + 16 ) * script_instance_count;
+	char* script = mem_alloc( script_size );
+	char* end = script + sprintf( script, "(scene " );
+	for ( int i = 0; i < script_instance_count; i++ )
+		end += sprintf( end, instance_script, i % 32, i / 32 );
+	sprintf( end, ")" );
+
+	unsigned long long start = timer_microseconds();
+	sterm* stree = parse_string( script );
+	scene* s = eval( stree );
+	sterm_free( stree );
+	unsigned long long script_time = timer_microseconds() - start;
+	vAssert( s->model_count == script_instance_count );
+	mem_free( script );
+
+	scene_saveFile( s, filename );
+	start = timer_microseconds();
+	scene* loaded = scene_loadFile( filename );
+	unsigned long long snapshot_time = timer_microseconds() - start;
+	vAssert( loaded->model_count == script_instance_count );
+	vAssert( loaded->transform_count == s->transform_count );
+	printf( "SCENE: %d instances. Script: %.2fms, snapshot: %.2fms.\n", script_instance_count, (float)script_time / 1000.f, (float)snapshot_time / 1000.f );
+	test_scene_delete( loaded );
+	test_scene_delete( s );
+
+	scene* large = scene_create();
+	modelHandle cube = model_getHandleFromFilename( "dat/model/cube.s" );
+	for ( int i = 0; i < large_instance_count; i++ ) {
+		modelInstance* instance = modelInstance_create( cube );
+		instance->trans = transform_createAndAdd( large );
+		vector translation = Vector( (float)( i % 64 ), 0.f, (float)( i / 64 ), 1.f );
+		transform_setLocalTranslation( instance->trans, &translation );
+		scene_addModel( large, instance );
+	}
+	start = timer_microseconds();
+	scene_saveFile( large, filename );
+	unsigned long long save_time = timer_microseconds() - start;
+	start = timer_microseconds();
+	loaded = scene_loadFile( filename );
+	snapshot_time = timer_microseconds() - start;
+	vAssert( loaded->model_count == large_instance_count );
+	printf( "SCENE: %d instances. Snapshot save: %.2fms, load: %.2fms.\n", large_instance_count, (float)save_time / 1000.f, (float)snapshot_time / 1000.f );
+	remove( filename );
+	test_scene_delete( loaded );
+	test_scene_delete( large );
+}
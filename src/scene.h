@@ -12,8 +12,8 @@
 #include "maths/maths.h"
 #include "transform.h"
 
-#define MAX_TRANSFORMS 512
-#define MAX_MODELS 512
+#define MAX_TRANSFORMS kMaxTransforms
+#define MAX_MODELS 4096
 #define MAX_LIGHTS 512
 #define MAX_EMITTERS 512
 
@@ -46,21 +46,6 @@ struct scene_s {
 	int			debug_flags;
 } ;
 
-typedef struct sceneData_s {
-	size_t		size;
-	//
-	int			transform_count;
-	transform*	transforms;
-	//
-	int				model_count;
-	modelInstance*	modelInstances;
-	//
-	int			light_count;
-	light*		lights;
-
-	camera*		cam;
-} sceneData;
-
 // *** Static functions
 
 void scene_initStatic( );
@@ -111,11 +96,12 @@ void		scene_addLight( scene* s, light* l );
 void scene_addEmitter( scene* s, particleEmitter* e );
 
 // Load & Save
-sceneData* scene_save( scene* s );
-scene* scene_load( sceneData* data );
-void sceneData_free( sceneData* data );
+void scene_saveFile( scene* s, const char* filename );
+scene* scene_loadFile( const char* filename );
 
 // ### TEST #############################
 // Initialise a scene with some test data
 scene* test_scene_init( engine* e );
 void test_scene_tick(scene* s, float dt);
+void test_sceneFile();
+void benchmark_sceneFile();
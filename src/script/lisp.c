@@ -70,6 +70,7 @@
 
 #include "common.h"
 #include "lisp.h"
+#include "lisp_vm.h"
 //--------------------------------------------------------
 #include "model.h"
 #include "model_loader.h"
@@ -85,12 +86,14 @@
 
 static term lisp_false = { 
 	typeFalse, 
+	kSymbolNone,	// Atom
 	{ NULL },		// Head 
 	NULL,			// Tail
 	0x0fffffff		// Refcount
 	};
 static term lisp_true = { 
 	typeTrue, 
+	kSymbolNone,	// Atom
 	{ NULL },		// Head 
 	NULL,			// Tail
 	0x0fffffff		// Refcount
@@ -100,8 +103,17 @@ const term* lisp_true_ptr = &lisp_true;
 const term* lisp_false_ptr = &lisp_false;
 context* lisp_global_context;
 
+const char* const lisp_library_files[kLispLibraryCount] = { "dat/script/lisp/vliblisp.s", "dat/script/lisp/particle.s" };
+
 static const size_t kLispHeapSize = 1 << 20;
 static heapAllocator* lisp_heap = NULL;
+
+// Terms created while evaluating a script are bump-allocated from the arena, then released
+// together once it's finished; anything that outlives it is promoted to the lisp heap
+static const size_t kLispArenaSize = 256 * 1024;
+static arenaAllocator* lisp_arena = NULL;
+static int lisp_arena_depth = 0;		// How many script evaluations are in progress
+static bool lisp_arena_bypass = false;	// True while promoting terms to the heap
 static passthroughAllocator* context_heap = NULL;
 
 typedef void (*attributeSetter)( term* ob, term* value );
@@ -116,6 +128,9 @@ void attr_particle_flags( term* definition_term, term* flags );
 void attr_particle_texture( term* definition_term, term* texture_attr );
 //// Attribute functions /////////////////////////////////////////
 
+// Particle flag bits, keyed by the symbol of their atom
+map* particleFlagMap = NULL;
+
 bool isType( term* t, enum termType type ) {
 	return t->type == type;
 	}
@@ -137,6 +152,27 @@ void term_deref( term* t ) {
 		term_delete( t );
 	}
 
+static void* lisp_allocate( size_t size ) {
+	if ( lisp_arena_depth > 0 && !lisp_arena_bypass ) {
+		void* mem = arena_allocate( lisp_arena, size );
+		if ( mem )
+			return mem;
+		// When the arena is full, fall back to the heap; those terms are refcounted as usual
+	}
+	return heap_allocate( lisp_heap, size );
+	}
+
+static void lisp_deallocate( void* mem ) {
+	// Arena allocations are released when the evaluation finishes
+	if ( !arena_contains( lisp_arena, mem ))
+		heap_deallocate( lisp_heap, mem );
+	}
+
+void term_release( term* t ) {
+	--(t->refcount);
+	vAssert( t->refcount >= 0 );
+	}
+
 #ifdef MEM_STACK_TRACE
 static const char* kLispTermAllocString = "lisp.c:term_create()";
 static const char* kLispValueAllocString = "lisp.c:value_create()";
@@ -176,7 +212,7 @@ void lisp_assert( bool b ) {
 
 term* term_create( enum termType type, void* value ) {
 	mem_pushStack( kLispTermAllocString );
-	term* t = heap_allocate( lisp_heap, sizeof( term ));
+	term* t = lisp_allocate( sizeof( term ));
 	mem_popStack();
 	t->type = type;
 	t->head = value;
@@ -185,11 +221,20 @@ term* term_create( enum termType type, void* value ) {
 		}
 	t->tail = NULL;
 	t->refcount = 0;
+	t->atom = kSymbolNone;
+	return t;
+	}
+
+term* atom_create( symbol s ) {
+	term* t = term_create( _typeAtom, (void*)symbol_name( s ));
+	t->atom = s;
 	return t;
 	}
 
 term* term_copy( term* t ) {
-	return term_create( t->type, t->head );
+	term* copy = term_create( t->type, t->head );
+	copy->atom = t->atom;
+	return copy;
 }
 
 void term_delete( term* t ) {
@@ -200,7 +245,79 @@ void term_delete( term* t ) {
 		if ( t->tail )
 			term_deref( t->tail );
 		}
-	heap_deallocate( lisp_heap, t );
+	lisp_deallocate( t );
+	}
+
+// The size of the value owned by a term of [type], or 0 if it doesn't own one
+static size_t term_valueSize( enum termType type ) {
+	switch ( type ) {
+		case typeFloat:		return sizeof( float );
+		case typeInt:		return sizeof( int );
+		case _typeVector:	return sizeof( vector );
+		case typeFunction:	return sizeof( lispFunction );
+		default:			return 0;	// Strings, atoms, objects and intrinsics point at memory lisp doesn't own
+	}
+}
+
+// Point [slot] at [child], moving the held reference
+static void term_setChild( term** slot, term* child ) {
+	if ( *slot == child )
+		return;
+	if ( child )
+		term_takeRef( child );
+	if ( *slot )
+		term_deref( *slot );
+	*slot = child;
+	}
+
+term* term_promote( term* t ) {
+	if ( !t || lisp_arena_depth == 0 )
+		return t;
+
+	bool bypass = lisp_arena_bypass;
+	lisp_arena_bypass = true;
+
+	term* promoted = t;
+	if ( arena_contains( lisp_arena, t )) {
+		promoted = term_create( t->type, NULL );
+		promoted->atom = t->atom;
+		if ( !isType( t, _typeList ))
+			promoted->data = t->data;
+		}
+
+	if ( isType( t, _typeList )) {
+		term_setChild( &promoted->head, term_promote( t->head ));
+		term_setChild( &promoted->tail, term_promote( t->tail ));
+		}
+	else {
+		size_t size = term_valueSize( t->type );
+		if ( size > 0 && arena_contains( lisp_arena, promoted->data )) {
+			void* value = value_create( size );
+			memcpy( value, promoted->data, size );
+			promoted->data = value;
+			if ( isType( t, typeFunction ))
+				((lispFunction*)value)->source = NULL;
+			}
+		if ( isType( t, typeFunction )) {
+			lispFunction* f = promoted->data;
+			term_setChild( &f->source, term_promote( ((lispFunction*)t->data)->source ));
+			}
+		}
+
+	lisp_arena_bypass = bypass;
+	return promoted;
+	}
+
+void lisp_beginEval() {
+	++lisp_arena_depth;
+	}
+
+term* lisp_endEval( term* result ) {
+	vAssert( lisp_arena_depth > 0 );
+	result = term_promote( result );
+	if ( --lisp_arena_depth == 0 )
+		arena_reset( lisp_arena );
+	return result;
 	}
 
 int _isListStart( char c ) {
@@ -217,7 +334,7 @@ int _isLineComment( const char* token ) {
 
 void* value_create( size_t size ) {
 	mem_pushStack( kLispValueAllocString );
-	void* mem = heap_allocate( lisp_heap, size );
+	void* mem = lisp_allocate( size );
 	mem_popStack();
 	return mem;
 	}
@@ -328,8 +445,10 @@ term* lisp_parse( inputStream* stream ) {
 		*f = strtof( token, NULL );
 		return term_create( typeFloat, f );
 		}
-	// When it's an atom, we keep the token, don't free it
-	return term_create( _typeAtom, (void*)token );
+	// Atoms are interned, so they can be looked up by symbol rather than by name
+	symbol atom = symbol_intern( token );
+	mem_free( token );
+	return atom_create( atom );
 }
 
 term* lisp_parse_string( const char* string ) {
@@ -377,8 +496,11 @@ term* _eval_list( term* list, context* c ) {
 }
 
 term* lisp_eval_file( context* c, const char* filename ) {
+	// The parsed source and every intermediate result are temporary
+	lisp_beginEval();
 	term* t = lisp_parse_file( filename );
-	return _eval_list( t, c );
+	term* result = lisp_use_vm ? lisp_run_list( t, c ) : _eval_list( t, c );
+	return lisp_endEval( result );
 }
 
 void list_delete( term* t ) {
@@ -415,7 +537,7 @@ void* value( term* atom ) {
 	return atom->head;
 	}
 
-void* context_lookup( context* c, int atom ) {
+void* context_lookup( context* c, symbol atom ) {
 	assert( c );
 	assert( c->lookup );
 	term** v = (term**)map_find( c->lookup, atom );
@@ -429,8 +551,15 @@ void* context_lookup( context* c, int atom ) {
 	}
 
 void context_add( context* c, const char* name, term* t ) {
-	map_add( c->lookup, mhash( name ), &t );
+	context_bind( c, symbol_intern( name ), t );
+	}
+
+void context_bind( context* c, symbol atom, term* t ) {
+	// Bindings outlive the evaluation that made them
+	t = term_promote( t );
+	map_add( c->lookup, atom, &t );
 	term_takeRef( t );
+	__sync_fetch_and_add( &lisp_context_generation, 1 );
 	}
 
 void term_debugPrint( term* t ) {
@@ -504,7 +633,6 @@ void term_validate( term* t ) {
 
 typedef term* (*fmap_func)( term*, void* );
 typedef term* (*fold_func)( term*, term* );
-typedef term* (*lisp_func)( context*, term* );
 
 term* fmap_1( fmap_func f, void* arg, term* expr ) {
 	if ( !expr )
@@ -514,8 +642,6 @@ term* fmap_1( fmap_func f, void* arg, term* expr ) {
 		   			fmap_1( f, arg, tail( expr )));
 }
 
-void* exec( context* c, term* func, term* args);
-
 /*
    Eval
 
@@ -549,7 +675,7 @@ term* _eval( term* expr, void* _context ) {
 	term* result = NULL;
 	// Eval arguments, then pass arguments to the binding of the first element and run
 	if ( isType( expr, _typeAtom )) {
-		term* value = context_lookup(_context, mhash(expr->string));
+		term* value = context_lookup( _context, expr->atom );
 		if ( !value )
 		{
 			printf( "## ERROR ## LISP: Cannot find binding for atom \"%s\"\n", expr->string );
@@ -562,10 +688,9 @@ term* _eval( term* expr, void* _context ) {
 		result = term_copy( expr );
 		}
 	if ( isType( expr, _typeList )) {
-		// TODO - need to check for intrinsic here
-		// as if it's a special form, we might not want to eval all (eg. if)
+		// Special forms get their arguments unevaluated (eg. if only evaluates one branch)
 		term* h = _eval( head( expr ), _context );
-		if ( !isType( h, typeIntrinsic )) {
+		if ( !isType( h, typeSpecialForm )) {
 			term* e = fmap_1( _eval, _context, tail( expr ));
 			if ( e )
 				term_takeRef( e );
@@ -590,6 +715,7 @@ context* context_create( context* parent ) {
 	int max = 128, stride = sizeof( term* );
 	c->lookup = map_create( max, stride );
 	c->parent = parent;
+	__sync_fetch_and_add( &lisp_context_generation, 1 );
 	return c;
 	}
 
@@ -602,6 +728,7 @@ void context_delete( context* c ) {
 			term_deref( t );
 		}
 
+	map_delete( c->lookup );
 	passthrough_deallocate( context_heap, c );
 	}
 
@@ -652,11 +779,24 @@ void define_arg( term* symbol, term* value, void* _context ) {
 	context_add( c, symbol->string, value );
 	}
 
+bool lisp_use_vm = true;
+
 void* exec( context* c, term* func, term* args ) {
 	lisp_assert( func );
-	lisp_assert( isType( func, _typeList ) || isType( func, typeIntrinsic ));
+	lisp_assert( isType( func, _typeList ) || isType( func, typeIntrinsic ) || isType( func, typeSpecialForm ) || isType( func, typeFunction ));
 	lisp_assert( !args || isType( args, _typeList ));
 
+	if ( isType( func, typeFunction )) {
+		lispFunction* f = func->data;
+		if ( lisp_use_vm ) {
+			term* ret = lispFunction_call( f, c, args );
+			term_validate( ret );
+			return ret;
+			}
+		// Otherwise fall through to walking the source tree
+		func = f->source;
+		}
+
 	if ( isType( func, _typeList )) {
 		lisp_assert( head( func ));			// The argument binding
 		term* arg_list = head( func );
@@ -671,12 +811,15 @@ void* exec( context* c, term* func, term* args ) {
 
 		// Evaluate the function in the local context including the argument bindings
 		term* ret = _eval( expr, local );
+		// Hold the result while the bindings are released, in case it's one of the arguments
+		term_takeRef( ret );
 		context_delete( local );
+		term_release( ret );
 		term_validate( ret );
 		return ret;
 		}
 
-	if ( isType( func, typeIntrinsic )) {
+	if ( isType( func, typeIntrinsic ) || isType( func, typeSpecialForm )) {
 		lisp_func f = func->data;
 		term* ret = f( c, args );
 		term_validate( ret );
@@ -687,13 +830,22 @@ void* exec( context* c, term* func, term* args ) {
 	return NULL;
 	}
 
+// Wrap the source of a lisp function, ((args) expr); it's compiled when first called
+term* lispFunction_create( term* source ) {
+	lispFunction* f = value_create( sizeof( lispFunction ));
+	f->source = source;
+	f->program = NULL;
+	term_takeRef( source );
+	return term_create( typeFunction, f );
+	}
+
 void define_function( context* c, const char* name, const char* value ) {
-	term* func = lisp_parse_string( value );
+	term* func = lispFunction_create( lisp_parse_string( value ));
 	context_add( c, name, func );
 	}
 
 void define_lispfunction( context* c, const char* name, term* func ) {
-	context_add( c, name, func );
+	context_add( c, name, lispFunction_create( func ));
 }
 
 void define_cfunction( context* c, const char* name, lisp_func implementation ) {
@@ -701,12 +853,17 @@ void define_cfunction( context* c, const char* name, lisp_func implementation )
 	context_add( c, name, func );
 	}
 
+void define_specialform( context* c, const char* name, lisp_func implementation ) {
+	term* func = term_create( typeSpecialForm, implementation );
+	context_add( c, name, func );
+	}
+
 // Intrinsic Maths functions
-term* lisp_func_add( context* c, term* raw_args ) {
-	assert( isType( raw_args, _typeList ));
-	assert( raw_args->tail );	
-	assert( isType( raw_args->tail, _typeList ));	
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_add( context* c, term* args ) {
+	(void)c;
+	assert( isType( args, _typeList ));
+	assert( args->tail );	
+	assert( isType( args->tail, _typeList ));	
 	term_takeRef( args );
 	assert( isType( args, _typeList ));
 	assert( isType( head( args ), typeFloat ));
@@ -714,17 +871,15 @@ term* lisp_func_add( context* c, term* raw_args ) {
 
 	float a = *(float*)head( args )->head;
 	float b = *(float*)head( tail( args ))->head;
-	mem_pushStack( kLispValueAllocString );
-	float* result = heap_allocate( lisp_heap, sizeof( float )  );
-	mem_popStack( );
+	float* result = value_create( sizeof( float ));
 	*result = a + b;
 	term* ret = term_create( typeFloat, result );
 	term_deref( args );
 	return ret;
 	}
 
-term* lisp_func_sub( context* c, term* raw_args ) {
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_sub( context* c, term* args ) {
+	(void)c;
 	term_takeRef( args );
 	assert( isType( args, _typeList ));
 	assert( isType( head( args ), typeFloat ));
@@ -732,17 +887,15 @@ term* lisp_func_sub( context* c, term* raw_args ) {
 
 	float a = *(float*)head( args )->head;
 	float b = *(float*)head( tail( args ))->head;
-	mem_pushStack( kLispValueAllocString );
-	float* result = heap_allocate( lisp_heap, sizeof( float )  );
-	mem_popStack( );
+	float* result = value_create( sizeof( float ));
 	*result = a - b;
 	term* ret = term_create( typeFloat, result );
 	term_deref( args );
 	return ret;
 	}
 
-term* lisp_func_mul( context* c, term* raw_args ) {
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_mul( context* c, term* args ) {
+	(void)c;
 	term_takeRef( args );
 	assert( isType( args, _typeList ));
 	assert( isType( head( args ), typeFloat ));
@@ -750,17 +903,15 @@ term* lisp_func_mul( context* c, term* raw_args ) {
 
 	float a = *(float*)head( args )->head;
 	float b = *(float*)head( tail( args ))->head;
-	mem_pushStack( kLispValueAllocString );
-	float* result = heap_allocate( lisp_heap, sizeof( float )  );
-	mem_popStack( );
+	float* result = value_create( sizeof( float ));
 	*result = a * b;
 	term* ret = term_create( typeFloat, result );
 	term_deref( args );
 	return ret;
 	}
 
-term* lisp_func_div( context* c, term* raw_args ) {
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_div( context* c, term* args ) {
+	(void)c;
 	term_takeRef( args );
 	assert( isType( args, _typeList ));
 	assert( isType( head( args ), typeFloat ));
@@ -768,17 +919,15 @@ term* lisp_func_div( context* c, term* raw_args ) {
 
 	float a = *(float*)head( args )->head;
 	float b = *(float*)head( tail( args ))->head;
-	mem_pushStack( kLispValueAllocString );
-	float* result = heap_allocate( lisp_heap, sizeof( float )  );
-	mem_popStack( );
+	float* result = value_create( sizeof( float ));
 	*result = a / b;
 	term* ret = term_create( typeFloat, result );
 	term_deref( args );
 	return ret;
 	}
 
-term* lisp_func_greaterthan( context* c, term* raw_args ) {
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_greaterthan( context* c, term* args ) {
+	(void)c;
 	term_takeRef( args );
 	assert( isType( args, _typeList ));
 	assert( isType( head( args ), typeFloat ));
@@ -794,15 +943,13 @@ term* lisp_func_greaterthan( context* c, term* raw_args ) {
 	return ret;
 	}
 
-term* lisp_func_length( context* c, term* raw_args ) {
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_length( context* c, term* args ) {
+	(void)c;
 	term_takeRef( args );
 
 	int len = list_length( head( args ));
 
-	mem_pushStack( kLispValueAllocString );
-	float* result = heap_allocate( lisp_heap, sizeof( float )  );
-	mem_popStack( );
+	float* result = value_create( sizeof( float ));
 	*result = (float)len;
 
 	term* tf = term_create( typeFloat, result );
@@ -810,8 +957,8 @@ term* lisp_func_length( context* c, term* raw_args ) {
 	return tf;
 	}
 
-term* lisp_func_vector( context* c, term* raw_args ) {
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_vector( context* c, term* args ) {
+	(void)c;
 	term_takeRef( args );
 	
 	vector* v = value_create( sizeof( vector ));
@@ -823,6 +970,7 @@ term* lisp_func_vector( context* c, term* raw_args ) {
 		assert( isType( head( t ), typeFloat ));
 		floats[i] = *(float*)head( t )->head;
 		t = t->tail;
+		++i;
 	}
 	
 	term* vec = term_create( _typeVector, v );;
@@ -830,8 +978,8 @@ term* lisp_func_vector( context* c, term* raw_args ) {
 	return vec;
 	}
 
-term* lisp_func_color( context* c, term* raw_args ) {
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_color( context* c, term* args ) {
+	(void)c;
 	term_takeRef( args );
 	// This should be called with a valid argument, which is one of the following:
 	//	> A Vector ( the rgba values from 0->1, eg. [1.0 0.0 0.0 1.0] )
@@ -891,8 +1039,8 @@ typedef struct test_struct_s {
 } test_struct;
 
 #define LISP_OBJECT_FUNC( CLASS, ATTR ) \
-term* lisp_func_##CLASS##_##ATTR( context* c, term* raw_args ) { \
-	term* args = fmap_1( _eval, c, raw_args ); \
+term* lisp_func_##CLASS##_##ATTR( context* c, term* args ) { \
+	(void)c; \
 	term_takeRef( args ); \
 	lisp_assert( list_length( args ) == 2 ); \
 	term* value = head( args ); \
@@ -919,8 +1067,8 @@ void* object_createType( const char* string ) {
 	return data;
 	}
 
-term* lisp_func_new( context* c, term* raw_args ) {
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_new( context* c, term* args ) {
+	(void)c;
 	term_takeRef( args );
 	term* type = head( args );
 	vAssert( type && isType( type, _typeAtom ));
@@ -932,9 +1080,8 @@ term* lisp_func_new( context* c, term* raw_args ) {
 
 // (object_process object function)
 // TODO this could be in lisp
-term* lisp_func_object_process( context *c, term* raw_args ) {
-	// Eval and validate args
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_object_process( context *c, term* args ) {
+	// Validate args
 	term_takeRef( args );
 	lisp_assert( list_length( args ) == 2 );
 	lisp_assert( isType( head( tail( args )), _typeList ));
@@ -973,8 +1120,8 @@ term* list_copy( term* list ) {
 		return _cons( list->head, NULL );
 }
 
-term* lisp_func_tail( context* c, term* raw_args ) {
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_tail( context* c, term* args ) {
+	(void)c;
 	term_takeRef( args );
 	term* list = head( args );
 	vAssert( isType( list, _typeList ));
@@ -988,8 +1135,8 @@ term* lisp_func_tail( context* c, term* raw_args ) {
 	return t;
 }
 
-term* lisp_func_head( context* c, term* raw_args ) {
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_head( context* c, term* args ) {
+	(void)c;
 	term_takeRef( args );
 	term* list = head( args );
 	term* h = head( list );
@@ -1013,9 +1160,15 @@ void attributeFunction_set( const char* name, attributeSetter f ) {
 	map_add( attrFuncMap, mhash( name ), &f_ );
 }
 
+void particleFlag_set( const char* name, int flag ) {
+	map_add( particleFlagMap, symbol_intern( name ), &flag );
+}
+
 void lisp_init() {
 	lisp_heap = heap_create( kLispHeapSize );
 	assert( lisp_heap->total_allocated == 0 );
+	lisp_arena = arena_create( kLispArenaSize );
+	lisp_vmInit();
 
 	context_heap = passthrough_create( lisp_heap );
 	lisp_debug_stack_init();
@@ -1029,6 +1182,11 @@ void lisp_init() {
 	attributeFunction_set( "flags", attr_particle_flags );
 	attributeFunction_set( "texture", attr_particle_texture );
 
+	particleFlagMap = map_create( 8, sizeof( int ));
+	particleFlag_set( "particle_burst", kParticleBurst );
+	particleFlag_set( "particle_worldspace", kParticleWorldSpace );
+	particleFlag_set( "particle_randomRotation", kParticleRandomRotation );
+
 	lisp_global_context = lisp_newContext();
 }
 
@@ -1041,10 +1199,9 @@ void lisp_init() {
 	// creates a model with that mesh
    */
 
-term* lisp_func_model( context* c, term* raw_args ) {
+term* lisp_func_model( context* c, term* args ) {
 	(void)c;
-	assert( isType( raw_args, _typeList ));
-	term* args = fmap_1( _eval, c, raw_args );
+	assert( isType( args, _typeList ));
 	term_takeRef( args );
 	assert( isType( args, _typeList ));
 	assert( isType( head( args ), _typeObject )); // Looking for a mesh
@@ -1052,7 +1209,7 @@ term* lisp_func_model( context* c, term* raw_args ) {
 	m->meshes[0] = head( args )->data;
 	term* ret = term_create( _typeObject, m );
 
-	m->obb = obb_calculate( m->meshes[0]->vert_count, m->meshes[0]->verts );
+	m->obb = m->meshes[0]->bounds;
 	//term_deref( args );	
 	return ret;
 }
@@ -1069,9 +1226,9 @@ term* lisp_func_model( context* c, term* raw_args ) {
 	> return the mesh
 
    */
-term* lisp_func_mesh( context* c, term* raw_args ) {
-	assert( isType( raw_args, _typeList ));
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_mesh( context* c, term* args ) {
+	(void)c;
+	assert( isType( args, _typeList ));
 	term_takeRef( args );
 	assert( isType( args, _typeList ));
 	assert( isType( head( args ), _typeObject )); // Looking for a mesh
@@ -1083,9 +1240,9 @@ term* lisp_func_mesh( context* c, term* raw_args ) {
 }
 
 // Create an empty mesh
-term* lisp_func_mesh_create( context* c, term* raw_args ) {
-	assert( isType( raw_args, _typeList ));
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_mesh_create( context* c, term* args ) {
+	(void)c;
+	assert( isType( args, _typeList ));
 	term_takeRef( args );
 	assert( isType( args, _typeList ));
 	assert( isType( head( args ), _typeObject )); // Looking for a mesh
@@ -1096,9 +1253,9 @@ term* lisp_func_mesh_create( context* c, term* raw_args ) {
 	return ret;
 }
 
-term* lisp_func_filename( context* c, term* raw_args ) {
-	lisp_assert( isType( raw_args, _typeList ));
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_filename( context* c, term* args ) {
+	(void)c;
+	lisp_assert( isType( args, _typeList ));
 	term_takeRef( args );
 	lisp_assert( isType( args, _typeList ));
 	lisp_assert( isType( head( args ), _typeString ));
@@ -1110,11 +1267,10 @@ term* lisp_func_filename( context* c, term* raw_args ) {
 }
 
 // PLACEHOLDER
-term* lisp_func_transform( context* c, term* raw_args ) {
+term* lisp_func_transform( context* c, term* args ) {
 	(void)c;
-	assert( isType( raw_args, _typeList ));
+	assert( isType( args, _typeList ));
 	/*
-	term* args = fmap_1( _eval, c, raw_args );
 	term_takeRef( args );
 	assert( isType( args, _typeList ));
 	assert( isType( head( args ), _typeObject )); // Looking for a mesh
@@ -1134,13 +1290,12 @@ attributeSetter attributeFunction( const char* name ) {
 }
 
 // (attribute name value)
-term* lisp_func_attribute( context* c, term* raw_args ) {
+term* lisp_func_attribute( context* c, term* args ) {
 	(void)c;
-	(void)raw_args;
+	(void)args;
 	
-	lisp_assert( isType( raw_args, _typeList ));
-	lisp_assert( list_length( raw_args ) ==  3 );
-	term* args = fmap_1( _eval, c, raw_args );
+	lisp_assert( isType( args, _typeList ));
+	lisp_assert( list_length( args ) ==  3 );
 	term* value = head( tail( args ));
 	term_validate( value );
 	term_takeRef( args );
@@ -1170,18 +1325,11 @@ term* setParticleFlags( term* flag_term, void* flag_ptr ) {
 // Turn a flag atom into a bitmask number
 term* parseFlag( term* flag_atom, void* unused /* to fit fmap_func signature */ ) {
 	(void)unused;
-	int* flag = mem_alloc( sizeof( int ));
+	int* flag = value_create( sizeof( int ));
 	*flag = 0x0;
-	// TODO this should be some kind of lookup
-	if (string_equal( flag_atom->string, "particle_burst" )) {
-		*flag = kParticleBurst;
-	}
-	if (string_equal( flag_atom->string, "particle_worldspace" )) {
-		*flag = kParticleWorldSpace;
-	}
-	if (string_equal( flag_atom->string, "particle_randomRotation" )) {
-		*flag = kParticleRandomRotation;
-	}
+	int* value = map_find( particleFlagMap, flag_atom->atom );
+	if ( value )
+		*flag = *value;
 	term* flag_term = term_create( typeInt, flag );
 	return flag_term;
 }
@@ -1189,7 +1337,7 @@ term* parseFlag( term* flag_atom, void* unused /* to fit fmap_func signature */
 term* lisp_bitwiseOr( term* a, term* b ) {
 	lisp_assert( isType( a, typeInt ));
 	lisp_assert( isType( b, typeInt ));
-	int* or_result = mem_alloc( sizeof( int ));
+	int* or_result = value_create( sizeof( int ));
 	*or_result = *a->integer | *b->integer;
 	term* result = term_create( typeInt, or_result );
 	return result;
@@ -1210,7 +1358,7 @@ void attr_particle_flags( term* definition_term, term* flags_attr ) {
 	particleEmitterDef* def = definition_term->data;
 	lisp_assert( def != 0x0 );
 
-	int* zero = mem_alloc( sizeof( int ));
+	int* zero = value_create( sizeof( int ));
 	*zero = 0;
 	term* lisp_zero = term_create( typeInt, zero );
 	term* flags_term = foldl( lisp_bitwiseOr, lisp_zero, fmap_1( parseFlag, NULL, flags_attr ));
@@ -1270,9 +1418,9 @@ term* lisp_func_particle_emitter_definition_create( context* c, term* raw_args )
 }
 
 // (property_create stride)
-term* lisp_func_property_create( context* c, term* raw_args ) {
-	lisp_assert( isType( raw_args, _typeList ));
-	term* args = fmap_1( _eval, c, raw_args );
+term* lisp_func_property_create( context* c, term* args ) {
+	(void)c;
+	lisp_assert( isType( args, _typeList ));
 	term_takeRef( args );
 	
 	lisp_assertArgs_1( args, typeFloat );
@@ -1287,10 +1435,9 @@ term* lisp_func_property_create( context* c, term* raw_args ) {
 	return tp;
 }
 
-term* lisp_func_property_addkey( context* c, term* raw_args ) {
+term* lisp_func_property_addkey( context* c, term* args ) {
 	(void)c;
-	lisp_assert( isType( raw_args, _typeList ));
-	term* args = fmap_1( _eval, c, raw_args );
+	lisp_assert( isType( args, _typeList ));
 	term_takeRef( args );
 	lisp_assert( isType( args, _typeList ));
 
@@ -1333,21 +1480,21 @@ term* lisp_func_property_addkey( context* c, term* raw_args ) {
    */
 term* lisp_func_defun( context* c, term* raw_args ) {
 	lisp_assert( isType( head( raw_args ), _typeAtom ));
-	const char* name = head( raw_args )->string;
+	term* name = head( raw_args );
 	term* value = tail( raw_args );
-	PARSE_PRINT( "LISP: DEFUN \"%s\"\n", name );
-	define_lispfunction( c, name, value );
+	PARSE_PRINT( "LISP: DEFUN \"%s\"\n", name->string );
+	context_bind( c, name->atom, lispFunction_create( value ));
 	return &lisp_true;
 }
 
 void lisp_initContext( context* c ) {
 	// Every lisp context needs this in order to pull in other functions, including the libraries
-	define_cfunction( c, "defun", lisp_func_defun );
+	define_specialform( c, "defun", lisp_func_defun );
 
 	define_cfunction( c, "tail", lisp_func_tail );
 	define_cfunction( c, "head", lisp_func_head );
 
-	define_cfunction( c, "if", lisp_func_if );
+	define_specialform( c, "if", lisp_func_if );
 
 	// General lisp funcs
 	define_function( c, "map",		"(( func list ) (cons (func (head list)) (if (tail list) (map func (tail list)) null)))" );
@@ -1356,7 +1503,7 @@ void lisp_initContext( context* c ) {
 	
 	define_cfunction( c, "vector", lisp_func_vector );
 	define_cfunction( c, "color", lisp_func_color );
-	define_cfunction( c, "quote", lisp_func_quote );
+	define_specialform( c, "quote", lisp_func_quote );
 
 	define_cfunction( c, "length", lisp_func_length );
 
@@ -1364,6 +1511,7 @@ void lisp_initContext( context* c ) {
 	define_cfunction( c, "-", lisp_func_sub );
 	define_cfunction( c, "*", lisp_func_mul );
 	define_cfunction( c, "/", lisp_func_div );
+	define_cfunction( c, ">", lisp_func_greaterthan );
 
 	define_cfunction( c, "object_process", lisp_func_object_process );
 
@@ -1383,8 +1531,8 @@ void lisp_initContext( context* c ) {
 	//define_function( c, "filename", "(() b )" );
 
 	// load the default vlisp library
-	lisp_eval_file( c, "dat/script/lisp/vliblisp.s" );
-	lisp_eval_file( c, "dat/script/lisp/particle.s" );
+	for ( int i = 0; i < kLispLibraryCount; i++ )
+		lisp_eval_file( c, lisp_library_files[i] );
 	// just load the definitions in the file
 }
 
@@ -1416,7 +1564,7 @@ void test_lisp() {
 	context_add( c, "b", hello );
 	context_add( c, "goodbye", goodbye );
 
-	term* search = context_lookup( c, mhash("b"));
+	term* search = context_lookup( c, symbol_intern( "b" ));
 	assert( search->head );
 
 	// Test #1 - Variable binding
@@ -1491,15 +1639,14 @@ void test_lisp() {
 
 	// False
 	// TRUE and FALSE are static lisp terms, we don't use context_add as we can't (and don't) add a ref
-	map_add( c->lookup, mhash("false"), (term**)&lisp_false_ptr ); // Casting away const (cleaner way of doing this?)
-	map_add( c->lookup, mhash("true"), (term**)&lisp_true_ptr ); // Casting away const (cleaner way of doing this?)
+	map_add( c->lookup, symbol_intern( "false" ), (term**)&lisp_false_ptr ); // Casting away const (cleaner way of doing this?)
+	map_add( c->lookup, symbol_intern( "true" ), (term**)&lisp_true_ptr ); // Casting away const (cleaner way of doing this?)
 	result = eval_string( "(if false a (if false a b))", c );
 	assert( result == eval_string( "b", c ) );
 	result = eval_string( "(if false a (if false b goodbye))", c );
 	assert( result != eval_string( "b", c ) );
 
 	// Greater-than
-	define_cfunction( c, ">", lisp_func_greaterthan );
 	result = eval_string( "(> five two )", c );
 	assert( result->type == typeTrue );
 	result = eval_string( "(> two five )", c );
@@ -1594,6 +1741,23 @@ void test_lisp() {
 		lisp_assert( isType( t, typeFalse ));
 	}
 
+	// Evaluation arena; temporaries are released, results and bindings promoted to the heap
+	{
+		size_t heap_before = lisp_heap->total_allocated;
+		lisp_beginEval();
+		lisp_assert( arena_contains( lisp_arena, lisp_parse_string( "(a b)" )));
+		term* t = lisp_run_list( lisp_parse_string( "((defun arena_test (a) (vector a (+ a 1.0))) (quote ((1.0 2.0) (arena_test 3.0))))" ), c );
+		t = lisp_endEval( t );
+		term_takeRef( t );
+		lisp_assert( lisp_arena->total_allocated == 0 );
+		lisp_assert( !arena_contains( lisp_arena, t ) && !arena_contains( lisp_arena, head( head( t ))));
+		lisp_assert( *head( tail( head( t )))->number == 2.f );
+		lisp_assert( lisp_heap->total_allocated - heap_before < 4096 );
+		term_deref( t );
+		result = eval_string( "(arena_test 1.0)", c );
+		lisp_assert( isType( result, _typeVector ) && ((vector*)result->data)->coord.y == 2.f );
+	}
+
 	context_delete( c );
 
 	printf( "Lisp heap storing " dPTRf " bytes in " dPTRf " allocations.\n", lisp_heap->total_allocated, lisp_heap->allocations );
@@ -1,6 +1,8 @@
 // lisp.h
 #pragma once
 
+#include "script/symbol.h"
+
 #define DEBUG_PARSE 0
 #define DEBUG_CONTEXT 0
 
@@ -29,8 +31,10 @@ enum termType {
 	typeFloat,
 	typeInt,
 	_typeVector,
-	typeIntrinsic,
+	typeIntrinsic,		// A C function, called with its arguments already evaluated
 	_typeObject,
+	typeSpecialForm,	// A C function, called with its arguments unevaluated (eg. if, quote)
+	typeFunction,		// A lisp function, compiled to bytecode on first call
 	typeFalse,		// Special FALSE datatype
 	typeTrue		// Special TRUE datatype
 	};
@@ -45,6 +49,7 @@ typedef struct term_s term;
 
 struct term_s {
 	enum termType type;
+	symbol atom;		// For atoms, the interned symbol; the string is its name
 	union {
 		term* head;
 		void* data;
@@ -64,8 +69,27 @@ typedef struct context_s {
 	map* lookup;
 	} context;
 
+struct lispProgram_s;
+
+/*
+	A lisp function: its source, ((args) expr), and the bytecode compiled from it
+   */
+typedef struct lispFunction_s {
+	term* source;
+	struct lispProgram_s* program;
+	} lispFunction;
+
+typedef term* (*lisp_func)( context*, term* );
+
 extern context* lisp_global_context;
 
+// If false, lisp functions are run by walking their term trees rather than as bytecode
+extern bool lisp_use_vm;
+
+// The library scripts every new context loads, in order
+#define kLispLibraryCount 2
+extern const char* const lisp_library_files[kLispLibraryCount];
+
 // Evaluate a lisp expression
 term* _eval( term* expr, void* _context );
 
@@ -73,6 +97,9 @@ term* _eval( term* expr, void* _context );
 context* lisp_newContext();
 void context_delete( context* c );
 
+// Parse [string] as a single lisp expression
+term* lisp_parse_string( const char* string );
+
 // Parse the contents of [filename] as lisp code
 term* lisp_parse_file( const char* filename );
 term* lisp_eval_file( context* c, const char* filename );
@@ -86,6 +113,43 @@ void term_takeRef( term* t );
 // Release a held reference to term [t]
 void term_deref( term* t );
 
+// Release a held reference to term [t], without deleting it; it's now owned by whoever we return it to
+void term_release( term* t );
+
+/*
+	Evaluation arena
+
+	Terms created between lisp_beginEval() and lisp_endEval() (including the parsed source)
+	are allocated from an arena and freed together at the end; lisp_endEval() returns its
+	[result] promoted to the lisp heap. Bindings added with context_add() are promoted too.
+	Anything else that holds a term beyond the evaluation must call term_promote().
+   */
+void lisp_beginEval();
+term* lisp_endEval( term* result );
+
+// Return [t], or a copy of it, with it and all it references in the lisp heap rather than the arena
+term* term_promote( term* t );
+
+term* term_create( enum termType type, void* value );
+// Create an atom term for symbol [s]
+term* atom_create( symbol s );
+term* _cons( void* head, term* tail );
+void* value_create( size_t size );
+void lisp_assert( bool b );
+
+void* context_lookup( context* c, symbol atom );
+void context_add( context* c, const char* name, term* t );
+void context_bind( context* c, symbol atom, term* t );
+
+extern const term* lisp_true_ptr;
+extern const term* lisp_false_ptr;
+
+// Wrap the source of a lisp function, ((args) expr)
+term* lispFunction_create( term* source );
+
+// Call [func] (an intrinsic or lisp function) with a list of already evaluated [args]
+void* exec( context* c, term* func, term* args );
+
 #ifdef UNIT_TEST
 void test_lisp();
 #endif
@@ -0,0 +1,690 @@
+// lisp_vm.c
+#include "common.h"
+#include "lisp_vm.h"
+//--------------------------------------------------------
+#include "lisp.h"
+#include "particle.h"
+#include "vtime.h"
+#include "maths/vector.h"
+#include "mem/allocator.h"
+#include "system/hash.h"
+#include "system/string.h"
+
+int lisp_context_generation = 0;
+
+// The symbols of the forms the compiler handles itself
+static symbol symbol_quote, symbol_if, symbol_defun, symbol_vector;
+static symbol symbol_add, symbol_sub, symbol_mul, symbol_div, symbol_greaterThan;
+
+void lisp_vmInit() {
+	symbol_quote = symbol_intern( "quote" );
+	symbol_if = symbol_intern( "if" );
+	symbol_defun = symbol_intern( "defun" );
+	symbol_vector = symbol_intern( "vector" );
+	symbol_add = symbol_intern( "+" );
+	symbol_sub = symbol_intern( "-" );
+	symbol_mul = symbol_intern( "*" );
+	symbol_div = symbol_intern( "/" );
+	symbol_greaterThan = symbol_intern( ">" );
+}
+
+/*
+   Compiler
+   */
+typedef struct lispCompiler_s {
+	lispInstruction	code[kLispMaxCode];
+	int				code_count;
+	lispValue		constants[kLispMaxConstants];
+	int				constant_count;
+	lispSymbol		symbols[kLispMaxSymbols];
+	int				symbol_count;
+	term*			params;		// The argument names of the function being compiled, if any
+	int				arg_count;
+} lispCompiler;
+
+void lisp_compileExpr( lispCompiler* comp, term* expr );
+
+static int compiler_emit( lispCompiler* comp, enum lispOp op, int operand ) {
+	vAssert( comp->code_count < kLispMaxCode );
+	vAssert( operand >= 0 && operand < ( 1 << 24 ));
+	comp->code[comp->code_count] = (lispInstruction)op | ((lispInstruction)operand << 8 );
+	return comp->code_count++;
+}
+
+// Set the operand of an already emitted instruction (eg. a forward jump)
+static void compiler_patch( lispCompiler* comp, int at, int operand ) {
+	comp->code[at] = LISP_OP( comp->code[at] ) | ((lispInstruction)operand << 8 );
+}
+
+static int compiler_constantTerm( lispCompiler* comp, term* t ) {
+	vAssert( comp->constant_count < kLispMaxConstants );
+	lispValue* v = &comp->constants[comp->constant_count];
+	v->type = kValueTerm;
+	v->t = t;
+	term_takeRef( t );
+	return comp->constant_count++;
+}
+
+static int compiler_constantFloat( lispCompiler* comp, float f ) {
+	for ( int i = 0; i < comp->constant_count; i++ )
+		if ( comp->constants[i].type == kValueFloat && comp->constants[i].f == f )
+			return i;
+	vAssert( comp->constant_count < kLispMaxConstants );
+	lispValue* v = &comp->constants[comp->constant_count];
+	v->type = kValueFloat;
+	v->f = f;
+	return comp->constant_count++;
+}
+
+static int compiler_symbol( lispCompiler* comp, symbol atom ) {
+	for ( int i = 0; i < comp->symbol_count; i++ )
+		if ( comp->symbols[i].atom == atom )
+			return i;
+	vAssert( comp->symbol_count < kLispMaxSymbols );
+	lispSymbol* s = &comp->symbols[comp->symbol_count];
+	s->atom = atom;
+	s->binding = NULL;
+	s->binding_context = NULL;
+	s->binding_generation = -1;
+	return comp->symbol_count++;
+}
+
+// The stack slot of argument [atom], or -1 if it's not an argument
+static int compiler_argIndex( lispCompiler* comp, symbol atom ) {
+	int i = 0;
+	for ( term* p = comp->params; p; p = p->tail, ++i ) {
+		term* param = p->head;
+		if ( param->type == _typeAtom && param->atom == atom )
+			return i;
+	}
+	return -1;
+}
+
+static int lisp_listLength( term* list ) {
+	int length = 0;
+	for ( ; list; list = list->tail )
+		++length;
+	return length;
+}
+
+// Compile special forms and intrinsics that we can do inline
+// Returns false if [expr] is not one of them
+static bool lisp_compileBuiltin( lispCompiler* comp, symbol name, term* args, int arg_count ) {
+	if ( name == symbol_quote ) {
+		lisp_assert( arg_count == 1 );
+		compiler_emit( comp, kOpConst, compiler_constantTerm( comp, args->head ));
+		return true;
+	}
+	if ( name == symbol_if ) {
+		lisp_assert( arg_count == 2 || arg_count == 3 );
+		lisp_compileExpr( comp, args->head );
+		int jump_else = compiler_emit( comp, kOpJumpIfFalse, 0 );
+		lisp_compileExpr( comp, args->tail->head );
+		int jump_end = compiler_emit( comp, kOpJump, 0 );
+		compiler_patch( comp, jump_else, comp->code_count );
+		if ( arg_count == 3 )
+			lisp_compileExpr( comp, args->tail->tail->head );
+		else
+			compiler_emit( comp, kOpConst, compiler_constantTerm( comp, (term*)lisp_false_ptr ));
+		compiler_patch( comp, jump_end, comp->code_count );
+		return true;
+	}
+	if ( name == symbol_defun ) {
+		term* func_name = args->head;
+		lisp_assert( func_name->type == _typeAtom );
+		compiler_emit( comp, kOpConst, compiler_constantTerm( comp, lispFunction_create( args->tail )));
+		compiler_emit( comp, kOpDefun, compiler_symbol( comp, func_name->atom ));
+		return true;
+	}
+
+	enum lispOp op = kOpReturn;
+	if ( name == symbol_add )
+		op = kOpAdd;
+	else if ( name == symbol_sub )
+		op = kOpSub;
+	else if ( name == symbol_mul )
+		op = kOpMul;
+	else if ( name == symbol_div )
+		op = kOpDiv;
+	else if ( name == symbol_greaterThan )
+		op = kOpGreaterThan;
+	if ( op != kOpReturn && arg_count == 2 ) {
+		lisp_compileExpr( comp, args->head );
+		lisp_compileExpr( comp, args->tail->head );
+		compiler_emit( comp, op, 0 );
+		return true;
+	}
+	if ( name == symbol_vector && arg_count <= 4 ) {
+		for ( term* a = args; a; a = a->tail )
+			lisp_compileExpr( comp, a->head );
+		compiler_emit( comp, kOpVector, arg_count );
+		return true;
+	}
+	return false;
+}
+
+void lisp_compileList( lispCompiler* comp, term* expr ) {
+	// The empty list evaluates to itself
+	if ( !expr->head ) {
+		compiler_emit( comp, kOpConst, compiler_constantTerm( comp, expr ));
+		return;
+	}
+
+	term* func = expr->head;
+	term* args = expr->tail;
+	int arg_count = lisp_listLength( args );
+	if ( func->type == _typeAtom && compiler_argIndex( comp, func->atom ) == -1 ) {
+		if ( lisp_compileBuiltin( comp, func->atom, args, arg_count ))
+			return;
+	}
+
+	// A general call; push the function, then its arguments
+	vAssert( arg_count <= kLispMaxArgs );
+	lisp_compileExpr( comp, func );
+	for ( term* a = args; a; a = a->tail )
+		lisp_compileExpr( comp, a->head );
+	compiler_emit( comp, kOpCall, arg_count );
+}
+
+void lisp_compileExpr( lispCompiler* comp, term* expr ) {
+	switch ( expr->type ) {
+		case _typeAtom:
+			{
+				int arg = compiler_argIndex( comp, expr->atom );
+				if ( arg != -1 )
+					compiler_emit( comp, kOpArg, arg );
+				else
+					compiler_emit( comp, kOpGlobal, compiler_symbol( comp, expr->atom ));
+			}
+			break;
+		case _typeList:
+			lisp_compileList( comp, expr );
+			break;
+		case typeFloat:
+			compiler_emit( comp, kOpConst, compiler_constantFloat( comp, *expr->number ));
+			break;
+		default:
+			// Other values evaluate to themselves
+			compiler_emit( comp, kOpConst, compiler_constantTerm( comp, expr ));
+			break;
+	}
+}
+
+// Copy the compiled program out of the compiler, into a single allocation
+lispProgram* lispCompiler_finish( lispCompiler* comp ) {
+	compiler_emit( comp, kOpReturn, 0 );
+	size_t code_size = sizeof( lispInstruction ) * comp->code_count;
+	size_t constant_size = sizeof( lispValue ) * comp->constant_count;
+	size_t symbol_size = sizeof( lispSymbol ) * comp->symbol_count;
+	lispProgram* p = mem_alloc( sizeof( lispProgram ) + constant_size + symbol_size + code_size );
+	p->arg_count = comp->arg_count;
+	p->constant_count = comp->constant_count;
+	p->constants = (lispValue*)( p + 1 );
+	p->symbol_count = comp->symbol_count;
+	p->symbols = (lispSymbol*)( (uint8_t*)p->constants + constant_size );
+	p->code_count = comp->code_count;
+	p->code = (lispInstruction*)( (uint8_t*)p->symbols + symbol_size );
+	memcpy( p->constants, comp->constants, constant_size );
+	memcpy( p->symbols, comp->symbols, symbol_size );
+	memcpy( p->code, comp->code, code_size );
+	return p;
+}
+
+lispProgram* lisp_compile( term* expr ) {
+	lispCompiler* comp = mem_alloc( sizeof( lispCompiler ));
+	comp->code_count = 0;
+	comp->constant_count = 0;
+	comp->symbol_count = 0;
+	comp->params = NULL;
+	comp->arg_count = 0;
+	lisp_compileExpr( comp, expr );
+	lispProgram* p = lispCompiler_finish( comp );
+	mem_free( comp );
+	return p;
+}
+
+lispProgram* lisp_compileFunction( term* source ) {
+	lisp_assert( source->type == _typeList );
+	term* params = source->head;
+	lisp_assert( params && params->type == _typeList );
+	lisp_assert( source->tail );
+
+	lispCompiler* comp = mem_alloc( sizeof( lispCompiler ));
+	comp->code_count = 0;
+	comp->constant_count = 0;
+	comp->symbol_count = 0;
+	// The empty argument list, (), is a list with no head
+	comp->params = params->head ? params : NULL;
+	comp->arg_count = lisp_listLength( comp->params );
+	lisp_compileExpr( comp, source->tail->head );
+	lispProgram* p = lispCompiler_finish( comp );
+	mem_free( comp );
+	return p;
+}
+
+void lispProgram_delete( lispProgram* p ) {
+	for ( int i = 0; i < p->constant_count; i++ )
+		if ( p->constants[i].type == kValueTerm )
+			term_deref( p->constants[i].t );
+	mem_free( p );
+}
+
+/*
+   Virtual Machine
+   */
+
+static inline void lispValue_retain( lispValue* v ) {
+	if ( v->type == kValueTerm )
+		term_takeRef( v->t );
+}
+
+static inline void lispValue_drop( lispValue* v ) {
+	if ( v->type == kValueTerm )
+		term_deref( v->t );
+}
+
+static inline float lispValue_float( lispValue* v ) {
+	if ( v->type == kValueFloat )
+		return v->f;
+	lisp_assert( v->type == kValueTerm && v->t->type == typeFloat );
+	return *v->t->number;
+}
+
+// Take a reference to [t] as a VM value, unboxing numbers
+static lispValue lispValue_fromTerm( term* t ) {
+	lispValue v;
+	if ( t->type == typeFloat ) {
+		v.type = kValueFloat;
+		v.f = *t->number;
+		// Deletes the term if it was a temporary
+		term_takeRef( t );
+		term_deref( t );
+	}
+	else {
+		v.type = kValueTerm;
+		v.t = t;
+		term_takeRef( t );
+	}
+	return v;
+}
+
+// Box [v] as a term, for passing to intrinsics
+static term* lispValue_toTerm( lispValue* v ) {
+	switch ( v->type ) {
+		case kValueFloat:
+			{
+				float* f = value_create( sizeof( float ));
+				*f = v->f;
+				return term_create( typeFloat, f );
+			}
+		case kValueVector:
+			{
+				vector* vec = value_create( sizeof( vector ));
+				*vec = v->v;
+				return term_create( _typeVector, vec );
+			}
+		case kValueTerm:
+			return v->t;
+	}
+	vAssert( 0 );
+	return NULL;
+}
+
+static term* lispSymbol_lookup( lispSymbol* s, context* c ) {
+	if ( s->binding_context != c || s->binding_generation != lisp_context_generation ) {
+		s->binding = context_lookup( c, s->atom );
+		s->binding_context = c;
+		s->binding_generation = lisp_context_generation;
+	}
+	if ( !s->binding )
+		printf( "## ERROR ## LISP: Cannot find binding for atom \"%s\"\n", symbol_name( s->atom ));
+	lisp_assert( s->binding );
+	return s->binding;
+}
+
+static lispValue lispVM_execute( lispProgram* p, context* c, lispValue* args );
+
+lispProgram* lispFunction_program( lispFunction* f ) {
+	if ( !f->program ) {
+		f->program = lisp_compileFunction( f->source );
+		// The program is kept with the function, so its constants mustn't live in the evaluation arena
+		lispProgram* p = f->program;
+		for ( int i = 0; i < p->constant_count; i++ ) {
+			if ( p->constants[i].type == kValueTerm ) {
+				term* t = term_promote( p->constants[i].t );
+				term_takeRef( t );
+				term_deref( p->constants[i].t );
+				p->constants[i].t = t;
+			}
+		}
+	}
+	return f->program;
+}
+
+// Call [slots][0] with arguments [slots][1..arg_count]
+static lispValue lispVM_call( context* c, lispValue* slots, int arg_count ) {
+	lisp_assert( slots[0].type == kValueTerm );
+	term* func = slots[0].t;
+	lispValue* args = &slots[1];
+
+	if ( func->type == typeFunction ) {
+		lispProgram* p = lispFunction_program( func->data );
+		lisp_assert( arg_count == p->arg_count );
+		return lispVM_execute( p, c, args );
+	}
+
+	// Special forms can't be called with arguments that are already evaluated
+	lisp_assert( func->type != typeSpecialForm );
+
+	// Intrinsics take a list of argument terms
+	term* arg_list = NULL;
+	for ( int i = arg_count - 1; i >= 0; --i )
+		arg_list = _cons( lispValue_toTerm( &args[i] ), arg_list );
+	if ( arg_list )
+		term_takeRef( arg_list );
+	term* result = exec( c, func, arg_list );
+	lisp_assert( result );
+	lispValue v = lispValue_fromTerm( result );
+	if ( arg_list )
+		term_deref( arg_list );
+	return v;
+}
+
+#define VM_PUSH( value ) \
+	vAssert( sp < kLispVMStackSize ); \
+	stack[sp++] = value;
+
+static lispValue lispVM_execute( lispProgram* p, context* c, lispValue* args ) {
+	// The call frame; arguments live in the caller's frame
+	lispValue stack[kLispVMStackSize];
+	int sp = 0;
+	int pc = 0;
+	while ( true ) {
+		lispInstruction instruction = p->code[pc++];
+		int operand = LISP_OPERAND( instruction );
+		switch ( LISP_OP( instruction )) {
+			case kOpConst:
+				VM_PUSH( p->constants[operand] );
+				lispValue_retain( &stack[sp-1] );
+				break;
+			case kOpArg:
+				VM_PUSH( args[operand] );
+				lispValue_retain( &stack[sp-1] );
+				break;
+			case kOpGlobal:
+				{
+					lispValue v;
+					v.type = kValueTerm;
+					v.t = lispSymbol_lookup( &p->symbols[operand], c );
+					term_takeRef( v.t );
+					VM_PUSH( v );
+				}
+				break;
+			case kOpCall:
+				{
+					int base = sp - operand - 1;
+					lispValue result = lispVM_call( c, &stack[base], operand );
+					for ( int i = base; i < sp; i++ )
+						lispValue_drop( &stack[i] );
+					sp = base;
+					VM_PUSH( result );
+				}
+				break;
+			case kOpAdd:
+			case kOpSub:
+			case kOpMul:
+			case kOpDiv:
+			case kOpGreaterThan:
+				{
+					float a = lispValue_float( &stack[sp-2] );
+					float b = lispValue_float( &stack[sp-1] );
+					lispValue_drop( &stack[sp-2] );
+					lispValue_drop( &stack[sp-1] );
+					sp -= 2;
+					lispValue r;
+					r.type = kValueFloat;
+					switch ( LISP_OP( instruction )) {
+						case kOpAdd: r.f = a + b; break;
+						case kOpSub: r.f = a - b; break;
+						case kOpMul: r.f = a * b; break;
+						case kOpDiv: r.f = a / b; break;
+						default:
+							r.type = kValueTerm;
+							r.t = (term*)( a > b ? lisp_true_ptr : lisp_false_ptr );
+							term_takeRef( r.t );
+							break;
+					}
+					VM_PUSH( r );
+				}
+				break;
+			case kOpVector:
+				{
+					lispValue r;
+					r.type = kValueVector;
+					r.v = Vector( 0.f, 0.f, 0.f, 0.f );
+					int base = sp - operand;
+					for ( int i = 0; i < operand; i++ ) {
+						r.v.val[i] = lispValue_float( &stack[base + i] );
+						lispValue_drop( &stack[base + i] );
+					}
+					sp = base;
+					VM_PUSH( r );
+				}
+				break;
+			case kOpJump:
+				pc = operand;
+				break;
+			case kOpJumpIfFalse:
+				{
+					lispValue* v = &stack[--sp];
+					bool is_false = ( v->type == kValueTerm && v->t->type == typeFalse );
+					lispValue_drop( v );
+					if ( is_false )
+						pc = operand;
+				}
+				break;
+			case kOpDefun:
+				{
+					lispValue* v = &stack[--sp];
+					lisp_assert( v->type == kValueTerm );
+					context_bind( c, p->symbols[operand].atom, v->t );
+					lispValue_drop( v );
+					lispValue r;
+					r.type = kValueTerm;
+					r.t = (term*)lisp_true_ptr;
+					term_takeRef( r.t );
+					VM_PUSH( r );
+				}
+				break;
+			case kOpReturn:
+				vAssert( sp == 1 );
+				return stack[0];
+			default:
+				vAssert( 0 );
+		}
+	}
+}
+
+// Hand a result back as a term, which the caller is given ownership of
+static term* lispValue_result( lispValue* v ) {
+	if ( v->type != kValueTerm ) {
+		return lispValue_toTerm( v );
+	}
+	term_release( v->t );
+	return v->t;
+}
+
+term* lisp_run( lispProgram* p, context* c ) {
+	lispValue result = lispVM_execute( p, c, NULL );
+	return lispValue_result( &result );
+}
+
+term* lisp_run_list( term* list, context* c ) {
+	term* result = NULL;
+	for ( ; list; list = list->tail ) {
+		lispProgram* p = lisp_compile( list->head );
+		result = lisp_run( p, c );
+		// Hold the result while the program is deleted, in case it's one of its constants
+		term_takeRef( result );
+		lispProgram_delete( p );
+		term_release( result );
+	}
+	return result;
+}
+
+term* lispFunction_call( lispFunction* f, context* c, term* args ) {
+	lispProgram* p = lispFunction_program( f );
+	lispValue values[kLispMaxArgs];
+	int arg_count = 0;
+	for ( term* a = args; a; a = a->tail ) {
+		vAssert( arg_count < kLispMaxArgs );
+		values[arg_count++] = lispValue_fromTerm( a->head );
+	}
+	lisp_assert( arg_count == p->arg_count );
+	lispValue result = lispVM_execute( p, c, values );
+	for ( int i = 0; i < arg_count; i++ )
+		lispValue_drop( &values[i] );
+	return lispValue_result( &result );
+}
+
+#ifdef UNIT_TEST
+// Evaluate [string] by walking the tree, and as bytecode
+static void lisp_evalBoth( context* c, const char* string, term** tree, term** vm ) {
+	term* expr = lisp_parse_string( string );
+	term_takeRef( expr );
+	lisp_use_vm = false;
+	*tree = _eval( expr, c );
+	term_takeRef( *tree );
+	lisp_use_vm = true;
+	lispProgram* p = lisp_compile( expr );
+	*vm = lisp_run( p, c );
+	term_takeRef( *vm );
+	lispProgram_delete( p );
+	term_deref( expr );
+}
+
+static float lisp_testFloat( context* c, const char* string ) {
+	term *tree, *vm;
+	lisp_evalBoth( c, string, &tree, &vm );
+	vAssert( tree->type == typeFloat && vm->type == typeFloat );
+	vAssert( *tree->number == *vm->number );
+	float f = *vm->number;
+	term_deref( tree );
+	term_deref( vm );
+	return f;
+}
+
+static enum termType lisp_testType( context* c, const char* string ) {
+	term *tree, *vm;
+	lisp_evalBoth( c, string, &tree, &vm );
+	vAssert( tree->type == vm->type );
+	enum termType type = vm->type;
+	term_deref( tree );
+	term_deref( vm );
+	return type;
+}
+
+void test_lisp_vm() {
+	context* c = lisp_newContext();
+	map_add( c->lookup, symbol_intern( "false" ), (term**)&lisp_false_ptr );
+	map_add( c->lookup, symbol_intern( "true" ), (term**)&lisp_true_ptr );
+
+	// Constants and inline arithmetic
+	vAssert( lisp_testFloat( c, "5.0" ) == 5.f );
+	vAssert( lisp_testFloat( c, "(+ 2.0 (* 3.0 4.0))" ) == 14.f );
+	vAssert( lisp_testFloat( c, "(/ (- 10.0 4.0) 2.0)" ) == 3.f );
+	vAssert( lisp_testType( c, "(> 3.0 2.0)" ) == typeTrue );
+	vAssert( lisp_testType( c, "(> 2.0 3.0)" ) == typeFalse );
+
+	// Lisp functions, arguments and branches
+	lisp_run_list( lisp_parse_string( "((defun double (a) (+ a a)) (defun max (a b) (if (> a b) a b)))" ), c );
+	vAssert( lisp_testFloat( c, "(double (double 5.0))" ) == 20.f );
+	vAssert( lisp_testFloat( c, "(max 3.0 (double 4.0))" ) == 8.f );
+	vAssert( lisp_testFloat( c, "(max (double 4.0) 3.0)" ) == 8.f );
+	vAssert( lisp_testFloat( c, "(length (quote (1.0 2.0 3.0)))" ) == 3.f );
+
+	// Intrinsics are passed boxed arguments, and their results unboxed
+	term *tree, *vm;
+	lisp_evalBoth( c, "(vector 1.0 (double 1.0) 3.0)", &tree, &vm );
+	vAssert( vm->type == _typeVector && tree->type == _typeVector );
+	vAssert( vector_equal( (vector*)vm->data, (vector*)tree->data ));
+	vector expected = Vector( 1.f, 2.f, 3.f, 0.f );
+	vAssert( vector_equal( (vector*)vm->data, &expected ));
+
+	// Functions passed as arguments
+	lisp_run_list( lisp_parse_string( "((defun apply2 (f x) (f (f x))))" ), c );
+	vAssert( lisp_testFloat( c, "(apply2 double 3.0)" ) == 12.f );
+
+	// Cached symbol bindings are only reused in the context they were found in
+	context* other = lisp_newContext();
+	lisp_run_list( lisp_parse_string( "((defun k () 1.0))" ), c );
+	lisp_run_list( lisp_parse_string( "((defun k () 2.0))" ), other );
+	lispProgram* p = lisp_compile( lisp_parse_string( "(k)" ));
+	vAssert( *lisp_run( p, c )->number == 1.f );
+	vAssert( *lisp_run( p, other )->number == 2.f );
+	vAssert( *lisp_run( p, c )->number == 1.f );
+	lispProgram_delete( p );
+}
+
+// Time evaluating the forms of [script] [iterations] times, as a file is loaded
+// Each run's result is a new particle emitter definition, which is freed
+static float lisp_benchmarkScript( context* c, term* script, int iterations, bool compiled ) {
+	int form_count = lisp_listLength( script );
+	lispProgram** programs = mem_alloc( sizeof( lispProgram* ) * form_count );
+	int form = 0;
+	for ( term* f = script; f; f = f->tail )
+		programs[form++] = compiled ? lisp_compile( f->head ) : NULL;
+
+	lisp_use_vm = compiled;
+	unsigned long long start = timer_microseconds();
+	for ( int i = 0; i < iterations; i++ ) {
+		lisp_beginEval();
+		term* result = NULL;
+		form = 0;
+		for ( term* f = script; f; f = f->tail, form++ )
+			result = compiled ? lisp_run( programs[form], c ) : _eval( f->head, c );
+		result = lisp_endEval( result );
+		term_takeRef( result );
+		vAssert( result->type == _typeObject );
+		particleEmitterDef* def = result->data;
+		particleEmitterDef_deInit( def );
+		mem_free( def );
+		term_deref( result );
+	}
+	unsigned long long duration = timer_microseconds() - start;
+	lisp_use_vm = true;
+
+	for ( form = 0; form < form_count; form++ )
+		if ( programs[form] )
+			lispProgram_delete( programs[form] );
+	mem_free( programs );
+	return (float)iterations / ((float)duration * uSecToSec );
+}
+
+void benchmark_lisp() {
+	// The particle definitions the game loads, from the same library they're loaded with
+	const char* scripts[] = { "dat/script/lisp/explosion.s",
+								"dat/script/lisp/explosion_b.s",
+								"dat/script/lisp/explosion_c.s",
+								"dat/script/lisp/missile_explosion.s",
+								"dat/script/lisp/missile_glow.s",
+								"dat/script/lisp/missile_particle.s" };
+	const int script_count = sizeof( scripts ) / sizeof( scripts[0] );
+	const int iterations = 50;
+	float tree_total = 0.f;
+	float vm_total = 0.f;
+	for ( int i = 0; i < script_count; i++ ) {
+		// Parsed once, as script strings live for the life of the game
+		term* script = lisp_parse_file( scripts[i] );
+		term_takeRef( script );
+		float tree = lisp_benchmarkScript( lisp_global_context, script, iterations, false );
+		float vm = lisp_benchmarkScript( lisp_global_context, script, iterations, true );
+		printf( "LISP: Benchmark \"%s\": tree-walk %.0f evals/sec, bytecode %.0f evals/sec (x%.1f).\n", scripts[i], tree, vm, vm / tree );
+		tree_total += 1.f / tree;
+		vm_total += 1.f / vm;
+		term_deref( script );
+	}
+	printf( "LISP: Benchmark: all %d particle scripts, tree-walk %.3fms, bytecode %.3fms (x%.1f).\n",
+			script_count, tree_total * 1000.f, vm_total * 1000.f, tree_total / vm_total );
+}
+#endif // UNIT_TEST
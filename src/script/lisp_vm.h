@@ -0,0 +1,105 @@
+// lisp_vm.h
+#pragma once
+
+#include "maths/mathstypes.h"
+#include "script/lisp.h"
+
+/*
+	Lisp bytecode
+
+	Lisp expressions are compiled from their term trees into a flat array of instructions for
+	a simple stack machine. Function arguments are resolved to stack slots at compile time and
+	global symbols have their hash precomputed (and their binding cached), numbers are kept
+	unboxed on the stack, and each call's frame lives on the C stack rather than in a new context.
+
+	Intrinsics keep the same C interface; they're passed a list of evaluated argument terms.
+
+	Note: compiled functions see their own arguments lexically. Free symbols are still looked up
+	in the calling context, but not in the arguments of lisp functions further up the call stack.
+   */
+
+#define kLispVMStackSize 64
+#define kLispMaxCode 1024
+#define kLispMaxConstants 128
+#define kLispMaxSymbols 64
+#define kLispMaxArgs 16
+
+enum lispOp {
+	kOpConst,			// Push constant [operand]
+	kOpArg,				// Push function argument [operand]
+	kOpGlobal,			// Push the binding of symbol [operand]
+	kOpCall,			// Call the function below [operand] arguments
+	kOpAdd,
+	kOpSub,
+	kOpMul,
+	kOpDiv,
+	kOpGreaterThan,
+	kOpVector,			// Build a vector from [operand] floats
+	kOpJump,			// Jump to [operand]
+	kOpJumpIfFalse,		// Pop, and jump to [operand] if false
+	kOpDefun,			// Pop a function and bind it to symbol [operand]
+	kOpReturn
+};
+
+// Instructions are an 8-bit opcode and a 24-bit operand
+typedef uint32_t lispInstruction;
+#define LISP_OP( instruction ) ((instruction) & 0xff )
+#define LISP_OPERAND( instruction ) ((instruction) >> 8 )
+
+enum lispValueType {
+	kValueFloat,
+	kValueVector,
+	kValueTerm
+};
+
+// A value on the VM stack; numbers and vectors are unboxed
+typedef struct lispValue_s {
+	enum lispValueType type;
+	union {
+		float f;
+		vector v;
+		term* t;
+	};
+} lispValue;
+
+typedef struct lispSymbol_s {
+	symbol		atom;
+	// The binding is cached for the context it was found in
+	term*		binding;
+	context*	binding_context;
+	int			binding_generation;
+} lispSymbol;
+
+typedef struct lispProgram_s {
+	int				arg_count;
+	int				code_count;
+	lispInstruction* code;
+	int				constant_count;
+	lispValue*		constants;
+	int				symbol_count;
+	lispSymbol*		symbols;
+} lispProgram;
+
+void lisp_vmInit();
+
+// Compile a single expression
+lispProgram* lisp_compile( term* expr );
+// Compile a lisp function, ((args) expr)
+lispProgram* lisp_compileFunction( term* source );
+void lispProgram_delete( lispProgram* p );
+
+// Run a compiled expression in [c]
+term* lisp_run( lispProgram* p, context* c );
+// Compile and run each expression in [list], returning the last result
+term* lisp_run_list( term* list, context* c );
+
+// Call a lisp function with a list of evaluated [args], compiling it if necessary
+term* lispFunction_call( lispFunction* f, context* c, term* args );
+
+// Bumped whenever a context binding may have changed, invalidating cached symbol bindings
+extern int lisp_context_generation;
+
+#ifdef UNIT_TEST
+void test_lisp_vm();
+void benchmark_lisp();
+#endif
@@ -27,6 +27,14 @@
 #define kStringHeapSize 64 * 1024
 heapAllocator* global_string_heap = NULL;
 
+// Script functions, keyed by the symbol of their name
+#define kMaxScriptFunctions 32
+map* script_functions = NULL;
+
+// Property names, interned once so properties can be compared by symbol
+static symbol symbol_modelInstance, symbol_light, symbol_particleEmitter, symbol_mesh;
+static symbol symbol_translation, symbol_diffuse, symbol_specular, symbol_filename, symbol_diffuseTexture;
+
 //
 // *** Parsing
 //
@@ -172,8 +180,8 @@ bool isFunction( sterm* s ) {
 	return s->type == typeFunc;
 }
 
-bool isPropertyType( sterm* s, const char* property_name ) {
-	return ( isAtom( s ) && s->tail && string_equal( s->head, property_name ));
+bool isPropertyType( sterm* s, symbol property_name ) {
+	return ( isAtom( s ) && s->tail && s->atom == property_name );
 }
 
 bool isTransform( sterm* s ) {
@@ -195,11 +203,18 @@ bool token_isString( const char* token ) {
 sterm* sterm_create( int tag, void* ptr ) {
 	sterm* term = mem_alloc( sizeof( sterm ) );
 	term->type = tag;
+	term->atom = kSymbolNone;
 	term->head = ptr;
 	term->tail = NULL;
 	return term;
 }
 
+sterm* sterm_createAtom( symbol s ) {
+	sterm* term = sterm_create( typeAtom, (void*)symbol_name( s ));
+	term->atom = s;
+	return term;
+}
+
 /*
 // Create a string from a string-form token
 // Allocated in the string memory pool
@@ -217,11 +232,11 @@ void* property_value( sterm* property ) {
 }
 
 // Find a named property in a list
-void* property_find( sterm* args, const char* name ) {
+void* property_find( sterm* args, symbol name ) {
 	sterm* term = args;
 	sterm* property = NULL;
 	while ( term ) {
-		if ( string_equal( ((sterm*)term->head)->head, name )) {
+		if ( ((sterm*)term->head)->atom == name ) {
 			property = term->head;
 			break;
 		}
@@ -241,6 +256,7 @@ void append( sterm* before, sterm* after ) {
 
 // Forward Declaration
 void* lookup( sterm* data );
+void script_registerFunctions();
 
 // Read a token at a time from the inputstream, advancing the read head,
 // and build it into an slist of atoms
@@ -290,8 +306,10 @@ sterm* parse( inputStream* stream ) {
 		return sterm_create( typeString, (char*)string );
 	}
 		
-//	if ( atom )
-		return sterm_create( typeAtom, (void*)token );
+	// Atoms are interned, so they can be compared and looked up by symbol rather than by name
+	symbol atom = symbol_intern( token );
+	mem_free( token );
+	return sterm_createAtom( atom );
 //	if ( number )
 //		return sterm_create( typeNumber );
 }
@@ -408,7 +426,7 @@ void sterm_free( sterm* s ) {
 	if ( !isList( s ) ) {
 		if ( isString( s ))
 			heap_deallocate( global_string_heap, s->head );
-		else
+		else if ( !isAtom( s ))		// Atom names belong to the symbol table
 			mem_free( s->head );
 		mem_free( s );
 	}
@@ -470,14 +488,14 @@ transformData* transformData_create() {
 void transformData_processElement( void* e, void* data ) {
 	sterm* element = e;
 	transformData* t = data;
-	if ( isPropertyType( element, "modelInstance" ) || 
+	if ( isPropertyType( element, symbol_modelInstance ) || 
 			isTransform( element ) || 
-			isPropertyType( element, "light" ) || 
-			isPropertyType( element, "particle_emitter" )) {
+			isPropertyType( element, symbol_light ) || 
+			isPropertyType( element, symbol_particleEmitter )) {
 		t->elements = cons( element, t->elements );
 	}
 	// If it's a translation, copy the vector to the transformData
-	if ( isPropertyType( element, "translation" )) {
+	if ( isPropertyType( element, symbol_translation )) {
 		vector* translation = (vector*)property_value( element );
 		t->translation = *translation;
 	}
@@ -504,14 +522,14 @@ void* s_transform( sterm* raw_elements ) {
 //	p->head = property name
 //	p->tail->head = property value
 //	p->tail->tail = NULL
-sterm* sterm_createProperty( const char* property_name, int property_type, void* property_data ) {
-	sterm* property = sterm_create( typeAtom, (char*)property_name );
+sterm* sterm_createProperty( symbol property_name, int property_type, void* property_data ) {
+	sterm* property = sterm_createAtom( property_name );
 	sterm* value = sterm_create( property_type, property_data );
 	property->tail = value;
 	return property;
 }
 
-void* s_readVector( const char* property_name, sterm* args ) {
+void* s_readVector( symbol property_name, sterm* args ) {
 	vAssert( args );
 	sterm* elements = eval_list( args );
 	// Should be a list of one single vector
@@ -523,15 +541,15 @@ void* s_readVector( const char* property_name, sterm* args ) {
 
 // Creates a translation
 void* s_translation( sterm* args ) {
-	return s_readVector( "translation", args );
+	return s_readVector( symbol_translation, args );
 }
 
 void* s_diffuse( sterm* args ) {
-	return s_readVector( "diffuse", args );
+	return s_readVector( symbol_diffuse, args );
 }
 
 void* s_specular( sterm* args ) {
-	return s_readVector( "specular", args );
+	return s_readVector( symbol_specular, args );
 }
 
 void* s_vector( sterm* args ) {
@@ -556,7 +574,7 @@ void* s_vector( sterm* args ) {
 
 // Process a Filename
 // ( filename <string> )
-void* s_readString( const char* property_name, sterm* args ) {
+void* s_readString( symbol property_name, sterm* args ) {
 	vAssert( args );
 	sterm* elements = eval_list( args );
 	// Should be a single string, so check the head
@@ -567,11 +585,11 @@ void* s_readString( const char* property_name, sterm* args ) {
 }
 
 void* s_filename( sterm* args ) {
-	return s_readString( "filename", args );
+	return s_readString( symbol_filename, args );
 }
 
 void* s_diffuse_texture( sterm* args ) {
-	return s_readString( "diffuse_texture", args );
+	return s_readString( symbol_diffuseTexture, args );
 }
 
 #define kMaxObjectTypes	16
@@ -579,7 +597,7 @@ void* s_diffuse_texture( sterm* args ) {
 map* object_offsets = NULL;
 
 void register_propertyOffset( const char* type, const char* property, int offset ) {
-	int t = mhash( type );
+	symbol t = symbol_intern( type );
 	map* m = NULL;
 	map** m_ptr = map_find( object_offsets, t );
 	if ( m_ptr )
@@ -591,16 +609,16 @@ void register_propertyOffset( const char* type, const char* property, int offset
 	}
 	vAssert( m ); // We should have a valid map by now
 
-	int p = mhash( property);
+	symbol p = symbol_intern( property );
 	printf( "Adding offset ( \"%s\", \"%s\", %d )\n", type, property, offset );
 	map_add( m, p, &offset );
 }
 
-int propertyOffset( const char* type, const char* property ) {
-	map** m_ptr = map_find( object_offsets, mhash( type ));
+int propertyOffset( symbol type, symbol property ) {
+	map** m_ptr = map_find( object_offsets, type );
 	vAssert( m_ptr && *m_ptr );
 
-	int* offset_ptr = map_find( *m_ptr, mhash( property ));
+	int* offset_ptr = map_find( *m_ptr, property );
 	vAssert( offset_ptr && (*offset_ptr >= 0) );
 	return (*offset_ptr);
 }
@@ -614,21 +632,33 @@ void parse_init() {
 	// Light
 	register_propertyOffset( "light", "diffuse", offsetof( light, diffuse_color ));
 	register_propertyOffset( "light", "specular", offsetof( light, specular_color ));
+
+	symbol_modelInstance = symbol_intern( "modelInstance" );
+	symbol_light = symbol_intern( "light" );
+	symbol_particleEmitter = symbol_intern( "particle_emitter" );
+	symbol_mesh = symbol_intern( "mesh" );
+	symbol_translation = symbol_intern( "translation" );
+	symbol_diffuse = symbol_intern( "diffuse" );
+	symbol_specular = symbol_intern( "specular" );
+	symbol_filename = symbol_intern( "filename" );
+	symbol_diffuseTexture = symbol_intern( "diffuse_texture" );
+
+	script_registerFunctions();
 }
 
 // Generic property process function
 // Process a list of properties
 // Compare them to the property list of the type
 // Set appropriately
-void processProperty( void* p, void* object, /* (const char*) */ void* type_name ) {
+void processProperty( void* p, void* object, /* (symbol*) */ void* type_name ) {
 	// We need the object type name and the property name
 	sterm* property = p;
 
-	const char*	property_name	= property->head;
+	symbol		object_type		= *(symbol*)type_name;
 	sterm*		value_term		= property->tail;
 	int			property_type	= value_term->type;
 
-	void* data = (uint8_t*)object + propertyOffset( type_name, property_name );
+	void* data = (uint8_t*)object + propertyOffset( object_type, property->atom );
 
 	switch ( property_type ) {
 		case typeVector:
@@ -653,7 +683,7 @@ void* s_modelInstance( sterm* raw_properties ) {
 		sterm* properties = eval_list( raw_properties );
 		while ( properties ) {
 			sterm* property = properties->head;
-			if ( isPropertyType( property, "filename" )) {
+			if ( isPropertyType( property, symbol_filename )) {
 				handle = model_getHandleFromFilename( property->tail->head );
 			}
 			properties = properties->tail;
@@ -662,7 +692,7 @@ void* s_modelInstance( sterm* raw_properties ) {
 	
 	vAssert( handle != -1 );
 	modelInstance* m = modelInstance_create( handle );
-	sterm* sm = sterm_createProperty( "modelInstance", typeObject, m );
+	sterm* sm = sterm_createProperty( symbol_modelInstance, typeObject, m );
 	return sm;
 }
 
@@ -676,11 +706,12 @@ void* s_object( /* void* object, const char* object_type,*/ sterm* raw_args ) {
 	// The object and object_type come first
 	void* object = args->head; // We just have a native type in the list, not a property
 	args = args->tail;
-	const char* object_type = ((sterm*)args->head)->head;
-//	printf( "s_object called with type \"%s\"\n", object_type );
+	// The type is a string, so intern it once here rather than per property
+	symbol object_type = symbol_intern( ((sterm*)args->head)->head );
+//	printf( "s_object called with type \"%s\"\n", symbol_name( object_type ));
 	args = args->tail;
 
-	map_vv( args, processProperty, object, (char*)object_type );
+	map_vv( args, processProperty, object, &object_type );
 
 	return sterm_createProperty( object_type, typeObject, object );
 }
@@ -706,21 +737,21 @@ void scene_processObject( void* object_, void* scene_, void* transform_ ) {
 	transform* parent = transform_;
 	if ( isTransform( object )) {
 		transform* t = transform_create();
-		t->parent = parent;
+		transform_setParent( t, parent );
 		transformData* tdata = object->head;
-		matrix_setTranslation( t->local, &tdata->translation );
+		matrix_setTranslation( transform_local( t ), &tdata->translation );
 		scene_addTransform( s, t );
 
 		// If it has children, process those
 		if ( tdata->elements )
 			map_vv( tdata->elements, scene_processObject, s, t );
 	}
-	if ( isPropertyType( object, "modelInstance" )) {
+	if ( isPropertyType( object, symbol_modelInstance )) {
 		modelInstance* m = property_value( object );
 		m->trans = parent;
 		scene_addModel( s, m );
 	}
-	if ( isPropertyType( object, "light" )) {
+	if ( isPropertyType( object, symbol_light )) {
 		light* l = property_value( object );
 		l->trans = parent;
 		scene_addLight( s, l );
@@ -760,13 +791,13 @@ void model_processObject( void* arg, void* model_, void* transform_ ) {
 	(void)mdl;
 	if ( isTransform( arg )) {
 		transform* t = transform_create();
-		t->parent = transform_;
+		transform_setParent( t, transform_ );
 		transformData* tdata = ((sterm*)arg)->head;
-		matrix_setTranslation( t->local, &tdata->translation );
+		matrix_setTranslation( transform_local( t ), &tdata->translation );
 		mdl->transforms[mdl->transform_count++] = t;
 		map_vv( tdata->elements, model_processObject, model_, t );
 	}
-	if ( isPropertyType( arg, "particle_emitter" )) {
+	if ( isPropertyType( arg, symbol_particleEmitter )) {
 		particleEmitter* p = property_value( arg );
 
 		// Convert pointer to index
@@ -783,13 +814,13 @@ void model_processObject( void* arg, void* model_, void* transform_ ) {
 void* s_model( sterm* raw_args ) {
 	sterm* args = eval_list( raw_args );
 	vAssert( args );
-	mesh* me = property_find( args, "mesh" );
+	mesh* me = property_find( args, symbol_mesh );
 	model* mdl = model_createModel( 1 ); // Only one mesh by default
 	mdl->meshes[0] = me;
 
 	map_vv( args, model_processObject, mdl, NULL ); // Initial transform is NULL
 
-	mdl->obb = obb_calculate( mdl->meshes[0]->vert_count, mdl->meshes[0]->verts );
+	mdl->obb = mdl->meshes[0]->bounds;
 
 	return mdl;
 }
@@ -797,15 +828,15 @@ void* s_model( sterm* raw_args ) {
 // pass through to model?
 void* s_mesh( sterm* raw_properties ) {
 	sterm* args = eval_list( raw_properties );
-	const char* filename = property_find( args, "filename" );
-	const char* diffuse_texture = property_find( args, "diffuse_texture" );
+	const char* filename = property_find( args, symbol_filename );
+	const char* diffuse_texture = property_find( args, symbol_diffuseTexture );
 	mesh* m = mesh_loadObj( filename );
 	if ( diffuse_texture ) {
 		printf( "Diffuse Texture: \"%s\"\n", diffuse_texture );
 		texture_request( &m->texture_diffuse, diffuse_texture );
 //		m->texture_diffuse = texture_loadTGA( diffuse_texture );
 	}
-	sterm* sm = sterm_createProperty( "mesh", typeObject, m );
+	sterm* sm = sterm_createProperty( symbol_mesh, typeObject, m );
 	return sm;
 }
 
@@ -838,12 +869,12 @@ void* s_particle_emitter( sterm* raw_args ) {
 	//texture_request( &p->definition->texture_diffuse, "dat/img/star_rgba64.tga" );
 	def->texture_diffuse = texture_load( "dat/img/star_rgba64.tga" );
 
-	return sterm_createProperty( "particle_emitter", typeObject, p );
+	return sterm_createProperty( symbol_particleEmitter, typeObject, p );
 }
 
-#define S_FUNC( atom, func )	if ( string_equal( (const char*)data->head, atom ) ) { \
-									sterm* s = sterm_create( typeFunc, func ); \
-									return s; \
+#define S_FUNC( atom, func )	{ \
+									script_func f = func; \
+									map_add( script_functions, symbol_intern( atom ), &f ); \
 								}
 
 // Parse a particle-style time-based property
@@ -873,9 +904,8 @@ void* s_property( sterm* args ) {
 	return p;
 }
 
-// TODO PLACEHOLDER
-// ( should be a hash lookup or similar )
-void* lookup( sterm* data ) {
+void script_registerFunctions() {
+	script_functions = map_create( kMaxScriptFunctions, sizeof( script_func ));
 	S_FUNC( "print", s_print )
 	S_FUNC( "concat", s_concat )
 	S_FUNC( "model-instance", s_modelInstance )
@@ -894,7 +924,12 @@ void* lookup( sterm* data ) {
 	S_FUNC( "diffuse_texture", s_diffuse_texture )
 	S_FUNC( "particle_emitter", s_particle_emitter )
 	S_FUNC( "property", s_property );
+}
 
+void* lookup( sterm* data ) {
+	script_func* f = map_find( script_functions, data->atom );
+	if ( f )
+		return sterm_create( typeFunc, *f );
 	return data;
 }
 
@@ -1,6 +1,7 @@
 // parse.h
 #pragma once
 #include "system/file.h"
+#include "script/symbol.h"
 
 // *** S-Expressions
 
@@ -21,6 +22,7 @@ typedef struct sterm_s sterm;
 
 struct sterm_s {	
 	int		type;
+	symbol	atom;	// For atoms, the interned symbol; head is its name
 	void*	head;
 	sterm*	tail;
 };
@@ -0,0 +1,59 @@
+// symbol.c
+#include "common.h"
+#include "symbol.h"
+//-----------------------
+#include "system/hash.h"
+#include "system/string.h"
+#include "system/thread.h"
+
+// An open-addressed hash table of symbol ids (stored +1, so zero is empty)
+#define kSymbolTableSize ( kMaxSymbols * 2 )
+
+static int			symbol_table[kSymbolTableSize];
+static const char*	symbol_names[kMaxSymbols];
+static unsigned int	symbol_hashes[kMaxSymbols];
+static int			symbols_interned = 0;
+static vmutex		symbol_mutex = kMutexInitialiser;
+
+symbol symbol_intern( const char* name ) {
+	unsigned int hash = mhash( name );
+	vmutex_lock( &symbol_mutex );
+	unsigned int slot = hash & ( kSymbolTableSize - 1 );
+	while ( symbol_table[slot] != 0 ) {
+		symbol s = symbol_table[slot] - 1;
+		if ( symbol_hashes[s] == hash && string_equal( symbol_names[s], name )) {
+			vmutex_unlock( &symbol_mutex );
+			return s;
+		}
+		slot = ( slot + 1 ) & ( kSymbolTableSize - 1 );
+	}
+
+	vAssert( symbols_interned < kMaxSymbols );
+	symbol s = symbols_interned++;
+	symbol_names[s] = string_createCopy( name );
+	symbol_hashes[s] = hash;
+	symbol_table[slot] = s + 1;
+	vmutex_unlock( &symbol_mutex );
+	return s;
+}
+
+const char* symbol_name( symbol s ) {
+	vAssert( s >= 0 && s < symbols_interned );
+	return symbol_names[s];
+}
+
+int symbol_count() {
+	return symbols_interned;
+}
+
+#ifdef UNIT_TEST
+void test_symbol() {
+	symbol a = symbol_intern( "test_symbol_a" );
+	symbol b = symbol_intern( "test_symbol_b" );
+	vAssert( a != b );
+	vAssert( symbol_intern( "test_symbol_a" ) == a );
+	vAssert( string_equal( symbol_name( b ), "test_symbol_b" ));
+	// The interned name is shared, not copied per use
+	vAssert( symbol_name( a ) == symbol_name( symbol_intern( "test_symbol_a" )));
+}
+#endif // UNIT_TEST
@@ -0,0 +1,30 @@
+// symbol.h
+#pragma once
+
+/*
+	Interned symbols
+
+	Script atoms are interned when they're parsed, so each distinct name is stored once and
+	given a small integer id. Evaluation can then compare and look up atoms by id, rather than
+	comparing or hashing their strings each time.
+
+	Symbol ids are never reused; interning is threadsafe, as scripts can be parsed on the worker.
+   */
+
+#define kMaxSymbols 4096
+#define kSymbolNone -1
+
+typedef int symbol;
+
+// Return the symbol for [name], adding it if it's new
+symbol symbol_intern( const char* name );
+
+// The interned name of symbol [s]; the same pointer for every use of the symbol
+const char* symbol_name( symbol s );
+
+// The number of symbols interned so far
+int symbol_count();
+
+#ifdef UNIT_TEST
+void test_symbol();
+#endif
@@ -9,13 +9,15 @@
 #if defined(LINUX_X) || defined(ANDROID)
 #include <sys/stat.h>
 #endif // LINUX_X || ANDROID
+#ifdef LINUX_X
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif // LINUX_X
 #ifdef ANDROID
 #include "zip.h"
 #include <jni.h>
 #endif // ANDROID
 
-void vfile_storeModifiedTime( const char* file );
-
 //
 // *** File
 //
@@ -102,7 +104,7 @@ struct zip_file* vfile_openApk( const char* path, const char* mode ) {
 // Load the entire contents of a file into a heap-allocated buffer of the same length
 // returns a pointer to that buffer
 // It its the caller's responsibility to free the buffer
-void* vfile_contentsApk( const char* path, int* length ) {
+void* vfile_contentsApk( const char* path, size_t* length ) {
     struct zip_file *f = vfile_openApk( path, "r" );
     void *buffer;
 
@@ -112,7 +114,7 @@ void* vfile_contentsApk( const char* path, int* length ) {
 
 	struct zip_stat stat;
 	zip_stat( apk_archive, asset_path, 0x0 /* flags */, &stat );
-	*length = (int)stat.size;
+	*length = (size_t)stat.size;
     buffer = mem_alloc( *length+1 );
     *length = zip_fread( f, buffer, *length );
     zip_fclose( f );
@@ -180,6 +182,73 @@ void vfile_writeContents( const char* path, void* buffer, int length ) {
 	fclose( f );
 }
 
+// Map the whole of a file read-only into our address space
+// The mapping is private, so the data can be used in place until vfile_unmap
+// Where files can't be mapped, this reads a copy instead (vfile_unmap frees it)
+// Returns NULL if the file does not exist or cannot be mapped
+void* vfile_map( const char* path, size_t* length ) {
+#ifdef LINUX_X
+	char asset_path[kVfileMaxPathLength];
+	vfile_assetPath( asset_path, path );
+
+	int fd = open( asset_path, O_RDONLY );
+	if ( fd < 0 )
+		return NULL;
+
+	struct stat file_stat;
+	if ( fstat( fd, &file_stat ) != 0 || file_stat.st_size <= 0 ) {
+		close( fd );
+		return NULL;
+	}
+
+	void* data = mmap( NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	// The mapping holds its own reference to the file
+	close( fd );
+	if ( data == MAP_FAILED )
+		return NULL;
+
+	*length = file_stat.st_size;
+	return data;
+#else
+	// Assets are compressed in the apk, so read a copy
+#ifdef ANDROID
+	char asset_path[kVfileMaxPathLength];
+	vfile_assetPath( asset_path, path );
+	if ( zip_name_locate( apk_archive, asset_path, 0x0 ) < 0 )
+		return NULL;
+#endif // ANDROID
+	return vfile_contents( path, length );
+#endif // LINUX_X
+}
+
+void vfile_unmap( void* data, size_t length ) {
+#ifdef LINUX_X
+	munmap( data, length );
+#else
+	// A copy from vfile_contents
+	(void)length;
+	mem_free( data );
+#endif // LINUX_X
+}
+
+time_t vfile_modifiedTime( const char* path ) {
+	char asset_path[kVfileMaxPathLength];
+	vfile_assetPath( asset_path, path );
+
+	struct stat file_stat;
+	if ( stat( asset_path, &file_stat ) != 0 )
+		return 0;
+	return file_stat.st_mtime;
+}
+
+void vfile_tempPath( char* path, size_t size, const char* name ) {
+	const char* dir = getenv( "TMPDIR" );
+	if ( !dir || !*dir )
+		dir = P_tmpdir;
+	int length = snprintf( path, size, "%s/%s", dir, name );
+	vAssert( length > 0 && (size_t)length < size );
+}
+
 // *** inputstream funcs
 bool token_isString( const char* token ) {
 	size_t len = strlen( token );
@@ -195,10 +264,12 @@ bool token_isFloat( const char* token ) {
 			return false;
 			}
 		}
+	// It must parse as a whole number, so that "-" or "." alone are not floats
 	errno = 0;
-	float f = strtof( token, NULL );
+	char* end = NULL;
+	float f = strtof( token, &end );
 	(void)f;
-	return ( errno == 0 );
+	return ( errno == 0 && end != token && *end == '\0' );
 	}
 
 // Create a string from a string-form token
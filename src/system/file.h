@@ -31,6 +31,18 @@ FILE* vfile_open( const char* path, const char* mode );
 void* vfile_contents(const char *path, size_t *length);
 void vfile_writeContents( const char* path, void* buffer, int length );
 
+// Map a whole file read-only into memory (or read a copy where files can't be mapped); returns NULL if it cannot be mapped
+void* vfile_map( const char* path, size_t* length );
+void vfile_unmap( void* data, size_t length );
+
+// Last modified time of a file, or 0 if it does not exist
+time_t vfile_modifiedTime( const char* path );
+
+// A path for a scratch file called [name], outside the asset directory (eg. for tests)
+void vfile_tempPath( char* path, size_t size, const char* name );
+
+// Record [file]'s current modified time, as opening it does, for vfile_modifiedSinceLast
+void vfile_storeModifiedTime( const char* file );
 bool vfile_modifiedSinceLast( const char* file );
 
 // Static init
@@ -3,6 +3,7 @@
 #include "hash.h"
 //-----------------------
 #include "mem/allocator.h"
+#include "test.h"
 
 unsigned int mhash( const char* src ) {
 	unsigned int seed = 0x0;
@@ -72,6 +73,121 @@ void map_delete( map* m ) {
 	mem_free( m );
 }
 
+// *** Pointer Map
+
+static inline int pointerMap_slot( const pointerMap* m, const void* key ) {
+	// Pointers are aligned, so mix the high bits down before masking
+	uintptr_t k = (uintptr_t)key;
+	k ^= k >> 16;
+	k *= 0x45d9f3b;
+	k ^= k >> 16;
+	return (int)( k & (uintptr_t)( m->capacity - 1 ));
+}
+
+void pointerMap_init( pointerMap* m, int capacity ) {
+	int c = 8;
+	while ( c < capacity )
+		c *= 2;
+	m->capacity = c;
+	m->count = 0;
+	m->keys = mem_alloc( sizeof( void* ) * c );
+	m->values = mem_alloc( sizeof( int ) * c );
+	memset( m->keys, 0, sizeof( void* ) * c );
+}
+
+void pointerMap_deinit( pointerMap* m ) {
+	mem_free( m->keys );
+	mem_free( m->values );
+	m->keys = NULL;
+	m->values = NULL;
+	m->capacity = 0;
+	m->count = 0;
+}
+
+void pointerMap_clear( pointerMap* m ) {
+	memset( m->keys, 0, sizeof( void* ) * m->capacity );
+	m->count = 0;
+}
+
+int* pointerMap_find( pointerMap* m, const void* key ) {
+	int mask = m->capacity - 1;
+	for ( int i = pointerMap_slot( m, key ); m->keys[i]; i = ( i + 1 ) & mask ) {
+		if ( m->keys[i] == key )
+			return &m->values[i];
+	}
+	return NULL;
+}
+
+void pointerMap_grow( pointerMap* m ) {
+	pointerMap old = *m;
+	pointerMap_init( m, old.capacity * 2 );
+	for ( int i = 0; i < old.capacity; i++ )
+		if ( old.keys[i] )
+			pointerMap_set( m, old.keys[i], old.values[i] );
+	pointerMap_deinit( &old );
+}
+
+void pointerMap_set( pointerMap* m, void* key, int value ) {
+	vAssert( key );
+	// Keep the load at most half, so probes stay short
+	if (( m->count + 1 ) * 2 > m->capacity )
+		pointerMap_grow( m );
+	int mask = m->capacity - 1;
+	int i = pointerMap_slot( m, key );
+	while ( m->keys[i] && m->keys[i] != key )
+		i = ( i + 1 ) & mask;
+	if ( !m->keys[i] )
+		m->count++;
+	m->keys[i] = key;
+	m->values[i] = value;
+}
+
+void pointerMap_remove( pointerMap* m, const void* key ) {
+	int mask = m->capacity - 1;
+	int i = pointerMap_slot( m, key );
+	while ( m->keys[i] != key ) {
+		if ( !m->keys[i] )
+			return;
+		i = ( i + 1 ) & mask;
+	}
+	// Shift later entries of the probe run back, so no tombstones are needed
+	int j = i;
+	while ( true ) {
+		m->keys[i] = NULL;
+		while ( true ) {
+			j = ( j + 1 ) & mask;
+			if ( !m->keys[j] ) {
+				m->count--;
+				return;
+			}
+			int home = pointerMap_slot( m, m->keys[j] );
+			// Entry j can fill the gap at i if its home slot is not cyclically in (i, j]
+			if ( i <= j ? ( home <= i || home > j ) : ( home <= i && home > j ))
+				break;
+		}
+		m->keys[i] = m->keys[j];
+		m->values[i] = m->values[j];
+		i = j;
+	}
+}
+
+void test_pointerMap() {
+	pointerMap m;
+	pointerMap_init( &m, 4 );
+	static int objects[1000];
+	for ( int i = 0; i < 1000; i++ )
+		pointerMap_set( &m, &objects[i], i );
+	for ( int i = 0; i < 1000; i += 2 )
+		pointerMap_remove( &m, &objects[i] );
+	bool found = m.count == 500;
+	for ( int i = 0; i < 1000; i++ ) {
+		int* value = pointerMap_find( &m, &objects[i] );
+		found = found && (( i % 2 ) ? ( value && *value == i ) : !value );
+	}
+	test( found, "PointerMap finds what was added and not what was removed.", "PointerMap lookup failed." );
+	pointerMap_deinit( &m );
+}
+
 void test_map() {
 	map* test_map = map_create( 16, sizeof( unsigned int ));
 	int key = mhash( "modelview" );
@@ -90,6 +206,7 @@ void test_murmurHash( const char* source ) {
 void test_hash() {
 
 	test_map();
+	test_pointerMap();
 
 	/*
 	test_murmurHash( "test" );
@@ -24,3 +24,19 @@ void*	map_find( map* m, int key );
 void	map_add( map* m, int key, void* value );
 void	map_addOverride( map* m, int key, void* value );
 void*	map_findOrAdd( map* m, int key );
+
+// Hash map from pointers to ints, with open addressing
+// (Used where a linear map would be too slow, eg. finding an entity's index in a delegate)
+typedef struct pointerMap_s {
+	int		capacity;	// Always a power of two
+	int		count;
+	void**	keys;		// NULL for an empty slot
+	int*	values;
+} pointerMap;
+
+void	pointerMap_init( pointerMap* m, int capacity );
+void	pointerMap_deinit( pointerMap* m );
+void	pointerMap_clear( pointerMap* m );
+int*	pointerMap_find( pointerMap* m, const void* key );
+void	pointerMap_set( pointerMap* m, void* key, int value );
+void	pointerMap_remove( pointerMap* m, const void* key );
@@ -4,6 +4,7 @@
 #include "thread.h"
 //-------------------------
 #include <sched.h> // for sched_yield
+#include <unistd.h> // for sysconf
 
 vcondition	conditions[kMaxConditions];
 vmutex		condition_mutices[kMaxConditions];
@@ -32,8 +33,18 @@ void vthread_yield() {
 	sched_yield();
 }
 
+int vthread_coreCount() {
+	long cores = sysconf( _SC_NPROCESSORS_ONLN );
+	return cores > 0 ? (int)cores : 1;
+}
+
 // *** Mutices
 
+// Initialise a Mutex that was not statically initialised
+void vmutex_init( vmutex* mutex ) {
+	pthread_mutex_init( mutex, NULL );
+}
+
 // Lock a Mutex, preventing other threads from accessing it
 void vmutex_lock( vmutex* mutex ) {
 	pthread_mutex_lock( mutex );
@@ -76,3 +87,25 @@ void vthread_waitCondition( int i ) {
 	condition_values[i] = false;
 	vmutex_unlock( condition_mutex );
 }
+
+bool vthread_testCondition( int i ) {
+	vmutex*		condition_mutex	= &condition_mutices[i];
+
+	vmutex_lock( condition_mutex );
+	bool signalled = condition_values[i];
+	condition_values[i] = false;
+	vmutex_unlock( condition_mutex );
+	return signalled;
+}
+
+void vcondition_init( vcondition* c ) {
+	pthread_cond_init( c, NULL );
+}
+
+void vcondition_wait( vcondition* c, vmutex* mutex ) {
+	pthread_cond_wait( c, mutex );
+}
+
+void vcondition_broadcast( vcondition* c ) {
+	pthread_cond_broadcast( c );
+}
@@ -35,6 +35,8 @@ void vthread_yield();
 // *** Mutices
 //
 
+// Initialise a Mutex that was not statically initialised
+void vmutex_init( vmutex* mutex );
 // Lock a Mutex, preventing other threads from accessing it
 void vmutex_lock( vmutex* mutex );
 // Relinquish the lock on a Mutex, allowing other threads to access it
@@ -46,3 +48,15 @@ void vmutex_unlock( vmutex* mutex );
 
 void vthread_signalCondition( int i );
 void vthread_waitCondition( int i );
+// If the condition has been signalled, consume it and return true; otherwise return false without waiting
+bool vthread_testCondition( int i );
+
+// Conditions not in the static set, paired with a caller-owned mutex
+void vcondition_init( vcondition* c );
+// Atomically release [mutex] and wait; [mutex] is held again on return
+void vcondition_wait( vcondition* c, vmutex* mutex );
+// Wake every thread waiting on [c]
+void vcondition_broadcast( vcondition* c );
+
+// Number of CPU cores available
+int vthread_coreCount();
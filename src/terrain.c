@@ -587,7 +587,7 @@ void terrain_render( void* data ) {
 	terrain* t = data;
 
 	render_resetModelView();
-	matrix_mul( modelview, modelview, t->trans->world );
+	matrix_mul( modelview, modelview, transform_world( t->trans ) );
 
 	// *** Render the blocks
 	for ( int i = 0; i < t->total_block_count; i++ ) {
@@ -3,6 +3,9 @@
 #include "src/ticker.h"
 //---------------------
 #include "engine.h"
+#include "worker.h"
+#include "test.h"
+#include "maths/maths.h"
 #include "mem/allocator.h"
 #include <assert.h>
 
@@ -11,7 +14,9 @@
 // This is to (hopefully) improve cache usage and debugging
 void delegate_tick(delegate* d, float dt, engine* eng ) {
 	for ( int i = 0; i < d->count; i++ ) {
-		((tickfunc)d->tick)( d->data[i], dt, eng );
+		void* entry = __atomic_load_n( &d->data[i], __ATOMIC_RELAXED );
+		if ( entry )
+			((tickfunc)d->tick)( entry, dt, eng );
 	}
 }
 
@@ -31,27 +36,347 @@ delegate* delegate_create(void* func, int size) {
 	delegate* d = (delegate*)mem_alloc(sizeof(delegate));
 	d->tick = func;
 	d->count = 0;
+	d->cleared = 0;
 	d->data = mem_alloc(size * sizeof(void*));
 	d->max = size;
+	pointerMap_init( &d->index, size * 2 );
 
 	return d;
 }
 
-int delegate_add(delegate* d, void* entry) {
-	if (d->count < d->max) {
-		d->data[d->count++] = entry;
-		return true;
+void delegate_delete( delegate* d ) {
+	pointerMap_deinit( &d->index );
+	mem_free( d->data );
+	mem_free( d );
+}
+
+void delegate_add(delegate* d, void* entry) {
+	// Each entry is only ticked once
+	if ( delegate_contains( d, entry ))
+		return;
+	if ( d->count == d->max ) {
+		int max = d->max * 2;
+		void** data = mem_alloc( max * sizeof( void* ));
+		memcpy( data, d->data, d->count * sizeof( void* ));
+		mem_free( d->data );
+		d->data = data;
+		d->max = max;
 	}
-	return false;
+	pointerMap_set( &d->index, entry, d->count );
+	d->data[d->count++] = entry;
 }
 
+// Swap the last entry into the gap
 void delegate_remove( delegate* d, void* entry ) {
-	array_remove( d->data, &d->count, entry );
+	int* index = pointerMap_find( &d->index, entry );
+	if ( !index )
+		return;
+	int i = *index;
+	pointerMap_remove( &d->index, entry );
+	--d->count;
+	if ( i != d->count ) {
+		d->data[i] = d->data[d->count];
+		// Cleared entries are NULL, and not in the index
+		if ( d->data[i] )
+			pointerMap_set( &d->index, d->data[i], i );
+	}
+	d->data[d->count] = NULL;
+}
+
+bool delegate_contains( delegate* d, void* entry ) {
+	return pointerMap_find( &d->index, entry ) != NULL;
+}
+
+// Other threads may be ticking or clearing other entries of this delegate, so this only reads
+// the index; it is rebuilt by delegate_compact()
+void delegate_clear( delegate* d, void* entry ) {
+	int* index = pointerMap_find( &d->index, entry );
+	if ( index && __atomic_load_n( &d->data[*index], __ATOMIC_RELAXED ) == entry ) {
+		__atomic_store_n( &d->data[*index], NULL, __ATOMIC_RELAXED );
+		__sync_fetch_and_add( &d->cleared, 1 );
+	}
+}
+
+void delegate_compact( delegate* d ) {
+	if ( d->cleared == 0 )
+		return;
+	int count = 0;
+	pointerMap_clear( &d->index );
+	for ( int i = 0; i < d->count; i++ ) {
+		if ( d->data[i] ) {
+			pointerMap_set( &d->index, d->data[i], count );
+			d->data[count++] = d->data[i];
+		}
+	}
+	d->count = count;
+	d->cleared = 0;
+}
+
+void delegateSet_init( delegateSet* s ) {
+	s->count = 0;
+	pointerMap_init( &s->index, kMaxDelegates );
+}
+
+delegate* delegateSet_find( delegateSet* s, void* func ) {
+	int* index = pointerMap_find( &s->index, func );
+	return index ? s->delegates[*index] : NULL;
+}
+
+delegate* delegateSet_findOrAdd( delegateSet* s, void* func ) {
+	delegate* d = delegateSet_find( s, func );
+	if ( !d ) {
+		vAssert( s->count < kMaxDelegates );
+		d = delegate_create( func, kDefaultDelegateSize );
+		pointerMap_set( &s->index, func, s->count );
+		s->delegates[s->count++] = d;
+	}
+	return d;
+}
+
+//////////////
+//
+// Tick Scheduling
+//
+//////////////
+
+tickDeclaration	tick_declarations[kMaxTickSystems];
+int				tick_declaration_count = 0;
+
+// Used for any tick that hasn't been declared
+const tickDeclaration tick_undeclared = { NULL, kTickAccessAll, kTickAccessAll, kTickMainThread };
+
+// Declaring a tick again replaces its declaration
+void tick_declare( void* tick, uint32_t reads, uint32_t writes, int flags ) {
+	tickDeclaration* d = NULL;
+	for ( int i = 0; i < tick_declaration_count && !d; i++ )
+		if ( tick_declarations[i].tick == tick )
+			d = &tick_declarations[i];
+	if ( !d ) {
+		vAssert( tick_declaration_count < kMaxTickSystems );
+		d = &tick_declarations[tick_declaration_count++];
+	}
+	d->tick = tick;
+	d->reads = reads;
+	d->writes = writes;
+	d->flags = flags;
+}
+
+const tickDeclaration* tick_declaration( void* tick ) {
+	for ( int i = 0; i < tick_declaration_count; i++ )
+		if ( tick_declarations[i].tick == tick )
+			return &tick_declarations[i];
+	return &tick_undeclared;
+}
+
+void tickGraph_reset( tickGraph* g ) {
+	g->system_count = 0;
+	g->task_count = 0;
+	g->phase_count = 0;
+}
+
+static bool tick_conflicts( uint32_t reads_a, uint32_t writes_a, uint32_t reads_b, uint32_t writes_b ) {
+	return ( writes_a & ( reads_b | writes_b )) || ( reads_a & writes_b );
+}
+
+int tickGraph_addSystem( tickGraph* g, tickfunc tick ) {
+	vAssert( g->system_count < kMaxTickSystems );
+	const tickDeclaration* d = tick_declaration( tick );
+
+	// Run straight after the last phase we conflict with
+	int phase = g->phase_count;
+	while ( phase > 0 && !tick_conflicts( d->reads, d->writes, g->phase_reads[phase-1], g->phase_writes[phase-1] ))
+		--phase;
+	if ( phase == g->phase_count ) {
+		vAssert( g->phase_count < kMaxTickPhases );
+		g->phase_reads[phase] = 0;
+		g->phase_writes[phase] = 0;
+		++g->phase_count;
+	}
+	g->phase_reads[phase] |= d->reads;
+	g->phase_writes[phase] |= d->writes;
+
+	int index = g->system_count++;
+	tickSystem* system = &g->systems[index];
+	system->graph = g;
+	system->declaration = d;
+	system->tick = tick;
+	system->phase = phase;
+	system->first_task = g->task_count;
+	system->task_count = 0;
+	return index;
+}
+
+void tickGraph_addEntities( tickGraph* g, int system, void** entities, int count ) {
+	tickSystem* s = &g->systems[system];
+	// A system's tasks are contiguous
+	vAssert( s->first_task + s->task_count == g->task_count );
+	int chunk = ( s->declaration->flags & kTickParallel ) ? kTickChunkSize : count;
+	for ( int begin = 0; begin < count; begin += chunk ) {
+		vAssert( g->task_count < kMaxTickTasks );
+		tickTask* t = &g->tasks[g->task_count++];
+		t->graph = g;
+		t->system = system;
+		t->entities = entities;
+		t->begin = begin;
+		t->end = min( begin + chunk, count );
+		++s->task_count;
+	}
+}
+
+void tickTask_run( tickTask* t ) {
+	tickGraph* g = t->graph;
+	tickfunc tick = g->systems[t->system].tick;
+	for ( int i = t->begin; i < t->end; i++ ) {
+		// Entries can be cleared by ticks running alongside
+		void* entity = __atomic_load_n( &t->entities[i], __ATOMIC_RELAXED );
+		if ( entity )
+			tick( entity, g->dt, g->eng );
+	}
 }
 
-int delegate_isFull( delegate* d ) {
-	return d->count == d->max;
+// A parallel system's tasks run as separate jobs
+void tickTask_job( void* args ) {
+	tickTask_run( args );
+}
+
+// Other systems run as a single job
+void tickSystem_run( tickSystem* s ) {
+	for ( int i = 0; i < s->task_count; i++ )
+		tickTask_run( &s->graph->tasks[s->first_task + i] );
+}
+
+void tickSystem_job( void* args ) {
+	tickSystem_run( args );
+}
+
+void tickGraph_run( tickGraph* g, float dt, engine* eng ) {
+	g->dt = dt;
+	g->eng = eng;
+	frameJob jobs[kMaxTickTasks];
+	for ( int phase = 0; phase < g->phase_count; phase++ ) {
+		int job_count = 0;
+		for ( int i = 0; i < g->system_count; i++ ) {
+			tickSystem* s = &g->systems[i];
+			if ( s->phase != phase || s->declaration->flags & kTickMainThread )
+				continue;
+			if ( s->declaration->flags & kTickParallel ) {
+				for ( int t = 0; t < s->task_count; t++ ) {
+					frameJob job = { tickTask_job, &g->tasks[s->first_task + t] };
+					jobs[job_count++] = job;
+				}
+			}
+			else if ( s->task_count > 0 ) {
+				frameJob job = { tickSystem_job, s };
+				jobs[job_count++] = job;
+			}
+		}
+
+		// With a single job, or nobody to share with, don't pay for handing out jobs
+		bool share = job_count > 1 && worker_frameWorkerCount() > 0;
+		if ( share )
+			worker_beginFrameJobs( jobs, job_count );
+		else
+			for ( int i = 0; i < job_count; i++ )
+				jobs[i].func( jobs[i].args );
+
+		for ( int i = 0; i < g->system_count; i++ ) {
+			tickSystem* s = &g->systems[i];
+			if ( s->phase == phase && s->declaration->flags & kTickMainThread )
+				tickSystem_run( s );
+		}
+
+		if ( share )
+			worker_finishFrameJobs();
+	}
+}
+
+#if UNIT_TEST
+int	tick_test_values[100];
+int	tick_test_order_errors = 0;
+
+void tick_testWrite( void* data, float dt, engine* eng ) {
+	(void)dt; (void)eng;
+	__sync_fetch_and_add( (int*)data, 1 );
+}
+
+void tick_testOther( void* data, float dt, engine* eng ) {
+	(void)data; (void)dt; (void)eng;
+}
+
+// Must run after every tick_testWrite has finished
+void tick_testRead( void* data, float dt, engine* eng ) {
+	(void)dt; (void)eng;
+	(void)data;
+	for ( int i = 0; i < 100; i++ )
+		if ( tick_test_values[i] != 1 )
+			__sync_fetch_and_add( &tick_test_order_errors, 1 );
+}
+
+void tick_testUndeclared( void* data, float dt, engine* eng ) {
+	(void)data; (void)dt; (void)eng;
+}
+
+void test_tickGraph() {
+	worker_initFrameWorkers();
+	tick_declare( tick_testWrite, 0, kTickAccessTransforms, kTickParallel );
+	tick_declare( tick_testOther, kTickAccessScene, kTickAccessTerrain, 0 );
+	tick_declare( tick_testRead, kTickAccessTransforms, 0, 0 );
+
+	void* entities[100];
+	for ( int i = 0; i < 100; i++ ) {
+		tick_test_values[i] = 0;
+		entities[i] = &tick_test_values[i];
+	}
+	void* single[1] = { NULL };
+	single[0] = &tick_test_values[0];
+
+	tickGraph* g = mem_alloc( sizeof( tickGraph ));
+	tickGraph_reset( g );
+	int write = tickGraph_addSystem( g, tick_testWrite );
+	tickGraph_addEntities( g, write, entities, 100 );
+	int other = tickGraph_addSystem( g, tick_testOther );
+	tickGraph_addEntities( g, other, single, 1 );
+	int read = tickGraph_addSystem( g, tick_testRead );
+	tickGraph_addEntities( g, read, single, 1 );
+	int undeclared = tickGraph_addSystem( g, tick_testUndeclared );
+	tickGraph_addEntities( g, undeclared, single, 1 );
+	test( g->systems[write].phase == 0 && g->systems[other].phase == 0, "Independent ticks share a phase.", "Independent ticks did not share a phase." );
+	test( g->systems[read].phase == 1, "Conflicting tick runs in a later phase.", "Conflicting tick did not run in a later phase." );
+	test( g->systems[undeclared].phase == 2 && g->phase_count == 3, "Undeclared tick runs alone.", "Undeclared tick did not run alone." );
+	test( g->systems[write].task_count == ( 100 + kTickChunkSize - 1 ) / kTickChunkSize, "Parallel tick split into chunks.", "Parallel tick not split into chunks." );
+
+	tickGraph_run( g, 0.f, NULL );
+	bool once = true;
+	for ( int i = 0; i < 100; i++ )
+		once = once && tick_test_values[i] == 1;
+	test( once, "Every entity ticked once.", "Entities not ticked exactly once." );
+	test( tick_test_order_errors == 0, "Conflicting ticks ran in order.", "Conflicting ticks ran out of order." );
+
+	// Clearing an entry while ticking skips it without moving the others
+	delegate* d = delegate_create( tick_testWrite, 4 );
+	for ( int i = 0; i < 4; i++ )
+		delegate_add( d, &tick_test_values[i] );
+	delegate_clear( d, &tick_test_values[1] );
+	delegate_tick( d, 0.f, NULL );
+	test( tick_test_values[1] == 1 && tick_test_values[2] == 2 && d->count == 4, "Cleared delegate entry skipped.", "Cleared delegate entry ticked." );
+	delegate_compact( d );
+	test( d->count == 3 && d->data[1] == &tick_test_values[2] && !delegate_contains( d, &tick_test_values[1] ),
+			"Delegate compacted.", "Delegate not compacted." );
+
+	// Removal swaps the last entry into the gap, and the delegate grows as needed
+	delegate_remove( d, &tick_test_values[0] );
+	test( d->count == 2 && d->data[0] == &tick_test_values[3] && *pointerMap_find( &d->index, &tick_test_values[3] ) == 0,
+			"Delegate removal swapped in the last entry.", "Delegate removal failed." );
+	for ( int i = 4; i < 100; i++ )
+		delegate_add( d, &tick_test_values[i] );
+	bool indexed = d->count == 98;
+	for ( int i = 0; i < d->count; i++ )
+		indexed = indexed && *pointerMap_find( &d->index, d->data[i] ) == i;
+	test( indexed, "Delegate grew and kept its index.", "Delegate index wrong after growing." );
+	delegate_delete( d );
+	mem_free( g );
 }
+#endif // UNIT_TEST
 
 //////////////
 //
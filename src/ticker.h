@@ -2,6 +2,11 @@
 #ifndef __TICKER_H__
 #define __TICKER_H__
 
+#include "system/hash.h"
+
+#define kMaxDelegates 64
+#define kDefaultDelegateSize 16
+
 // Tick function signature
 typedef void (*tickfunc)( void*, float, engine* );
 // Render function signature
@@ -10,27 +15,29 @@ typedef void (*renderfunc)( void*);
 typedef void (*inputfunc)( void*, input* );
 
 // delegate
-// A struct holding a list of objects to be ticked (updated)
-// All objects have the same tick handler, ie. they are of the same time
-// You should create a separate delegate for each type of object you want to tick
-// and then tick them each explicitly
+// A dense array of the objects to be ticked (or rendered, or sent input)
+// All objects have the same tick handler, ie. they are of the same type, so ticking a delegate
+// walks one array calling one function
 //
-// eg. 
-//  delegate animations;
-//  delegate models;
-//  delegate physics;
-//
-//	delegate_tick(animations, dt);
-//  delegate_tick(models, dt);
-//  delegate_tick(physics, dt);
+// Each entry's index is kept in a map, so adding and removing are O(1); removing moves the
+// last entry into the gap
 //
 typedef struct {
 	void*		tick;
 	void**		data;
 	int			count;
 	int			max;
+	int			cleared;	// Entries cleared while ticking, to be compacted
+	pointerMap	index;		// Entry to its index in data
 } delegate;
 
+// All the delegates of one kind (tick, render or input), one per function
+typedef struct delegateSet_s {
+	delegate*	delegates[kMaxDelegates];
+	int			count;
+	pointerMap	index;		// Function to its delegate's index
+} delegateSet;
+
 // tick all objects in a delegate
 void delegate_tick(delegate* t, float dt, engine* eng );
 
@@ -40,16 +47,121 @@ void delegate_render( delegate* d );
 // Process input for all objects in a delegate
 void delegate_input( delegate* d, input* i );
 
-// create a new delegate
+// create a new delegate; it grows as needed
 delegate* delegate_create(void* func, int size);
 
+void delegate_delete( delegate* d );
+
 // add an entry to a delegate
-int delegate_add(delegate* t, void* entry);
+void delegate_add(delegate* t, void* entry);
 
 // remove an entry from a delegate
 void delegate_remove(delegate* t, void* entry);
 
-int delegate_isFull( delegate* t );
+bool delegate_contains( delegate* d, void* entry );
+
+// Clear an entry without moving the others; safe while the delegate is being ticked
+void delegate_clear( delegate* d, void* entry );
+
+// Remove cleared entries
+void delegate_compact( delegate* d );
+
+void delegateSet_init( delegateSet* s );
+// The delegate for [func], or NULL
+delegate* delegateSet_find( delegateSet* s, void* func );
+// The delegate for [func], created if there isn't one yet
+delegate* delegateSet_findOrAdd( delegateSet* s, void* func );
+
+//////////////
+//
+// Tick Scheduling
+//
+//////////////
+
+/*
+   Each tick function declares the shared data it reads and writes. Each frame, ticks are put
+   in phases: a tick runs in the phase after the last earlier tick it conflicts with, so ticks
+   that touch disjoint data run at the same time on the frame workers, while ticks that do
+   conflict keep their order.
+
+   A tick function's own entity is not declared; a tick declared kTickParallel only touches its
+   own entity and declared data, so its entities can be split into chunks and ticked at once.
+
+   Ticks that haven't been declared read and write everything, on the main thread.
+   */
+enum tickAccess {
+	kTickAccessLua			= 0x1,
+	kTickAccessInput		= 0x2,
+	kTickAccessTransforms	= 0x4,
+	kTickAccessScene		= 0x8,		// Scene contents, lights, fog and sky
+	kTickAccessCollision	= 0x10,
+	kTickAccessTerrain		= 0x20,
+	kTickAccessDebugDraw	= 0x40,
+	kTickAccessAll			= 0xffffffff
+};
+
+// Tick flags
+#define kTickMainThread	0x1		// Must run on the main thread (eg. calls into Lua)
+#define kTickParallel	0x2		// Entities are independent, and can be ticked in parallel
+
+#define kMaxTickSystems	64
+#define kMaxTickTasks	256
+#define kMaxTickPhases	16
+#define kTickChunkSize	32
+
+typedef struct tickDeclaration_s {
+	void*		tick;
+	uint32_t	reads;
+	uint32_t	writes;
+	int			flags;
+} tickDeclaration;
+
+typedef struct tickGraph_s tickGraph;
+
+// Entities to tick; part of one system
+typedef struct tickTask_s {
+	tickGraph*	graph;
+	int			system;
+	void**		entities;
+	int			begin;
+	int			end;
+} tickTask;
+
+// A tick function scheduled this frame
+typedef struct tickSystem_s {
+	tickGraph*				graph;
+	const tickDeclaration*	declaration;
+	tickfunc				tick;
+	int						phase;
+	int						first_task;
+	int						task_count;
+} tickSystem;
+
+struct tickGraph_s {
+	tickSystem	systems[kMaxTickSystems];
+	int			system_count;
+	tickTask	tasks[kMaxTickTasks];
+	int			task_count;
+	int			phase_count;
+	uint32_t	phase_reads[kMaxTickPhases];
+	uint32_t	phase_writes[kMaxTickPhases];
+	float		dt;
+	engine*		eng;
+};
+
+// Declare the data [tick] reads and writes
+void tick_declare( void* tick, uint32_t reads, uint32_t writes, int flags );
+
+// Empty the graph, ready to schedule a frame
+void tickGraph_reset( tickGraph* g );
+// Schedule [tick], after every earlier tick it conflicts with; returns the system index
+int tickGraph_addSystem( tickGraph* g, tickfunc tick );
+// Tick [entities] with [system]
+void tickGraph_addEntities( tickGraph* g, int system, void** entities, int count );
+// Run every phase in turn; returns once all ticks are done
+void tickGraph_run( tickGraph* g, float dt, engine* eng );
+
+void test_tickGraph();
 
 //////////////
 //
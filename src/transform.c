@@ -5,70 +5,153 @@
 #include "maths/quaternion.h"
 #include "maths/vector.h"
 #include "mem/allocator.h"
+#include "vtime.h"
 #include "debug/debugtext.h"
 
-IMPLEMENT_POOL( transform )
+transformStorage transform_storage;
 
-pool_transform* static_transform_pool = NULL;
-
-void transform_initPool() {
-	static_transform_pool = pool_transform_create( 256 );
+void transform_initStorage() {
+	transformStorage* ts = &transform_storage;
+	memset( ts, 0, sizeof( transformStorage ));
+	ts->local		= mem_alloc( sizeof( matrix ) * kMaxTransforms );
+	ts->world		= mem_alloc( sizeof( matrix ) * kMaxTransforms );
+	ts->parent		= mem_alloc( sizeof( int ) * kMaxTransforms );
+	ts->dirty		= mem_alloc( sizeof( uint8_t ) * kMaxTransforms );
+	ts->updated		= mem_alloc( sizeof( uint8_t ) * kMaxTransforms );
+	ts->live		= mem_alloc( sizeof( bool ) * kMaxTransforms );
+	ts->handles		= mem_alloc( sizeof( transform ) * kMaxTransforms );
+	ts->free_slots	= mem_alloc( sizeof( int ) * kMaxTransforms );
+	ts->pending_slots	= mem_alloc( sizeof( int ) * kMaxTransforms );
+	ts->order		= mem_alloc( sizeof( int ) * kMaxTransforms );
+	memset( ts->dirty, 0, sizeof( uint8_t ) * kMaxTransforms );
+	memset( ts->updated, 0, sizeof( uint8_t ) * kMaxTransforms );
+	memset( ts->live, 0, sizeof( bool ) * kMaxTransforms );
+	ts->order_valid = true;
+	vmutex_init( &ts->lock );
 }
 
-void transform_setWorldSpace( transform* t, matrix world ) {
-//	matrix_cpy( t->world, world );
-	if ( t->parent ) {
-		matrix inv_parent;
-	  	matrix_inverse( inv_parent, t->parent->world );
-		matrix_mul( t->local, world, inv_parent );
+// Rebuild the update order, depth first from each root, so parents come before children
+// and each root's subtree is contiguous
+// Must be called with the storage lock held
+void transform_buildOrder() {
+	transformStorage* ts = &transform_storage;
+	// Count children, then lay them out contiguously per parent ( child_start[p] .. child_start[p+1] )
+	int* child_start = mem_alloc( sizeof( int ) * ( ts->count + 1 ));
+	int* children = mem_alloc( sizeof( int ) * max( 1, ts->count ));
+	int* stack = mem_alloc( sizeof( int ) * max( 1, ts->count ));
+	memset( child_start, 0, sizeof( int ) * ( ts->count + 1 ));
+	for ( int i = 0; i < ts->count; i++ ) {
+		if ( !ts->live[i] )
+			continue;
+		// Transforms whose parent has been deleted become roots
+		if ( ts->parent[i] != kTransformNoParent && !ts->live[ts->parent[i]] )
+			ts->parent[i] = kTransformNoParent;
+		if ( ts->parent[i] != kTransformNoParent )
+			child_start[ts->parent[i] + 1]++;
 	}
-	else
-		matrix_cpy( t->local, world );
+	for ( int i = 0; i < ts->count; i++ )
+		child_start[i + 1] += child_start[i];
+	for ( int i = 0; i < ts->count; i++ ) {
+		if ( ts->live[i] && ts->parent[i] != kTransformNoParent )
+			children[child_start[ts->parent[i]]++] = i;
+	}
+	// child_start has been advanced to the end of each range; shift it back to the start
+	for ( int i = ts->count; i > 0; i-- )
+		child_start[i] = child_start[i - 1];
+	child_start[0] = 0;
 
-	transform_markDirty( t );
-	transform_concatenate( t );
-//	t->local = t->world * inverse( t->parent->world );
+	ts->order_count = 0;
+	for ( int root = 0; root < ts->count; root++ ) {
+		if ( !ts->live[root] || ts->parent[root] != kTransformNoParent )
+			continue;
+		int top = 0;
+		stack[top++] = root;
+		while ( top > 0 ) {
+			int i = stack[--top];
+			ts->order[ts->order_count++] = i;
+			// Push children in reverse, so they are visited in order
+			for ( int c = child_start[i + 1] - 1; c >= child_start[i]; c-- )
+				stack[top++] = children[c];
+		}
+	}
+	ts->order_valid = true;
+
+	// No live transform refers to a deleted slot any more, so they can be reused
+	memcpy( ts->free_slots + ts->free_count, ts->pending_slots, sizeof( int ) * ts->pending_count );
+	ts->free_count += ts->pending_count;
+	ts->pending_count = 0;
+
+	mem_free( stack );
+	mem_free( children );
+	mem_free( child_start );
 }
 
-void transform_setWorldSpacePosition( transform* t, vector* position ) {
-	// Concat in case world space rotation is not up to date
-	// Could we just set localspace position actually?
-	/*
-	transform_concatenate( t );
-	matrix m;
-	matrix_cpy( m, t->world );
-	matrix_setTranslation( m, position );
-	transform_setWorldSpace( t, m );
-	*/
-	if ( !t->parent ) {
-		matrix_setTranslation( t->local, position );
-	} else {
-		vector position_local;
-		Sub( &position_local, position, matrix_getTranslation( t->parent->world ));
-		matrix_setTranslation( t->local, &position_local );
+// A transform is recalculated if it, or any of its ancestors, is dirty
+// Each dirty flag is cleared as it is taken, so a transform marked dirty by another thread after
+// that is updated next pass rather than lost
+void transform_updateRange( int begin, int end ) {
+	transformStorage* ts = &transform_storage;
+	for ( int o = begin; o < end; o++ ) {
+		int i = ts->order[o];
+		int parent = ts->parent[i];
+		bool dirty = __sync_lock_test_and_set( &ts->dirty[i], 0 );
+		if ( parent == kTransformNoParent ) {
+			if ( dirty )
+				matrix_cpy( ts->world[i], ts->local[i] );
+		}
+		// Parents come first in the same range, so have already been updated this pass
+		else if ( dirty || ts->updated[parent] ) {
+			matrix_mul( ts->world[i], ts->world[parent], ts->local[i] );
+			dirty = true;
+		}
+		ts->updated[i] = dirty;
 	}
-	transform_concatenate( t );
 }
 
-void transform_setLocalSpace();
+// Bring every world space transform up to date
+void transform_updateAll() {
+	transformStorage* ts = &transform_storage;
+	vmutex_lock( &ts->lock );
+	if ( !ts->order_valid )
+		transform_buildOrder();
+	transform_updateRange( 0, ts->order_count );
+	vmutex_unlock( &ts->lock );
+}
 
-// Create a new default transform
 transform* transform_create() {
-	transform* t = pool_transform_allocate( static_transform_pool );
-	matrix_setIdentity( t->local );
-	matrix_setIdentity( t->world );
-	t->parent = NULL;
-	t->isDirty = 1; // All transforms are initially dirty, to force initial update
+	transformStorage* ts = &transform_storage;
+	vmutex_lock( &ts->lock );
+	int i;
+	// Release deleted slots rather than grow
+	if ( ts->free_count == 0 && ts->pending_count > 0 )
+		transform_buildOrder();
+	if ( ts->free_count > 0 )
+		i = ts->free_slots[--ts->free_count];
+	else {
+		if ( ts->count >= kMaxTransforms ) {
+			printf( "Transform storage is full; cannot allocate new transform.\n" );
+			vAssert( 0 );
+		}
+		i = ts->count++;
+	}
+	matrix_setIdentity( ts->local[i] );
+	matrix_setIdentity( ts->world[i] );
+	ts->parent[i] = kTransformNoParent;
+	ts->dirty[i] = 1; // All transforms are initially dirty, to force initial update
+	ts->live[i] = true;
+	// A new root can go anywhere in the update order, so just append it
+	if ( ts->order_valid )
+		ts->order[ts->order_count++] = i;
+	transform* t = &ts->handles[i];
+	t->index = i;
 #if DEBUG_STRINGS
+	t->debug_name = NULL;
 	//t->debug_name = debug_string( "Transform" );
 #endif
+	vmutex_unlock( &ts->lock );
 	return t;
 }
 
-void transform_delete( transform* t ) {
-	pool_transform_free( static_transform_pool, t );
-}
-
 transform* transform_createAndAdd( scene* s ) {
 	assert( s->transform_count < MAX_TRANSFORMS );
 	transform* t = transform_create();
@@ -76,78 +159,114 @@ transform* transform_createAndAdd( scene* s ) {
 	return t;
 }
 
-// Create a new default transform
-transform* transform_createEmpty() {
-	transform* t = mem_alloc( sizeof( transform ));
-	matrix_setIdentity(t->local);
-	matrix_setIdentity(t->world);
-	t->parent = NULL;
-	t->isDirty = 0;
-	return t;
+void transform_delete( transform* t ) {
+	transformStorage* ts = &transform_storage;
+	vmutex_lock( &ts->lock );
+	vAssert( ts->live[t->index] );
+	ts->live[t->index] = false;
+	// Its children still refer to it until the order is rebuilt, so it can't be reused yet
+	ts->pending_slots[ts->pending_count++] = t->index;
+	ts->order_valid = false;
+	vmutex_unlock( &ts->lock );
 }
 
-
 // Create a new default transform with the given parent
 transform* transform_create_Parent(scene* s, transform* parent) {
-	transform* t = transform_create(s);
-	t->parent = parent;
+	(void)s;
+	transform* t = transform_create();
+	transform_setParent( t, parent );
 	return t;
 }
 
-/*
-// Concatenate the parent world space transforms to produce this world space transform from local
-void transform_concatenate(transform* t) {
-	if (transform_isDirty(t)) {
-		transform_markClean(t);
-		if (t->parent) {
-			transform_concatenate(t->parent);
-			t->world = matrix_mul(t->local, t->parent->world);
-		}
-		else
-			t->world = t->local;
+transform* transform_parent( transform* t ) {
+	int parent = transform_storage.parent[t->index];
+	return parent == kTransformNoParent ? NULL : &transform_storage.handles[parent];
+}
+
+void transform_setParent( transform* t, transform* parent ) {
+	transformStorage* ts = &transform_storage;
+	vAssert( t != parent );
+	vmutex_lock( &ts->lock );
+	int parent_index = parent ? parent->index : kTransformNoParent;
+	if ( ts->parent[t->index] != parent_index ) {
+		ts->parent[t->index] = parent_index;
+		ts->dirty[t->index] = 1;
+		ts->order_valid = false;
 	}
+	vmutex_unlock( &ts->lock );
 }
-*/
 
-// Concatenate the parent world space transforms to produce this world space transform from local
-int transform_concatenate(transform* t) {
-//	printf( "concatenate transform. This = %x, Parent = %x\n", (unsigned int)t, (unsigned int)t->parent );
-	if (t->parent)	{
-		if (transform_concatenate(t->parent) || transform_isDirty(t)) {
-			transform_markDirty(t);
-			matrix_mul(t->world, t->parent->world, t->local );
-			return true;
-		}
+void transform_setWorldSpace( transform* t, matrix world ) {
+//	matrix_cpy( t->world, world );
+	transform* parent = transform_parent( t );
+	if ( parent ) {
+		matrix inv_parent;
+	  	matrix_inverse( inv_parent, transform_world( parent ));
+		matrix_mul( transform_local( t ), world, inv_parent );
 	}
-	else if (transform_isDirty(t)) {
-		matrix_cpy( t->world, t->local );
-		return true;
+	else
+		matrix_cpy( transform_local( t ), world );
+
+	transform_markDirty( t );
+	transform_concatenate( t );
+//	t->local = t->world * inverse( t->parent->world );
+}
+
+void transform_setWorldSpacePosition( transform* t, vector* position ) {
+	// Concat in case world space rotation is not up to date
+	// Could we just set localspace position actually?
+	/*
+	transform_concatenate( t );
+	matrix m;
+	matrix_cpy( m, t->world );
+	matrix_setTranslation( m, position );
+	transform_setWorldSpace( t, m );
+	*/
+	transform* parent = transform_parent( t );
+	if ( !parent ) {
+		matrix_setTranslation( transform_local( t ), position );
+	} else {
+		vector position_local;
+		Sub( &position_local, position, matrix_getTranslation( transform_world( parent )));
+		matrix_setTranslation( transform_local( t ), &position_local );
 	}
-	return false;
+	transform_markDirty( t );
+	transform_concatenate( t );
 }
 
+void transform_setLocalSpace();
+
+// Concatenate the parent world space transforms to produce this world space transform from local
+// This updates just this transform and its ancestors, for when the world transform is needed
+// before the next transform_updateAll()
+void transform_concatenate(transform* t) {
+	transform* parent = transform_parent( t );
+	if ( parent ) {
+		transform_concatenate( parent );
+		matrix_mul( transform_world( t ), transform_world( parent ), transform_local( t ));
+	}
+	else
+		matrix_cpy( transform_world( t ), transform_local( t ));
+}
 
 // Mark the transform as dirty (needs concatenation)
 void transform_markDirty(transform* t) {
-	t->isDirty = 1;
-//	t->local[3][3] = 2.f;
+	transform_storage.dirty[t->index] = 1;
 }
 
 // Mark the transform as clean (doesn't need concatenation)
 void transform_markClean(transform* t) {
-	t->isDirty = 0;
-//	t->local[3][3] = 1.f;
+	transform_storage.dirty[t->index] = 0;
 }
 
 // Is the transform dirty? (does it need concatenating?)
 int transform_isDirty(transform* t) {
-	return t->isDirty;
-//	return (t->local[3][3] > 1.f);
+	return transform_storage.dirty[t->index];
 }
 
 // Set the translation of the localspace transformation matrix
 void transform_setLocalTranslation(transform* t, vector* v) {
-	matrix_setTranslation(t->local, v);
+	matrix_setTranslation(transform_local( t ), v);
 	transform_markDirty(t);
 }
 
@@ -157,14 +276,14 @@ void transform_printDebug( transform* t, debugtextframe* f ) {
 #if DEBUG_STRINGS
 	sprintf( string, "Transform: Name: %s, Translation %.2f, %.2f, %.2f", 
 			t->debug_name,
-			t->world[3][0], 
-			t->world[3][1], 
-			t->world[3][2] );
+			transform_world( t )[3][0], 
+			transform_world( t )[3][1], 
+			transform_world( t )[3][2] );
 #else
 	sprintf( string, "Transform: Translation %.2f, %.2f, %.2f", 
-			t->world[3][0], 
-			t->world[3][1], 
-			t->world[3][2] );
+			transform_world( t )[3][0], 
+			transform_world( t )[3][1], 
+			transform_world( t )[3][2] );
 #endif
 #ifndef ANDROID	
 //	PrintDebugText( f, string );
@@ -174,39 +293,153 @@ void transform_printDebug( transform* t, debugtextframe* f ) {
 void transform_yaw( transform* t, float yaw ) {
 	matrix m;
 	matrix_rotY( m, yaw );
-	matrix_mul( t->local, t->local, m );
+	matrix_mul( transform_local( t ), transform_local( t ), m );
+	transform_markDirty( t );
 }
 
 void transform_pitch( transform* t, float pitch ) {
 	matrix m;
 	matrix_rotX( m, pitch );
-	matrix_mul( t->local, t->local, m );
+	matrix_mul( transform_local( t ), transform_local( t ), m );
+	transform_markDirty( t );
 }
 
 void transform_roll( transform* t, float roll ) {
 	matrix m;
 	matrix_rotZ( m, roll );
-	matrix_mul( t->local, t->local, m );
+	matrix_mul( transform_local( t ), transform_local( t ), m );
+	transform_markDirty( t );
 }
 
 const vector* transform_getWorldPosition( transform* t ) {
-	return matrix_getTranslation( t->world );
+	return matrix_getTranslation( transform_world( t ));
 }
 
 quaternion transform_getWorldRotation( transform* t ) {
-	return matrix_getRotation( t->world );
+	return matrix_getRotation( transform_world( t ));
 }
 
 void transform_setWorldRotationMatrix( transform* t, matrix world_m ) {
 	transform_concatenate( t );
 	// parent * local_m = world_m;
-	if ( t->parent ) {
+	transform* parent = transform_parent( t );
+	if ( parent ) {
 		matrix inv_parent, local_m;
-		matrix_inverse( inv_parent, t->parent->world );
+		matrix_inverse( inv_parent, transform_world( parent ));
 		matrix_mul( local_m, inv_parent, world_m );
-		matrix_copyRotation( t->local, local_m );
+		matrix_copyRotation( transform_local( t ), local_m );
 	}
 	else {
-		matrix_copyRotation( t->local, world_m );
+		matrix_copyRotation( transform_local( t ), world_m );
 	}
+	transform_markDirty( t );
+}
+
+// *** Testing
+
+void test_transform() {
+	// Create the child first, so the update order has to be rebuilt to put the parent before it
+	transform* child = transform_create();
+	transform* parent = transform_create();
+	transform_setParent( child, parent );
+	vector a = Vector( 1.f, 0.f, 0.f, 1.f );
+	vector b = Vector( 0.f, 1.f, 0.f, 1.f );
+	transform_setLocalTranslation( parent, &a );
+	transform_setLocalTranslation( child, &b );
+	transform_updateAll();
+	vector expected = Vector( 1.f, 1.f, 0.f, 1.f );
+	vAssert( vector_equal( transform_getWorldPosition( child ), &expected ));
+	vAssert( !transform_isDirty( parent ) && !transform_isDirty( child ));
+
+	// Changing the parent updates the child
+	vector c = Vector( 0.f, 0.f, 2.f, 1.f );
+	transform_setLocalTranslation( parent, &c );
+	transform_updateAll();
+	expected = Vector( 0.f, 1.f, 2.f, 1.f );
+	vAssert( vector_equal( transform_getWorldPosition( child ), &expected ));
+
+	// Clean transforms are not recalculated
+	matrix_setIdentity( transform_world( child ));
+	transform_updateAll();
+	vAssert( transform_getWorldPosition( child )->coord.y == 0.f );
+
+	// Deleting the parent leaves the child as a root
+	transform_delete( parent );
+	transform_markDirty( child );
+	transform_updateAll();
+	vAssert( transform_parent( child ) == NULL );
+	vAssert( vector_equal( transform_getWorldPosition( child ), &b ));
+	transform_delete( child );
+
+	// Freed slots are reused
+	transform* reused = transform_create();
+	vAssert( reused == parent || reused == child );
+	transform_delete( reused );
+
+	// A deleted parent's slot is not reused while its children still refer to it
+	parent = transform_create();
+	child = transform_create();
+	transform_setParent( child, parent );
+	transform_updateAll();
+	transform_delete( parent );
+	transform* created = transform_create();
+	vAssert( transform_parent( child ) != created );
+	transform_updateAll();
+	vAssert( transform_parent( child ) == NULL );
+	transform_delete( created );
+	transform_delete( child );
+}
+
+// Update a large hierarchy, fully dirty and with a few dirty transforms
+void benchmark_transform() {
+	const int root_count = 2000;
+	const int children_per_root = 9;
+	const int count = root_count * ( 1 + children_per_root );
+	transform** transforms = mem_alloc( sizeof( transform* ) * count );
+	int n = 0;
+	for ( int r = 0; r < root_count; r++ ) {
+		transform* root = transform_create();
+		transforms[n++] = root;
+		transform* parent = root;
+		// A mix of depth and breadth
+		for ( int i = 0; i < children_per_root; i++ ) {
+			transform* t = transform_create();
+			transform_setParent( t, parent );
+			vector translation = Vector( 0.f, 1.f, 0.f, 1.f );
+			transform_setLocalTranslation( t, &translation );
+			transform_yaw( t, 0.1f );
+			transforms[n++] = t;
+			if ( i % 3 == 2 )
+				parent = t;
+		}
+	}
+
+	unsigned long long start = timer_microseconds();
+	transform_updateAll();
+	unsigned long long rebuild_time = timer_microseconds() - start;
+
+	for ( int i = 0; i < count; i++ )
+		transform_markDirty( transforms[i] );
+	start = timer_microseconds();
+	transform_updateAll();
+	unsigned long long full_time = timer_microseconds() - start;
+
+	for ( int i = 0; i < count; i += 100 )
+		transform_markDirty( transforms[i] );
+	start = timer_microseconds();
+	transform_updateAll();
+	unsigned long long partial_time = timer_microseconds() - start;
+
+	// Concatenating each transform individually, as scenes used to
+	start = timer_microseconds();
+	for ( int i = 0; i < count; i++ )
+		transform_concatenate( transforms[i] );
+	unsigned long long concatenate_time = timer_microseconds() - start;
+
+	printf( "TRANSFORM: %d transforms. Order rebuild + update: %.2fms, all dirty: %.2fms, 1%% dirty: %.2fms, per-transform concatenate: %.2fms.\n",
+			count, (float)rebuild_time / 1000.f, (float)full_time / 1000.f, (float)partial_time / 1000.f, (float)concatenate_time / 1000.f );
+
+	for ( int i = 0; i < count; i++ )
+		transform_delete( transforms[i] );
+	mem_free( transforms );
 }
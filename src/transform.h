@@ -3,23 +3,61 @@
 
 #include "maths/maths.h"
 #include "maths/matrix.h"
-#include "mem/pool.h"
+#include "system/thread.h"
+
+#define kMaxTransforms		32768
+#define kTransformNoParent	-1
 
 // *** Transform ***
+/*
+   Transform data is stored in arrays (structure of arrays), indexed by a slot that stays the
+   same for the life of the transform. A transform* is a handle to that slot.
+
+   An update order is kept with parents before children, and each root's subtree contiguous,
+   so one linear pass brings every world matrix up to date, and can be split at root boundaries.
+   */
 struct transform_s {
-	matrix		local;	// Local space matrix; 15th element is 1.f if clean and 2.f if dirty
-	matrix		world;
-	transform*	parent;
-	int			isDirty;
+	int			index;	// Slot in transform_storage
 #if DEBUG_STRINGS
 	const char* debug_name;
 #endif
 };
 
-DECLARE_POOL( transform )
+typedef struct transformStorage_s {
+	matrix*		local;
+	matrix*		world;
+	int*		parent;			// Parent slot, or kTransformNoParent
+	uint8_t*	dirty;			// Local changed since the last update
+	uint8_t*	updated;		// Recalculated in the last update pass, so its children must be too
+	bool*		live;
+	transform*	handles;
+	// Free slots, as a stack
+	int*		free_slots;
+	int			free_count;
+	// Deleted slots, held until the order rebuild has detached their children
+	int*		pending_slots;
+	int			pending_count;
+	int			count;			// Slots ever used
+	// Update order: parents before children, each root's subtree contiguous
+	int*		order;
+	int			order_count;
+	bool		order_valid;
+	vmutex		lock;
+} transformStorage;
+
+extern transformStorage transform_storage;
+
+// Local and world space matrices; mark the transform dirty after writing the local matrix
+#define transform_local( t )	( transform_storage.local[(t)->index] )
+#define transform_world( t )	( transform_storage.world[(t)->index] )
 
 // *** Static
-void transform_initPool();
+void transform_initStorage();
+
+// Bring every world space transform up to date
+void transform_updateAll();
+// Update the slots in order[begin..end); safe to run in parallel for ranges split at roots
+void transform_updateRange( int begin, int end );
 
 // Create a new default transform
 transform* transform_create();
@@ -33,8 +71,11 @@ transform* transform_create_Parent(scene* s, transform* parent);
 
 // *** Members
 
+transform* transform_parent( transform* t );
+void transform_setParent( transform* t, transform* parent );
+
 // Concatenate the parent world space transforms to produce this world space transform from local
-int transform_concatenate(transform* t);
+void transform_concatenate(transform* t);
 
 // Mark the transform as dirty (needs concatenation)
 void transform_markDirty(transform* t);
@@ -61,4 +102,7 @@ void transform_roll( transform* t, float roll );
 
 void transform_setWorldRotationMatrix( transform* t, matrix m );
 
+void test_transform();
+void benchmark_transform();
+
 #endif // __TRANSFORM_H__
@@ -41,15 +41,17 @@ void panel_draw( panel* p, float x, float y ) {
 	p->vertex_buffer[1].position = Vector( p->x + p->width,	p->y,				0.1f, 1.f );
 	p->vertex_buffer[2].position = Vector( p->x,				p->y + p->height,	0.1f, 1.f );
 	p->vertex_buffer[3].position = Vector( p->x + p->width,	p->y + p->height,	0.1f, 1.f );
-	p->vertex_buffer[0].uv = Vector( 0.f, 0.f, 0.f, 0.f );
-	p->vertex_buffer[1].uv = Vector( 1.f, 0.f, 0.f, 0.f );
-	p->vertex_buffer[2].uv = Vector( 0.f, 1.f, 0.f, 0.f );
-	p->vertex_buffer[3].uv = Vector( 1.f, 1.f, 0.f, 0.f );
+	textureRegion region = texture_region( p->texture );
+	p->vertex_buffer[0].uv = textureRegion_uv( &region, 0.f, 0.f );
+	p->vertex_buffer[1].uv = textureRegion_uv( &region, 1.f, 0.f );
+	p->vertex_buffer[2].uv = textureRegion_uv( &region, 0.f, 1.f );
+	p->vertex_buffer[3].uv = textureRegion_uv( &region, 1.f, 1.f );
 
 	// Copy our data to the GPU
 	// There are now <index_count> vertices, as we have unrolled them
-	drawCall* draw = drawCall_create( &renderPass_alpha, resources.shader_ui, element_count, element_buffer, p->vertex_buffer, p->texture, modelview );
+	drawCall* draw = drawCall_create( &renderPass_alpha, resources.shader_ui, element_count, element_buffer, p->vertex_buffer, region.gl_tex, modelview );
 	draw->depth_mask = GL_FALSE;
+	draw->depth = kDrawDepthOverlay;
 }
 
 void panel_render( void* panel_ ) {
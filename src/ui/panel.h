@@ -28,7 +28,7 @@ struct panel_s {
 	unsigned int remote_anchor;
 
 	// Temp
-	GLuint	texture;
+	texture*	texture;
 	vertex vertex_buffer[4];
 };
 
@@ -61,3 +61,10 @@ float timer_getDelta(frame_timer* timer) {
 float timer_getTimeSeconds(frame_timer* t) {
 	return ((float)t->oldTime) * uSecToSec;
 }
+
+// Get the current wall-clock time in microseconds, for measuring durations
+unsigned long long timer_microseconds() {
+	time_v t;
+	gettimeofday(&t, NULL);
+	return (unsigned long long)t.tv_sec * SecToUSec + t.tv_usec;
+}
@@ -37,4 +37,7 @@ float timer_getDelta(frame_timer* timer);
 // Get the time in seconds
 float timer_getTimeSeconds();
 
+// Get the current wall-clock time in microseconds, for measuring durations
+unsigned long long timer_microseconds();
+
 #endif // __TIME_H__
@@ -5,20 +5,23 @@
 #include "common.h"
 #include "worker.h"
 //-----------------------
+#include "maths/maths.h"
 #include "system/thread.h"
 #include <unistd.h>
 
-#define kMaxWorkerTasks 16
+#define kMaxWorkerTasks 256
 int worker_task_count = 0;
+int worker_task_first = 0;	// Tasks are stored in a ring buffer, starting at this index
 vmutex worker_task_mutex = kMutexInitialiser;
 worker_task worker_tasks[kMaxWorkerTasks];
 
 // TODO worker task adding/removing should be lock free
 void worker_addTask( worker_task t ) {
-	vAssert( worker_task_count < kMaxWorkerTasks );
 	vmutex_lock( &worker_task_mutex );
 	{
-		worker_tasks[worker_task_count++] = t;
+		vAssert( worker_task_count < kMaxWorkerTasks );
+		worker_tasks[( worker_task_first + worker_task_count ) % kMaxWorkerTasks] = t;
+		++worker_task_count;
 	}
 	vmutex_unlock( &worker_task_mutex );
 }
@@ -27,11 +30,8 @@ worker_task worker_nextTask() {
 	worker_task task;
 	vmutex_lock( &worker_task_mutex );
 	{
-		task = worker_tasks[0];
-		// Move worker tasks down
-		for ( int i = 0; i < worker_task_count + 1; ++i ) {
-			worker_tasks[i] = worker_tasks[i + 1];
-		}
+		task = worker_tasks[worker_task_first];
+		worker_task_first = ( worker_task_first + 1 ) % kMaxWorkerTasks;
 		--worker_task_count;
 	}
 	vmutex_unlock( &worker_task_mutex );
@@ -51,3 +51,101 @@ void* worker_threadFunc( void* args ) {
 		vthread_yield();
 	}
 }
+
+// *** Frame jobs
+
+typedef struct frameJobBatch_s {
+	frameJob*	jobs;
+	int			count;
+	int			next;		// Next job to claim
+	int			remaining;	// Jobs not yet finished
+	int			generation;	// Bumped for each batch, to wake the workers
+	int			active;		// Workers claiming jobs from the current batch
+	vmutex		mutex;
+	vcondition	start;
+	vcondition	finished;
+} frameJobBatch;
+
+frameJobBatch frame_jobs;
+int frame_worker_count = 0;
+
+// Claim and run jobs from the current batch until there are none left
+void worker_runFrameJobs() {
+	while ( true ) {
+		int i = __sync_fetch_and_add( &frame_jobs.next, 1 );
+		if ( i >= frame_jobs.count )
+			break;
+		frame_jobs.jobs[i].func( frame_jobs.jobs[i].args );
+		if ( __sync_sub_and_fetch( &frame_jobs.remaining, 1 ) == 0 ) {
+			vmutex_lock( &frame_jobs.mutex );
+			vcondition_broadcast( &frame_jobs.finished );
+			vmutex_unlock( &frame_jobs.mutex );
+		}
+	}
+}
+
+void* worker_frameThreadFunc( void* args ) {
+	(void)args;
+	int generation = 0;
+	while ( true ) {
+		vmutex_lock( &frame_jobs.mutex );
+		while ( frame_jobs.generation == generation )
+			vcondition_wait( &frame_jobs.start, &frame_jobs.mutex );
+		generation = frame_jobs.generation;
+		frame_jobs.active++;
+		vmutex_unlock( &frame_jobs.mutex );
+
+		worker_runFrameJobs();
+
+		vmutex_lock( &frame_jobs.mutex );
+		if ( --frame_jobs.active == 0 )
+			vcondition_broadcast( &frame_jobs.finished );
+		vmutex_unlock( &frame_jobs.mutex );
+	}
+	return NULL;
+}
+
+void worker_initFrameWorkers() {
+	static bool initialised = false;
+	if ( initialised )
+		return;
+	initialised = true;
+	memset( &frame_jobs, 0, sizeof( frame_jobs ));
+	vmutex_init( &frame_jobs.mutex );
+	vcondition_init( &frame_jobs.start );
+	vcondition_init( &frame_jobs.finished );
+	// Leave a core for the main thread, which also runs jobs, and one for the render thread
+	frame_worker_count = min( max( vthread_coreCount() - 2, 0 ), kMaxFrameWorkers );
+	for ( int i = 0; i < frame_worker_count; i++ ) {
+		vthread t = vthread_create( worker_frameThreadFunc, NULL );
+		(void)t;
+	}
+}
+
+int worker_frameWorkerCount() {
+	return frame_worker_count;
+}
+
+void worker_beginFrameJobs( frameJob* jobs, int count ) {
+	vmutex_lock( &frame_jobs.mutex );
+	vAssert( frame_jobs.remaining == 0 );
+	// Wait for workers still claiming from the previous batch, so none claims from this one
+	// before it is set up
+	while ( frame_jobs.active > 0 )
+		vcondition_wait( &frame_jobs.finished, &frame_jobs.mutex );
+	frame_jobs.jobs = jobs;
+	frame_jobs.count = count;
+	frame_jobs.next = 0;
+	frame_jobs.remaining = count;
+	frame_jobs.generation++;
+	vcondition_broadcast( &frame_jobs.start );
+	vmutex_unlock( &frame_jobs.mutex );
+}
+
+void worker_finishFrameJobs() {
+	worker_runFrameJobs();
+	vmutex_lock( &frame_jobs.mutex );
+	while ( frame_jobs.remaining > 0 )
+		vcondition_wait( &frame_jobs.finished, &frame_jobs.mutex );
+	vmutex_unlock( &frame_jobs.mutex );
+}
@@ -12,3 +12,27 @@ void* worker_threadFunc( void* args );
 
 void worker_addTask( worker_task t );
 worker_task worker_nextTask();
+
+// *** Frame jobs
+/*
+   Short jobs that must finish within the frame (eg. ticking), run on a pool of frame worker
+   threads. These are separate from the worker thread above, so a long running task
+   (eg. loading a texture) never stalls the frame.
+   */
+typedef void (*frameJobFunc)( void* );
+
+typedef struct frameJob_s {
+	frameJobFunc func;
+	void* args;
+} frameJob;
+
+#define kMaxFrameWorkers 8
+
+// Start the frame worker threads; one per spare core, up to kMaxFrameWorkers
+void worker_initFrameWorkers();
+int worker_frameWorkerCount();
+
+// Start running [jobs] on the frame workers; [jobs] must stay valid until worker_finishFrameJobs()
+void worker_beginFrameJobs( frameJob* jobs, int count );
+// Help run the jobs begun by worker_beginFrameJobs(), then wait for all of them to finish
+void worker_finishFrameJobs();